@@ -0,0 +1,13 @@
+core.log("info", "Initializing mapgen environment")
+
+local commonpath = core.get_builtin_path() .. "common" .. DIR_DELIM
+
+local builtin_shared = {}
+
+assert(loadfile(commonpath .. "transferred_globals.lua"))(builtin_shared)
+assert(loadfile(commonpath .. "register.lua"))(builtin_shared)
+
+-- Called by the emerge thread for every chunk it generated, with the
+-- chunk's VoxelManip before it is written to the map
+core.registered_on_generateds, core.register_on_generated =
+	builtin_shared.make_registration()
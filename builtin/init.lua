@@ -66,6 +66,8 @@ elseif INIT == "async"  then
 	dofile(asyncpath .. "mainmenu.lua")
 elseif INIT == "async_game" then
 	dofile(asyncpath .. "game.lua")
+elseif INIT == "emerge" then
+	dofile(scriptdir .. "emerge" .. DIR_DELIM .. "init.lua")
 elseif INIT == "client" then
 	dofile(clientpath .. "init.lua")
 else
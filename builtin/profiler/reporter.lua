@@ -87,6 +87,14 @@ end
 -- ' | ' should break less with github than '-+-', when people are pasting there
 HR = sprintf("-%s-", table.concat(HR, " | "))
 
+local engine_widths = { widths[1], 9, 12, 9 }
+local engine_row_format = sprintf(" %%-%ds | %%%ds | %%%ds | %%%ds", unpack(engine_widths))
+local engine_HR = {}
+for i=1, #engine_widths do
+	engine_HR[i] = rep("-", engine_widths[i])
+end
+engine_HR = sprintf("-%s-", table.concat(engine_HR, " | "))
+
 local TxtFormatter = Formatter:new {
 	format_row = function(self, modname, instrument_name, statistics)
 		local label
@@ -136,6 +144,38 @@ local TxtFormatter = Formatter:new {
 		if not filter then
 			self:format_row("total", nil, profile.stats_total)
 		end
+
+		if profile.engine_baseline then
+			self:format_engine(filter)
+		end
+	end,
+	format_engine = function(self, filter)
+		local baseline = self.profile.engine_baseline
+		local names = {}
+		local probes = core.get_profiler_probes()
+		for name in pairs(probes) do
+			if filter_matches(filter, name) then
+				names[#names + 1] = name
+			end
+		end
+		if #names == 0 then
+			return
+		end
+		table.sort(names)
+
+		self:print()
+		self:print(engine_row_format, "engine", "calls", "total ms", "avg Ms")
+		self:print(engine_HR)
+		for i = 1, #names do
+			local name = names[i]
+			local old = baseline[name] or { time = 0, count = 0 }
+			local count = probes[name].count - old.count
+			local time = probes[name].time - old.time
+			self:print(engine_row_format, shorten(name, widths[1]),
+				format_number(count),
+				format_number(time / 1000, "%.1f"),
+				format_number(count > 0 and time / count or nil))
+		end
 	end
 }
 
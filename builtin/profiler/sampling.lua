@@ -62,6 +62,11 @@ function sampler.reset()
 	}
 	stats_total = profile.stats_total
 
+	-- Engine probe values at the time of the reset, reports show the difference
+	if core.get_profiler_probes then
+		profile.engine_baseline = core.get_profiler_probes()
+	end
+
 	-- Provide access to the most recent profile.
 	sampler.profile = profile
 end
@@ -177,6 +177,7 @@ dofile(modpath .. "/player.lua")
 dofile(modpath .. "/crafting.lua")
 dofile(modpath .. "/itemdescription.lua")
 dofile(modpath .. "/async_env.lua")
+dofile(modpath .. "/mapgen_env.lua")
 dofile(modpath .. "/entity.lua")
 dofile(modpath .. "/get_version.lua")
 dofile(modpath .. "/itemstack_equals.lua")
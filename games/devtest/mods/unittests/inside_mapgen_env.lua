@@ -0,0 +1,50 @@
+-- Runs in the mapgen environment, see mapgen_env.lua.
+-- The results are written into the generated chunk: stone for a passed
+-- check, dirt for a failed one.
+
+-- Must be the same as in mapgen_env.lua
+local test_pos = vector.new(0, 26960, 0)
+
+local function do_tests()
+	assert(core == minetest)
+	-- stuff that should not be here
+	assert(not core.get_player_by_name)
+	assert(not core.set_node)
+	assert(not core.get_node)
+	assert(not core.object_refs)
+	-- stuff that should be here
+	assert(ItemStack)
+	assert(VoxelManip)
+	assert(type(core.get_mapgen_object) == "function")
+	assert(type(core.generate_ores) == "function")
+	assert(core.registered_nodes["basenodes:stone"])
+	-- alias handling
+	assert(core.registered_items["unittests:steel_ingot_alias"].name ==
+		"unittests:steel_ingot")
+end
+
+local function set_result(vm, pos, ok, err)
+	if not ok then
+		core.log("error", err)
+	end
+	vm:set_node_at(pos, {name = ok and "basenodes:stone" or "basenodes:dirt"})
+end
+
+core.register_on_generated(function(vm, minp, maxp, blockseed)
+	if not vector.in_area(test_pos, minp, maxp) then
+		return
+	end
+
+	set_result(vm, test_pos, pcall(do_tests))
+
+	-- The map may not be read without the environment lock
+	local ok = pcall(vm.read_from_map, vm, minp, maxp)
+	set_result(vm, test_pos:offset(1, 0, 0), not ok,
+		"VoxelManip:read_from_map did not fail")
+
+	-- Without update_liquids, the water would not start to flow
+	local water_pos = test_pos:offset(3, 0, 0)
+	vm:set_node_at(water_pos, {name = "basenodes:water_source"})
+	vm:set_node_at(water_pos:offset(0, -1, 0), {name = "air"})
+	vm:update_liquids()
+end)
@@ -0,0 +1,41 @@
+core.register_mapgen_script(core.get_modpath(core.get_current_modname()) ..
+	DIR_DELIM .. "inside_mapgen_env.lua")
+
+-- Must be the same as in inside_mapgen_env.lua, far away from the player
+local test_pos = vector.new(0, 26960, 0)
+
+local function test_mapgen_env(cb)
+	-- Make sure the chunk is generated again
+	core.delete_area(test_pos:subtract(80), test_pos:add(80))
+
+	local function check_liquid(tries)
+		local node = core.get_node(test_pos:offset(3, -1, 0))
+		if node.name == "basenodes:water_flowing" then
+			return cb()
+		end
+		if tries == 0 then
+			return cb("Liquid queued by update_liquids did not flow")
+		end
+		core.after(0.2, check_liquid, tries - 1)
+	end
+
+	core.emerge_area(test_pos, test_pos, function(_, action, blocks_left)
+		if blocks_left > 0 then
+			return
+		end
+		if action ~= core.EMERGE_GENERATED then
+			return cb("Test chunk was not generated")
+		end
+		local name = core.get_node(test_pos).name
+		if name == "ignore" or name == "air" then
+			return cb("on_generated did not run in the mapgen environment")
+		elseif name ~= "basenodes:stone" then
+			return cb("Mapgen environment is set up wrong")
+		end
+		if core.get_node(test_pos:offset(1, 0, 0)).name ~= "basenodes:stone" then
+			return cb("VoxelManip:read_from_map is available in the mapgen environment")
+		end
+		check_liquid(50)
+	end)
+end
+unittests.register("test_mapgen_env", test_mapgen_env, {async=true})
@@ -55,6 +55,10 @@ struct ActiveObjectMessage
 	u16 id;
 	bool reliable;
 	std::string datastring;
+	// Smaller alternative to datastring for clients that support it,
+	// empty if there is none (see AO_CMD_UPDATE_POSITION_DELTA).
+	// If datastring is empty, only those clients get the message.
+	std::string compact_datastring;
 };
 
 enum ActiveObjectCommand {
@@ -71,7 +75,8 @@ enum ActiveObjectCommand {
 	AO_CMD_OBSOLETE1,
 	// ^ UPDATE_NAMETAG_ATTRIBUTES deprecated since 0.4.14, removed in 5.3.0
 	AO_CMD_SPAWN_INFANT,
-	AO_CMD_SET_ANIMATION_SPEED
+	AO_CMD_SET_ANIMATION_SPEED,
+	AO_CMD_UPDATE_POSITION_DELTA
 };
 
 struct BoneOverride
@@ -0,0 +1,131 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "serverenvironment.h"
+#include "util/numeric.h"
+#include <set>
+
+namespace {
+
+// Block positions of players, moving a bit every step
+std::vector<v3s16> randomPlayers(size_t n)
+{
+	std::vector<v3s16> players;
+	for (size_t i = 0; i < n; i++) {
+		players.emplace_back(myrand_range(-200, 200), myrand_range(-10, 10),
+			myrand_range(-200, 200));
+	}
+	return players;
+}
+
+void movePlayers(std::vector<v3s16> &players)
+{
+	for (v3s16 &p : players)
+		p.X += myrand_range(-1, 1);
+}
+
+// Same shape as the active block range around players
+template <typename F>
+void forEachInSphere(v3s16 p0, s16 r, F &&f)
+{
+	v3s16 p;
+	for (p.X = p0.X - r; p.X <= p0.X + r; p.X++)
+	for (p.Y = p0.Y - r; p.Y <= p0.Y + r; p.Y++)
+	for (p.Z = p0.Z - r; p.Z <= p0.Z + r; p.Z++) {
+		if (p.getDistanceFrom(p0) <= r)
+			f(p);
+	}
+}
+
+// What ActiveBlockList::update() did before BlockPosSet
+size_t updateStdSet(const std::vector<v3s16> &players, s16 range,
+		std::set<v3s16> &list)
+{
+	std::set<v3s16> newlist;
+	for (v3s16 pos : players)
+		forEachInSphere(pos, range, [&] (v3s16 p) { newlist.insert(p); });
+
+	std::set<v3s16> removed, added;
+	for (v3s16 p : list) {
+		if (newlist.find(p) == newlist.end())
+			removed.insert(p);
+	}
+	for (v3s16 p : newlist) {
+		if (list.find(p) == list.end())
+			added.insert(p);
+	}
+	list = std::move(newlist);
+	return removed.size() + added.size();
+}
+
+size_t updateBlockPosSet(const std::vector<v3s16> &players, s16 range,
+		BlockPosSet &list)
+{
+	BlockPosSet newlist;
+	newlist.reserve(list.size());
+	for (v3s16 pos : players)
+		forEachInSphere(pos, range, [&] (v3s16 p) { newlist.push(p); });
+	newlist.sort();
+
+	std::vector<v3s16> removed, added;
+	BlockPosSet::difference(list, newlist, removed);
+	BlockPosSet::difference(newlist, list, added);
+	list = std::move(newlist);
+	return removed.size() + added.size();
+}
+
+}
+
+#define BENCH_UPDATE(_players, _range) \
+	BENCHMARK_ADVANCED("update_std_set_" #_players "_" #_range)(Catch::Benchmark::Chronometer meter) { \
+		auto players = randomPlayers(_players); \
+		std::set<v3s16> list; \
+		updateStdSet(players, _range, list); \
+		meter.measure([&] { \
+			movePlayers(players); \
+			return updateStdSet(players, _range, list); \
+		}); \
+	}; \
+	BENCHMARK_ADVANCED("update_blockposset_" #_players "_" #_range)(Catch::Benchmark::Chronometer meter) { \
+		auto players = randomPlayers(_players); \
+		BlockPosSet list; \
+		updateBlockPosSet(players, _range, list); \
+		meter.measure([&] { \
+			movePlayers(players); \
+			return updateBlockPosSet(players, _range, list); \
+		}); \
+	};
+
+TEST_CASE("benchmark_activeblocklist") {
+	BENCH_UPDATE(10, 4)
+	BENCH_UPDATE(50, 4)
+	BENCH_UPDATE(50, 8)
+
+	BENCHMARK_ADVANCED("contains_blockposset")(Catch::Benchmark::Chronometer meter) {
+		auto players = randomPlayers(50);
+		BlockPosSet list;
+		updateBlockPosSet(players, 8, list);
+		meter.measure([&] {
+			v3s16 p(myrand_range(-200, 200), myrand_range(-10, 10),
+				myrand_range(-200, 200));
+			return list.contains(p);
+		});
+	};
+}
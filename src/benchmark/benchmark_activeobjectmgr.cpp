@@ -0,0 +1,127 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "server/activeobjectmgr.h"
+#include "util/numeric.h"
+#include <queue>
+#include <set>
+
+namespace {
+
+class TestObject : public ServerActiveObject
+{
+public:
+	TestObject(v3f pos) : ServerActiveObject(nullptr, pos) {}
+
+	ActiveObjectType getType() const override { return ACTIVEOBJECT_TYPE_TEST; }
+	bool getCollisionBox(aabb3f *toset) const override { return false; }
+	bool getSelectionBox(aabb3f *toset) const override { return false; }
+	bool collideWithObjects() const override { return false; }
+};
+
+constexpr float POS_RANGE = 2000 * BS;
+
+inline v3f randpos()
+{
+	return v3f(myrand_range(-POS_RANGE, POS_RANGE),
+		myrand_range(-POS_RANGE / 10, POS_RANGE / 10),
+		myrand_range(-POS_RANGE, POS_RANGE));
+}
+
+void fill(server::ActiveObjectMgr &mgr, size_t n,
+		std::vector<ServerActiveObject *> &all)
+{
+	mgr.clear();
+	all.clear();
+	for (size_t i = 0; i < n; i++) {
+		auto obj = std::make_unique<TestObject>(randpos());
+		auto *ptr = obj.get();
+		if (mgr.registerObject(std::move(obj)))
+			all.push_back(ptr);
+	}
+}
+
+// What getObjectsInsideRadius() did before the spatial index
+size_t linearScan(const std::vector<ServerActiveObject *> &all,
+		const v3f &pos, float radius)
+{
+	float r2 = radius * radius;
+	size_t found = 0;
+	for (auto *obj : all) {
+		if (obj->getBasePosition().getDistanceFromSQ(pos) <= r2)
+			found++;
+	}
+	return found;
+}
+
+}
+
+#define BENCH_INSIDE_RADIUS(_count) \
+	BENCHMARK_ADVANCED("inside_radius_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		std::vector<ServerActiveObject *> all; \
+		fill(mgr, _count, all); \
+		std::vector<ServerActiveObject *> result; \
+		meter.measure([&] { \
+			result.clear(); \
+			mgr.getObjectsInsideRadius(randpos(), 30 * BS, result, nullptr); \
+			return result.size(); \
+		}); \
+		mgr.clear(); \
+	}; \
+	BENCHMARK_ADVANCED("inside_radius_linear_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		std::vector<ServerActiveObject *> all; \
+		fill(mgr, _count, all); \
+		meter.measure([&] { \
+			return linearScan(all, randpos(), 30 * BS); \
+		}); \
+		mgr.clear(); \
+	}; \
+	BENCHMARK_ADVANCED("added_around_pos_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		std::vector<ServerActiveObject *> all; \
+		fill(mgr, _count, all); \
+		std::set<u16> current; \
+		meter.measure([&] { \
+			std::queue<u16> added; \
+			mgr.getAddedActiveObjectsAroundPos(randpos(), 64 * BS, 0, current, added); \
+			return added.size(); \
+		}); \
+		mgr.clear(); \
+	}; \
+	BENCHMARK_ADVANCED("update_pos_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		std::vector<ServerActiveObject *> all; \
+		fill(mgr, _count, all); \
+		meter.measure([&] { \
+			for (auto *obj : all) { \
+				obj->setBasePosition(obj->getBasePosition() + v3f(0.5f * BS, 0, 0)); \
+				mgr.updateObjectPos(obj); \
+			} \
+		}); \
+		mgr.clear(); \
+	};
+
+TEST_CASE("benchmark_activeobjectmgr") {
+	BENCH_INSIDE_RADIUS(200)
+	BENCH_INSIDE_RADIUS(1450)
+	BENCH_INSIDE_RADIUS(10000)
+}
@@ -0,0 +1,397 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "constants.h"
+#include "network/connection.h"
+#include "network/networkpacket.h"
+#include "network/networkprotocol.h"
+#include "noise.h"
+#include "porting.h"
+#include "threading/thread.h"
+#include "util/numeric.h"
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+
+namespace {
+
+struct LinkParams
+{
+	const char *name;
+	// One way, jitter is added on top of it
+	u32 delay_ms;
+	u32 jitter_ms;
+	u32 loss_percent;
+	// Datagrams that are held back so that later ones overtake them
+	u32 reorder_percent;
+	// In each direction, 0 for unlimited
+	u32 bandwidth_kbps;
+};
+
+// Longest a datagram may wait for the bandwidth before it is dropped
+#define LINK_MAX_QUEUE_US 200000
+
+/*
+	UDP relay between a server and the first client that sends to it,
+	simulating the link properties on the way.
+*/
+class LinkSimulator : public Thread
+{
+public:
+	LinkSimulator(u16 port, const Address &server, const LinkParams &params) :
+		Thread("LinkSimulator"),
+		m_server(server),
+		m_params(params)
+	{
+		m_socket.init(false);
+		m_socket.Bind(Address(0, 0, 0, 0, port));
+		m_socket.setTimeoutMs(1);
+	}
+
+	~LinkSimulator()
+	{
+		stop();
+		wait();
+	}
+
+	u32 getDropped() const { return m_dropped; }
+
+protected:
+	void *run()
+	{
+		std::string buffer(0x10000, '\0');
+		PcgRandom random(1234);
+
+		while (!stopRequested()) {
+			Address sender;
+			int size = m_socket.Receive(sender, &buffer[0], buffer.size());
+			u64 now = porting::getTimeUs();
+			if (size >= 0)
+				enqueue(sender, buffer.substr(0, size), now, random);
+
+			now = porting::getTimeUs();
+			while (!m_in_flight.empty() && m_in_flight.top().due <= now) {
+				const Datagram &d = m_in_flight.top();
+				try {
+					m_socket.Send(d.destination, d.data.data(), d.data.size());
+				} catch (SendFailedException &e) {
+				}
+				m_in_flight.pop();
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	struct Datagram
+	{
+		u64 due;
+		// Keeps datagrams that are due at the same time in order
+		u64 order;
+		Address destination;
+		std::string data;
+
+		bool operator>(const Datagram &other) const
+		{
+			return due != other.due ? due > other.due : order > other.order;
+		}
+	};
+
+	void enqueue(const Address &sender, std::string &&data, u64 now,
+			PcgRandom &random)
+	{
+		const bool from_server = m_server == sender;
+		if (!from_server)
+			m_client = sender;
+		u64 &busy_until = from_server ? m_busy_until[0] : m_busy_until[1];
+
+		if (random.range(0, 99) < (s32)m_params.loss_percent) {
+			m_dropped++;
+			return;
+		}
+
+		u64 departure = now;
+		if (m_params.bandwidth_kbps > 0) {
+			departure = MYMAX(now, busy_until);
+			if (departure - now > LINK_MAX_QUEUE_US) {
+				// Queue of the bottleneck is full
+				m_dropped++;
+				return;
+			}
+			departure += (u64)data.size() * 8 * 1000 / m_params.bandwidth_kbps;
+			busy_until = departure;
+		}
+
+		u64 delay_ms = m_params.delay_ms;
+		if (m_params.jitter_ms > 0)
+			delay_ms += random.range(0, m_params.jitter_ms);
+		if (random.range(0, 99) < (s32)m_params.reorder_percent)
+			delay_ms += MYMAX(m_params.delay_ms / 2, 5U);
+
+		m_in_flight.push({departure + delay_ms * 1000, m_next_order++,
+				from_server ? m_client : m_server, std::move(data)});
+	}
+
+	UDPSocket m_socket;
+	Address m_server;
+	Address m_client;
+	const LinkParams m_params;
+	std::priority_queue<Datagram, std::vector<Datagram>,
+			std::greater<Datagram>> m_in_flight;
+	u64 m_next_order = 0;
+	// Server to client, client to server
+	u64 m_busy_until[2] = {0, 0};
+	std::atomic<u32> m_dropped{0};
+};
+
+struct PeerCounter : public con::PeerHandler
+{
+	void peerAdded(con::Peer *peer) { last_id = peer->id; count++; }
+	void deletingPeer(con::Peer *peer, bool timeout) { count--; }
+
+	std::atomic<s32> count{0};
+	std::atomic<session_t> last_id{0};
+};
+
+// A server and a client that are connected to each other
+struct Endpoints
+{
+	Endpoints(u16 server_port, u16 connect_port) :
+		server(PROTOCOL_ID, 512, CONNECTION_TIMEOUT, false, &server_handler),
+		client(PROTOCOL_ID, 512, CONNECTION_TIMEOUT, false, &client_handler)
+	{
+		server.Serve(Address(0, 0, 0, 0, server_port));
+		client.Connect(Address(127, 0, 0, 1, connect_port));
+	}
+
+	bool waitConnected()
+	{
+		const u64 start = porting::getTimeMs();
+		while (!client.Connected() || server_handler.count == 0) {
+			if (porting::getTimeMs() - start > 10000)
+				return false;
+			NetworkPacket pkt;
+			client.ReceiveTimeoutMs(&pkt, 10);
+			server.ReceiveTimeoutMs(&pkt, 10);
+		}
+		return true;
+	}
+
+	PeerCounter server_handler;
+	PeerCounter client_handler;
+	con::Connection server;
+	con::Connection client;
+};
+
+struct TrafficClass
+{
+	const char *name;
+	u16 command;
+	u8 channel;
+	bool reliable;
+	u32 min_size;
+	u32 max_size;
+	// Packets per tick
+	u32 per_tick;
+	// Only every nth tick
+	u32 tick_interval;
+
+	u32 sent = 0;
+	u32 received = 0;
+	u64 bytes = 0;
+	std::vector<u32> latencies_us;
+};
+
+// Length of one server step
+#define TRAFFIC_TICK_MS 20
+// How long data is offered, afterwards the reliable data is left to arrive
+#define TRAFFIC_TICKS 50
+
+/*
+	What a server sends to a player that walks into new terrain: map blocks
+	on channel 2, active object updates on channel 1 and the occasional
+	chat message on channel 0. Every payload starts with its send time
+	and the index of its class.
+*/
+std::vector<TrafficClass> makeTrafficMix()
+{
+	return {
+		{"blockdata", TOCLIENT_BLOCKDATA, 2, true, 500, 6000, 10, 1},
+		{"ao_messages", TOCLIENT_ACTIVE_OBJECT_MESSAGES, 1, false, 200, 1400, 1, 1},
+		{"ao_messages_rel", TOCLIENT_ACTIVE_OBJECT_MESSAGES, 0, true, 20, 100, 1, 5},
+		{"chat", TOCLIENT_CHAT_MESSAGE, 0, true, 30, 120, 1, 10},
+	};
+}
+
+void sendTraffic(con::Connection &server, session_t peer_id,
+		std::vector<TrafficClass> &mix, u8 index, u32 tick, PcgRandom &random)
+{
+	TrafficClass &tc = mix[index];
+	if (tick % tc.tick_interval != 0)
+		return;
+	for (u32 i = 0; i < tc.per_tick; i++) {
+		const u32 size = random.range(tc.min_size, tc.max_size);
+		NetworkPacket pkt(tc.command, size);
+		pkt << (u64)porting::getTimeUs() << index;
+		pkt.putRawString(std::string(size - sizeof(u64) - sizeof(u8), 'x'));
+		server.Send(peer_id, tc.channel, std::move(pkt), tc.reliable);
+		tc.sent++;
+	}
+}
+
+void receiveTraffic(NetworkPacket &pkt, std::vector<TrafficClass> &mix)
+{
+	u64 sent_time;
+	u8 index;
+	pkt >> sent_time >> index;
+	TrafficClass &tc = mix.at(index);
+	tc.received++;
+	tc.bytes += pkt.getSize();
+	tc.latencies_us.push_back(porting::getTimeUs() - sent_time);
+}
+
+bool reliableComplete(const std::vector<TrafficClass> &mix)
+{
+	for (const TrafficClass &tc : mix) {
+		if (tc.reliable && tc.received < tc.sent)
+			return false;
+	}
+	return true;
+}
+
+float percentileMs(std::vector<u32> values, float p)
+{
+	if (values.empty())
+		return 0.0f;
+	size_t i = MYMIN((size_t)(values.size() * p), values.size() - 1);
+	std::nth_element(values.begin(), values.begin() + i, values.end());
+	return values[i] / 1000.0f;
+}
+
+void runTransfer(const LinkParams &params, u16 base_port,
+		const char *congestion_control)
+{
+	const u16 server_port = base_port;
+	const u16 link_port = base_port + 1;
+
+	LinkSimulator link(link_port, Address(127, 0, 0, 1, server_port), params);
+	link.start();
+
+	Endpoints ep(server_port, link_port);
+	ep.server.SetCongestionControl(congestion_control);
+	ep.client.SetCongestionControl(congestion_control);
+	REQUIRE(ep.waitConnected());
+	const session_t peer_id = ep.server_handler.last_id;
+
+	std::vector<TrafficClass> mix = makeTrafficMix();
+	PcgRandom random(42);
+
+	const std::clock_t cpu_start = std::clock();
+	const u64 start = porting::getTimeMs();
+	u64 end = start;
+	for (u32 tick = 0; ; tick++) {
+		if (tick < TRAFFIC_TICKS) {
+			for (u8 i = 0; i < mix.size(); i++)
+				sendTraffic(ep.server, peer_id, mix, i, tick, random);
+		} else if (reliableComplete(mix) || end - start > 60000) {
+			break;
+		}
+
+		const u64 tick_end = start + (tick + 1) * TRAFFIC_TICK_MS;
+		for (;;) {
+			end = porting::getTimeMs();
+			if (end >= tick_end)
+				break;
+			NetworkPacket pkt;
+			if (ep.client.ReceiveTimeoutMs(&pkt, tick_end - end))
+				receiveTraffic(pkt, mix);
+		}
+		NetworkPacket pkt;
+		while (ep.server.TryReceive(&pkt))
+			;
+	}
+	const float cpu_ms = (std::clock() - cpu_start) * 1000.0f / CLOCKS_PER_SEC;
+	CHECK(reliableComplete(mix));
+
+	u64 bytes = 0;
+	for (const TrafficClass &tc : mix)
+		bytes += tc.bytes;
+	const float mb = bytes / (1024.0f * 1024.0f);
+	const float seconds = MYMAX(end - start, (u64)1) / 1000.0f;
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< "connection " << params.name << " (" << congestion_control << "): "
+		<< "goodput " << bytes / 1024.0f / seconds << " KiB/s, "
+		<< "CPU " << cpu_ms / MYMAX(mb, 0.001f) << " ms/MiB, "
+		<< link.getDropped() << " datagrams dropped" << std::endl;
+	for (const TrafficClass &tc : mix) {
+		std::cout << "    " << std::left << std::setw(16) << tc.name << std::right
+			<< tc.received << "/" << tc.sent << " delivered, latency p50 "
+			<< percentileMs(tc.latencies_us, 0.5f) << " ms, p99 "
+			<< percentileMs(tc.latencies_us, 0.99f) << " ms" << std::endl;
+	}
+}
+
+const LinkParams link_profiles[] = {
+	{"lan", 1, 0, 0, 0, 0},
+	{"dsl", 20, 5, 1, 0, 16000},
+	{"mobile", 60, 20, 3, 5, 4000},
+	{"lossy", 100, 10, 10, 2, 0},
+};
+
+}
+
+TEST_CASE("benchmark_connection") {
+	// Goodput, latency and CPU time of a whole transfer, each of these
+	// takes a few seconds so they are run once rather than sampled
+	SECTION("transfer") {
+		u16 port = 30100;
+		for (const LinkParams &params : link_profiles) {
+			for (const char *cc : {"legacy", "cubic", "bbr"}) {
+				runTransfer(params, port, cc);
+				port += 2;
+			}
+		}
+	}
+
+	// Cost of the connection stack per packet, without simulated delay
+	SECTION("roundtrip") {
+		Endpoints ep(30200, 30200);
+		REQUIRE(ep.waitConnected());
+		const session_t peer_id = ep.server_handler.last_id;
+
+		for (u32 size : {64U, 1024U, 16384U}) {
+			const std::string payload(size, 'x');
+			BENCHMARK_ADVANCED("reliable_roundtrip_" + std::to_string(size))(
+					Catch::Benchmark::Chronometer meter) {
+				meter.measure([&] {
+					NetworkPacket pkt(TOCLIENT_BLOCKDATA, size);
+					pkt.putRawString(payload);
+					ep.server.Send(peer_id, 2, std::move(pkt), true);
+					NetworkPacket received;
+					return ep.client.ReceiveTimeoutMs(&received, 1000);
+				});
+			};
+		}
+	}
+}
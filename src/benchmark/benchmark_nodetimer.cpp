@@ -0,0 +1,88 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "nodetimer.h"
+#include "constants.h"
+#include "util/numeric.h"
+#include <sstream>
+
+namespace {
+
+// A block with `count` nodes running timers, e.g. furnaces or crops
+void fillTimers(NodeTimerList &list, u32 count)
+{
+	list.clear();
+	for (u32 i = 0; i < count; i++) {
+		v3s16 p(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+			i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+		list.insert(NodeTimer(myrand_range(1, 10), myrand_float(), p));
+	}
+}
+
+// What MapBlock::step() does: elapsed timers are started again
+size_t stepAndRestart(NodeTimerList &list, float dtime)
+{
+	std::vector<NodeTimer> elapsed = list.step(dtime);
+	for (const NodeTimer &t : elapsed)
+		list.set(NodeTimer(t.timeout, 0, t.position));
+	return elapsed.size();
+}
+
+}
+
+#define BENCH_TIMERS(_count) \
+	BENCHMARK_ADVANCED("step_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		NodeTimerList list; \
+		fillTimers(list, _count); \
+		meter.measure([&] { return stepAndRestart(list, 0.09f); }); \
+	}; \
+	BENCHMARK_ADVANCED("set_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		NodeTimerList list; \
+		fillTimers(list, _count); \
+		meter.measure([&] { \
+			u32 i = myrand_range(0, _count - 1); \
+			v3s16 p(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE, \
+				i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE)); \
+			list.set(NodeTimer(myrand_range(1, 10), 0, p)); \
+			return list.size(); \
+		}); \
+	}; \
+	BENCHMARK_ADVANCED("serialize_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		NodeTimerList list; \
+		fillTimers(list, _count); \
+		meter.measure([&] { \
+			std::ostringstream os(std::ios_base::binary); \
+			list.serialize(os, 29); \
+			return os.tellp(); \
+		}); \
+	}; \
+	BENCHMARK_ADVANCED("fill_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		NodeTimerList list; \
+		meter.measure([&] { \
+			fillTimers(list, _count); \
+			return list.size(); \
+		}); \
+	};
+
+TEST_CASE("benchmark_nodetimer") {
+	BENCH_TIMERS(10)
+	BENCH_TIMERS(200)
+	BENCH_TIMERS(4096)
+}
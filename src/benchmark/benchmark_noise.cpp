@@ -0,0 +1,47 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "noise.h"
+#include "noise_kernels.h"
+#include <string>
+
+// Noise maps of the size mapgen v7 uses for an 80³ chunk, with its
+// mountain and terrain parameters
+TEST_CASE("benchmark_noise")
+{
+	NoiseParams np_3d(-0.6, 1.0, v3f(250, 350, 250), 5333, 5, 0.63, 2.0);
+	NoiseParams np_2d(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0);
+
+	for (const NoiseKernels *kernels : NoiseKernels::getSupported()) {
+		const std::string name = kernels->name;
+
+		BENCHMARK_ADVANCED("perlinMap3D_80x82x80_" + name)(Catch::Benchmark::Chronometer meter) {
+			Noise noise(&np_3d, 1337, 80, 82, 80);
+			noise.kernels = kernels;
+			meter.measure([&] { return noise.perlinMap3D(-1040, -32, 2000)[0]; });
+		};
+
+		BENCHMARK_ADVANCED("perlinMap2D_80x80_" + name)(Catch::Benchmark::Chronometer meter) {
+			Noise noise(&np_2d, 1337, 80, 80);
+			noise.kernels = kernels;
+			meter.measure([&] { return noise.perlinMap2D(-1040, 2000)[0]; });
+		};
+	}
+}
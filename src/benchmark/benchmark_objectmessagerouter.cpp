@@ -0,0 +1,145 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "server/objectmessagerouter.h"
+#include "server/serveractiveobject.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include <memory>
+#include <set>
+#include <unordered_map>
+
+namespace {
+
+class TestObject : public ServerActiveObject
+{
+public:
+	TestObject() : ServerActiveObject(nullptr, v3f()) {}
+
+	ActiveObjectType getType() const override { return ACTIVEOBJECT_TYPE_TEST; }
+	bool getCollisionBox(aabb3f *toset) const override { return false; }
+	bool getSelectionBox(aabb3f *toset) const override { return false; }
+	bool collideWithObjects() const override { return false; }
+};
+
+struct World
+{
+	std::vector<std::unique_ptr<TestObject>> objects;
+	// Known objects of each client, like RemoteClient::m_known_objects
+	std::vector<std::set<u16>> known_objects;
+	// The messages of one server step
+	std::vector<ActiveObjectMessage> messages;
+
+	ServerActiveObject *get(u16 id) const
+	{
+		return id > 0 && id <= objects.size() ? objects[id - 1].get() : nullptr;
+	}
+};
+
+// Every object moves, every client sees about a tenth of them
+void fill(World &world, u16 object_count, u16 client_count)
+{
+	for (u16 id = 1; id <= object_count; id++) {
+		auto obj = std::make_unique<TestObject>();
+		obj->setId(id);
+		world.objects.push_back(std::move(obj));
+	}
+
+	world.known_objects.resize(client_count);
+	for (u16 peer_id = 0; peer_id < client_count; peer_id++) {
+		for (auto &obj : world.objects) {
+			if (myrand_range(0, 9) == 0) {
+				world.known_objects[peer_id].insert(obj->getId());
+				obj->addKnownBy(peer_id);
+			}
+		}
+	}
+
+	const std::string pos_cmd = std::string(1, AO_CMD_UPDATE_POSITION) +
+		std::string(40, 'p');
+	const std::string anim_cmd = std::string(1, AO_CMD_SET_ANIMATION) +
+		std::string(20, 'a');
+	for (auto &obj : world.objects) {
+		world.messages.emplace_back(obj->getId(), false, pos_cmd);
+		if (myrand_range(0, 4) == 0)
+			world.messages.emplace_back(obj->getId(), true, anim_cmd);
+	}
+}
+
+size_t routeByObservers(const World &world)
+{
+	ObjectMessageRouter router;
+	for (ActiveObjectMessage aom : world.messages)
+		router.push(std::move(aom));
+	router.route([&] (u16 id) { return world.get(id); });
+
+	size_t bytes = 0;
+	for (const auto &it : router.getClientData())
+		bytes += it.second.reliable.size() + it.second.unreliable.size();
+	return bytes;
+}
+
+// What Server::AsyncRunStep() did before: every client looks at every
+// object with messages and serializes them again
+size_t routePerClient(const World &world)
+{
+	std::unordered_map<u16, std::vector<ActiveObjectMessage>> buffered;
+	for (ActiveObjectMessage aom : world.messages)
+		buffered[aom.id].push_back(std::move(aom));
+
+	size_t bytes = 0;
+	std::string reliable_data, unreliable_data;
+	for (const std::set<u16> &known : world.known_objects) {
+		reliable_data.clear();
+		unreliable_data.clear();
+		for (const auto &it : buffered) {
+			if (!world.get(it.first) || known.find(it.first) == known.end())
+				continue;
+			for (const ActiveObjectMessage &aom : it.second) {
+				std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
+				char idbuf[2];
+				writeU16((u8 *)idbuf, aom.id);
+				buffer.append(idbuf, sizeof(idbuf));
+				buffer.append(serializeString16(aom.datastring));
+			}
+		}
+		bytes += reliable_data.size() + unreliable_data.size();
+	}
+	return bytes;
+}
+
+}
+
+#define BENCH_ROUTE(_objects, _clients) \
+	BENCHMARK_ADVANCED("route_observers_" #_objects "_" #_clients)(Catch::Benchmark::Chronometer meter) { \
+		World world; \
+		fill(world, _objects, _clients); \
+		meter.measure([&] { return routeByObservers(world); }); \
+	}; \
+	BENCHMARK_ADVANCED("route_per_client_" #_objects "_" #_clients)(Catch::Benchmark::Chronometer meter) { \
+		World world; \
+		fill(world, _objects, _clients); \
+		meter.measure([&] { return routePerClient(world); }); \
+	};
+
+TEST_CASE("benchmark_objectmessagerouter") {
+	BENCH_ROUTE(1000, 50)
+	BENCH_ROUTE(4000, 50)
+}
@@ -0,0 +1,102 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "blockcontentindex.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+void BlockContentIndex::build(const MapNode *data, u32 nodecount)
+{
+	clear();
+	m_slots.resize(nodecount);
+
+	// Runs of the same content are very common, so remember the last one
+	content_t last_c = CONTENT_IGNORE;
+	size_t last_k = SIZE_MAX;
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		if (c != last_c || last_k == SIZE_MAX) {
+			last_c = c;
+			last_k = find(c);
+			if (last_k == SIZE_MAX) {
+				last_k = m_contents.size();
+				m_contents.push_back(c);
+				m_positions.emplace_back();
+			}
+		}
+		m_slots[i] = m_positions[last_k].size();
+		m_positions[last_k].push_back(i);
+	}
+
+	m_valid = true;
+}
+
+void BlockContentIndex::clear()
+{
+	m_valid = false;
+	m_contents.clear();
+	m_positions.clear();
+	m_slots.clear();
+}
+
+bool BlockContentIndex::contains(content_t c) const
+{
+	return find(c) != SIZE_MAX;
+}
+
+size_t BlockContentIndex::find(content_t c) const
+{
+	for (size_t k = 0; k < m_contents.size(); k++) {
+		if (m_contents[k] == c)
+			return k;
+	}
+	return SIZE_MAX;
+}
+
+void BlockContentIndex::move(u16 i, content_t old_c, content_t new_c)
+{
+	size_t k = find(old_c);
+	assert(k != SIZE_MAX);
+	if (k != SIZE_MAX) {
+		// Move the last position into the slot of the removed one
+		std::vector<u16> &positions = m_positions[k];
+		const u16 slot = m_slots[i];
+		assert(slot < positions.size() && positions[slot] == i);
+		const u16 last = positions.back();
+		positions[slot] = last;
+		m_slots[last] = slot;
+		positions.pop_back();
+		if (positions.empty()) {
+			std::swap(m_contents[k], m_contents.back());
+			m_contents.pop_back();
+			std::swap(m_positions[k], m_positions.back());
+			m_positions.pop_back();
+		}
+	}
+
+	k = find(new_c);
+	if (k == SIZE_MAX) {
+		k = m_contents.size();
+		m_contents.push_back(new_c);
+		m_positions.emplace_back();
+	}
+	m_slots[i] = m_positions[k].size();
+	m_positions[k].push_back(i);
+}
@@ -0,0 +1,67 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes.h"
+#include "mapnode.h"
+
+/*
+	Positions of the nodes of a mapblock, grouped by content ID.
+
+	Built on demand (by the ABM scan) and kept up to date by single node
+	changes, so a block only has to be scanned completely again after
+	bulk modifications like a voxel manipulator write.
+	Positions are indices into the node data of the block
+	(z * MAP_BLOCKSIZE^2 + y * MAP_BLOCKSIZE + x).
+*/
+class BlockContentIndex
+{
+public:
+	bool isValid() const { return m_valid; }
+
+	void build(const MapNode *data, u32 nodecount);
+	void clear();
+
+	// Called when the node at `i` changes from `old_c` to `new_c`
+	inline void update(u16 i, content_t old_c, content_t new_c)
+	{
+		if (m_valid && old_c != new_c)
+			move(i, old_c, new_c);
+	}
+
+	// Content IDs in the block, in no particular order
+	const std::vector<content_t> &getContents() const { return m_contents; }
+
+	// Node positions of the content ID at getContents()[k]
+	const std::vector<u16> &getPositions(size_t k) const { return m_positions[k]; }
+
+	bool contains(content_t c) const;
+
+private:
+	size_t find(content_t c) const;
+	void move(u16 i, content_t old_c, content_t new_c);
+
+	bool m_valid = false;
+	std::vector<content_t> m_contents;
+	std::vector<std::vector<u16>> m_positions;
+	// Where each node position is stored in its m_positions entry
+	std::vector<u16> m_slots;
+};
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <map>
 #include "irrlichttypes_extrabloated.h"
 #include "clientobject.h"
+#include "object_position.h"
 #include "object_properties.h"
 #include "itemgroup.h"
 #include "constants.h"
@@ -94,6 +95,7 @@ class GenericCAO : public ClientActiveObject
 	u16 m_hp = 1;
 	SmoothTranslator<v3f> pos_translator;
 	SmoothTranslatorWrappedv3f rot_translator;
+	ObjectPositionDecoder m_position_decoder;
 	// Spritesheet/animation stuff
 	v2f m_tx_size = v2f(1,1);
 	v2s16 m_tx_basepos;
@@ -271,6 +273,8 @@ class GenericCAO : public ClientActiveObject
 
 	void processMessage(const std::string &data) override;
 
+	void processPositionUpdate(const ObjectPositionUpdate &update);
+
 	bool directReportPunch(v3f dir, const ItemStack *punchitem=NULL,
 			float time_from_last_punch=1000000) override;
 
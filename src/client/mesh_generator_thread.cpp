@@ -225,7 +225,9 @@ void MeshUpdateWorkerThread::doUpdate()
 	while ((q = m_queue_in->pop())) {
 		if (m_generation_interval)
 			sleep_ms(m_generation_interval);
-		ScopeProfiler sp(g_profiler, "Client: Mesh making (sum)");
+		static const ProfilerProbe probe = g_profiler->registerProbe(
+			"Client: Mesh making (sum)", SPT_ADD);
+		ScopeProfiler sp(g_profiler, probe);
 
 		MapBlockMesh *mesh_new = new MapBlockMesh(q->data, *m_camera_offset);
 
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serverenvironment.h"
 #include "map.h"
 #include "emerge.h"
+#include "server/bandwidthscheduler.h"
 #include "server/luaentity_sao.h"
 #include "server/player_sao.h"
 #include "log.h"
@@ -125,7 +126,7 @@ void RemoteClient::GetNextBlocks (
 		return;
 
 	// Won't send anything if already sending
-	if (m_blocks_sending.size() >= m_max_simul_sends) {
+	if (getSendingCount() >= m_max_simul_sends) {
 		//infostream<<"Not sending any blocks, Queue full."<<std::endl;
 		return;
 	}
@@ -169,7 +170,7 @@ void RemoteClient::GetNextBlocks (
 	/*
 		Number of blocks sending + number of blocks selected for sending
 	*/
-	u32 num_blocks_selected = m_blocks_sending.size();
+	u32 num_blocks_selected = getSendingCount();
 
 	/*
 		next time d will be continued from the d from which the nearest
@@ -310,7 +311,7 @@ void RemoteClient::GetNextBlocks (
 			/*
 				Check if map has this block
 			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
+			MapBlock *block = env->getMap().getBlockNoCreateNoExNoCache(p);
 			if (block) {
 				// First: Reset usage timer, this block will be of use in the future.
 				block->resetUsageTimer();
@@ -323,7 +324,8 @@ void RemoteClient::GetNextBlocks (
 			}
 
 			// Don't send blocks that are currently being transferred
-			if (m_blocks_sending.find(p) != m_blocks_sending.end())
+			if (m_blocks_sending.find(p) != m_blocks_sending.end() ||
+					m_blocks_serializing.find(p) != m_blocks_serializing.end())
 				continue;
 
 			/*
@@ -447,6 +449,7 @@ void RemoteClient::GotBlock(v3s16 p)
 
 void RemoteClient::SentBlock(v3s16 p)
 {
+	m_blocks_serializing.erase(p);
 	if (m_blocks_sending.find(p) == m_blocks_sending.end())
 		m_blocks_sending[p] = 0.0f;
 	else
@@ -454,13 +457,25 @@ void RemoteClient::SentBlock(v3s16 p)
 				" already in m_blocks_sending"<<std::endl;
 }
 
+void RemoteClient::QueuedBlock(v3s16 p, u64 block_version)
+{
+	m_blocks_serializing[p] = block_version;
+}
+
+bool RemoteClient::isWaitingForBlock(v3s16 p, u64 block_version) const
+{
+	auto it = m_blocks_serializing.find(p);
+	return it != m_blocks_serializing.end() && it->second == block_version;
+}
+
 void RemoteClient::SetBlockNotSent(v3s16 p)
 {
 	m_nothing_to_send_pause_timer = 0;
 
 	// remove the block from sending and sent sets,
 	// and mark as modified if found
-	if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0)
+	if (m_blocks_sending.erase(p) + m_blocks_serializing.erase(p) +
+			m_blocks_sent.erase(p) > 0)
 		m_blocks_modified.insert(p);
 }
 
@@ -472,7 +487,8 @@ void RemoteClient::SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks)
 		v3s16 p = block.first;
 		// remove the block from sending and sent sets,
 		// and mark as modified if found
-		if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0)
+		if (m_blocks_sending.erase(p) + m_blocks_serializing.erase(p) +
+				m_blocks_sent.erase(p) > 0)
 			m_blocks_modified.insert(p);
 	}
 }
@@ -648,6 +664,15 @@ ClientInterface::ClientInterface(const std::shared_ptr<con::Connection> & con)
 {
 
 }
+
+void ClientInterface::initBandwidthScheduler(MetricsBackend *mb)
+{
+	const u32 rate = g_settings->getU32("max_client_send_rate") * 1024;
+	m_scheduler = std::make_unique<BandwidthScheduler>(rate,
+		[this] (session_t peer_id, u8 channelnum, NetworkPacket &&pkt, bool reliable) {
+			m_con->Send(peer_id, channelnum, std::move(pkt), reliable);
+		}, mb);
+}
 ClientInterface::~ClientInterface()
 {
 	/*
@@ -704,6 +729,11 @@ void ClientInterface::step(float dtime)
 	}
 }
 
+bool ClientInterface::sendScheduled()
+{
+	return m_scheduler && m_scheduler->step();
+}
+
 void ClientInterface::UpdatePlayerList()
 {
 	if (m_env) {
@@ -736,7 +766,20 @@ void ClientInterface::UpdatePlayerList()
 void ClientInterface::send(session_t peer_id, u8 channelnum,
 		NetworkPacket *pkt, bool reliable)
 {
-	m_con->Send(peer_id, channelnum, pkt, reliable);
+	// Only copy the packet if it has to wait
+	if (m_scheduler && !m_scheduler->admit(peer_id, pkt->getCommand(), pkt->getSize()))
+		m_scheduler->push(peer_id, channelnum, NetworkPacket(*pkt), reliable);
+	else
+		m_con->Send(peer_id, channelnum, pkt, reliable);
+}
+
+void ClientInterface::send(session_t peer_id, u8 channelnum,
+		NetworkPacket &&pkt, bool reliable)
+{
+	if (m_scheduler && !m_scheduler->admit(peer_id, pkt.getCommand(), pkt.getSize()))
+		m_scheduler->push(peer_id, channelnum, std::move(pkt), reliable);
+	else
+		m_con->Send(peer_id, channelnum, std::move(pkt), reliable);
 }
 
 void ClientInterface::sendToAll(NetworkPacket *pkt)
@@ -746,7 +789,7 @@ void ClientInterface::sendToAll(NetworkPacket *pkt)
 		RemoteClient *client = client_it.second;
 
 		if (client->net_proto_version != 0) {
-			m_con->Send(client->peer_id,
+			send(client->peer_id,
 					clientCommandFactoryTable[pkt->getCommand()].channel, pkt,
 					clientCommandFactoryTable[pkt->getCommand()].reliable);
 		}
@@ -825,13 +868,16 @@ void ClientInterface::DeleteClient(session_t peer_id)
 		// Get object
 		ServerActiveObject* obj = m_env->getActiveObject(id);
 
-		if(obj && obj->m_known_by_count > 0)
-			obj->m_known_by_count--;
+		if (obj)
+			obj->removeKnownBy(peer_id);
 	}
 
 	// Delete client
 	delete m_clients[peer_id];
 	m_clients.erase(peer_id);
+
+	if (m_scheduler)
+		m_scheduler->removePeer(peer_id);
 }
 
 void ClientInterface::CreateClient(session_t peer_id)
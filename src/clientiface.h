@@ -40,6 +40,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 class MapBlock;
 class ServerEnvironment;
 class EmergeManager;
+class BandwidthScheduler;
+class MetricsBackend;
 
 /*
  * State Transitions
@@ -236,6 +238,8 @@ class RemoteClient
 	u8 serialization_version = SER_FMT_VER_INVALID;
 	//
 	u16 net_proto_version = 0;
+	// Bytes saved by compact object position updates
+	u64 position_bytes_saved = 0;
 
 	/* Authentication information */
 	std::string enc_pwd = "";
@@ -259,6 +263,9 @@ class RemoteClient
 		Finds block that should be sent next to the client.
 		Environment should be locked when this is called.
 		dtime is used for resetting send radius at slow interval
+		Only reads the environment and the map, so it may run for several
+		clients at the same time. The block state it updates (usage timer,
+		day/night difference) is safe to update from several threads.
 	*/
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
 			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
@@ -266,6 +273,11 @@ class RemoteClient
 	void GotBlock(v3s16 p);
 
 	void SentBlock(v3s16 p);
+	// The block is being serialized for the client, it counts as sending
+	void QueuedBlock(v3s16 p, u64 block_version);
+	// Whether the client still wants the serialization of this version of
+	// the block, i.e. it was queued for it and not modified since
+	bool isWaitingForBlock(v3s16 p, u64 block_version) const;
 
 	void SetBlockNotSent(v3s16 p);
 	void SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks);
@@ -278,7 +290,10 @@ class RemoteClient
 	 */
 	void ResendBlockIfOnWire(v3s16 p);
 
-	u32 getSendingCount() const { return m_blocks_sending.size(); }
+	u32 getSendingCount() const
+	{
+		return m_blocks_sending.size() + m_blocks_serializing.size();
+	}
 
 	bool isBlockSent(v3s16 p) const
 	{
@@ -295,6 +310,7 @@ class RemoteClient
 		o<<"RemoteClient "<<peer_id<<": "
 				<<"m_blocks_sent.size()="<<m_blocks_sent.size()
 				<<", m_blocks_sending.size()="<<m_blocks_sending.size()
+				<<", m_blocks_serializing.size()="<<m_blocks_serializing.size()
 				<<", m_nearest_unsent_d="<<m_nearest_unsent_d
 				<<", m_excess_gotblocks="<<m_excess_gotblocks
 				<<std::endl;
@@ -411,6 +427,13 @@ class RemoteClient
 	*/
 	std::unordered_map<v3s16, float> m_blocks_sending;
 
+	/*
+		Blocks that were selected for sending but wait for a worker to
+		serialize them, with the version of the block that was queued.
+		Block is moved to m_blocks_sending when it is actually sent.
+	*/
+	std::unordered_map<v3s16, u64> m_blocks_serializing;
+
 	/*
 		Blocks that have been modified since blocks were
 		sent to the client last (getNextBlocks()).
@@ -468,9 +491,16 @@ class ClientInterface {
 	ClientInterface(const std::shared_ptr<con::Connection> &con);
 	~ClientInterface();
 
+	/* limit outgoing traffic per client, see max_client_send_rate */
+	void initBandwidthScheduler(MetricsBackend *mb);
+
 	/* run sync step */
 	void step(float dtime);
 
+	/* send packets that waited for client bandwidth,
+	   returns true if some are still waiting */
+	bool sendScheduled();
+
 	/* get list of active client id's */
 	std::vector<session_t> getClientIDs(ClientState min_state=CS_Active);
 
@@ -485,6 +515,8 @@ class ClientInterface {
 
 	/* send message to client */
 	void send(session_t peer_id, u8 channelnum, NetworkPacket *pkt, bool reliable);
+	/* same, but hands the packet data over without copying it */
+	void send(session_t peer_id, u8 channelnum, NetworkPacket &&pkt, bool reliable);
 
 	/* send to all clients */
 	void sendToAll(NetworkPacket *pkt);
@@ -542,6 +574,8 @@ class ClientInterface {
 
 	// Connection
 	std::shared_ptr<con::Connection> m_con;
+	// Everything sent to clients goes through this, if it exists
+	std::unique_ptr<BandwidthScheduler> m_scheduler;
 	std::recursive_mutex m_clients_mutex;
 	// Connected clients (behind the con mutex)
 	RemoteClientMap m_clients;
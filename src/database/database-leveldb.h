@@ -39,6 +39,10 @@ class Database_LevelDB : public MapDatabase
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	void beginSave() {}
 	void endSave() {}
 
@@ -34,7 +34,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 #include "remoteplayer.h"
 #include "server/player_sao.h"
+#include "util/serialize.h"
+#include <algorithm>
 #include <cstdlib>
+#include <unordered_map>
 
 Database_PostgreSQL::Database_PostgreSQL(const std::string &connect_string,
 	const char *type) :
@@ -214,6 +217,18 @@ void MapDatabasePostgreSQL::initStatements()
 				"($1::int4, $2::int4, $3::int4, $4::bytea) "
 				"ON CONFLICT ON CONSTRAINT blocks_pkey DO "
 				"UPDATE SET data = $4::bytea");
+
+		// Batches, passed as arrays of the columns
+		prepareStatement("write_blocks",
+			"INSERT INTO blocks (posX, posY, posZ, data) "
+				"SELECT * FROM unnest($1::int4[], $2::int4[], $3::int4[], $4::bytea[]) "
+				"ON CONFLICT ON CONSTRAINT blocks_pkey DO "
+				"UPDATE SET data = EXCLUDED.data");
+
+		prepareStatement("read_blocks",
+			"SELECT b.posX, b.posY, b.posZ, b.data FROM "
+				"unnest($1::int4[], $2::int4[], $3::int4[]) AS p(x, y, z) "
+				"JOIN blocks b ON b.posX = p.x AND b.posY = p.y AND b.posZ = p.z");
 	}
 
 	prepareStatement("delete_block", "DELETE FROM blocks WHERE "
@@ -279,6 +294,138 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+/*
+	One-dimensional array parameter in binary format (see array_send() in
+	PostgreSQL), elements are appended with pg_array_append().
+*/
+#define PG_INT4OID 23
+#define PG_BYTEAOID 17
+
+static void pg_array_init(std::string &buf, u32 elemtype, u32 count)
+{
+	buf.clear();
+	u8 header[20];
+	writeU32(&header[0], 1); // number of dimensions
+	writeU32(&header[4], 0); // no NULLs
+	writeU32(&header[8], elemtype);
+	writeU32(&header[12], count);
+	writeU32(&header[16], 1); // lower bound
+	buf.append((char *)header, sizeof(header));
+}
+
+static void pg_array_append(std::string &buf, const void *data, u32 len)
+{
+	u8 size[4];
+	writeU32(size, len);
+	buf.append((char *)size, sizeof(size));
+	buf.append((const char *)data, len);
+}
+
+static void pg_array_append_int(std::string &buf, s32 value)
+{
+	u8 data[4];
+	writeS32(data, value);
+	pg_array_append(buf, data, sizeof(data));
+}
+
+// Blocks saved with one statement
+#define PG_WRITE_BATCH_SIZE 256
+
+bool MapDatabasePostgreSQL::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	if (getPGVersion() < 90500)
+		return MapDatabase::saveBlocks(blocks);
+
+	verifyDatabase();
+
+	std::string xs, ys, zs, datas;
+	for (size_t start = 0; start < blocks.size(); start += PG_WRITE_BATCH_SIZE) {
+		const size_t count = std::min<size_t>(PG_WRITE_BATCH_SIZE, blocks.size() - start);
+
+		pg_array_init(xs, PG_INT4OID, count);
+		pg_array_init(ys, PG_INT4OID, count);
+		pg_array_init(zs, PG_INT4OID, count);
+		pg_array_init(datas, PG_BYTEAOID, count);
+		for (size_t i = start; i < start + count; i++) {
+			const v3s16 &pos = blocks[i].first;
+			const std::string &data = blocks[i].second;
+			pg_array_append_int(xs, pos.X);
+			pg_array_append_int(ys, pos.Y);
+			pg_array_append_int(zs, pos.Z);
+			pg_array_append(datas, data.c_str(), data.size());
+		}
+
+		// Verify if we don't overflow the platform integer
+		if (datas.size() > INT_MAX) {
+			errorstream << "Database_PostgreSQL::saveBlocks: Data truncation! "
+				<< "batch size over INT_MAX (== " << datas.size()
+				<< "), saving blocks one by one" << std::endl;
+			for (size_t i = start; i < start + count; i++)
+				saveBlock(blocks[i].first, blocks[i].second);
+			continue;
+		}
+
+		const void *args[] = { xs.c_str(), ys.c_str(), zs.c_str(), datas.c_str() };
+		const int argLen[] = {
+			(int)xs.size(), (int)ys.size(), (int)zs.size(), (int)datas.size()
+		};
+		const int argFmt[] = { 1, 1, 1, 1 };
+
+		execPrepared("write_blocks", ARRLEN(args), args, argLen, argFmt);
+	}
+	return true;
+}
+
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	if (getPGVersion() < 90500) {
+		MapDatabase::loadBlocks(positions, blocks);
+		return;
+	}
+
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	std::string xs, ys, zs;
+	pg_array_init(xs, PG_INT4OID, positions.size());
+	pg_array_init(ys, PG_INT4OID, positions.size());
+	pg_array_init(zs, PG_INT4OID, positions.size());
+	std::unordered_map<s64, size_t> index;
+	for (size_t i = 0; i < positions.size(); i++) {
+		pg_array_append_int(xs, positions[i].X);
+		pg_array_append_int(ys, positions[i].Y);
+		pg_array_append_int(zs, positions[i].Z);
+		index[getBlockAsInteger(positions[i])] = i;
+	}
+
+	const void *args[] = { xs.c_str(), ys.c_str(), zs.c_str() };
+	const int argLen[] = { (int)xs.size(), (int)ys.size(), (int)zs.size() };
+	const int argFmt[] = { 1, 1, 1 };
+
+	// Results are in binary format
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+		argLen, argFmt, false);
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		v3s16 pos(
+			readS32((const u8 *)PQgetvalue(results, row, 0)),
+			readS32((const u8 *)PQgetvalue(results, row, 1)),
+			readS32((const u8 *)PQgetvalue(results, row, 2))
+		);
+		auto it = index.find(getBlockAsInteger(pos));
+		if (it != index.end())
+			(*blocks)[it->second] = pg_to_string(results, row, 3);
+	}
+
+	PQclear(results);
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -125,8 +125,13 @@ class MapDatabasePostgreSQL : private Database_PostgreSQL, public MapDatabase
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	void beginSave() { Database_PostgreSQL::beginSave(); }
 	void endSave() { Database_PostgreSQL::endSave(); }
+	void rollback() { Database_PostgreSQL::rollback(); }
 
 protected:
 	virtual void createDatabase();
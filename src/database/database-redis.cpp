@@ -91,6 +91,15 @@ void Database_Redis::endSave() {
 	freeReplyObject(reply);
 }
 
+void Database_Redis::rollback() {
+	redisReply *reply = static_cast<redisReply *>(redisCommand(ctx, "DISCARD"));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'DISCARD' failed: ") + ctx->errstr);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::saveBlock(const v3s16 &pos, const std::string &data)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
@@ -155,6 +164,109 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+bool Database_Redis::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	if (blocks.empty())
+		return true;
+
+	// A single HMSET with all fields and values (multiple pairs for HSET
+	// need Redis 4)
+	std::vector<std::string> keys;
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	keys.reserve(blocks.size());
+	argv.reserve(2 + 2 * blocks.size());
+	argvlen.reserve(2 + 2 * blocks.size());
+
+	argv.push_back("HMSET");
+	argvlen.push_back(5);
+	argv.push_back(hash.c_str());
+	argvlen.push_back(hash.size());
+	for (const auto &it : blocks) {
+		keys.push_back(i64tos(getBlockAsInteger(it.first)));
+		argv.push_back(keys.back().c_str());
+		argvlen.push_back(keys.back().size());
+		argv.push_back(it.second.data());
+		argvlen.push_back(it.second.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), argv.data(), argvlen.data()));
+	if (!reply) {
+		warningstream << "saveBlocks: redis command 'HMSET' failed on "
+			<< blocks.size() << " blocks: " << ctx->errstr << std::endl;
+		return false;
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		warningstream << "saveBlocks: saving " << blocks.size()
+			<< " blocks failed: " << std::string(reply->str, reply->len) << std::endl;
+		freeReplyObject(reply);
+		return false;
+	}
+
+	freeReplyObject(reply);
+	return true;
+}
+
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	// A single HMGET for all blocks
+	std::vector<std::string> keys;
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	keys.reserve(positions.size());
+	argv.reserve(2 + positions.size());
+	argvlen.reserve(2 + positions.size());
+
+	argv.push_back("HMGET");
+	argvlen.push_back(5);
+	argv.push_back(hash.c_str());
+	argvlen.push_back(hash.size());
+	for (const v3s16 &pos : positions) {
+		keys.push_back(i64tos(getBlockAsInteger(pos)));
+		argv.push_back(keys.back().c_str());
+		argvlen.push_back(keys.back().size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), argv.data(), argvlen.data()));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		std::string errstr(reply->str, reply->len);
+		freeReplyObject(reply);
+		errorstream << "loadBlocks: loading " << positions.size()
+			<< " blocks failed: " << errstr << std::endl;
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' errored: ") + errstr);
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != positions.size()) {
+		errorstream << "loadBlocks: loading " << positions.size()
+			<< " blocks returned invalid reply type " << reply->type << std::endl;
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' gave invalid reply."));
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		const redisReply *element = reply->element[i];
+		if (element->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(element->str, element->len);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
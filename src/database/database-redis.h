@@ -37,12 +37,17 @@ class Database_Redis : public MapDatabase
 
 	void beginSave();
 	void endSave();
+	void rollback();
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 private:
 	redisContext *ctx = nullptr;
 	std::string hash = "";
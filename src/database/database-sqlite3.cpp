@@ -37,7 +37,9 @@ SQLite format specification:
 #include "irrlicht_changes/printing.h"
 #include "server/player_sao.h"
 
+#include <algorithm>
 #include <cassert>
+#include <unordered_map>
 
 // When to print messages when the database is being held locked by another process
 // Note: I've seen occasional delays of over 250ms while running minetestmapper.
@@ -65,6 +67,9 @@ SQLite format specification:
 			<< sqlite3_errmsg(m_database) << std::endl; \
 	}
 
+// Number of blocks read by one query in MapDatabaseSQLite3::loadBlocks()
+#define SQLITE_READ_BATCH_SIZE 16
+
 #define FINALIZE_STATEMENT(statement) SQLOK_ERRSTREAM(sqlite3_finalize(statement), \
 	"Failed to finalize " #statement)
 
@@ -131,9 +136,21 @@ void Database_SQLite3::beginSave()
 void Database_SQLite3::endSave()
 {
 	verifyDatabase();
-	SQLRES(sqlite3_step(m_stmt_end), SQLITE_DONE,
-		"Failed to commit SQLite3 transaction");
+	// Reset before checking, a failed commit must not keep it busy
+	const int res = sqlite3_step(m_stmt_end);
 	sqlite3_reset(m_stmt_end);
+	SQLRES(res, SQLITE_DONE, "Failed to commit SQLite3 transaction");
+}
+
+void Database_SQLite3::rollback()
+{
+	verifyDatabase();
+	// Nothing to do if the transaction never started or already ended
+	if (sqlite3_get_autocommit(m_database))
+		return;
+	const int res = sqlite3_step(m_stmt_rollback);
+	sqlite3_reset(m_stmt_rollback);
+	SQLRES(res, SQLITE_DONE, "Failed to roll back SQLite3 transaction");
 }
 
 void Database_SQLite3::openDatabase()
@@ -180,6 +197,7 @@ void Database_SQLite3::verifyDatabase()
 
 	PREPARE_STATEMENT(begin, "BEGIN;");
 	PREPARE_STATEMENT(end, "COMMIT;");
+	PREPARE_STATEMENT(rollback, "ROLLBACK;");
 
 	initStatements();
 
@@ -190,6 +208,7 @@ Database_SQLite3::~Database_SQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_begin)
 	FINALIZE_STATEMENT(m_stmt_end)
+	FINALIZE_STATEMENT(m_stmt_rollback)
 
 	SQLOK_ERRSTREAM(sqlite3_close(m_database), "Failed to close database");
 }
@@ -207,6 +226,7 @@ MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
 MapDatabaseSQLite3::~MapDatabaseSQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_batch)
 	FINALIZE_STATEMENT(m_stmt_write)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_delete)
@@ -229,6 +249,9 @@ void MapDatabaseSQLite3::createDatabase()
 void MapDatabaseSQLite3::initStatements()
 {
 	PREPARE_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
+	// Must have SQLITE_READ_BATCH_SIZE parameters
+	PREPARE_STATEMENT(read_batch, "SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN "
+		"(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
 	PREPARE_STATEMENT(write, "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
@@ -296,6 +319,60 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+bool MapDatabaseSQLite3::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	verifyDatabase();
+
+	// No round trips with SQLite, only the checks are saved
+	for (const auto &it : blocks) {
+		bindPos(m_stmt_write, it.first);
+		SQLOK(sqlite3_bind_blob(m_stmt_write, 2, it.second.data(), it.second.size(), NULL),
+			"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+
+		// Reset first, so that the transaction can be rolled back
+		const int res = sqlite3_step(m_stmt_write);
+		sqlite3_reset(m_stmt_write);
+		SQLRES(res, SQLITE_DONE, "Failed to save block")
+	}
+
+	return true;
+}
+
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	std::unordered_map<s64, size_t> index;
+	for (size_t start = 0; start < positions.size(); start += SQLITE_READ_BATCH_SIZE) {
+		const size_t end = std::min(positions.size(), start + SQLITE_READ_BATCH_SIZE);
+
+		index.clear();
+		for (size_t i = start; i < end; i++) {
+			index[getBlockAsInteger(positions[i])] = i;
+			bindPos(m_stmt_read_batch, positions[i], i - start + 1);
+		}
+		// Fill up unused parameters, duplicates don't matter here
+		for (size_t i = end - start; i < SQLITE_READ_BATCH_SIZE; i++)
+			bindPos(m_stmt_read_batch, positions[start], i + 1);
+
+		while (sqlite3_step(m_stmt_read_batch) == SQLITE_ROW) {
+			auto it = index.find(sqlite3_column_int64(m_stmt_read_batch, 0));
+			if (it == index.end())
+				continue;
+
+			const char *data = (const char *) sqlite3_column_blob(m_stmt_read_batch, 1);
+			size_t len = sqlite3_column_bytes(m_stmt_read_batch, 1);
+			if (data)
+				(*blocks)[it->second].assign(data, len);
+		}
+		sqlite3_reset(m_stmt_read_batch);
+	}
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
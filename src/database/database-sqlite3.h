@@ -35,6 +35,7 @@ class Database_SQLite3 : public Database
 
 	void beginSave();
 	void endSave();
+	void rollback();
 
 	bool initialized() const { return m_initialized; }
 protected:
@@ -134,6 +135,7 @@ class Database_SQLite3 : public Database
 
 	sqlite3_stmt *m_stmt_begin = nullptr;
 	sqlite3_stmt *m_stmt_end = nullptr;
+	sqlite3_stmt *m_stmt_rollback = nullptr;
 
 	s64 m_busy_handler_data[2];
 
@@ -151,8 +153,13 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	void beginSave() { Database_SQLite3::beginSave(); }
 	void endSave() { Database_SQLite3::endSave(); }
+	void rollback() { Database_SQLite3::rollback(); }
 protected:
 	virtual void createDatabase();
 	virtual void initStatements();
@@ -162,6 +169,8 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	// Map
 	sqlite3_stmt *m_stmt_read = nullptr;
+	// Reads up to SQLITE_READ_BATCH_SIZE blocks
+	sqlite3_stmt *m_stmt_read_batch = nullptr;
 	sqlite3_stmt *m_stmt_write = nullptr;
 	sqlite3_stmt *m_stmt_list = nullptr;
 	sqlite3_stmt *m_stmt_delete = nullptr;
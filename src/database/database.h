@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 #include "irr_v3d.h"
 #include "irrlichttypes.h"
@@ -32,6 +33,8 @@ class Database
 public:
 	virtual void beginSave() = 0;
 	virtual void endSave() = 0;
+	// Discards what was done since beginSave(), after an error
+	virtual void rollback() {}
 	virtual bool initialized() const { return true; }
 };
 
@@ -44,6 +47,14 @@ class MapDatabase : public Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	// Batch variants of the above, to be overridden by backends that can
+	// avoid a round trip per block. Positions must be unique.
+	// Returns false if any block failed to save.
+	virtual bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	// blocks[i] receives the data of positions[i], empty if not found
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
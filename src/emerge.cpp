@@ -21,8 +21,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <deque>
 #include <iostream>
-#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "util/container.h"
 #include "util/thread.h"
@@ -41,24 +43,60 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/mg_schematic.h"
 #include "nodedef.h"
 #include "profiler.h"
+#include "scripting_emerge.h"
 #include "scripting_server.h"
 #include "server.h"
 #include "settings.h"
 #include "voxel.h"
 
+// Maximum number of queued blocks looked up in the database at once
+#define EMERGE_LOAD_BATCH_SIZE 16
+
+static EmergePriority get_emerge_priority(session_t peer_requested)
+{
+	return peer_requested != PEER_ID_INEXISTENT ?
+		EMERGE_PRIORITY_PLAYER : EMERGE_PRIORITY_BULK;
+}
+
+std::vector<v3s16> get_prefetch_positions(v3s16 pos,
+	const std::deque<v3s16> (&queues)[EMERGE_PRIORITY_COUNT],
+	const std::unordered_set<v3s16> &skip, size_t limit)
+{
+	// MapDatabase::loadBlocks() requires unique positions. A block can be
+	// in both queues, and pos can still be queued too.
+	std::vector<v3s16> positions;
+	std::unordered_set<v3s16> seen;
+	positions.push_back(pos);
+	seen.insert(pos);
+	for (const auto &queue : queues) {
+		for (size_t i = 0; i < queue.size() && positions.size() < limit; i++) {
+			const v3s16 &p = queue[i];
+			if (blockpos_over_max_limit(p) || skip.count(p) != 0)
+				continue;
+			if (seen.insert(p).second)
+				positions.push_back(p);
+		}
+	}
+	return positions;
+}
+
 class EmergeThread : public Thread {
 public:
 	bool enable_mapgen_debug_info;
 	int id;
 
-	EmergeThread(Server *server, int ethreadid);
+	EmergeThread(Server *server, int ethreadid, MetricsBackend *mb);
 	~EmergeThread() = default;
 
 	void *run();
 	void signal();
 
 	// Requires queue mutex held
-	bool pushBlock(const v3s16 &pos);
+	bool pushBlock(const v3s16 &pos, EmergePriority priority);
+	size_t getQueueSize() const;
+	bool isIdle() const { return m_idle; }
+	// Takes the block that was queued last, for another thread
+	bool stealBlock(EmergePriority priority, v3s16 *pos);
 
 	void cancelPendingItems();
 
@@ -73,12 +111,35 @@ class EmergeThread : public Thread {
 	ServerMap *m_map;
 	EmergeManager *m_emerge;
 	Mapgen *m_mapgen;
+	// Mapgen environment, only there if mods registered scripts for it
+	std::unique_ptr<EmergeScripting> m_script;
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
-
+	// Blocks to emerge by priority, other threads may take them when idle.
+	// Requires queue mutex held, same for m_idle
+	std::deque<v3s16> m_block_queue[EMERGE_PRIORITY_COUNT];
+	// Waiting for blocks to be queued
+	bool m_idle = false;
+
+	MetricCounterPtr m_busy_counter;
+	MetricCounterPtr m_steal_counter;
+
+	// Queued positions that were already looked up in the database together
+	// with an earlier item
+	std::unordered_set<v3s16> m_prefetched;
+	// Blocks that were loaded from the database by a batch lookup
+	std::unordered_set<v3s16> m_loaded_from_disk;
+	// Blocks that a batch lookup found not to be in the database, valid as
+	// long as the map's block removal count for them stays the same
+	std::unordered_map<v3s16, u32> m_not_in_database;
+
+	// Takes the next block from the own queue or from another thread
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
 
+	// Loads the block and the ones queued after it from the database at once.
+	// Only inserting them into the map happens with the env lock held.
+	void prefetchBlocks(const v3s16 &pos);
+
 	EmergeAction getBlockOrStartGen(
 		const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
@@ -192,7 +253,7 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 	m_qlimit_generate = rangelim(m_qlimit_generate, 1, 1000000);
 
 	for (s16 i = 0; i < nthreads; i++)
-		m_threads.push_back(new EmergeThread(server, i));
+		m_threads.push_back(new EmergeThread(server, i, mb));
 
 	infostream << "EmergeManager: using " << nthreads << " threads" << std::endl;
 }
@@ -357,11 +418,16 @@ bool EmergeManager::enqueueBlockEmergeEx(
 				callback, callback_param, &entry_already_exists))
 			return false;
 
-		if (entry_already_exists)
+		// Queue it again if a player now waits for a block that was queued
+		// in bulk, whichever queue entry is reached first emerges it
+		const EmergePriority priority = get_emerge_priority(peer_id);
+		BlockEmergeData &bedata = m_blocks_enqueued[blockpos];
+		if (entry_already_exists && bedata.queued_priority <= priority)
 			return true;
+		bedata.queued_priority = priority;
 
 		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
+		thread->pushBlock(blockpos, priority);
 	}
 
 	thread->signal();
@@ -489,20 +555,44 @@ EmergeThread *EmergeManager::getOptimalThread()
 
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
+	// A waiting thread starts right away, otherwise the work goes where the
+	// least is queued. Where it ends up matters little since idle threads
+	// take blocks from the others.
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	size_t nitems_lowest = m_threads[0]->getQueueSize();
+	bool idle_found = m_threads[0]->isIdle();
 
-	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
-		if (nitems < nitems_lowest) {
+	for (size_t i = 1; i < nthreads && !idle_found; i++) {
+		size_t nitems = m_threads[i]->getQueueSize();
+		if (m_threads[i]->isIdle() || nitems < nitems_lowest) {
 			index = i;
 			nitems_lowest = nitems;
+			idle_found = m_threads[i]->isIdle();
 		}
 	}
 
 	return m_threads[index];
 }
 
+bool EmergeManager::stealBlock(EmergeThread *thief, EmergePriority priority,
+	v3s16 *pos)
+{
+	// Take from the longest queue
+	EmergeThread *victim = nullptr;
+	size_t nitems_highest = 0;
+	for (EmergeThread *thread : m_threads) {
+		if (thread == thief)
+			continue;
+		size_t nitems = thread->m_block_queue[priority].size();
+		if (nitems > nitems_highest) {
+			victim = thread;
+			nitems_highest = nitems;
+		}
+	}
+
+	return victim && victim->stealBlock(priority, pos);
+}
+
 void EmergeManager::reportCompletedEmerge(EmergeAction action)
 {
 	assert((size_t)action < ARRLEN(m_completed_emerge_counter));
@@ -514,7 +604,7 @@ void EmergeManager::reportCompletedEmerge(EmergeAction action)
 //// EmergeThread
 ////
 
-EmergeThread::EmergeThread(Server *server, int ethreadid) :
+EmergeThread::EmergeThread(Server *server, int ethreadid, MetricsBackend *mb) :
 	enable_mapgen_debug_info(false),
 	id(ethreadid),
 	m_server(server),
@@ -523,6 +613,16 @@ EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	m_mapgen(NULL)
 {
 	m_name = "Emerge-" + itos(ethreadid);
+
+	const std::string thread_id = itos(ethreadid);
+	m_busy_counter = mb->addCounter(
+		"minetest_emerge_thread_busy_seconds",
+		"Time an emerge thread spent emerging blocks",
+		{{"thread", thread_id}});
+	m_steal_counter = mb->addCounter(
+		"minetest_emerge_thread_steals",
+		"Number of blocks an emerge thread took from the queue of another",
+		{{"thread", thread_id}});
 }
 
 
@@ -532,9 +632,33 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(const v3s16 &pos)
+bool EmergeThread::pushBlock(const v3s16 &pos, EmergePriority priority)
 {
-	m_block_queue.push(pos);
+	m_block_queue[priority].push_back(pos);
+	// Busy from now on, spread the next blocks to others
+	m_idle = false;
+	return true;
+}
+
+
+size_t EmergeThread::getQueueSize() const
+{
+	size_t nitems = 0;
+	for (const auto &queue : m_block_queue)
+		nitems += queue.size();
+	return nitems;
+}
+
+
+bool EmergeThread::stealBlock(EmergePriority priority, v3s16 *pos)
+{
+	std::deque<v3s16> &queue = m_block_queue[priority];
+	if (queue.empty())
+		return false;
+
+	// The owner works from the front, and has looked up blocks there
+	*pos = queue.back();
+	queue.pop_back();
 	return true;
 }
 
@@ -543,17 +667,25 @@ void EmergeThread::cancelPendingItems()
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
+	for (auto &queue : m_block_queue) {
+		while (!queue.empty()) {
+			BlockEmergeData bedata;
+			v3s16 pos;
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+			pos = queue.front();
+			queue.pop_front();
 
-		m_emerge->popBlockEmergeData(pos, &bedata);
+			// Queued twice, see enqueueBlockEmergeEx()
+			if (!m_emerge->popBlockEmergeData(pos, &bedata))
+				continue;
 
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
+			runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
+		}
 	}
+
+	m_prefetched.clear();
+	m_loaded_from_disk.clear();
+	m_not_in_database.clear();
 }
 
 
@@ -578,15 +710,58 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
-		return false;
+	for (int priority = 0; priority < EMERGE_PRIORITY_COUNT; ) {
+		std::deque<v3s16> &queue = m_block_queue[priority];
+		if (!queue.empty()) {
+			*pos = queue.front();
+			queue.pop_front();
+		} else if (m_emerge->stealBlock(this, (EmergePriority)priority, pos)) {
+			m_steal_counter->increment();
+		} else {
+			priority++;
+			continue;
+		}
+
+		// Already emerged if it was queued twice
+		if (m_emerge->popBlockEmergeData(*pos, bedata)) {
+			m_idle = false;
+			return true;
+		}
+	}
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	m_idle = true;
+	return false;
+}
 
-	m_emerge->popBlockEmergeData(*pos, bedata);
 
-	return true;
+void EmergeThread::prefetchBlocks(const v3s16 &pos)
+{
+	// Looked up already, whatever was found is in memory now
+	if (m_prefetched.erase(pos))
+		return;
+
+	std::vector<v3s16> positions;
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+		positions = get_prefetch_positions(pos, m_block_queue, m_prefetched,
+			EMERGE_LOAD_BATCH_SIZE);
+	}
+
+	// The expensive part, other threads can keep working meanwhile
+	DetachedBlockList blocks;
+	m_map->readBlocks(positions, &blocks);
+
+	std::vector<v3s16> loaded, missing;
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+		m_map->insertBlocks(blocks, &loaded, &missing);
+		for (const v3s16 &p : missing)
+			m_not_in_database[p] = m_map->getBlockRemovalCount(p);
+	}
+
+	for (size_t i = 1; i < positions.size(); i++)
+		m_prefetched.insert(positions[i]);
+	m_loaded_from_disk.insert(loaded.begin(), loaded.end());
 }
 
 
@@ -596,12 +771,21 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 	MutexAutoLock envlock(m_server->m_env_mutex);
 
 	// 1). Attempt to fetch block from memory
+	bool from_disk = m_loaded_from_disk.erase(pos) > 0;
+	bool not_in_database = false;
+	auto it = m_not_in_database.find(pos);
+	if (it != m_not_in_database.end()) {
+		// Unless it was unloaded since, which may have saved it
+		not_in_database = it->second == m_map->getBlockRemovalCount(pos);
+		m_not_in_database.erase(it);
+	}
 	*block = m_map->getBlockNoCreateNoEx(pos);
 	if (*block) {
 		if ((*block)->isGenerated())
-			return EMERGE_FROM_MEMORY;
-	} else {
+			return from_disk ? EMERGE_FROM_DISK : EMERGE_FROM_MEMORY;
+	} else if (!not_in_database) {
 		// 2). Attempt to load block from disk if it was not in the memory
+		// and prefetchBlocks() didn't get to look it up
 		*block = m_map->loadBlock(pos);
 		if (*block && (*block)->isGenerated())
 			return EMERGE_FROM_DISK;
@@ -620,8 +804,9 @@ MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
 	std::map<v3s16, MapBlock *> *modified_blocks)
 {
 	MutexAutoLock envlock(m_server->m_env_mutex);
-	ScopeProfiler sp(g_profiler,
+	static const ProfilerProbe probe = g_profiler->registerProbe(
 		"EmergeThread: after Mapgen::makeChunk", SPT_AVG);
+	ScopeProfiler sp(g_profiler, probe);
 
 	/*
 		Perform post-processing on blocks (invalidate lighting, queue liquid
@@ -686,6 +871,17 @@ void *EmergeThread::run()
 	m_mapgen = m_emerge->m_mapgens[id];
 	enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
 
+	if (!m_script && !m_server->m_mapgen_init_files.empty()) {
+		try {
+			m_script = std::make_unique<EmergeScripting>(m_server);
+		} catch (const ModError &e) {
+			errorstream << "Failed to load mod script inside mapgen environment." << std::endl;
+			m_server->setAsyncFatalError(e.what());
+			cancelPendingItems();
+			return nullptr;
+		}
+	}
+
 	try {
 	while (!stopRequested()) {
 		BlockEmergeData bedata;
@@ -694,9 +890,14 @@ void *EmergeThread::run()
 		MapBlock *block = nullptr;
 
 		if (!popBlockEmerge(&pos, &bedata)) {
+			// Whatever was looked up in advance was taken by others
+			m_prefetched.clear();
+			m_loaded_from_disk.clear();
+			m_not_in_database.clear();
 			m_queue_event.wait();
 			continue;
 		}
+		const u64 busy_start = porting::getTimeUs();
 
 		if (blockpos_over_max_limit(pos))
 			continue;
@@ -704,15 +905,29 @@ void *EmergeThread::run()
 		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
 		EMERGE_DBG_OUT("pos=" << pos << " allow_gen=" << allow_gen);
 
+		prefetchBlocks(pos);
 		action = getBlockOrStartGen(pos, allow_gen, &block, &bmdata);
 		if (action == EMERGE_GENERATED) {
 			{
-				ScopeProfiler sp(g_profiler,
+				static const ProfilerProbe probe = g_profiler->registerProbe(
 					"EmergeThread: Mapgen::makeChunk", SPT_AVG);
+				ScopeProfiler sp(g_profiler, probe);
 
 				m_mapgen->makeChunk(&bmdata);
 			}
 
+			if (m_script) {
+				static const ProfilerProbe probe = g_profiler->registerProbe(
+					"EmergeThread: mapgen env on_generated", SPT_AVG);
+				ScopeProfiler sp(g_profiler, probe);
+
+				try {
+					m_script->on_generated(&bmdata, m_mapgen->blockseed);
+				} catch (LuaError &e) {
+					m_server->setAsyncFatalError(e);
+				}
+			}
+
 			block = finishGen(pos, &bmdata, &modified_blocks);
 			if (!block)
 				action = EMERGE_ERRORED;
@@ -731,6 +946,8 @@ void *EmergeThread::run()
 			m_map->dispatchEvent(event);
 		}
 		modified_blocks.clear();
+
+		m_busy_counter->increment((porting::getTimeUs() - busy_start) / 1.0e6);
 	}
 	} catch (VersionMismatchException &e) {
 		std::ostringstream err;
@@ -19,8 +19,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <deque>
 #include <map>
 #include <mutex>
+#include <unordered_set>
+#include <vector>
 #include "network/networkprotocol.h"
 #include "irr_v3d.h"
 #include "util/container.h"
@@ -89,12 +92,30 @@ typedef std::vector<
 	>
 > EmergeCallbackList;
 
+// Order in which queued blocks are emerged
+enum EmergePriority : u8 {
+	// Requested by a client, a player is probably waiting for it
+	EMERGE_PRIORITY_PLAYER,
+	// emerge_area() and blocks the server loads for itself
+	EMERGE_PRIORITY_BULK,
+	EMERGE_PRIORITY_COUNT
+};
+
 struct BlockEmergeData {
 	u16 peer_requested;
 	u16 flags;
+	// Highest priority the block is queued with
+	EmergePriority queued_priority = EMERGE_PRIORITY_BULK;
 	EmergeCallbackList callbacks;
 };
 
+// Positions to look up in the database at once for the emerge of pos:
+// pos itself, then up to limit - 1 queued blocks that are not in skip.
+// Each position is returned once, even if it is queued several times.
+std::vector<v3s16> get_prefetch_positions(v3s16 pos,
+	const std::deque<v3s16> (&queues)[EMERGE_PRIORITY_COUNT],
+	const std::unordered_set<v3s16> &skip, size_t limit);
+
 class EmergeParams {
 	friend class EmergeManager;
 public:
@@ -169,6 +190,7 @@ class EmergeManager {
 	void startThreads();
 	void stopThreads();
 	bool isRunning();
+	size_t getThreadCount() const { return m_threads.size(); }
 
 	bool enqueueBlockEmerge(
 		session_t peer_id,
@@ -219,6 +241,8 @@ class EmergeManager {
 
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
+	// Requires m_queue_mutex held
+	bool stealBlock(EmergeThread *thief, EmergePriority priority, v3s16 *pos);
 
 	bool pushBlockEmergeData(
 		v3s16 pos,
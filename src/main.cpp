@@ -41,6 +41,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "network/socket.h"
 #include "mapblock.h"
+#include "server/pregenerate.h"
+#include "threading/thread.h"
 #if USE_CURSES
 	#include "terminal_chat_console.h"
 #endif
@@ -127,6 +129,7 @@ static bool determine_subgame(GameParams *game_params);
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_map_database(const GameParams &game_params, const Settings &cmd_args);
 static bool recompress_map_database(const GameParams &game_params, const Settings &cmd_args);
+static bool pregenerate_map(const GameParams &game_params, const Settings &cmd_args);
 
 /**********************************************************************/
 
@@ -382,6 +385,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Feature an interactive terminal (Only works when using minetestserver or with --server)"))));
 	allowed_options->insert(std::make_pair("recompress", ValueSpec(VALUETYPE_FLAG,
 			_("Recompress the blocks of the given map database."))));
+	allowed_options->insert(std::make_pair("pregenerate", ValueSpec(VALUETYPE_STRING,
+			_("Generate the map in the area \"(x1,y1,z1) (x2,y2,z2)\" and exit (Only works when using minetestserver or with --server)"))));
 #ifndef SERVER
 	allowed_options->insert(std::make_pair("speedtests", ValueSpec(VALUETYPE_FLAG,
 			_("Run speed tests"))));
@@ -1064,6 +1069,9 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	if (cmd_args.getFlag("recompress"))
 		return recompress_map_database(game_params, cmd_args);
 
+	if (cmd_args.exists("pregenerate"))
+		return pregenerate_map(game_params, cmd_args);
+
 	// Bind address
 	std::string bind_str = g_settings->get("bind_address");
 	Address bind_addr(0, 0, 0, 0, game_params.socket_port);
@@ -1299,3 +1307,35 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 	actionstream << "Done, " << count << " blocks were recompressed." << std::endl;
 	return true;
 }
+
+static bool pregenerate_map(const GameParams &game_params, const Settings &cmd_args)
+{
+	const std::string area = cmd_args.get("pregenerate");
+	v3s16 minp, maxp;
+	if (std::sscanf(area.c_str(), " ( %hd , %hd , %hd ) ( %hd , %hd , %hd )",
+			&minp.X, &minp.Y, &minp.Z, &maxp.X, &maxp.Y, &maxp.Z) != 6) {
+		errorstream << "Invalid area \"" << area << "\" for --pregenerate, "
+				"expected \"(x1,y1,z1) (x2,y2,z2)\"" << std::endl;
+		return false;
+	}
+
+	// Nothing else is running, so use all cores unless configured otherwise.
+	// One is left for compressing and saving the blocks.
+	if (!g_settings->existsLocal("num_emerge_threads")) {
+		g_settings->setS16("num_emerge_threads",
+				MYMAX(1, (int)Thread::getNumberOfProcessors() - 1));
+	}
+
+	bool &kill = *porting::signal_handler_killstatus();
+	try {
+		Server server(game_params.world_path, game_params.game_spec, false,
+				Address(), false);
+		MapPregenerator pregen(&server, minp, maxp);
+		return pregen.run(kill);
+	} catch (const ModError &e) {
+		errorstream << "ModError: " << e.what() << std::endl;
+	} catch (const ServerError &e) {
+		errorstream << "ServerError: " << e.what() << std::endl;
+	}
+	return false;
+}
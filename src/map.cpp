@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "profiler.h"
 #include "nodedef.h"
+#include "noise.h"
 #include "gamedef.h"
 #include "util/directiontables.h"
 #include "rollback_interface.h"
@@ -44,6 +45,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database/database-dummy.h"
 #include "database/database-sqlite3.h"
 #include "script/scripting_server.h"
+#include "server/mapsavethread.h"
 #include "irrlicht_changes/printing.h"
 #include <deque>
 #include <queue>
@@ -131,6 +133,14 @@ MapBlock *Map::getBlockNoCreateNoEx(v3s16 p3d)
 	return block;
 }
 
+MapBlock *Map::getBlockNoCreateNoExNoCache(v3s16 p3d) const
+{
+	auto it = m_sectors.find(v2s16(p3d.X, p3d.Z));
+	if (it == m_sectors.end())
+		return nullptr;
+	return it->second->getBlockNoCreateNoExNoCache(p3d.Y);
+}
+
 MapBlock *Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -358,6 +368,7 @@ void Map::timerUpdate(float dtime, float unload_timeout, s32 max_loaded_blocks,
 
 					// Delete from memory
 					sector->deleteBlock(block);
+					countBlockRemoval(p);
 
 					if (unloaded_blocks)
 						unloaded_blocks->push_back(p);
@@ -414,6 +425,7 @@ void Map::timerUpdate(float dtime, float unload_timeout, s32 max_loaded_blocks,
 
 			// Delete from memory
 			b.sect->deleteBlock(block);
+			countBlockRemoval(p);
 
 			if (unloaded_blocks)
 				unloaded_blocks->push_back(p);
@@ -1135,16 +1147,22 @@ bool Map::isOccluded(const v3s16 &pos_camera, const v3s16 &pos_target,
 
 	v3f pos_origin_f = intToFloat(pos_camera, BS);
 	u32 count = 0;
-	bool is_valid_position;
+	// Consecutive steps are mostly in the same block
+	v3s16 last_blockpos(S16_MAX, S16_MAX, S16_MAX);
+	MapBlock *block = nullptr;
 
 	for (; offset < distance + end_offset; offset += step) {
 		v3f pos_node_f = pos_origin_f + direction * offset;
 		v3s16 pos_node = floatToInt(pos_node_f, BS);
 
-		MapNode node = getNode(pos_node, &is_valid_position);
+		v3s16 blockpos = getNodeBlockPos(pos_node);
+		if (blockpos != last_blockpos) {
+			block = getBlockNoCreateNoExNoCache(blockpos);
+			last_blockpos = blockpos;
+		}
 
-		if (is_valid_position &&
-				!m_nodedef->getLightingFlags(node).light_propagates) {
+		if (block && !m_nodedef->getLightingFlags(block->getNodeNoCheck(
+				pos_node - blockpos * MAP_BLOCKSIZE)).light_propagates) {
 			// Cannot see through light-blocking nodes --> occluded
 			count++;
 			if (count >= needed_count)
@@ -1193,7 +1211,10 @@ bool Map::isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes, bool simple_chec
 	// this is a HACK, we should think of a more precise algorithm
 	u32 needed_count = 2;
 
-	v3s16 random_point(myrand_range(-bs2, bs2), myrand_range(-bs2, bs2), myrand_range(-bs2, bs2));
+	// myrand() is not thread-safe
+	thread_local PcgRandom pcgrand(porting::getTimeUs());
+	v3s16 random_point(pcgrand.range(-bs2, bs2), pcgrand.range(-bs2, bs2),
+			pcgrand.range(-bs2, bs2));
 	if (!isOccluded(cam_pos_nodes, pos_blockcenter + random_point, step, stepfac,
 				start_offset, end_offset, needed_count))
 		return false;
@@ -1265,6 +1286,11 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
 
+	m_save_thread = std::make_unique<MapSaveThread>(dbase, m_db_mutex,
+		m_map_compression_level,
+		(size_t)g_settings->getU32("map_save_queue_size") * 1024 * 1024, mb);
+	m_save_thread->start();
+
 	try {
 		// If directory exists, check contents and load if possible
 		if (fs::PathExists(m_savedir)) {
@@ -1325,6 +1351,9 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	// Writes whatever is still queued
+	m_save_thread.reset();
+
 	/*
 		Close database if it was opened
 	*/
@@ -1668,9 +1697,6 @@ void ServerMap::save(ModifiedState save_level)
 	u32 block_count = 0;
 	u32 block_count_all = 0; // Number of blocks in memory
 
-	// Don't do anything with sqlite unless something is really saved
-	bool save_started = false;
-
 	for (auto &sector_it : m_sectors) {
 		MapSector *sector = sector_it.second;
 
@@ -1681,12 +1707,6 @@ void ServerMap::save(ModifiedState save_level)
 			block_count_all++;
 
 			if(block->getModified() >= (u32)save_level) {
-				// Lazy beginSave()
-				if(!save_started) {
-					beginSave();
-					save_started = true;
-				}
-
 				modprofiler.add(block->getModifiedReasonString(), 1);
 
 				saveBlock(block);
@@ -1695,8 +1715,9 @@ void ServerMap::save(ModifiedState save_level)
 		}
 	}
 
-	if(save_started)
-		endSave();
+	// Saving the whole map is expected to be done when this returns
+	if (save_level == MOD_STATE_CLEAN && !m_save_thread->flush())
+		errorstream << "ServerMap: Not all blocks could be saved" << std::endl;
 
 	/*
 		Only print if something happened or saved whole map
@@ -1716,8 +1737,17 @@ void ServerMap::save(ModifiedState save_level)
 	reportMetrics(end_time - start_time, block_count, block_count_all);
 }
 
+void ServerMap::flushSaves()
+{
+	if (!m_save_thread->flush())
+		errorstream << "ServerMap: Not all blocks could be saved" << std::endl;
+}
+
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
+	flushSaves();
+
+	MutexAutoLock dblock(m_db_mutex);
 	dbase->listAllLoadableBlocks(dst);
 	if (dbase_ro)
 		dbase_ro->listAllLoadableBlocks(dst);
@@ -1768,23 +1798,22 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
-	dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
-	dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase, m_map_compression_level);
+	m_save_thread->queueBlock(block);
+	// The snapshot is what will end up on the disk
+	block->resetModified();
+	return true;
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+std::string ServerMap::serializeBlock(MapBlock *block, int compression_level)
 {
-	v3s16 p3d = block->getPos();
-
 	// Format used for writing
 	u8 version = SER_FMT_VER_HIGHEST_WRITE;
 
@@ -1795,8 +1824,12 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	std::ostringstream o(std::ios_base::binary);
 	o.write((char*) &version, 1);
 	block->serialize(o, version, true, compression_level);
+	return o.str();
+}
 
-	bool ret = db->saveBlock(p3d, o.str());
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+{
+	bool ret = db->saveBlock(block->getPos(), serializeBlock(block, compression_level));
 	if (ret) {
 		// We just wrote it to the disk so clear modified flag
 		block->resetModified();
@@ -1825,7 +1858,9 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 		}
 
 		{
-		ScopeProfiler sp(g_profiler, "ServerMap: deSer block", SPT_AVG);
+		static const ProfilerProbe probe = g_profiler->registerProbe(
+			"ServerMap: deSer block", SPT_AVG);
+		ScopeProfiler sp(g_profiler, probe);
 		// Read basic data
 		block->deSerialize(is, version, true);
 		}
@@ -1869,17 +1904,26 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 
 MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 {
-	ScopeProfiler sp(g_profiler, "ServerMap: load block", SPT_AVG);
+	static const ProfilerProbe probe = g_profiler->registerProbe(
+		"ServerMap: load block", SPT_AVG);
+	ScopeProfiler sp(g_profiler, probe);
 	bool created_new = (getBlockNoCreateNoEx(blockpos) == NULL);
 
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
 	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
+	// Blocks waiting to be saved are more recent than the database
+	if (!m_save_thread->getQueued(blockpos, &ret)) {
+		MutexAutoLock dblock(m_db_mutex);
+		dbase->loadBlock(blockpos, &ret);
+	}
 	if (!ret.empty()) {
 		loadBlock(&ret, blockpos, createSector(p2d), false);
 	} else if (dbase_ro) {
-		dbase_ro->loadBlock(blockpos, &ret);
+		{
+			MutexAutoLock dblock(m_db_mutex);
+			dbase_ro->loadBlock(blockpos, &ret);
+		}
 		if (!ret.empty()) {
 			loadBlock(&ret, blockpos, createSector(p2d), false);
 		}
@@ -1888,25 +1932,179 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
-	if (created_new && (block != NULL)) {
-		std::map<v3s16, MapBlock*> modified_blocks;
-		// Fix lighting if necessary
-		voxalgo::update_block_border_lighting(this, block, modified_blocks);
-		if (!modified_blocks.empty()) {
-			//Modified lighting, send event
-			MapEditEvent event;
-			event.type = MEET_OTHER;
-			event.setModifiedBlocks(modified_blocks);
-			dispatchEvent(event);
+	if (created_new && (block != NULL))
+		fixLoadedBlockLighting(block);
+	return block;
+}
+
+void ServerMap::readBlocks(const std::vector<v3s16> &positions, DetachedBlockList *dst)
+{
+	static const ProfilerProbe probe = g_profiler->registerProbe(
+		"ServerMap: read blocks", SPT_AVG);
+	ScopeProfiler sp(g_profiler, probe);
+
+	dst->entries.clear();
+	dst->entries.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		// A block removed from now on may be saved after it is read below
+		dst->entries[i].pos = positions[i];
+		dst->entries[i].removal_count = getBlockRemovalCount(positions[i]);
+	}
+
+	// Blocks waiting to be saved are more recent than the database
+	std::vector<std::string> blobs;
+	{
+		std::vector<v3s16> stored;
+		std::vector<size_t> stored_idx;
+		blobs.resize(positions.size());
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (!m_save_thread->getQueued(positions[i], &blobs[i])) {
+				stored.push_back(positions[i]);
+				stored_idx.push_back(i);
+			}
+		}
+
+		std::vector<std::string> stored_blobs;
+		if (!stored.empty()) {
+			MutexAutoLock dblock(m_db_mutex);
+			dbase->loadBlocks(stored, &stored_blobs);
+		}
+		for (size_t i = 0; i < stored_blobs.size(); i++)
+			blobs[stored_idx[i]] = std::move(stored_blobs[i]);
+	}
+
+	// Look for the remaining blocks in the read-only database
+	if (dbase_ro) {
+		std::vector<v3s16> missing;
+		std::vector<size_t> missing_idx;
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (blobs[i].empty()) {
+				missing.push_back(positions[i]);
+				missing_idx.push_back(i);
+			}
+		}
+		if (!missing.empty()) {
+			std::vector<std::string> ro_blobs;
+			{
+				// Not only the env lock kept this from being used by two threads
+				MutexAutoLock dblock(m_db_mutex);
+				dbase_ro->loadBlocks(missing, &ro_blobs);
+			}
+			for (size_t i = 0; i < missing.size(); i++)
+				blobs[missing_idx[i]] = std::move(ro_blobs[i]);
+		}
+	}
+
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (blobs[i].empty())
+			continue;
+		DetachedBlockList::Entry &entry = dst->entries[i];
+		const v3s16 p = entry.pos;
+		try {
+			std::istringstream is(blobs[i], std::ios_base::binary);
+
+			u8 version = SER_FMT_VER_INVALID;
+			is.read((char*)&version, 1);
+			if (is.fail())
+				throw SerializationError("ServerMap::readBlocks(): Failed"
+						" to read MapBlock version");
+
+			// Left for loadBlock(), the node ids of old formats can't be
+			// corrected later
+			if (version <= 21) {
+				entry.deferred = true;
+				continue;
+			}
+
+			auto block = std::make_unique<MapBlock>(p, m_gamedef);
+			{
+			static const ProfilerProbe probe = g_profiler->registerProbe(
+				"ServerMap: deSer block", SPT_AVG);
+			ScopeProfiler sp(g_profiler, probe);
+			// Node ids are looked up in insertBlocks(), since unknown
+			// names are added to the node definitions
+			block->deSerialize(is, version, true, &entry.nimap);
+			}
+			// We just loaded it from, so it's up-to-date.
+			block->resetModified();
+			entry.block = std::move(block);
+		} catch (SerializationError &e) {
+			errorstream << "Invalid block data in database"
+					<< " (" << p.X << "," << p.Y << "," << p.Z << ")"
+					<< " (SerializationError): " << e.what() << std::endl;
+
+			if (g_settings->getBool("ignore_world_load_errors")) {
+				errorstream << "Ignoring block load error. Duck and cover! "
+						<< "(ignore_world_load_errors)" << std::endl;
+			} else {
+				throw SerializationError("Invalid block data in database");
+			}
 		}
 	}
-	return block;
+}
+
+void ServerMap::insertBlocks(DetachedBlockList &src, std::vector<v3s16> *loaded,
+		std::vector<v3s16> *missing)
+{
+	static const ProfilerProbe probe = g_profiler->registerProbe(
+		"ServerMap: insert blocks", SPT_AVG);
+	ScopeProfiler sp(g_profiler, probe);
+
+	for (DetachedBlockList::Entry &entry : src.entries) {
+		const v3s16 p = entry.pos;
+		// Unloaded in the meantime, so it may have been saved after the
+		// database was read. It is loaded again the usual way.
+		if (entry.removal_count != getBlockRemovalCount(p))
+			continue;
+
+		if (!entry.block) {
+			if (!entry.deferred && missing)
+				missing->push_back(p);
+			continue;
+		}
+
+		MapSector *sector = createSector(v2s16(p.X, p.Z));
+		// Created or loaded by someone else since
+		if (sector->getBlockNoCreateNoEx(p.Y))
+			continue;
+
+		MapBlock *block = entry.block.get();
+		block->correctNodeIds(entry.nimap);
+		sector->insertBlock(std::move(entry.block));
+		ReflowScan scanner(this, m_emerge->ndef);
+		scanner.scan(block, &m_transforming_liquid);
+		fixLoadedBlockLighting(block);
+
+		if (loaded)
+			loaded->push_back(p);
+	}
+	src.entries.clear();
+}
+
+void ServerMap::fixLoadedBlockLighting(MapBlock *block)
+{
+	std::map<v3s16, MapBlock*> modified_blocks;
+	// Fix lighting if necessary
+	voxalgo::update_block_border_lighting(this, block, modified_blocks);
+	if (!modified_blocks.empty()) {
+		//Modified lighting, send event
+		MapEditEvent event;
+		event.type = MEET_OTHER;
+		event.setModifiedBlocks(modified_blocks);
+		dispatchEvent(event);
+	}
 }
 
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		m_save_thread->cancel(blockpos);
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
+	// Copies of it may have been read from the database already
+	countBlockRemoval(blockpos);
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
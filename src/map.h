@@ -19,11 +19,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <sstream>
 #include <set>
 #include <map>
 #include <list>
+#include <memory>
+#include <mutex>
 
 #include "irrlichttypes_bloated.h"
 #include "mapblock.h"
@@ -36,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/numeric.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
+#include "nameidmapping.h"
 #include "debug.h"
 
 class Settings;
@@ -50,6 +54,7 @@ class IRollbackManager;
 class EmergeManager;
 class MetricsBackend;
 class ServerEnvironment;
+class MapSaveThread;
 struct BlockMakeData;
 
 /*
@@ -162,6 +167,9 @@ class Map /*: public NodeContainer*/
 	MapBlock * getBlockNoCreate(v3s16 p);
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
+	// Same, but without the lookup caches. Several threads may call this at
+	// once as long as none of them modifies the map.
+	MapBlock * getBlockNoCreateNoExNoCache(v3s16 p) const;
 
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
@@ -305,10 +313,30 @@ class Map /*: public NodeContainer*/
 		}
 	}
 
+	// Only reads the map, see getBlockNoCreateNoExNoCache()
 	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes, bool simple_check = false);
+
+	// Changes whenever the block at the position is removed from memory, may
+	// be read without holding the env lock. Positions that are a multiple of
+	// 16 blocks apart share a count.
+	u32 getBlockRemovalCount(v3s16 p) const
+	{
+		return m_block_removal_counts[getRemovalCountIndex(p)].load();
+	}
 protected:
 	IGameDef *m_gamedef;
 
+	static u32 getRemovalCountIndex(v3s16 p)
+	{
+		return (p.X & 15) | (p.Y & 15) << 4 | (p.Z & 15) << 8;
+	}
+	void countBlockRemoval(v3s16 p)
+	{
+		m_block_removal_counts[getRemovalCountIndex(p)]++;
+	}
+
+	std::atomic<u32> m_block_removal_counts[16 * 16 * 16] = {};
+
 	std::set<MapEventReceiver*> m_event_receivers;
 
 	std::unordered_map<v2s16, MapSector*> m_sectors;
@@ -330,6 +358,29 @@ class Map /*: public NodeContainer*/
 		u32 needed_count);
 };
 
+/*
+	Blocks read from the database by ServerMap::readBlocks() that are not
+	part of the map yet
+*/
+struct DetachedBlockList
+{
+	struct Entry
+	{
+		v3s16 pos;
+		// null if the block is not in the database
+		std::unique_ptr<MapBlock> block;
+		// Node ids of the block are still the stored ones
+		NameIdMapping nimap;
+		// The block is in the database but in a format that can't be read
+		// this way, ServerMap::loadBlock() has to be used
+		bool deferred = false;
+		// Map::getBlockRemovalCount() from before the block was read
+		u32 removal_count = 0;
+	};
+
+	std::vector<Entry> entries;
+};
+
 /*
 	ServerMap
 
@@ -396,21 +447,44 @@ class ServerMap : public Map
 	*/
 	static MapDatabase *createDatabase(const std::string &name, const std::string &savedir, Settings &conf);
 
-	// Call these before and after saving of blocks
+	// Call these before and after saving of blocks.
+	// No-ops, the save thread uses transactions of its own.
 	void beginSave() override;
 	void endSave() override;
 
 	void save(ModifiedState save_level) override;
+	// Waits until the blocks queued for saving so far are written
+	void flushSaves();
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	void listAllLoadedBlocks(std::vector<v3s16> &dst);
 
 	MapgenParams *getMapgenParams();
 
+	// Queues the block to be written by the save thread
 	bool saveBlock(MapBlock *block) override;
 	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1);
+	// Serializes a block the way it is stored in the database
+	static std::string serializeBlock(MapBlock *block, int compression_level = -1);
 	MapBlock* loadBlock(v3s16 p);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
+	/*
+		Loading in two steps, so that the database lookups and the
+		deserialization don't need the env lock.
+
+		readBlocks() fetches all given blocks with one query and deserializes
+		them without touching the map or the node definitions, so it may be
+		called without the env lock. insertBlocks() then sets the node ids and
+		adds them to the map, it needs the env lock. Blocks that are in memory
+		by then are dropped, as are blocks that were removed from memory in
+		between, since the database may have been outdated at the time they
+		were read.
+		The positions of the blocks that were inserted are added to `loaded`,
+		the ones that are known not to be in the database to `missing`.
+	*/
+	void readBlocks(const std::vector<v3s16> &positions, DetachedBlockList *dst);
+	void insertBlocks(DetachedBlockList &src, std::vector<v3s16> *loaded,
+			std::vector<v3s16> *missing);
 
 	// Blocks are removed from the map but not deleted from memory until
 	// deleteDetachedBlocks() is called, since pointers to them may still exist
@@ -454,6 +528,9 @@ class ServerMap : public Map
 private:
 	friend class ModApiMapgen; // for m_transforming_liquid
 
+	// Updates the border lighting of a block freshly loaded from the database
+	void fixLoadedBlockLighting(MapBlock *block);
+
 	// Emerge manager
 	EmergeManager *m_emerge;
 
@@ -481,6 +558,11 @@ class ServerMap : public Map
 	bool m_map_metadata_changed = true;
 	MapDatabase *dbase = nullptr;
 	MapDatabase *dbase_ro = nullptr;
+	// Held for every access to dbase and dbase_ro, dbase is shared with the
+	// save thread and both are read by emerge threads without the env lock
+	std::mutex m_db_mutex;
+	// Compresses and writes modified blocks in the background
+	std::unique_ptr<MapSaveThread> m_save_thread;
 
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <atomic>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -72,6 +73,9 @@ MapBlock::MapBlock(v3s16 pos, IGameDef *gamedef):
 		data(new MapNode[nodecount]),
 		m_gamedef(gamedef)
 {
+	static std::atomic<u32> next_instance_id(0);
+	m_instance_id = next_instance_id.fetch_add(1, std::memory_order_relaxed);
+
 	reallocate();
 }
 
@@ -191,9 +195,6 @@ void MapBlock::actuallyUpdateDayNightDiff()
 {
 	const NodeDefManager *nodemgr = m_gamedef->ndef();
 
-	// Running this function un-expires m_day_night_differs
-	m_day_night_differs_expired = false;
-
 	bool differs = false;
 
 	/*
@@ -231,8 +232,11 @@ void MapBlock::actuallyUpdateDayNightDiff()
 			differs = false;
 	}
 
-	// Set member variable
-	m_day_night_differs = differs;
+	// Set member variable, this un-expires it. Several threads may do this
+	// at the same time while the node data doesn't change, they get the
+	// same result.
+	m_day_night_differs.store(differs, std::memory_order_relaxed);
+	m_day_night_differs_expired.store(false, std::memory_order_release);
 }
 
 void MapBlock::expireDayNightDiff()
@@ -363,9 +367,45 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialization version error");
 
-	std::ostringstream os_raw(std::ios_base::binary);
-	std::ostream &os = version >= 29 ? os_raw : os_compressed;
+	if (version >= 29) {
+		std::ostringstream os_raw(std::ios_base::binary);
+		serializeBody(os_raw, version, disk, compression_level);
+		// now compress the whole thing
+		compress(os_raw.str(), os_compressed, version, compression_level);
+	} else {
+		serializeBody(os_compressed, version, disk, compression_level);
+	}
+}
+
+void MapBlock::serializeNetworkUncompressed(std::ostream &os, u8 version)
+{
+	FATAL_ERROR_IF(version < 29, "Serialization version error");
+
+	serializeBody(os, version, false, 0);
+}
+
+void MapBlock::compressNetworkSerialization(const std::string &raw,
+		std::ostream &os, u8 version, int compression_level)
+{
+	compress(raw, os, version, compression_level);
+	serializeNetworkSpecific(os);
+}
+
+void MapBlock::serializeDiskUncompressed(std::ostream &os, u8 version)
+{
+	FATAL_ERROR_IF(version < 29, "Serialization version error");
+
+	serializeBody(os, version, true, 0);
+}
 
+void MapBlock::compressDiskSerialization(const std::string &raw,
+		std::ostream &os, u8 version, int compression_level)
+{
+	compress(raw, os, version, compression_level);
+}
+
+void MapBlock::serializeBody(std::ostream &os, u8 version, bool disk, int compression_level)
+{
 	// First byte
 	u8 flags = 0;
 	if(is_underground)
@@ -424,7 +464,7 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 	if (version >= 29) {
 		m_node_metadata.serialize(os, version, disk);
 	} else {
-		// use os_raw from above to avoid allocating another stream object
+		std::ostringstream os_raw(std::ios_base::binary);
 		m_node_metadata.serialize(os_raw, version, disk);
 		// prior to 29 node data was compressed individually
 		compress(os_raw.str(), os, version, compression_level);
@@ -455,11 +495,6 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 			m_node_timers.serialize(os, version);
 		}
 	}
-
-	if (version >= 29) {
-		// now compress the whole thing
-		compress(os_raw.str(), os_compressed, version, compression_level);
-	}
 }
 
 void MapBlock::serializeNetworkSpecific(std::ostream &os)
@@ -467,7 +502,8 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
-void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
+void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk,
+		NameIdMapping *nimap_out)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
@@ -478,6 +514,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 
 	if(version <= 21)
 	{
+		FATAL_ERROR_IF(nimap_out, "Deferred node id correction is not supported");
 		deSerialize_pre22(in_compressed, version, disk);
 		return;
 	}
@@ -593,7 +630,10 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		}
 
 		// Dynamically re-set ids based on node names
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		if (nimap_out)
+			*nimap_out = std::move(nimap);
+		else
+			correctBlockNodeIds(&nimap, data, m_gamedef);
 
 		if(version >= 25){
 			TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()
@@ -606,6 +646,11 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 			<<": Done."<<std::endl);
 }
 
+void MapBlock::correctNodeIds(const NameIdMapping &nimap)
+{
+	correctBlockNodeIds(&nimap, data, m_gamedef);
+}
+
 void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 {
 	try {
@@ -19,9 +19,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include "irr_v3d.h"
 #include "mapnode.h"
+#include "blockcontentindex.h"
 #include "exceptions.h"
 #include "constants.h"
 #include "staticobject.h"
@@ -32,6 +34,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 
 class Map;
+class NameIdMapping;
 class NodeMetadataList;
 class IGameDef;
 class MapBlockMesh;
@@ -65,6 +68,18 @@ class VoxelManipulator;
 #define MOD_REASON_VMANIP                    (1 << 19)
 #define MOD_REASON_UNKNOWN                   (1 << 20)
 
+// Reasons that do not touch the node data of a block (single node changes
+// update the content index on their own)
+#define MOD_REASONS_KEEP_CONTENT_INDEX (MOD_REASON_SET_IS_UNDERGROUND | \
+	MOD_REASON_SET_LIGHTING_COMPLETE | MOD_REASON_SET_GENERATED | \
+	MOD_REASON_SET_NODE | MOD_REASON_SET_NODE_NO_CHECK | \
+	MOD_REASON_SET_TIMESTAMP | MOD_REASON_REPORT_META_CHANGE | \
+	MOD_REASON_CLEAR_ALL_OBJECTS | MOD_REASON_BLOCK_EXPIRED | \
+	MOD_REASON_ADD_ACTIVE_OBJECT_RAW | MOD_REASON_REMOVE_OBJECTS_REMOVE | \
+	MOD_REASON_REMOVE_OBJECTS_DEACTIVATE | MOD_REASON_TOO_MANY_OBJECTS | \
+	MOD_REASON_STATIC_DATA_ADDED | MOD_REASON_STATIC_DATA_REMOVED | \
+	MOD_REASON_STATIC_DATA_CHANGED | MOD_REASON_EXPIRE_DAYNIGHTDIFF)
+
 ////
 //// MapBlock itself
 ////
@@ -113,8 +128,19 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents.clear();
+		if (mod == MOD_STATE_WRITE_NEEDED) {
+			if (reason & ~MOD_REASONS_KEEP_CONTENT_INDEX)
+				content_index.clear();
+			m_change_counter++;
+		}
+	}
+
+	// Changes whenever the block data may have changed in a way that
+	// matters to clients. Unique among all blocks of this process, so it
+	// can be used to key caches of serialized block data.
+	inline u64 getNetworkVersion() const
+	{
+		return ((u64)m_instance_id << 32) | m_change_counter;
 	}
 
 	inline u32 getModified()
@@ -266,7 +292,9 @@ class MapBlock
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		const u16 i = z * zstride + y * ystride + x;
+		content_index.update(i, data[i].getContent(), n.getContent());
+		data[i] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -291,7 +319,9 @@ class MapBlock
 
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode n)
 	{
-		data[z * zstride + y * ystride + x] = n;
+		const u16 i = z * zstride + y * ystride + x;
+		content_index.update(i, data[i].getContent(), n.getContent());
+		data[i] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -315,11 +345,13 @@ class MapBlock
 	// when the value is actually needed.
 	void expireDayNightDiff();
 
+	// May be called from several threads as long as none of them
+	// modifies the block
 	inline bool getDayNightDiff()
 	{
-		if (m_day_night_differs_expired)
+		if (m_day_night_differs_expired.load(std::memory_order_acquire))
 			actuallyUpdateDayNightDiff();
-		return m_day_night_differs;
+		return m_day_night_differs.load(std::memory_order_relaxed);
 	}
 
 	bool onObjectsActivation();
@@ -358,19 +390,21 @@ class MapBlock
 	//// Usage timer (see m_usage_timer)
 	////
 
+	// May be called by several threads at once
 	inline void resetUsageTimer()
 	{
-		m_usage_timer = 0;
+		m_usage_timer.store(0, std::memory_order_relaxed);
 	}
 
 	inline void incrementUsageTimer(float dtime)
 	{
-		m_usage_timer += dtime;
+		m_usage_timer.store(m_usage_timer.load(std::memory_order_relaxed) + dtime,
+				std::memory_order_relaxed);
 	}
 
 	inline float getUsageTimer()
 	{
-		return m_usage_timer;
+		return m_usage_timer.load(std::memory_order_relaxed);
 	}
 
 	////
@@ -428,11 +462,31 @@ class MapBlock
 	void serialize(std::ostream &result, u8 version, bool disk, int compression_level);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
-	void deSerialize(std::istream &is, u8 version, bool disk);
-
-	void serializeNetworkSpecific(std::ostream &os);
+	// If nimap_out is given, the node ids are left as stored and the
+	// id-name mapping is returned instead. The node definitions are not
+	// accessed then, correctNodeIds() has to be called before the block is
+	// used. Only for version >= 22 and disk == true.
+	void deSerialize(std::istream &is, u8 version, bool disk,
+			NameIdMapping *nimap_out = nullptr);
+	// Sets the node ids from the mapping, see deSerialize()
+	void correctNodeIds(const NameIdMapping &nimap);
+
+	static void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
 
+	// Network serialization split in two steps: the uncompressed data is
+	// written first (this needs the block to be locked), compressing and
+	// finishing it off can then happen on any thread.
+	// Precondition: version >= 29
+	void serializeNetworkUncompressed(std::ostream &os, u8 version);
+	static void compressNetworkSerialization(const std::string &raw,
+			std::ostream &os, u8 version, int compression_level);
+	// Same for the on-disk format, used to save blocks in the background
+	// Precondition: version >= 29
+	void serializeDiskUncompressed(std::ostream &os, u8 version);
+	static void compressDiskSerialization(const std::string &raw,
+			std::ostream &os, u8 version, int compression_level);
+
 	bool storeActiveObject(u16 id);
 	// clearObject and return removed objects count
 	u32 clearObjects();
@@ -449,6 +503,10 @@ class MapBlock
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
+	// Writes everything serialize() does, without the final compression
+	// for version >= 29
+	void serializeBody(std::ostream &os, u8 version, bool disk, int compression_level);
+
 	/*
 	 * PLEASE NOTE: When adding something here be mindful of position and size
 	 * of member variables! This is also the reason for the weird public-private
@@ -499,22 +557,17 @@ class MapBlock
 		When the block is accessed, this is set to 0.
 		Map will unload the block when this reaches a timeout.
 	*/
-	float m_usage_timer = 0;
+	std::atomic<float> m_usage_timer{0};
 
 public:
 	//// ABM optimizations ////
-	// True if we never want to cache content types for this block
-	bool do_not_cache_contents = false;
-	// Cache of content types
-	// This is actually a set but for the small sizes we have a vector should be
-	// more efficient.
-	// Can be empty, in which case nothing was cached yet.
-	std::vector<content_t> contents;
+	// Node positions by content type, invalid if not built yet
+	BlockContentIndex content_index;
 
 private:
 	// Whether day and night lighting differs
-	bool m_day_night_differs = false;
-	bool m_day_night_differs_expired = true;
+	std::atomic<bool> m_day_night_differs{false};
+	std::atomic<bool> m_day_night_differs_expired{true};
 
 	/*
 		- On the server, this is used for telling whether the
@@ -524,6 +577,10 @@ class MapBlock
 	u16 m_modified = MOD_STATE_WRITE_NEEDED;
 	u32 m_modified_reason = MOD_REASON_INITIAL;
 
+	// See getNetworkVersion()
+	u32 m_instance_id;
+	u32 m_change_counter = 0;
+
 	/*
 		When block is removed from active blocks, this is set to gametime.
 		Value BLOCK_TIMESTAMP_UNDEFINED=0xffffffff means there is no timestamp.
@@ -51,6 +51,8 @@ class MapSector
 	}
 
 	MapBlock *getBlockNoCreateNoEx(s16 y);
+	// Doesn't use the block cache, see Map::getBlockNoCreateNoExNoCache()
+	MapBlock *getBlockNoCreateNoExNoCache(s16 y) const;
 	std::unique_ptr<MapBlock> createBlankBlockNoInsert(s16 y);
 	MapBlock *createBlankBlock(s16 y);
 
@@ -0,0 +1,310 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "congestioncontrol.h"
+#include <cmath>
+#include "connection.h"
+#include "constants.h"
+#include "log.h"
+#include "util/basic_macros.h"
+#include "util/numeric.h"
+
+namespace con
+{
+
+std::unique_ptr<CongestionController> createCongestionController(
+		const std::string &name)
+{
+	if (name == "cubic")
+		return std::make_unique<CubicCongestionController>();
+	if (name == "bbr")
+		return std::make_unique<BbrCongestionController>();
+	if (name != "legacy")
+		warningstream << "Unknown congestion control \"" << name
+				<< "\", using legacy" << std::endl;
+	return std::make_unique<LegacyCongestionController>();
+}
+
+u32 CongestionController::getSeqnumSpan() const
+{
+	return MAX_RELIABLE_WINDOW_SIZE;
+}
+
+// Moving average over roughly the last 10 packets
+static void update_packet_size(float &avg, u32 bytes)
+{
+	avg = avg > 0.0f ? avg * 0.9f + bytes * 0.1f : bytes;
+}
+
+/*
+	LegacyCongestionController
+*/
+
+LegacyCongestionController::LegacyCongestionController() :
+	m_window_size(START_RELIABLE_WINDOW_SIZE)
+{
+}
+
+void LegacyCongestionController::onPacketAcked(u32 bytes, float rtt, u64 time_ms)
+{
+	m_packets_acked++;
+	m_bytes_acked += bytes;
+}
+
+void LegacyCongestionController::onPacketsLost(u32 count, u64 time_ms)
+{
+	m_packets_lost += count;
+}
+
+void LegacyCongestionController::step(float dtime, u64 time_ms)
+{
+	m_bytes_timer += dtime;
+	m_timer += dtime;
+
+	if (m_timer > 1.0f) {
+		m_timer -= 1.0f;
+
+		/* don't even think about increasing if we didn't even
+		 * use major parts of our window */
+		const bool reasonable_amount_of_data_transmitted =
+				m_bytes_acked > m_window_size * 512 / 2;
+
+		if (m_packets_acked > 0) {
+			float successful_to_lost_ratio = m_packets_lost / m_packets_acked;
+
+			if (successful_to_lost_ratio < 0.01f) {
+				if (reasonable_amount_of_data_transmitted)
+					setWindowSize(m_window_size + 100);
+			} else if (successful_to_lost_ratio < 0.05f) {
+				if (reasonable_amount_of_data_transmitted)
+					setWindowSize(m_window_size + 50);
+			} else if (successful_to_lost_ratio > 0.15f) {
+				setWindowSize(m_window_size - 100);
+			} else if (successful_to_lost_ratio > 0.1f) {
+				setWindowSize(m_window_size - 50);
+			}
+		} else if (m_packets_lost > 0) {
+			setWindowSize(m_window_size - 10);
+		}
+
+		m_packets_lost = 0;
+		m_packets_acked = 0;
+	}
+
+	// Same period as the transfer rate statistics of the channel
+	if (m_bytes_timer > 10.0f) {
+		m_bytes_timer = 0.0f;
+		m_bytes_acked = 0;
+	}
+}
+
+void LegacyCongestionController::setWindowSize(long size)
+{
+	m_window_size = rangelim(size, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+}
+
+/*
+	CubicCongestionController
+*/
+
+// Constants from RFC 8312
+#define CUBIC_C 0.4f
+#define CUBIC_BETA 0.7f
+
+CubicCongestionController::CubicCongestionController() :
+	m_cwnd(MIN_RELIABLE_WINDOW_SIZE),
+	m_ssthresh(MAX_RELIABLE_WINDOW_SIZE)
+{
+}
+
+void CubicCongestionController::onPacketAcked(u32 bytes, float rtt, u64 time_ms)
+{
+	update_packet_size(m_avg_packet_size, bytes);
+	if (rtt >= 0.0f)
+		m_srtt = m_srtt > 0.0f ? m_srtt * 0.875f + rtt * 0.125f : rtt;
+
+	if (m_cwnd < m_ssthresh) {
+		// Slow start
+		m_cwnd = MYMIN(m_cwnd + 1.0f, (float)MAX_RELIABLE_WINDOW_SIZE);
+		return;
+	}
+
+	if (m_epoch_start == 0) {
+		m_epoch_start = time_ms;
+		if (m_cwnd < m_w_max) {
+			m_k = std::cbrt((m_w_max - m_cwnd) / CUBIC_C);
+			m_origin = m_w_max;
+		} else {
+			m_k = 0.0f;
+			m_origin = m_cwnd;
+		}
+		m_w_est = m_cwnd;
+	}
+
+	const float t = (time_ms - m_epoch_start) / 1000.0f + m_srtt;
+	float target = m_origin + CUBIC_C * (t - m_k) * (t - m_k) * (t - m_k);
+
+	// Never grow slower than Reno would
+	m_w_est += 3.0f * (1.0f - CUBIC_BETA) / (1.0f + CUBIC_BETA) / m_cwnd;
+	target = MYMAX(target, m_w_est);
+	target = MYMIN(target, m_cwnd * 1.5f);
+
+	if (target > m_cwnd)
+		m_cwnd += (target - m_cwnd) / m_cwnd;
+	else
+		m_cwnd += 0.01f / m_cwnd;
+	m_cwnd = MYMIN(m_cwnd, (float)MAX_RELIABLE_WINDOW_SIZE);
+}
+
+void CubicCongestionController::onPacketsLost(u32 count, u64 time_ms)
+{
+	// Packets that time out up to a resend timeout after a reduction were
+	// sent with the old window, don't reduce again for them
+	if (time_ms < m_recovery_end)
+		return;
+	m_recovery_end = time_ms +
+			(u64)(MYMAX(m_srtt, 0.1f) * RESEND_TIMEOUT_FACTOR * 1000.0f);
+
+	m_epoch_start = 0;
+	// Fast convergence: give up bandwidth early if the loss happened
+	// before reaching the last maximum
+	if (m_cwnd < m_w_max)
+		m_w_max = m_cwnd * (1.0f + CUBIC_BETA) / 2.0f;
+	else
+		m_w_max = m_cwnd;
+
+	m_cwnd = MYMAX(m_cwnd * CUBIC_BETA, (float)MIN_RELIABLE_WINDOW_SIZE);
+	m_ssthresh = m_cwnd;
+}
+
+u32 CubicCongestionController::getWindowSize() const
+{
+	return rangelim((u32)m_cwnd, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+}
+
+float CubicCongestionController::getPacingRate() const
+{
+	if (m_srtt <= 0.0f || m_avg_packet_size <= 0.0f)
+		return 0.0f;
+	// Slightly faster than the window so that pacing does not limit it
+	const float gain = m_cwnd < m_ssthresh ? 2.0f : 1.25f;
+	return gain * m_cwnd * m_avg_packet_size / m_srtt;
+}
+
+/*
+	BbrCongestionController
+*/
+
+// 2 / ln(2), doubles the delivery rate every round
+#define BBR_STARTUP_GAIN 2.885f
+#define BBR_CWND_GAIN 2.0f
+// Rounds without 25% bandwidth growth until startup ends
+#define BBR_FULL_BW_ROUNDS 3
+// How long a minimal round trip time stays valid
+#define BBR_MIN_RTT_WINDOW_MS 10000
+// Shortest round, if the connection has a very low latency
+#define BBR_MIN_ROUND_MS 10
+
+static const float bbr_probe_gains[] = {1.25f, 0.75f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+
+BbrCongestionController::BbrCongestionController() :
+	m_pacing_gain(BBR_STARTUP_GAIN),
+	m_cwnd_gain(BBR_STARTUP_GAIN)
+{
+}
+
+void BbrCongestionController::onPacketAcked(u32 bytes, float rtt, u64 time_ms)
+{
+	update_packet_size(m_avg_packet_size, bytes);
+	m_delivered += bytes;
+
+	if (rtt >= 0.0f && (m_min_rtt < 0.0f || rtt <= m_min_rtt ||
+			time_ms - m_min_rtt_time > BBR_MIN_RTT_WINDOW_MS)) {
+		m_min_rtt = rtt;
+		m_min_rtt_time = time_ms;
+	}
+
+	if (m_round_start == 0) {
+		m_round_start = time_ms;
+		m_round_delivered = m_delivered;
+		return;
+	}
+
+	// A round lasts one round trip, sample the delivery rate over it
+	if (m_min_rtt < 0.0f)
+		return;
+	const u64 elapsed = time_ms - m_round_start;
+	if (elapsed < MYMAX((u64)(m_min_rtt * 1000.0f), (u64)BBR_MIN_ROUND_MS))
+		return;
+
+	const float bw = (m_delivered - m_round_delivered) * 1000.0f / elapsed;
+	m_round_start = time_ms;
+	m_round_delivered = m_delivered;
+	onRoundEnd(bw, time_ms);
+}
+
+void BbrCongestionController::onRoundEnd(float bw, u64 time_ms)
+{
+	m_bw_samples[m_round_count % BW_FILTER_ROUNDS] = bw;
+	m_round_count++;
+	m_max_bw = 0.0f;
+	for (float sample : m_bw_samples)
+		m_max_bw = MYMAX(m_max_bw, sample);
+
+	switch (m_state) {
+	case STARTUP:
+		if (m_max_bw >= m_full_bw * 1.25f) {
+			m_full_bw = m_max_bw;
+			m_full_bw_rounds = 0;
+		} else if (++m_full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+			// Empty the queue that was built up during startup
+			m_state = DRAIN;
+			m_pacing_gain = 1.0f / BBR_STARTUP_GAIN;
+		}
+		break;
+	case DRAIN:
+		m_state = PROBE_BW;
+		m_cwnd_gain = BBR_CWND_GAIN;
+		// Don't start with the phase that sends slower
+		m_cycle_index = 2;
+		m_pacing_gain = bbr_probe_gains[m_cycle_index];
+		break;
+	case PROBE_BW:
+		m_cycle_index = (m_cycle_index + 1) % ARRLEN(bbr_probe_gains);
+		m_pacing_gain = bbr_probe_gains[m_cycle_index];
+		break;
+	}
+}
+
+u32 BbrCongestionController::getWindowSize() const
+{
+	if (m_max_bw <= 0.0f || m_min_rtt <= 0.0f || m_avg_packet_size <= 0.0f)
+		return MIN_RELIABLE_WINDOW_SIZE;
+
+	const float bdp = m_max_bw * m_min_rtt / m_avg_packet_size;
+	return rangelim((u32)(m_cwnd_gain * bdp),
+			MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+}
+
+float BbrCongestionController::getPacingRate() const
+{
+	return m_pacing_gain * m_max_bw;
+}
+
+}
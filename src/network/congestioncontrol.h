@@ -0,0 +1,197 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include "irrlichttypes.h"
+
+namespace con
+{
+
+/*
+	Decides how many reliable packets a channel may have on the wire and
+	how fast they may be sent.
+
+	Times are in milliseconds (porting::getTimeMs()), round trip times in
+	seconds. Not thread-safe, the owning Channel serializes all calls.
+*/
+class CongestionController
+{
+public:
+	virtual ~CongestionController() = default;
+
+	virtual const char *getName() const = 0;
+
+	// A reliable packet is sent for the first time
+	virtual void onPacketSent(u32 bytes, u64 time_ms) {}
+	// A reliable packet was acknowledged. rtt is negative if the packet
+	// was resent, because then it is unknown which copy was acked.
+	virtual void onPacketAcked(u32 bytes, float rtt, u64 time_ms) = 0;
+	// Reliable packets were not acked in time and are resent
+	virtual void onPacketsLost(u32 count, u64 time_ms) = 0;
+	// Called by the send thread for every channel once per iteration
+	virtual void step(float dtime, u64 time_ms) {}
+
+	// Maximum number of unacknowledged reliable packets
+	virtual u32 getWindowSize() const = 0;
+	// How far apart the seqnums of unacknowledged packets may be. If this is
+	// not larger than the window, one lost packet holds back all after it.
+	virtual u32 getSeqnumSpan() const;
+	// Maximum send rate in bytes per second, 0 if sending is not paced
+	virtual float getPacingRate() const { return 0.0f; }
+};
+
+// Names are those of the congestion_control setting: "legacy", "cubic"
+// and "bbr". Unknown names give the legacy controller.
+std::unique_ptr<CongestionController> createCongestionController(
+		const std::string &name);
+
+/*
+	The original behaviour: the window grows by a fixed amount every second
+	if little was lost and shrinks if a lot was lost. Sending is not paced.
+*/
+class LegacyCongestionController : public CongestionController
+{
+public:
+	LegacyCongestionController();
+
+	const char *getName() const override { return "legacy"; }
+
+	void onPacketAcked(u32 bytes, float rtt, u64 time_ms) override;
+	void onPacketsLost(u32 count, u64 time_ms) override;
+	void step(float dtime, u64 time_ms) override;
+
+	u32 getWindowSize() const override { return m_window_size; }
+	u32 getSeqnumSpan() const override { return m_window_size; }
+
+private:
+	void setWindowSize(long size);
+
+	u32 m_window_size;
+	float m_timer = 0.0f;
+	float m_bytes_timer = 0.0f;
+	u32 m_packets_lost = 0;
+	u32 m_packets_acked = 0;
+	u32 m_bytes_acked = 0;
+};
+
+/*
+	Window growth as in TCP CUBIC (RFC 8312): slow start, then a cubic
+	function of the time since the last loss, which quickly returns to the
+	window where the loss happened and then probes carefully beyond it.
+	Sending is paced at the window per smoothed round trip time.
+*/
+class CubicCongestionController : public CongestionController
+{
+public:
+	CubicCongestionController();
+
+	const char *getName() const override { return "cubic"; }
+
+	void onPacketAcked(u32 bytes, float rtt, u64 time_ms) override;
+	void onPacketsLost(u32 count, u64 time_ms) override;
+
+	u32 getWindowSize() const override;
+	float getPacingRate() const override;
+
+private:
+	// Window in packets
+	float m_cwnd;
+	float m_ssthresh;
+	// Window before the last reduction
+	float m_w_max = 0.0f;
+	// Window estimate of a Reno-like sender, the window never grows slower
+	float m_w_est = 0.0f;
+	float m_k = 0.0f;
+	float m_origin = 0.0f;
+	// Start of the current growth period, 0 if none
+	u64 m_epoch_start = 0;
+	// Losses until this time belong to the same window and are
+	// only reacted to once
+	u64 m_recovery_end = 0;
+
+	float m_srtt = 0.0f;
+	float m_avg_packet_size = 0.0f;
+};
+
+/*
+	Bandwidth based control like TCP BBR (v1): the bottleneck bandwidth is
+	the maximum delivery rate seen over the last rounds, the propagation
+	delay the minimum round trip time of the last ten seconds. Sending is
+	paced at the bandwidth estimate, with a gain that is higher during
+	startup and cycles slightly above and below 1 afterwards to find new
+	bandwidth. The window is a multiple of the bandwidth-delay product.
+	Losses are not taken as a congestion signal.
+
+	Delivery rates are sampled once per round trip from the acked bytes,
+	there is no per-packet bookkeeping and no PROBE_RTT state (the window
+	never drops below MIN_RELIABLE_WINDOW_SIZE anyway).
+*/
+class BbrCongestionController : public CongestionController
+{
+public:
+	BbrCongestionController();
+
+	const char *getName() const override { return "bbr"; }
+
+	void onPacketAcked(u32 bytes, float rtt, u64 time_ms) override;
+	void onPacketsLost(u32 count, u64 time_ms) override {}
+
+	u32 getWindowSize() const override;
+	float getPacingRate() const override;
+
+	// For the tests
+	float getBandwidth() const { return m_max_bw; }
+	float getMinRtt() const { return m_min_rtt; }
+	bool isInStartup() const { return m_state == STARTUP; }
+
+private:
+	enum State { STARTUP, DRAIN, PROBE_BW };
+
+	void onRoundEnd(float bw, u64 time_ms);
+
+	State m_state = STARTUP;
+
+	// Bandwidth samples of the last rounds (bytes per second)
+	static constexpr int BW_FILTER_ROUNDS = 10;
+	float m_bw_samples[BW_FILTER_ROUNDS] = {};
+	u32 m_round_count = 0;
+	float m_max_bw = 0.0f;
+
+	float m_min_rtt = -1.0f;
+	u64 m_min_rtt_time = 0;
+
+	// Current round
+	u64 m_round_start = 0;
+	u64 m_delivered = 0;
+	u64 m_round_delivered = 0;
+
+	// Startup ends when the bandwidth stops growing
+	float m_full_bw = 0.0f;
+	u32 m_full_bw_rounds = 0;
+
+	u32 m_cycle_index = 0;
+	float m_pacing_gain;
+	float m_cwnd_gain;
+	float m_avg_packet_size = 0.0f;
+};
+
+}
@@ -144,6 +144,67 @@ void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 	list->push_back(makeOriginalPacket(data));
 }
 
+// Makes a packet with room for the base and reliable headers in front of
+// the data, which is written by the caller
+static BufferedPacketPtr makeReliablePacketNoData(Address &address,
+		u32 data_size, u32 protocol_id, session_t sender_peer_id, u8 channel)
+{
+	auto p = std::make_shared<BufferedPacket>(
+			BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + data_size);
+	p->address = address;
+
+	writeU32(&p->data[0], protocol_id);
+	writeU16(&p->data[4], sender_peer_id);
+	writeU8(&p->data[6], channel);
+	writeU8(&p->data[BASE_HEADER_SIZE], PACKET_TYPE_RELIABLE);
+
+	return p;
+}
+
+void makeAutoSplitReliablePackets(Address &address, const u8 *data, u32 size,
+		u32 chunksize_max, u16 &split_seqnum, u32 protocol_id,
+		session_t sender_peer_id, u8 channel, std::vector<BufferedPacketPtr> *list)
+{
+	const u32 original_header_size = 1;
+	const u32 payload_offset = BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE;
+
+	if (size + original_header_size <= chunksize_max) {
+		BufferedPacketPtr p = makeReliablePacketNoData(address,
+				original_header_size + size, protocol_id, sender_peer_id, channel);
+		writeU8(&p->data[payload_offset], PACKET_TYPE_ORIGINAL);
+		if (size > 0)
+			memcpy(&p->data[payload_offset + original_header_size], data, size);
+		list->push_back(p);
+		return;
+	}
+
+	// Same format as makeSplitPacket()
+	const u32 chunk_header_size = 7;
+	const u32 maximum_data_size = chunksize_max - chunk_header_size;
+	const u32 chunk_count = (size + maximum_data_size - 1) / maximum_data_size;
+	for (u32 chunk_num = 0; chunk_num < chunk_count; chunk_num++) {
+		const u32 start = chunk_num * maximum_data_size;
+		const u32 payload_size = MYMIN(maximum_data_size, size - start);
+
+		BufferedPacketPtr p = makeReliablePacketNoData(address,
+				chunk_header_size + payload_size, protocol_id, sender_peer_id, channel);
+		u8 *chunk = &p->data[payload_offset];
+		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
+		writeU16(&chunk[1], split_seqnum);
+		writeU16(&chunk[3], chunk_count);
+		writeU16(&chunk[5], chunk_num);
+		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+
+		list->push_back(p);
+	}
+	split_seqnum++;
+}
+
+void setReliableSeqnum(BufferedPacket &p, u16 seqnum)
+{
+	writeU16(&p.data[BASE_HEADER_SIZE + 1], seqnum);
+}
+
 SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
 {
 	u32 header_size = 3;
@@ -167,7 +228,10 @@ void ReliablePacketBuffer::print()
 	MutexAutoLock listlock(m_list_mutex);
 	LOG(dout_con<<"Dump of ReliablePacketBuffer:" << std::endl);
 	unsigned int index = 0;
-	for (BufferedPacketPtr &packet : m_list) {
+	for (u32 i = 0; i < m_span; i++) {
+		const BufferedPacketPtr &packet = slotNoLock(m_first + i);
+		if (!packet)
+			continue;
 		LOG(dout_con<<index<< ":" << packet->getSeqnum() << std::endl);
 		index++;
 	}
@@ -176,69 +240,82 @@ void ReliablePacketBuffer::print()
 bool ReliablePacketBuffer::empty()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.empty();
+	return m_count == 0;
 }
 
 u32 ReliablePacketBuffer::size()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.size();
+	return m_count;
 }
 
-RPBSearchResult ReliablePacketBuffer::findPacketNoLock(u16 seqnum)
+void ReliablePacketBuffer::reserveNoLock(u32 span)
 {
-	for (auto it = m_list.begin(); it != m_list.end(); ++it) {
-		if ((*it)->getSeqnum() == seqnum)
-			return it;
+	if (span <= m_slots.size())
+		return;
+
+	size_t capacity = MYMAX(m_slots.size(), (size_t)MIN_RELIABLE_WINDOW_SIZE);
+	while (capacity < span)
+		capacity *= 2;
+
+	std::vector<BufferedPacketPtr> slots(capacity);
+	for (u32 i = 0; i < m_span; i++) {
+		BufferedPacketPtr &packet = slotNoLock(m_first + i);
+		if (packet)
+			slots[packet->getSeqnum() & (capacity - 1)] = std::move(packet);
+	}
+	m_slots = std::move(slots);
+}
+
+BufferedPacketPtr ReliablePacketBuffer::removeNoLock(u16 seqnum)
+{
+	BufferedPacketPtr p = std::move(slotNoLock(seqnum));
+	m_count--;
+
+	if (m_count == 0) {
+		m_span = 0;
+	} else if (seqnum == m_first) {
+		// Skip to the next buffered packet
+		do {
+			m_first++;
+			m_span--;
+		} while (!slotNoLock(m_first));
+	} else if ((u16)(seqnum - m_first) == m_span - 1) {
+		do {
+			m_span--;
+		} while (!slotNoLock(m_first + m_span - 1));
 	}
-	return m_list.end();
+	return p;
 }
 
 bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_count == 0)
 		return false;
-	result = m_list.front()->getSeqnum();
+	result = m_first;
 	return true;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popFirst()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_count == 0)
 		throw NotFoundException("Buffer is empty");
 
-	BufferedPacketPtr p(m_list.front());
-	m_list.pop_front();
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
-	return p;
+	return removeNoLock(m_first);
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	RPBSearchResult r = findPacketNoLock(seqnum);
-	if (r == m_list.end()) {
+	if ((u16)(seqnum - m_first) >= m_span || !slotNoLock(seqnum)) {
 		LOG(dout_con<<"Sequence number: " << seqnum
 				<< " not found in reliable buffer"<<std::endl);
 		throw NotFoundException("seqnum not found in buffer");
 	}
 
-	BufferedPacketPtr p(*r);
-	m_list.erase(r);
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
-	return p;
+	return removeNoLock(seqnum);
 }
 
 void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
@@ -270,45 +347,34 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 		return;
 	}
 
-	sanity_check(m_list.size() <= SEQNUM_MAX); // FIXME: Handle the error?
-
-	// Find the right place for the packet and insert it there
-	// If list is empty, just add it
-	if (m_list.empty()) {
-		m_list.push_back(p_ptr);
-		m_oldest_non_answered_ack = seqnum;
-		// Done.
-		return;
-	}
-
-	// Otherwise find the right place
-	auto it = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	u16 s = (*it)->getSeqnum();
-
-	/* case seqnum is smaller then next_expected seqnum */
-	/* this is true e.g. on wrap around */
-	if (seqnum < next_expected) {
-		while(((s < seqnum) || (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
+	// Range of sequence numbers covered after inserting the packet
+	u16 first = seqnum;
+	u32 span = 1;
+	if (m_count > 0) {
+		const u16 offset = seqnum - m_first;
+		if (offset < m_span) {
+			first = m_first;
+			span = m_span;
+		} else if (seqnum_higher(seqnum, m_first)) {
+			first = m_first;
+			span = (u32)offset + 1;
+		} else {
+			span = m_span + (u16)(m_first - seqnum);
 		}
 	}
-	/* non wrap around case (at least for incoming and next_expected */
-	else
-	{
-		while(((s < seqnum) && (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
+	// A full window plus the packet that is sent next
+	if (span > MAX_RELIABLE_WINDOW_SIZE + 1) {
+		errorstream << "ReliablePacketBuffer::insert(): seqnum is too far "
+			"from the buffered packets" << std::endl;
+		return;
 	}
 
-	if (s == seqnum) {
+	reserveNoLock(span);
+	BufferedPacketPtr &slot = slotNoLock(seqnum);
+	if (slot) {
 		/* nothing to do this seems to be a resent packet */
 		/* for paranoia reason data should be compared */
-		auto &i = *it;
+		auto &i = slot;
 		if (
 			(i->getSeqnum() != seqnum) ||
 			(i->size() != p.size()) ||
@@ -327,22 +393,22 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 					p.address.serializeString().c_str());
 			throw IncomingDataCorruption("duplicated packet isn't same as original one");
 		}
-	}
-	/* insert or push back */
-	else if (it != m_list.end()) {
-		m_list.insert(it, p_ptr);
-	} else {
-		m_list.push_back(p_ptr);
+		return;
 	}
 
-	/* update last packet number */
-	m_oldest_non_answered_ack = m_list.front()->getSeqnum();
+	slot = p_ptr;
+	m_first = first;
+	m_span = span;
+	m_count++;
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list) {
+	for (u32 i = 0; i < m_span; i++) {
+		BufferedPacketPtr &packet = slotNoLock(m_first + i);
+		if (!packet)
+			continue;
 		packet->time += dtime;
 		packet->totaltime += dtime;
 	}
@@ -353,8 +419,9 @@ std::list<ConstSharedPtr<BufferedPacket>>
 {
 	MutexAutoLock listlock(m_list_mutex);
 	std::list<ConstSharedPtr<BufferedPacket>> timed_outs;
-	for (auto &packet : m_list) {
-		if (packet->time < timeout)
+	for (u32 i = 0; i < m_span; i++) {
+		BufferedPacketPtr &packet = slotNoLock(m_first + i);
+		if (!packet || packet->time < timeout)
 			continue;
 
 		// caller will resend packet so reset time and increase counter
@@ -555,7 +622,18 @@ ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = reliable;
-	c->data = pkt->oldForgePacket();
+	c->data = pkt->getForgedPacket();
+	return c;
+}
+
+ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
+	NetworkPacket &&pkt, bool reliable)
+{
+	auto c = create(CONNCMD_SEND);
+	c->peer_id = peer_id;
+	c->channelnum = channelnum;
+	c->reliable = reliable;
+	c->data = pkt.takeForgedPacket();
 	return c;
 }
 
@@ -565,7 +643,7 @@ ConnectionCommandPtr ConnectionCommand::ack(session_t peer_id, u8 channelnum, co
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = false;
-	data.copyTo(c->data);
+	c->data.assign(*data, *data + data.getSize());
 	return c;
 }
 
@@ -576,7 +654,7 @@ ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buff
 	c->channelnum = 0;
 	c->reliable = true;
 	c->raw = true;
-	data.copyTo(c->data);
+	c->data.assign(*data, *data + data.getSize());
 	return c;
 }
 
@@ -584,6 +662,28 @@ ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buff
 	Channel
 */
 
+Channel::Channel() :
+	m_congestion(std::make_unique<LegacyCongestionController>())
+{
+	updateWindowSize();
+}
+
+void Channel::setCongestionController(std::unique_ptr<CongestionController> controller)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	m_congestion = std::move(controller);
+	m_send_credit = 0.0f;
+	updateWindowSize();
+}
+
+void Channel::updateWindowSize()
+{
+	m_window_size = rangelim(m_congestion->getWindowSize(),
+			MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+	m_seqnum_span = rangelim(m_congestion->getSeqnumSpan(),
+			(u32)m_window_size, MAX_RELIABLE_WINDOW_SIZE);
+}
+
 u16 Channel::readNextIncomingSeqNum()
 {
 	MutexAutoLock internal(m_internal_mutex);
@@ -629,7 +729,7 @@ u16 Channel::getOutgoingSequenceNumber(bool& successful)
 			// ugly cast but this one is required in order to tell compiler we
 			// know about difference of two unsigned may be negative in general
 			// but we already made sure it won't happen in this case
-			if (((u16)(next_outgoing_seqnum - lowest_unacked_seqnumber)) > m_window_size) {
+			if (((u16)(next_outgoing_seqnum - lowest_unacked_seqnumber)) > m_seqnum_span) {
 				return 0;
 			}
 		} else {
@@ -637,7 +737,7 @@ u16 Channel::getOutgoingSequenceNumber(bool& successful)
 			// know about difference of two unsigned may be negative in general
 			// but we already made sure it won't happen in this case
 			if ((next_outgoing_seqnum + (u16)(SEQNUM_MAX - lowest_unacked_seqnumber)) >
-					m_window_size) {
+					m_seqnum_span) {
 				return 0;
 			}
 		}
@@ -664,13 +764,6 @@ bool Channel::putBackSequenceNumber(u16 seqnum)
 	return false;
 }
 
-void Channel::UpdateBytesSent(unsigned int bytes, unsigned int packets)
-{
-	MutexAutoLock internal(m_internal_mutex);
-	current_bytes_transfered += bytes;
-	current_packet_successful += packets;
-}
-
 void Channel::UpdateBytesReceived(unsigned int bytes) {
 	MutexAutoLock internal(m_internal_mutex);
 	current_bytes_received += bytes;
@@ -686,7 +779,35 @@ void Channel::UpdateBytesLost(unsigned int bytes)
 void Channel::UpdatePacketLossCounter(unsigned int count)
 {
 	MutexAutoLock internal(m_internal_mutex);
-	current_packet_loss += count;
+	m_congestion->onPacketsLost(count, porting::getTimeMs());
+	updateWindowSize();
+}
+
+void Channel::UpdatePacketAcked(unsigned int bytes, float rtt)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	current_bytes_transfered += bytes;
+	m_congestion->onPacketAcked(bytes, rtt, porting::getTimeMs());
+	updateWindowSize();
+}
+
+bool Channel::allowSend(unsigned int bytes)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	const u64 now = porting::getTimeMs();
+	const float rate = m_congestion->getPacingRate();
+	if (rate > 0.0f) {
+		// Allow bursts of up to one send thread iteration
+		const float max_credit = MYMAX(rate * PACING_BURST_TIME, (float)bytes);
+		m_send_credit = MYMIN(m_send_credit +
+				(now - m_send_credit_time) / 1000.0f * rate, max_credit);
+		m_send_credit_time = now;
+		if (m_send_credit < bytes)
+			return false;
+		m_send_credit -= bytes;
+	}
+	m_congestion->onPacketSent(bytes, now);
+	return true;
 }
 
 void Channel::UpdatePacketTooLateCounter()
@@ -698,59 +819,11 @@ void Channel::UpdatePacketTooLateCounter()
 void Channel::UpdateTimers(float dtime)
 {
 	bpm_counter += dtime;
-	packet_loss_counter += dtime;
-
-	if (packet_loss_counter > 1.0f) {
-		packet_loss_counter -= 1.0f;
-
-		unsigned int packet_loss = 11; /* use a neutral value for initialization */
-		unsigned int packets_successful = 0;
-		//unsigned int packet_too_late = 0;
-
-		bool reasonable_amount_of_data_transmitted = false;
 
-		{
-			MutexAutoLock internal(m_internal_mutex);
-			packet_loss = current_packet_loss;
-			//packet_too_late = current_packet_too_late;
-			packets_successful = current_packet_successful;
-
-			if (current_bytes_transfered > (unsigned int) (m_window_size*512/2)) {
-				reasonable_amount_of_data_transmitted = true;
-			}
-			current_packet_loss = 0;
-			current_packet_too_late = 0;
-			current_packet_successful = 0;
-		}
-
-		/* dynamic window size */
-		float successful_to_lost_ratio = 0.0f;
-		bool done = false;
-
-		if (packets_successful > 0) {
-			successful_to_lost_ratio = packet_loss/packets_successful;
-		} else if (packet_loss > 0) {
-			setWindowSize(m_window_size - 10);
-			done = true;
-		}
-
-		if (!done) {
-			if (successful_to_lost_ratio < 0.01f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 100);
-			} else if (successful_to_lost_ratio < 0.05f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 50);
-			} else if (successful_to_lost_ratio > 0.15f) {
-				setWindowSize(m_window_size - 100);
-			} else if (successful_to_lost_ratio > 0.1f) {
-				setWindowSize(m_window_size - 50);
-			}
-		}
+	{
+		MutexAutoLock internal(m_internal_mutex);
+		m_congestion->step(dtime, porting::getTimeMs());
+		updateWindowSize();
 	}
 
 	if (bpm_counter > 10.0f) {
@@ -949,8 +1022,9 @@ void Peer::Drop()
 UDPPeer::UDPPeer(u16 a_id, Address a_address, Connection* connection) :
 	Peer(a_address,a_id,connection)
 {
+	const std::string congestion_control = connection->getCongestionControl();
 	for (Channel &channel : channels)
-		channel.setWindowSize(START_RELIABLE_WINDOW_SIZE);
+		channel.setCongestionController(createCongestionController(congestion_control));
 }
 
 bool UDPPeer::getAddress(MTProtocols type,Address& toset)
@@ -1008,13 +1082,13 @@ void UDPPeer::PutReliableSendCommand(ConnectionCommandPtr &c,
 			(chan.queued_reliables.size() + 1 < chan.getWindowSize() / 2)) {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" processing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() << std::endl);
+				<<" data size: " << c->data.size() << std::endl);
 		if (processReliableSendCommand(c, max_packet_size))
 			return;
 	} else {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" Queueing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() <<std::endl);
+				<<" data size: " << c->data.size() <<std::endl);
 
 		if (chan.queued_commands.size() + 1 >= chan.getWindowSize() / 2) {
 			LOG(derr_con << m_connection->getDesc()
@@ -1040,15 +1114,23 @@ bool UDPPeer::processReliableSendCommand(
 							- BASE_HEADER_SIZE
 							- RELIABLE_HEADER_SIZE;
 
-	sanity_check(c.data.getSize() < MAX_RELIABLE_WINDOW_SIZE*512);
+	sanity_check(c.data.size() < MAX_RELIABLE_WINDOW_SIZE*512);
 
-	std::list<SharedBuffer<u8>> originals;
+	// Packets with base headers, the seqnums are filled in below
+	std::vector<BufferedPacketPtr> packets;
 	u16 split_sequence_number = chan.readNextSplitSeqNum();
 
 	if (c.raw) {
-		originals.emplace_back(c.data);
+		SharedBuffer<u8> reliable = makeReliablePacket(
+				SharedBuffer<u8>(c.data.data(), c.data.size()), 0);
+		packets.push_back(con::makePacket(address, reliable,
+				m_connection->GetProtocolID(), m_connection->GetPeerID(),
+				c.channelnum));
 	} else {
-		makeAutoSplitPacket(c.data, chunksize_max,split_sequence_number, &originals);
+		makeAutoSplitReliablePackets(address, c.data.data(), c.data.size(),
+				chunksize_max, split_sequence_number,
+				m_connection->GetProtocolID(), m_connection->GetPeerID(),
+				c.channelnum, &packets);
 		chan.setNextSplitSeqNum(split_sequence_number);
 	}
 
@@ -1057,7 +1139,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacketPtr> toadd;
 	volatile u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (BufferedPacketPtr &p : packets) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1070,13 +1152,7 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
-
-		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(address, reliable,
-				m_connection->GetProtocolID(), m_connection->GetPeerID(),
-				c.channelnum);
-
+		setReliableSeqnum(*p, seqnum);
 		toadd.push(p);
 	}
 
@@ -1119,7 +1195,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	LOG(dout_con<<m_connection->getDesc()
 			<< " Windowsize exceeded on reliable sending "
-			<< c.data.getSize() << " bytes"
+			<< c.data.size() << " bytes"
 			<< std::endl << "\t\tinitial_sequence_number: "
 			<< initial_sequence_number
 			<< std::endl << "\t\tgot at most            : "
@@ -1155,7 +1231,7 @@ void UDPPeer::RunCommandQueues(
 				} else {
 					LOG(dout_con << m_connection->getDesc()
 							<< " Failed to queue packets for peer_id: " << c->peer_id
-							<< ", delaying sending of " << c->data.getSize()
+							<< ", delaying sending of " << c->data.size()
 							<< " bytes" << std::endl);
 				}
 			}
@@ -1259,6 +1335,8 @@ Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
 	 * from the connection timeout */
 	m_udpSocket.setTimeoutMs(500);
 
+	m_congestion_control = g_settings->get("congestion_control");
+
 	m_sendThread->setParent(this);
 	m_receiveThread->setParent(this);
 
@@ -1485,6 +1563,26 @@ void Connection::Send(session_t peer_id, u8 channelnum,
 	putCommand(ConnectionCommand::send(peer_id, channelnum, pkt, reliable));
 }
 
+void Connection::Send(session_t peer_id, u8 channelnum,
+		NetworkPacket &&pkt, bool reliable)
+{
+	assert(channelnum < CHANNEL_COUNT); // Pre-condition
+
+	putCommand(ConnectionCommand::send(peer_id, channelnum, std::move(pkt), reliable));
+}
+
+void Connection::SetCongestionControl(const std::string &name)
+{
+	MutexAutoLock lock(m_info_mutex);
+	m_congestion_control = name;
+}
+
+std::string Connection::getCongestionControl() const
+{
+	MutexAutoLock lock(m_info_mutex);
+	return m_congestion_control;
+}
+
 Address Connection::GetPeerAddress(session_t peer_id)
 {
 	PeerHelper peer = getPeerNoEx(peer_id);
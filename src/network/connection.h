@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include "congestioncontrol.h"
 #include "peerhandler.h"
 #include "socket.h"
 #include "constants.h"
@@ -28,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/thread.h"
 #include "util/numeric.h"
 #include "networkprotocol.h"
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <map>
@@ -222,6 +224,15 @@ void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 // Add the TYPE_RELIABLE header to the data
 SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
 
+// Like makeAutoSplitPacket() followed by makeReliablePacket() and
+// makePacket(), but the data is copied only once, straight into the
+// final packets. The seqnums are set later with setReliableSeqnum().
+void makeAutoSplitReliablePackets(Address &address, const u8 *data, u32 size,
+		u32 chunksize_max, u16 &split_seqnum, u32 protocol_id,
+		session_t sender_peer_id, u8 channel, std::vector<BufferedPacketPtr> *list);
+
+void setReliableSeqnum(BufferedPacket &p, u16 seqnum);
+
 struct IncomingSplitPacket
 {
 	IncomingSplitPacket(u32 cc, bool r):
@@ -248,9 +259,12 @@ struct IncomingSplitPacket
 /*
 	A buffer which stores reliable packets and sorts them internally
 	for fast access to the smallest one.
-*/
 
-typedef std::list<BufferedPacketPtr>::iterator RPBSearchResult;
+	Packets are kept in a ring indexed by seqnum, so inserting, looking up
+	and removing a packet takes constant time. The ring grows to cover the
+	sequence numbers from the first to the last buffered packet, which are
+	at most a window apart.
+*/
 
 class ReliablePacketBuffer
 {
@@ -272,11 +286,19 @@ class ReliablePacketBuffer
 
 
 private:
-	RPBSearchResult findPacketNoLock(u16 seqnum);
-
-	std::list<BufferedPacketPtr> m_list;
-
-	u16 m_oldest_non_answered_ack;
+	BufferedPacketPtr &slotNoLock(u16 seqnum)
+	{ return m_slots[seqnum & (m_slots.size() - 1)]; }
+	// Makes the ring large enough for span sequence numbers
+	void reserveNoLock(u32 span);
+	BufferedPacketPtr removeNoLock(u16 seqnum);
+
+	// Size is zero or a power of two
+	std::vector<BufferedPacketPtr> m_slots;
+	// Smallest buffered seqnum
+	u16 m_first = 0;
+	// Number of sequence numbers from the first to the last buffered packet
+	u32 m_span = 0;
+	u32 m_count = 0;
 
 	std::mutex m_list_mutex;
 };
@@ -326,7 +348,8 @@ struct ConnectionCommand
 	Address address;
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
-	Buffer<u8> data;
+	// For CONNCMD_SEND(_TO_ALL) this is the forged NetworkPacket
+	std::vector<u8> data;
 	bool reliable = false;
 	bool raw = false;
 
@@ -337,6 +360,8 @@ struct ConnectionCommand
 	static ConnectionCommandPtr disconnect();
 	static ConnectionCommandPtr disconnect_peer(session_t peer_id);
 	static ConnectionCommandPtr send(session_t peer_id, u8 channelnum, NetworkPacket *pkt, bool reliable);
+	// Takes over the data of pkt instead of copying it
+	static ConnectionCommandPtr send(session_t peer_id, u8 channelnum, NetworkPacket &&pkt, bool reliable);
 	static ConnectionCommandPtr ack(session_t peer_id, u8 channelnum, const Buffer<u8> &data);
 	static ConnectionCommandPtr createPeer(session_t peer_id, const Buffer<u8> &data);
 
@@ -356,6 +381,8 @@ struct ConnectionCommand
 #define START_RELIABLE_WINDOW_SIZE 0x400
 /* minimum value for window size */
 #define MIN_RELIABLE_WINDOW_SIZE 0x40
+/* how much a paced channel may send at once, in seconds of its pacing rate */
+#define PACING_BURST_TIME 0.01f
 
 class Channel
 {
@@ -386,14 +413,20 @@ class Channel
 
 	IncomingSplitBuffer incoming_splits;
 
-	Channel() = default;
+	Channel();
 	~Channel() = default;
 
+	void setCongestionController(std::unique_ptr<CongestionController> controller);
+
 	void UpdatePacketLossCounter(unsigned int count);
 	void UpdatePacketTooLateCounter();
-	void UpdateBytesSent(unsigned int bytes,unsigned int packages=1);
 	void UpdateBytesLost(unsigned int bytes);
 	void UpdateBytesReceived(unsigned int bytes);
+	// A reliable packet was acked, rtt is negative if it is not known
+	void UpdatePacketAcked(unsigned int bytes, float rtt);
+	// Takes a reliable packet that is about to be sent for the first time
+	// from the pacing budget. Returns false if it has to wait.
+	bool allowSend(unsigned int bytes);
 
 	void UpdateTimers(float dtime);
 
@@ -421,24 +454,28 @@ class Channel
 
 	u16 getWindowSize() const { return m_window_size; };
 
-	void setWindowSize(long size)
-	{
-		m_window_size = (u16)rangelim(size, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
-	}
+	const char *getCongestionControlName()
+		{ MutexAutoLock lock(m_internal_mutex); return m_congestion->getName(); }
 
 private:
+	// Call with m_internal_mutex held
+	void updateWindowSize();
+
 	std::mutex m_internal_mutex;
-	u16 m_window_size = MIN_RELIABLE_WINDOW_SIZE;
+	std::unique_ptr<CongestionController> m_congestion;
+	// Copied from m_congestion so that it can be read without locking
+	std::atomic<u16> m_window_size{MIN_RELIABLE_WINDOW_SIZE};
+	u16 m_seqnum_span = MIN_RELIABLE_WINDOW_SIZE;
+	// Pacing budget in bytes, refilled at the pacing rate
+	float m_send_credit = 0.0f;
+	u64 m_send_credit_time = 0;
 
 	u16 next_incoming_seqnum = SEQNUM_INITIAL;
 
 	u16 next_outgoing_seqnum = SEQNUM_INITIAL;
 	u16 next_outgoing_split_seqnum = SEQNUM_INITIAL;
 
-	unsigned int current_packet_loss = 0;
 	unsigned int current_packet_too_late = 0;
-	unsigned int current_packet_successful = 0;
-	float packet_loss_counter = 0.0f;
 
 	unsigned int current_bytes_transfered = 0;
 	unsigned int current_bytes_received = 0;
@@ -718,6 +755,8 @@ class Connection
 	void Receive(NetworkPacket *pkt);
 	bool TryReceive(NetworkPacket *pkt);
 	void Send(session_t peer_id, u8 channelnum, NetworkPacket *pkt, bool reliable);
+	// Same, but without copying the data. pkt is empty afterwards.
+	void Send(session_t peer_id, u8 channelnum, NetworkPacket &&pkt, bool reliable);
 	session_t GetPeerID() const { return m_peer_id; }
 	Address GetPeerAddress(session_t peer_id);
 	float getPeerStat(session_t peer_id, rtt_stat_type type);
@@ -725,6 +764,11 @@ class Connection
 	u32 GetProtocolID() const { return m_protocol_id; };
 	const std::string getDesc();
 	void DisconnectPeer(session_t peer_id);
+	UDPSocket::Stats getSocketStats() const { return m_udpSocket.getStats(); }
+	// Congestion control for peers added from now on, one of the values of
+	// the congestion_control setting, which is the default
+	void SetCongestionControl(const std::string &name);
+	std::string getCongestionControl() const;
 
 protected:
 	PeerHelper getPeerNoEx(session_t peer_id);
@@ -771,6 +815,7 @@ class Connection
 	std::unique_ptr<ConnectionReceiveThread> m_receiveThread;
 
 	mutable std::mutex m_info_mutex;
+	std::string m_congestion_control;
 
 	// Backwards compatibility
 	PeerHandler *m_bc_peerhandler;
@@ -46,6 +46,10 @@ namespace con
 
 #define WINDOW_SIZE 5
 
+// Number of packets handed to the socket at once
+#define SEND_BATCH_SIZE 64
+#define RECEIVE_BATCH_SIZE 32
+
 static session_t readPeerId(const u8 *packetdata)
 {
 	return readU16(&packetdata[4]);
@@ -90,8 +94,9 @@ void *ConnectionSendThread::run()
 
 		m_iteration_packets_avaialble = m_max_data_packets_per_iteration;
 
-		/* wait for trigger or timeout */
-		m_send_sleep_semaphore.wait(50);
+		/* wait for trigger or timeout, don't let paced packets wait long */
+		m_send_sleep_semaphore.wait(m_pacing_limited ? 2 : 50);
+		m_pacing_limited = false;
 
 		/* remove all triggers */
 		while (m_send_sleep_semaphore.wait(0)) {
@@ -103,6 +108,7 @@ void *ConnectionSendThread::run()
 
 		/* first resend timed-out packets */
 		runTimeouts(dtime);
+		flushSendBatch();
 		if (m_iteration_packets_avaialble == 0) {
 			LOG(warningstream << m_connection->getDesc()
 				<< " Packet quota used up after re-sending packets, "
@@ -122,6 +128,7 @@ void *ConnectionSendThread::run()
 
 		/* send queued packets */
 		sendPackets(dtime);
+		flushSendBatch();
 
 		END_DEBUG_EXCEPTION_HANDLER
 	}
@@ -237,7 +244,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 					<< ", seqnum=" << seqnum
 					<< std::endl);
 
-				rawSend(k.get());
+				rawSend(k);
 
 				// do not handle rtt here as we can't decide if this packet was
 				// lost or really takes more time to transmit
@@ -270,18 +277,42 @@ void ConnectionSendThread::runTimeouts(float dtime)
 	}
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
 {
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
+	m_send_batch.push_back(p);
+	if (m_send_batch.size() >= SEND_BATCH_SIZE)
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.empty())
+		return;
+
+	std::vector<UDPSendItem> items(m_send_batch.size());
+	size_t bytes = 0;
+	for (size_t i = 0; i < m_send_batch.size(); i++) {
+		const BufferedPacket *p = m_send_batch[i].get();
+		items[i].address = p->address;
+		items[i].data = p->data;
+		items[i].size = p->size();
+		bytes += p->size();
+	}
+
+	int dropped = 0;
+	const int handled = m_connection->m_udpSocket.SendBatch(items.data(),
+			items.size(), &dropped);
+	if (dropped == 0 && handled == (int)items.size()) {
 		LOG(dout_con << m_connection->getDesc()
-			<< " rawSend: " << p->size()
-			<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
+			<< " rawSend: " << handled << " packets, "
+			<< bytes << " bytes sent" << std::endl);
+	} else if (dropped > 0) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "Connection::rawSend(): SendFailedException: "
-			<< p->address.serializeString() << std::endl);
+			<< "Connection::rawSend(): failed to send "
+			<< dropped << " of " << handled << " packets" << std::endl);
 	}
+	// Whatever did not fit into the send buffer goes out with the next batch
+	m_send_batch.erase(m_send_batch.begin(), m_send_batch.begin() + handled);
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
@@ -300,7 +331,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
@@ -332,7 +363,8 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			channelnum);
 
 		// first check if our send window is already maxed out
-		if (channel->outgoing_reliables_sent.size() < channel->getWindowSize()) {
+		if (channel->outgoing_reliables_sent.size() < channel->getWindowSize() &&
+				channel->allowSend(p->size())) {
 			LOG(dout_con << m_connection->getDesc()
 				<< " INFO: sending a reliable packet to peer_id " << peer_id
 				<< " channel: " << (u32)channelnum
@@ -357,7 +389,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			channelnum);
 
 		// Send the packet
-		rawSend(p.get());
+		rawSend(p);
 		return true;
 	}
 
@@ -392,7 +424,8 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 		case CONCMD_CREATE_PEER:
 			LOG(dout_con << m_connection->getDesc()
 				<< "UDP processing reliable CONCMD_CREATE_PEER" << std::endl);
-			if (!rawSendAsPacket(c->peer_id, c->channelnum, c->data, c->reliable)) {
+			if (!rawSendAsPacket(c->peer_id, c->channelnum,
+					SharedBuffer<u8>(c->data.data(), c->data.size()), c->reliable)) {
 				/* put to queue if we couldn't send it immediately */
 				sendReliable(c);
 			}
@@ -444,17 +477,20 @@ void ConnectionSendThread::processNonReliableCommand(ConnectionCommandPtr &c_ptr
 		case CONNCMD_SEND:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONNCMD_SEND" << std::endl);
-			send(c.peer_id, c.channelnum, c.data);
+			send(c.peer_id, c.channelnum,
+				SharedBuffer<u8>(c.data.data(), c.data.size()));
 			return;
 		case CONNCMD_SEND_TO_ALL:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONNCMD_SEND_TO_ALL" << std::endl);
-			sendToAll(c.channelnum, c.data);
+			sendToAll(c.channelnum,
+				SharedBuffer<u8>(c.data.data(), c.data.size()));
 			return;
 		case CONCMD_ACK:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONCMD_ACK" << std::endl);
-			sendAsPacket(c.peer_id, c.channelnum, c.data, true);
+			sendAsPacket(c.peer_id, c.channelnum,
+				SharedBuffer<u8>(c.data.data(), c.data.size()), true);
 			return;
 		case CONCMD_CREATE_PEER:
 			FATAL_ERROR("Got command that should be reliable as unreliable command");
@@ -689,6 +725,11 @@ void ConnectionSendThread::sendPackets(float dtime)
 					< channel.getWindowSize() &&
 					peer->m_increment_packets_remaining > 0) {
 				BufferedPacketPtr p = channel.queued_reliables.front();
+				if (!channel.allowSend(p->size())) {
+					// Try again soon
+					m_pacing_limited = true;
+					break;
+				}
 				channel.queued_reliables.pop();
 
 				LOG(dout_con << m_connection->getDesc()
@@ -787,7 +828,8 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	// room for a batch of packets
+	SharedBuffer<u8> packetdata(packet_maxsize * RECEIVE_BATCH_SIZE);
 
 	bool packet_queued = true;
 
@@ -872,32 +914,57 @@ void *ConnectionReceiveThread::run()
 void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 		bool &packet_queued)
 {
-	try {
-		// First, see if there any buffered packets we can process now
+	// First, see if there any buffered packets we can process now
+	if (packet_queued) {
+		processBufferedPackets();
+		packet_queued = false;
+	}
+
+	// Wait for incoming data and read as many packets as there are
+	UDPReceiveItem items[RECEIVE_BATCH_SIZE];
+	const int packet_maxsize = packetdata.getSize() / RECEIVE_BATCH_SIZE;
+	for (int i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+		items[i].data = &packetdata[i * packet_maxsize];
+		items[i].capacity = packet_maxsize;
+	}
+
+	int count = m_connection->m_udpSocket.ReceiveBatch(items, RECEIVE_BATCH_SIZE);
+	for (int i = 0; i < count; i++) {
+		// A previous packet might have completed buffered ones
 		if (packet_queued) {
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (true) {
-				try {
-					if (!getFromBuffers(peer_id, resultdata))
-						break;
-
-					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
-				}
-			}
+			processBufferedPackets();
 			packet_queued = false;
 		}
+		processDatagram(items[i].address, items[i].data, items[i].size,
+				packet_queued);
+	}
+}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
+void ConnectionReceiveThread::processBufferedPackets()
+{
+	try {
+		session_t peer_id;
+		SharedBuffer<u8> resultdata;
+		while (true) {
+			try {
+				if (!getFromBuffers(peer_id, resultdata))
+					break;
+
+				m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+			}
+			catch (ProcessedSilentlyException &e) {
+				/* try reading again */
+			}
+		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
 
+void ConnectionReceiveThread::processDatagram(Address &sender,
+		const u8 *packetdata, s32 received_size, bool &packet_queued)
+{
+	try {
 		if ((received_size < BASE_HEADER_SIZE) ||
 				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
 			LOG(derr_con << m_connection->getDesc()
@@ -909,8 +976,8 @@ void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 			return;
 		}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+		session_t peer_id = readPeerId(packetdata);
+		u8 channelnum = readChannel(packetdata);
 
 		if (channelnum > CHANNEL_COUNT - 1) {
 			LOG(derr_con << m_connection->getDesc()
@@ -1125,31 +1192,31 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 		try {
 			BufferedPacketPtr p = channel->outgoing_reliables_sent.popSeqnum(seqnum);
 
-			// the rtt calculation will be a bit off for re-sent packets but that's okay
-			{
+			// For re-sent packets it is unknown which copy was acked, don't
+			// let them distort the round trip time (Karn's algorithm)
+			float rtt = -1.0f;
+			if (p->resend_count == 0) {
 				// Get round trip time
 				u64 current_time = porting::getTimeMs();
 
 				// an overflow is quite unlikely but as it'd result in major
 				// rtt miscalculation we handle it here
-				if (current_time > p->absolute_send_time) {
-					float rtt = (current_time - p->absolute_send_time) / 1000.0;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
-					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				} else if (p->totaltime > 0) {
-					float rtt = p->totaltime;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
+				if (current_time > p->absolute_send_time)
+					rtt = (current_time - p->absolute_send_time) / 1000.0;
+				else if (p->totaltime > 0)
+					rtt = p->totaltime;
+
+				// Let peer calculate stuff according to it
+				// (avg_rtt and resend_timeout)
+				if (rtt >= 0.0f)
 					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				}
 			}
 
 			// put bytes for max bandwidth calculation
-			channel->UpdateBytesSent(p->size(), 1);
-			if (channel->outgoing_reliables_sent.size() == 0)
+			channel->UpdatePacketAcked(p->size(), rtt);
+			// Also send on right away if the window was full
+			const u32 in_flight = channel->outgoing_reliables_sent.size();
+			if (in_flight == 0 || in_flight + 1 >= channel->getWindowSize())
 				m_connection->TriggerSend();
 		} catch (NotFoundException &e) {
 			LOG(derr_con << m_connection->getDesc()
@@ -70,7 +70,10 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime);
-	void rawSend(const BufferedPacket *p);
+	// Queues a packet for the next flushSendBatch()
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	// Sends all packets given to rawSend() so far
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
 			const SharedBuffer<u8> &data, bool reliable);
 
@@ -98,7 +101,11 @@ class ConnectionSendThread : public Thread
 	unsigned int m_max_packet_size;
 	float m_timeout;
 	std::queue<OutgoingPacket> m_outgoing_queue;
+	// Packets waiting to be handed to the socket
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
 	Semaphore m_send_sleep_semaphore;
+	// Set if a channel had to hold packets back for pacing
+	bool m_pacing_limited = false;
 
 	unsigned int m_iteration_packets_avaialble;
 	unsigned int m_max_commands_per_iteration = 1;
@@ -121,6 +128,10 @@ class ConnectionReceiveThread : public Thread
 
 private:
 	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	// Turns buffered packets that are ready into events
+	void processBufferedPackets();
+	void processDatagram(Address &sender, const u8 *packetdata,
+			s32 received_size, bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
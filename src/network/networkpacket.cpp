@@ -26,13 +26,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 NetworkPacket::NetworkPacket(u16 command, u32 datasize, session_t peer_id):
 m_datasize(datasize), m_command(command), m_peer_id(peer_id)
 {
-	m_data.resize(m_datasize);
+	m_data.resize(HEADER_SIZE + m_datasize);
 }
 
 NetworkPacket::NetworkPacket(u16 command, u32 datasize):
 m_datasize(datasize), m_command(command)
 {
-	m_data.resize(m_datasize);
+	m_data.resize(HEADER_SIZE + m_datasize);
 }
 
 NetworkPacket::~NetworkPacket()
@@ -56,15 +56,12 @@ void NetworkPacket::putRawPacket(const u8 *data, u32 datasize, session_t peer_id
 	// This is not permitted
 	assert(m_command == 0);
 
-	m_datasize = datasize - 2;
+	m_datasize = datasize - HEADER_SIZE;
 	m_peer_id = peer_id;
 
-	m_data.resize(m_datasize);
-
-	// split command and datas
+	// the data is kept with the command in front
+	m_data.assign(data, data + datasize);
 	m_command = readU16(&data[0]);
-	if (m_datasize > 0)
-		memcpy(m_data.data(), &data[2], m_datasize);
 }
 
 void NetworkPacket::clear()
@@ -80,27 +77,27 @@ const char* NetworkPacket::getString(u32 from_offset)
 {
 	checkReadOffset(from_offset, 0);
 
-	return (char*)&m_data[from_offset];
+	return (char*)&m_data[HEADER_SIZE + from_offset];
 }
 
 void NetworkPacket::putRawString(const char* src, u32 len)
 {
 	if (m_read_offset + len > m_datasize) {
 		m_datasize = m_read_offset + len;
-		m_data.resize(m_datasize);
+		m_data.resize(HEADER_SIZE + m_datasize);
 	}
 
 	if (len == 0)
 		return;
 
-	memcpy(&m_data[m_read_offset], src, len);
+	memcpy(&m_data[HEADER_SIZE + m_read_offset], src, len);
 	m_read_offset += len;
 }
 
 NetworkPacket& NetworkPacket::operator>>(std::string& dst)
 {
 	checkReadOffset(m_read_offset, 2);
-	u16 strLen = readU16(&m_data[m_read_offset]);
+	u16 strLen = readU16(&m_data[HEADER_SIZE + m_read_offset]);
 	m_read_offset += 2;
 
 	dst.clear();
@@ -112,7 +109,7 @@ NetworkPacket& NetworkPacket::operator>>(std::string& dst)
 	checkReadOffset(m_read_offset, strLen);
 
 	dst.reserve(strLen);
-	dst.append((char*)&m_data[m_read_offset], strLen);
+	dst.append((char*)&m_data[HEADER_SIZE + m_read_offset], strLen);
 
 	m_read_offset += strLen;
 	return *this;
@@ -151,7 +148,7 @@ static constexpr bool NEED_SURROGATE_CODING = sizeof(wchar_t) > 2;
 NetworkPacket& NetworkPacket::operator>>(std::wstring& dst)
 {
 	checkReadOffset(m_read_offset, 2);
-	u16 strLen = readU16(&m_data[m_read_offset]);
+	u16 strLen = readU16(&m_data[HEADER_SIZE + m_read_offset]);
 	m_read_offset += 2;
 
 	dst.clear();
@@ -164,12 +161,12 @@ NetworkPacket& NetworkPacket::operator>>(std::wstring& dst)
 
 	dst.reserve(strLen);
 	for (u16 i = 0; i < strLen; i++) {
-		wchar_t c = readU16(&m_data[m_read_offset]);
+		wchar_t c = readU16(&m_data[HEADER_SIZE + m_read_offset]);
 		if (NEED_SURROGATE_CODING && c >= 0xD800 && c < 0xDC00 && i+1 < strLen) {
 			i++;
 			m_read_offset += sizeof(u16);
 
-			wchar_t c2 = readU16(&m_data[m_read_offset]);
+			wchar_t c2 = readU16(&m_data[HEADER_SIZE + m_read_offset]);
 			c = 0x10000 + ( ((c & 0x3ff) << 10) | (c2 & 0x3ff) );
 		}
 		dst.push_back(c);
@@ -214,7 +211,7 @@ NetworkPacket& NetworkPacket::operator<<(const std::wstring &src)
 
 	if (written > WIDE_STRING_MAX_LEN)
 		throw PacketError("String too long");
-	writeU16(&m_data[len_offset], written);
+	writeU16(&m_data[HEADER_SIZE + len_offset], written);
 
 	return *this;
 }
@@ -222,7 +219,7 @@ NetworkPacket& NetworkPacket::operator<<(const std::wstring &src)
 std::string NetworkPacket::readLongString()
 {
 	checkReadOffset(m_read_offset, 4);
-	u32 strLen = readU32(&m_data[m_read_offset]);
+	u32 strLen = readU32(&m_data[HEADER_SIZE + m_read_offset]);
 	m_read_offset += 4;
 
 	if (strLen == 0) {
@@ -238,7 +235,7 @@ std::string NetworkPacket::readLongString()
 	std::string dst;
 
 	dst.reserve(strLen);
-	dst.append((char*)&m_data[m_read_offset], strLen);
+	dst.append((char*)&m_data[HEADER_SIZE + m_read_offset], strLen);
 
 	m_read_offset += strLen;
 
@@ -249,7 +246,7 @@ NetworkPacket& NetworkPacket::operator>>(char& dst)
 {
 	checkReadOffset(m_read_offset, 1);
 
-	dst = readU8(&m_data[m_read_offset]);
+	dst = readU8(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 1;
 	return *this;
@@ -259,7 +256,7 @@ NetworkPacket& NetworkPacket::operator<<(char src)
 {
 	checkDataSize(1);
 
-	writeU8(&m_data[m_read_offset], src);
+	writeU8(&m_data[HEADER_SIZE + m_read_offset], src);
 
 	m_read_offset += 1;
 	return *this;
@@ -269,7 +266,7 @@ NetworkPacket& NetworkPacket::operator<<(u8 src)
 {
 	checkDataSize(1);
 
-	writeU8(&m_data[m_read_offset], src);
+	writeU8(&m_data[HEADER_SIZE + m_read_offset], src);
 
 	m_read_offset += 1;
 	return *this;
@@ -279,7 +276,7 @@ NetworkPacket& NetworkPacket::operator<<(bool src)
 {
 	checkDataSize(1);
 
-	writeU8(&m_data[m_read_offset], src);
+	writeU8(&m_data[HEADER_SIZE + m_read_offset], src);
 
 	m_read_offset += 1;
 	return *this;
@@ -289,7 +286,7 @@ NetworkPacket& NetworkPacket::operator<<(u16 src)
 {
 	checkDataSize(2);
 
-	writeU16(&m_data[m_read_offset], src);
+	writeU16(&m_data[HEADER_SIZE + m_read_offset], src);
 
 	m_read_offset += 2;
 	return *this;
@@ -299,7 +296,7 @@ NetworkPacket& NetworkPacket::operator<<(u32 src)
 {
 	checkDataSize(4);
 
-	writeU32(&m_data[m_read_offset], src);
+	writeU32(&m_data[HEADER_SIZE + m_read_offset], src);
 
 	m_read_offset += 4;
 	return *this;
@@ -309,7 +306,7 @@ NetworkPacket& NetworkPacket::operator<<(u64 src)
 {
 	checkDataSize(8);
 
-	writeU64(&m_data[m_read_offset], src);
+	writeU64(&m_data[HEADER_SIZE + m_read_offset], src);
 
 	m_read_offset += 8;
 	return *this;
@@ -319,7 +316,7 @@ NetworkPacket& NetworkPacket::operator<<(float src)
 {
 	checkDataSize(4);
 
-	writeF32(&m_data[m_read_offset], src);
+	writeF32(&m_data[HEADER_SIZE + m_read_offset], src);
 
 	m_read_offset += 4;
 	return *this;
@@ -329,7 +326,7 @@ NetworkPacket& NetworkPacket::operator>>(bool& dst)
 {
 	checkReadOffset(m_read_offset, 1);
 
-	dst = readU8(&m_data[m_read_offset]);
+	dst = readU8(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 1;
 	return *this;
@@ -339,7 +336,7 @@ NetworkPacket& NetworkPacket::operator>>(u8& dst)
 {
 	checkReadOffset(m_read_offset, 1);
 
-	dst = readU8(&m_data[m_read_offset]);
+	dst = readU8(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 1;
 	return *this;
@@ -349,7 +346,7 @@ u8 NetworkPacket::getU8(u32 offset)
 {
 	checkReadOffset(offset, 1);
 
-	return readU8(&m_data[offset]);
+	return readU8(&m_data[HEADER_SIZE + offset]);
 }
 
 u8* NetworkPacket::getU8Ptr(u32 from_offset)
@@ -360,14 +357,14 @@ u8* NetworkPacket::getU8Ptr(u32 from_offset)
 
 	checkReadOffset(from_offset, 1);
 
-	return (u8*)&m_data[from_offset];
+	return (u8*)&m_data[HEADER_SIZE + from_offset];
 }
 
 NetworkPacket& NetworkPacket::operator>>(u16& dst)
 {
 	checkReadOffset(m_read_offset, 2);
 
-	dst = readU16(&m_data[m_read_offset]);
+	dst = readU16(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 2;
 	return *this;
@@ -377,14 +374,14 @@ u16 NetworkPacket::getU16(u32 from_offset)
 {
 	checkReadOffset(from_offset, 2);
 
-	return readU16(&m_data[from_offset]);
+	return readU16(&m_data[HEADER_SIZE + from_offset]);
 }
 
 NetworkPacket& NetworkPacket::operator>>(u32& dst)
 {
 	checkReadOffset(m_read_offset, 4);
 
-	dst = readU32(&m_data[m_read_offset]);
+	dst = readU32(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 4;
 	return *this;
@@ -394,7 +391,7 @@ NetworkPacket& NetworkPacket::operator>>(u64& dst)
 {
 	checkReadOffset(m_read_offset, 8);
 
-	dst = readU64(&m_data[m_read_offset]);
+	dst = readU64(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 8;
 	return *this;
@@ -404,7 +401,7 @@ NetworkPacket& NetworkPacket::operator>>(float& dst)
 {
 	checkReadOffset(m_read_offset, 4);
 
-	dst = readF32(&m_data[m_read_offset]);
+	dst = readF32(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 4;
 	return *this;
@@ -414,7 +411,7 @@ NetworkPacket& NetworkPacket::operator>>(v2f& dst)
 {
 	checkReadOffset(m_read_offset, 8);
 
-	dst = readV2F32(&m_data[m_read_offset]);
+	dst = readV2F32(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 8;
 	return *this;
@@ -424,7 +421,7 @@ NetworkPacket& NetworkPacket::operator>>(v3f& dst)
 {
 	checkReadOffset(m_read_offset, 12);
 
-	dst = readV3F32(&m_data[m_read_offset]);
+	dst = readV3F32(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 12;
 	return *this;
@@ -434,7 +431,7 @@ NetworkPacket& NetworkPacket::operator>>(s16& dst)
 {
 	checkReadOffset(m_read_offset, 2);
 
-	dst = readS16(&m_data[m_read_offset]);
+	dst = readS16(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 2;
 	return *this;
@@ -450,7 +447,7 @@ NetworkPacket& NetworkPacket::operator>>(s32& dst)
 {
 	checkReadOffset(m_read_offset, 4);
 
-	dst = readS32(&m_data[m_read_offset]);
+	dst = readS32(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 4;
 	return *this;
@@ -466,7 +463,7 @@ NetworkPacket& NetworkPacket::operator>>(v3s16& dst)
 {
 	checkReadOffset(m_read_offset, 6);
 
-	dst = readV3S16(&m_data[m_read_offset]);
+	dst = readV3S16(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 6;
 	return *this;
@@ -476,7 +473,7 @@ NetworkPacket& NetworkPacket::operator>>(v2s32& dst)
 {
 	checkReadOffset(m_read_offset, 8);
 
-	dst = readV2S32(&m_data[m_read_offset]);
+	dst = readV2S32(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 8;
 	return *this;
@@ -486,7 +483,7 @@ NetworkPacket& NetworkPacket::operator>>(v3s32& dst)
 {
 	checkReadOffset(m_read_offset, 12);
 
-	dst = readV3S32(&m_data[m_read_offset]);
+	dst = readV3S32(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 12;
 	return *this;
@@ -534,7 +531,7 @@ NetworkPacket& NetworkPacket::operator>>(video::SColor& dst)
 {
 	checkReadOffset(m_read_offset, 4);
 
-	dst = readARGB8(&m_data[m_read_offset]);
+	dst = readARGB8(&m_data[HEADER_SIZE + m_read_offset]);
 
 	m_read_offset += 4;
 	return *this;
@@ -544,7 +541,7 @@ NetworkPacket& NetworkPacket::operator<<(video::SColor src)
 {
 	checkDataSize(4);
 
-	writeU32(&m_data[m_read_offset], src.color);
+	writeU32(&m_data[HEADER_SIZE + m_read_offset], src.color);
 
 	m_read_offset += 4;
 	return *this;
@@ -552,10 +549,30 @@ NetworkPacket& NetworkPacket::operator<<(video::SColor src)
 
 Buffer<u8> NetworkPacket::oldForgePacket()
 {
-	Buffer<u8> sb(m_datasize + 2);
+	Buffer<u8> sb(m_datasize + HEADER_SIZE);
 	writeU16(&sb[0], m_command);
 	if (m_datasize > 0)
-		memcpy(&sb[2], m_data.data(), m_datasize);
+		memcpy(&sb[HEADER_SIZE], &m_data[HEADER_SIZE], m_datasize);
 
 	return sb;
 }
+
+std::vector<u8> NetworkPacket::getForgedPacket() const
+{
+	std::vector<u8> data(HEADER_SIZE + m_datasize);
+	writeU16(&data[0], m_command);
+	if (m_datasize > 0)
+		memcpy(&data[HEADER_SIZE], &m_data[HEADER_SIZE], m_datasize);
+
+	return data;
+}
+
+std::vector<u8> NetworkPacket::takeForgedPacket()
+{
+	m_data.resize(HEADER_SIZE + m_datasize);
+	writeU16(&m_data[0], m_command);
+
+	std::vector<u8> data = std::move(m_data);
+	clear();
+	return data;
+}
@@ -31,9 +31,14 @@ class NetworkPacket
 	NetworkPacket(u16 command, u32 datasize, session_t peer_id);
 	NetworkPacket(u16 command, u32 datasize);
 	NetworkPacket() = default;
+	NetworkPacket(const NetworkPacket &) = default;
+	NetworkPacket(NetworkPacket &&) = default;
 
 	~NetworkPacket();
 
+	NetworkPacket &operator=(const NetworkPacket &) = default;
+	NetworkPacket &operator=(NetworkPacket &&) = default;
+
 	void putRawPacket(const u8 *data, u32 datasize, session_t peer_id);
 	void clear();
 
@@ -118,6 +123,11 @@ class NetworkPacket
 	// ^ this comment has been here for 4 years
 	Buffer<u8> oldForgePacket();
 
+	// Same data as oldForgePacket(), either copied or moved out of the
+	// packet without copying. The packet is empty after takeForgedPacket().
+	std::vector<u8> getForgedPacket() const;
+	std::vector<u8> takeForgedPacket();
+
 private:
 	void checkReadOffset(u32 from_offset, u32 field_size);
 
@@ -125,10 +135,15 @@ class NetworkPacket
 	{
 		if (m_read_offset + field_size > m_datasize) {
 			m_datasize = m_read_offset + field_size;
-			m_data.resize(m_datasize);
+			m_data.resize(HEADER_SIZE + m_datasize);
 		}
 	}
 
+	// Size of the command in front of the data
+	static constexpr u32 HEADER_SIZE = 2;
+
+	// Command (written when the packet is sent) followed by the data, so
+	// that the packet can be handed to the connection without copying
 	std::vector<u8> m_data;
 	u32 m_datasize = 0;
 	u32 m_read_offset = 0;
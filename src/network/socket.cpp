@@ -44,12 +44,22 @@ typedef int socklen_t;
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #define LAST_SOCKET_ERR() (errno)
 #define SOCKET_ERR_STR(e) strerror(e)
 #endif
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_MMSG 1
+#else
+#define HAVE_MMSG 0
+#endif
+
+// Maximum number of datagrams passed to one sendmmsg()/recvmmsg() call
+#define UDP_MMSG_MAX 64
+
 // Set to true to enable verbose debug output
 bool socket_enable_debug_output = false; // yuck
 
@@ -75,6 +85,57 @@ void sockets_cleanup()
 #endif
 }
 
+static socklen_t toSockaddr(const Address &addr, struct sockaddr_storage *ss)
+{
+	memset(ss, 0, sizeof(*ss));
+	if (addr.isIPv6()) {
+		auto *address = reinterpret_cast<struct sockaddr_in6 *>(ss);
+		address->sin6_family = AF_INET6;
+		address->sin6_addr = addr.getAddress6();
+		address->sin6_port = htons(addr.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+
+	auto *address = reinterpret_cast<struct sockaddr_in *>(ss);
+	address->sin_family = AF_INET;
+	address->sin_addr = addr.getAddress();
+	address->sin_port = htons(addr.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address fromSockaddr(const struct sockaddr_storage &ss)
+{
+	if (ss.ss_family == AF_INET6) {
+		const auto *address = reinterpret_cast<const struct sockaddr_in6 *>(&ss);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes *>
+			(address->sin6_addr.s6_addr);
+		return Address(bytes, ntohs(address->sin6_port));
+	}
+
+	const auto *address = reinterpret_cast<const struct sockaddr_in *>(&ss);
+	return Address(ntohl(address->sin_addr.s_addr), ntohs(address->sin_port));
+}
+
+static void dumpPacket(int handle, const char *direction, const Address &address,
+		const void *data, int size)
+{
+	// Print packet address and size
+	tracestream << handle << direction;
+	address.print(tracestream);
+	tracestream << ", size=" << size;
+
+	// Print packet contents
+	tracestream << ", data=";
+	for (int i = 0; i < size && i < 20; i++) {
+		if (i % 2 == 0)
+			tracestream << " ";
+		unsigned int a = ((const unsigned char *)data)[i];
+		tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+	}
+	if (size > 20)
+		tracestream << "...";
+}
+
 /*
 	UDPSocket
 */
@@ -184,6 +245,18 @@ void UDPSocket::Bind(Address addr)
 	}
 }
 
+Address UDPSocket::getLocalAddress()
+{
+	struct sockaddr_storage address;
+	memset(&address, 0, sizeof(address));
+	socklen_t address_len = sizeof(address);
+
+	if (getsockname(m_handle, (struct sockaddr *)&address, &address_len) < 0)
+		throw SocketException("Failed to get local socket address");
+
+	return fromSockaddr(address);
+}
+
 void UDPSocket::Send(const Address &destination, const void *data, int size)
 {
 	bool dumping_packet = false; // for INTERNET_SIMULATOR
@@ -192,22 +265,7 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 		dumping_packet = myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0;
 
 	if (socket_enable_debug_output) {
-		// Print packet destination and size
-		tracestream << (int)m_handle << " -> ";
-		destination.print(tracestream);
-		tracestream << ", size=" << size;
-
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < size && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
-		}
-
-		if (size > 20)
-			tracestream << "...";
+		dumpPacket(m_handle, " -> ", destination, data, size);
 
 		if (dumping_packet)
 			tracestream << " (DUMPED BY INTERNET_SIMULATOR)";
@@ -225,27 +283,15 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 	if (destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = {};
-		address.sin6_family = AF_INET6;
-		address.sin6_addr = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
-
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = {};
-		address.sin_family = AF_INET;
-		address.sin_addr = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
-
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
-	}
+	struct sockaddr_storage address;
+	socklen_t address_len = toSockaddr(destination, &address);
+	int sent = sendto(m_handle, (const char *)data, size, 0,
+			(struct sockaddr *)&address, address_len);
+	m_send_calls.fetch_add(1, std::memory_order_relaxed);
 
 	if (sent != size)
 		throw SendFailedException("Failed to send packet");
+	m_send_packets.fetch_add(1, std::memory_order_relaxed);
 }
 
 int UDPSocket::Receive(Address &sender, void *data, int size)
@@ -254,61 +300,194 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
+	return receiveOne(sender, data, size);
+}
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+int UDPSocket::receiveOne(Address &sender, void *data, int size)
+{
+	struct sockaddr_storage address;
+	memset(&address, 0, sizeof(address));
+	socklen_t address_len = sizeof(address);
 
-		if (received < 0)
-			return -1;
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
+	m_recv_calls.fetch_add(1, std::memory_order_relaxed);
 
-		u16 address_port = ntohs(address.sin6_port);
-		const auto *bytes = reinterpret_cast<IPv6AddressBytes*>
-			(address.sin6_addr.s6_addr);
-		sender = Address(bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
+	if (received < 0)
+		return -1;
 
-		socklen_t address_len = sizeof(address);
+	sender = fromSockaddr(address);
+	m_recv_packets.fetch_add(1, std::memory_order_relaxed);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	if (socket_enable_debug_output) {
+		dumpPacket(m_handle, " <- ", sender, data, received);
+		tracestream << std::endl;
+	}
 
-		if (received < 0)
-			return -1;
+	return received;
+}
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+int UDPSocket::SendBatch(const UDPSendItem *items, int count, int *dropped)
+{
+	int dropped_count = 0;
+
+#if HAVE_MMSG
+	// The simulator drops single packets, leave that to Send()
+	if (m_use_sendmmsg && !INTERNET_SIMULATOR) {
+		struct mmsghdr msgs[UDP_MMSG_MAX];
+		struct iovec iovs[UDP_MMSG_MAX];
+		struct sockaddr_storage addresses[UDP_MMSG_MAX];
+		// Index of the item of each message
+		int item_index[UDP_MMSG_MAX];
+
+		int i = 0;
+		while (i < count) {
+			// Collect the next batch
+			int n = 0;
+			for (; i < count && n < UDP_MMSG_MAX; i++) {
+				const UDPSendItem &item = items[i];
+				if (item.address.getFamily() != m_addr_family) {
+					dropped_count++;
+					continue;
+				}
+
+				if (socket_enable_debug_output) {
+					dumpPacket(m_handle, " -> ", item.address, item.data, item.size);
+					tracestream << std::endl;
+				}
+
+				iovs[n].iov_base = const_cast<void *>(item.data);
+				iovs[n].iov_len = item.size;
+				memset(&msgs[n], 0, sizeof(msgs[n]));
+				msgs[n].msg_hdr.msg_name = &addresses[n];
+				msgs[n].msg_hdr.msg_namelen = toSockaddr(item.address, &addresses[n]);
+				msgs[n].msg_hdr.msg_iov = &iovs[n];
+				msgs[n].msg_hdr.msg_iovlen = 1;
+				item_index[n] = i;
+				n++;
+			}
+
+			int done = 0;
+			while (done < n) {
+				int ret = sendmmsg(m_handle, &msgs[done], n - done, 0);
+				m_send_calls.fetch_add(1, std::memory_order_relaxed);
+				if (ret > 0) {
+					m_send_packets.fetch_add(ret, std::memory_order_relaxed);
+					done += ret;
+					continue;
+				}
+
+				const int err = LAST_SOCKET_ERR();
+				if (err == EINTR) {
+					// Interrupted before anything was sent
+					continue;
+				} else if (err == EAGAIN || err == EWOULDBLOCK) {
+					// The rest is left to the caller, including the items of
+					// the wrong family that were counted already
+					const int stop = item_index[done];
+					for (int k = stop; k < i; k++) {
+						if (items[k].address.getFamily() != m_addr_family)
+							dropped_count--;
+					}
+					if (dropped)
+						*dropped = dropped_count;
+					return stop;
+				} else if (err == ENOSYS) {
+					// Can only happen on the very first call
+					infostream << "UDPSocket: sendmmsg() is not supported, "
+						"sending packets one by one" << std::endl;
+					m_use_sendmmsg = false;
+					return SendBatch(items, count, dropped);
+				} else {
+					// Sending the first datagram failed, drop it
+					dropped_count++;
+					done++;
+				}
+			}
+		}
 
-		sender = Address(address_ip, address_port);
+		if (dropped)
+			*dropped = dropped_count;
+		return count;
 	}
+#endif
 
-	if (socket_enable_debug_output) {
-		// Print packet sender and size
-		tracestream << (int)m_handle << " <- ";
-		sender.print(tracestream);
-		tracestream << ", size=" << received;
-
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < received && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+	for (int i = 0; i < count; i++) {
+		try {
+			Send(items[i].address, items[i].data, items[i].size);
+		} catch (SendFailedException &e) {
+			dropped_count++;
 		}
-		if (received > 20)
-			tracestream << "...";
+	}
+	if (dropped)
+		*dropped = dropped_count;
+	return count;
+}
 
-		tracestream << std::endl;
+int UDPSocket::ReceiveBatch(UDPReceiveItem *items, int count)
+{
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+#if HAVE_MMSG
+	if (m_use_recvmmsg) {
+		struct mmsghdr msgs[UDP_MMSG_MAX];
+		struct iovec iovs[UDP_MMSG_MAX];
+		struct sockaddr_storage addresses[UDP_MMSG_MAX];
+
+		const int n = MYMIN(count, UDP_MMSG_MAX);
+		for (int i = 0; i < n; i++) {
+			iovs[i].iov_base = items[i].data;
+			iovs[i].iov_len = items[i].capacity;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &addresses[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// There is data, so this returns at least one datagram without
+		// blocking and then only takes what is already there
+		int received = recvmmsg(m_handle, msgs, n, MSG_DONTWAIT, nullptr);
+		m_recv_calls.fetch_add(1, std::memory_order_relaxed);
+		if (received >= 0) {
+			for (int i = 0; i < received; i++) {
+				items[i].address = fromSockaddr(addresses[i]);
+				items[i].size = msgs[i].msg_len;
+
+				if (socket_enable_debug_output) {
+					dumpPacket(m_handle, " <- ", items[i].address,
+							items[i].data, items[i].size);
+					tracestream << std::endl;
+				}
+			}
+			m_recv_packets.fetch_add(received, std::memory_order_relaxed);
+			return received;
+		}
+
+		if (LAST_SOCKET_ERR() != ENOSYS)
+			return 0;
+		infostream << "UDPSocket: recvmmsg() is not supported, "
+			"receiving packets one by one" << std::endl;
+		m_use_recvmmsg = false;
 	}
+#endif
 
-	return received;
+	int received = receiveOne(items[0].address, items[0].data, items[0].capacity);
+	if (received < 0)
+		return 0;
+	items[0].size = received;
+	return 1;
+}
+
+UDPSocket::Stats UDPSocket::getStats() const
+{
+	Stats stats;
+	stats.recv_calls = m_recv_calls.load(std::memory_order_relaxed);
+	stats.recv_packets = m_recv_packets.load(std::memory_order_relaxed);
+	stats.send_calls = m_send_calls.load(std::memory_order_relaxed);
+	stats.send_packets = m_send_packets.load(std::memory_order_relaxed);
+	return stats;
 }
 
 int UDPSocket::GetHandle()
@@ -323,8 +502,9 @@ void UDPSocket::setTimeoutMs(int timeout_ms)
 
 bool UDPSocket::WaitData(int timeout_ms)
 {
-	fd_set readset;
 	int result;
+#ifdef _WIN32
+	fd_set readset;
 
 	// Initialize the set
 	FD_ZERO(&readset);
@@ -337,6 +517,14 @@ bool UDPSocket::WaitData(int timeout_ms)
 
 	// select()
 	result = select(m_handle + 1, &readset, NULL, NULL, &tv);
+#else
+	struct pollfd pfd;
+	pfd.fd = m_handle;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	result = poll(&pfd, 1, timeout_ms);
+#endif
 
 	if (result == 0)
 		return false;
@@ -358,7 +546,13 @@ bool UDPSocket::WaitData(int timeout_ms)
 			<< std::endl;
 
 		throw SocketException("Select failed");
-	} else if (!FD_ISSET(m_handle, &readset)) {
+	}
+#ifdef _WIN32
+	if (!FD_ISSET(m_handle, &readset)) {
+#else
+	// poll() reports closed sockets with POLLNVAL instead of EBADF
+	if (!(pfd.revents & (POLLIN | POLLERR))) {
+#endif
 		// No data
 		return false;
 	}
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
 #include <ostream>
 #include <cstring>
 #include "address.h"
@@ -30,27 +31,82 @@ extern bool socket_enable_debug_output;
 void sockets_init();
 void sockets_cleanup();
 
+// A datagram to send with UDPSocket::SendBatch()
+struct UDPSendItem
+{
+	Address address;
+	const void *data;
+	int size;
+};
+
+// A buffer for UDPSocket::ReceiveBatch()
+struct UDPReceiveItem
+{
+	// Set by ReceiveBatch()
+	Address address;
+	int size = 0;
+
+	u8 *data = nullptr;
+	int capacity = 0;
+};
+
 class UDPSocket
 {
 public:
+	// Syscall counters, can be read from any thread
+	struct Stats
+	{
+		u64 recv_calls = 0;
+		u64 recv_packets = 0;
+		u64 send_calls = 0;
+		u64 send_packets = 0;
+	};
+
 	UDPSocket() = default;
 
 	UDPSocket(bool ipv6);
 	~UDPSocket();
 	void Bind(Address addr);
+	// Returns the bound address, e.g. to find out which port was picked
+	// when binding to port 0
+	Address getLocalAddress();
 
 	bool init(bool ipv6, bool noExceptions = false);
 
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+
+	// Sends several datagrams in order using as few syscalls as possible
+	// (sendmmsg() on Linux, one Send() per datagram elsewhere).
+	// Datagrams that could not be sent are dropped, their number is stored
+	// in `dropped`. Stops early if the socket's send buffer is full.
+	// Returns the number of items that were sent or dropped, the remaining
+	// ones should be passed again later.
+	int SendBatch(const UDPSendItem *items, int count, int *dropped = nullptr);
+	// Waits for data like Receive(), then reads as many datagrams as are
+	// available and fit into `items` (recvmmsg() on Linux, one otherwise).
+	// Returns the number of datagrams received, 0 if there is no data.
+	int ReceiveBatch(UDPReceiveItem *items, int count);
+	Stats getStats() const;
 	int GetHandle(); // For debugging purposes only
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
 	bool WaitData(int timeout_ms);
 
 private:
+	// Receives a single datagram without waiting
+	int receiveOne(Address &sender, void *data, int size);
+
 	int m_handle;
 	int m_timeout_ms;
 	int m_addr_family;
+	// Cleared if the kernel does not support sendmmsg()/recvmmsg()
+	bool m_use_sendmmsg = true;
+	bool m_use_recvmmsg = true;
+
+	std::atomic<u64> m_recv_calls{0};
+	std::atomic<u64> m_recv_packets{0};
+	std::atomic<u64> m_send_calls{0};
+	std::atomic<u64> m_send_packets{0};
 };
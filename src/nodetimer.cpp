@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "nodetimer.h"
+#include <algorithm>
 #include "log.h"
 #include "serialization.h"
 #include "util/serialize.h"
@@ -47,23 +48,31 @@ void NodeTimerList::serialize(std::ostream &os, u8 map_format_version) const
 {
 	if (map_format_version == 24) {
 		// Version 0 is a placeholder for "nothing to see here; go away."
-		if (m_timers.empty()) {
+		if (m_heap.empty()) {
 			writeU8(os, 0); // version
 			return;
 		}
 		writeU8(os, 1); // version
-		writeU16(os, m_timers.size());
+		writeU16(os, m_heap.size());
 	}
 
 	if (map_format_version >= 25) {
 		writeU8(os, 2 + 4 + 4); // length of the data for a single timer
-		writeU16(os, m_timers.size());
+		writeU16(os, m_heap.size());
 	}
 
-	for (const auto &timer : m_timers) {
-		NodeTimer t = timer.second;
+	// Written in trigger order
+	std::vector<const Entry *> sorted;
+	sorted.reserve(m_heap.size());
+	for (const Entry &e : m_heap)
+		sorted.push_back(&e);
+	std::sort(sorted.begin(), sorted.end(),
+		[] (const Entry *a, const Entry *b) { return *a < *b; });
+
+	for (const Entry *e : sorted) {
+		const NodeTimer &t = e->timer;
 		NodeTimer nt = NodeTimer(t.timeout,
-			t.timeout - (f32)(timer.first - m_time), t.position);
+			t.timeout - (f32)(e->trigger_time - m_time), t.position);
 		v3s16 p = t.position;
 
 		u16 p16 = p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
@@ -113,7 +122,7 @@ void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 			continue;
 		}
 
-		if (m_iterators.find(p) != m_iterators.end()) {
+		if (findSlot(p) != NO_SLOT) {
 			warningstream<<"NodeTimerList::deSerialize(): "
 					<<"already set data at position"
 					<<"("<<p.X<<","<<p.Y<<","<<p.Z<<"): Ignoring."
@@ -125,26 +134,124 @@ void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 	}
 }
 
+static inline u16 node_index(v3s16 p)
+{
+	return p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
+}
+
+NodeTimer NodeTimerList::get(const v3s16 &p) const
+{
+	u16 slot = findSlot(p);
+	if (slot == NO_SLOT)
+		return NodeTimer();
+	const Entry &e = m_heap[slot];
+	NodeTimer t = e.timer;
+	t.elapsed = t.timeout - (e.trigger_time - m_time);
+	return t;
+}
+
+void NodeTimerList::remove(v3s16 p)
+{
+	u16 slot = findSlot(p);
+	if (slot != NO_SLOT)
+		eraseSlot(slot);
+}
+
+void NodeTimerList::insert(const NodeTimer &timer)
+{
+	if (m_slots.empty())
+		m_slots.resize(MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE, NO_SLOT);
+
+	Entry e;
+	e.trigger_time = m_time + (double)(timer.timeout - timer.elapsed);
+	e.seq = m_next_seq++;
+	e.timer = timer;
+
+	m_heap.emplace_back();
+	place(m_heap.size() - 1, std::move(e));
+	siftUp(m_heap.size() - 1);
+}
+
+void NodeTimerList::clear()
+{
+	m_heap.clear();
+	m_slots.clear();
+	m_next_seq = 0;
+}
+
 std::vector<NodeTimer> NodeTimerList::step(float dtime)
 {
 	std::vector<NodeTimer> elapsed_timers;
 	m_time += dtime;
-	if (m_next_trigger_time == -1. || m_time < m_next_trigger_time) {
-		return elapsed_timers;
-	}
-	std::multimap<double, NodeTimer>::iterator i = m_timers.begin();
 	// Process timers
-	for (; i != m_timers.end() && i->first <= m_time; ++i) {
-		NodeTimer t = i->second;
-		t.elapsed = t.timeout + (f32)(m_time - i->first);
+	while (!m_heap.empty() && m_heap.front().trigger_time <= m_time) {
+		const Entry &e = m_heap.front();
+		NodeTimer t = e.timer;
+		t.elapsed = t.timeout + (f32)(m_time - e.trigger_time);
 		elapsed_timers.push_back(t);
-		m_iterators.erase(t.position);
+		eraseSlot(0);
 	}
-	// Delete elapsed timers
-	m_timers.erase(m_timers.begin(), i);
-	if (m_timers.empty())
-		m_next_trigger_time = -1.;
-	else
-		m_next_trigger_time = m_timers.begin()->first;
 	return elapsed_timers;
 }
+
+u16 NodeTimerList::findSlot(v3s16 p) const
+{
+	if (m_slots.empty())
+		return NO_SLOT;
+	return m_slots[node_index(p)];
+}
+
+void NodeTimerList::place(size_t i, Entry &&e)
+{
+	m_slots[node_index(e.timer.position)] = i;
+	m_heap[i] = std::move(e);
+}
+
+void NodeTimerList::siftUp(size_t i)
+{
+	Entry e = std::move(m_heap[i]);
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!(e < m_heap[parent]))
+			break;
+		place(i, std::move(m_heap[parent]));
+		i = parent;
+	}
+	place(i, std::move(e));
+}
+
+void NodeTimerList::siftDown(size_t i)
+{
+	const size_t n = m_heap.size();
+	Entry e = std::move(m_heap[i]);
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n && m_heap[child + 1] < m_heap[child])
+			child++;
+		if (!(m_heap[child] < e))
+			break;
+		place(i, std::move(m_heap[child]));
+		i = child;
+	}
+	place(i, std::move(e));
+}
+
+void NodeTimerList::eraseSlot(size_t i)
+{
+	m_slots[node_index(m_heap[i].timer.position)] = NO_SLOT;
+
+	const size_t last = m_heap.size() - 1;
+	if (i != last) {
+		// Fill the gap with the last timer and restore the heap order
+		place(i, std::move(m_heap[last]));
+		m_heap.pop_back();
+		if (i > 0 && m_heap[i] < m_heap[(i - 1) / 2])
+			siftUp(i);
+		else
+			siftDown(i);
+	} else {
+		m_heap.pop_back();
+	}
+}
@@ -21,7 +21,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "irr_v3d.h"
 #include <iostream>
-#include <map>
 #include <vector>
 
 /*
@@ -52,6 +51,11 @@ class NodeTimer
 
 /*
 	List of timers of all the nodes of a block
+
+	The timers are kept in a binary heap ordered by trigger time, in a flat
+	array. A second array, indexed by the position of the node within the
+	block, points to the heap slot of each timer.
+	Timers that trigger at the same time elapse in the order they were set.
 */
 
 class NodeTimerList
@@ -64,61 +68,51 @@ class NodeTimerList
 	void deSerialize(std::istream &is, u8 map_format_version);
 
 	// Get timer
-	NodeTimer get(const v3s16 &p) {
-		std::map<v3s16, std::multimap<double, NodeTimer>::iterator>::iterator n =
-			m_iterators.find(p);
-		if (n == m_iterators.end())
-			return NodeTimer();
-		NodeTimer t = n->second->second;
-		t.elapsed = t.timeout - (n->second->first - m_time);
-		return t;
-	}
+	NodeTimer get(const v3s16 &p) const;
 	// Deletes timer
-	void remove(v3s16 p) {
-		std::map<v3s16, std::multimap<double, NodeTimer>::iterator>::iterator n =
-			m_iterators.find(p);
-		if(n != m_iterators.end()) {
-			double removed_time = n->second->first;
-			m_timers.erase(n->second);
-			m_iterators.erase(n);
-			// Yes, this is float equality, but it is not a problem
-			// since we only test equality of floats as an ordered type
-			// and thus we never lose precision
-			if (removed_time == m_next_trigger_time) {
-				if (m_timers.empty())
-					m_next_trigger_time = -1.;
-				else
-					m_next_trigger_time = m_timers.begin()->first;
-			}
-		}
-	}
+	void remove(v3s16 p);
 	// Undefined behavior if there already is a timer
-	void insert(const NodeTimer &timer) {
-		v3s16 p = timer.position;
-		double trigger_time = m_time + (double)(timer.timeout - timer.elapsed);
-		std::multimap<double, NodeTimer>::iterator it = m_timers.emplace(trigger_time, timer);
-		m_iterators.emplace(p, it);
-		if (m_next_trigger_time == -1. || trigger_time < m_next_trigger_time)
-			m_next_trigger_time = trigger_time;
-	}
+	void insert(const NodeTimer &timer);
 	// Deletes old timer and sets a new one
 	inline void set(const NodeTimer &timer) {
 		remove(timer.position);
 		insert(timer);
 	}
 	// Deletes all timers
-	void clear() {
-		m_timers.clear();
-		m_iterators.clear();
-		m_next_trigger_time = -1.;
-	}
+	void clear();
+
+	size_t size() const { return m_heap.size(); }
 
 	// Move forward in time, returns elapsed timers
 	std::vector<NodeTimer> step(float dtime);
 
 private:
-	std::multimap<double, NodeTimer> m_timers;
-	std::map<v3s16, std::multimap<double, NodeTimer>::iterator> m_iterators;
-	double m_next_trigger_time = -1.0;
+	struct Entry {
+		double trigger_time;
+		// Insertion order
+		u64 seq;
+		NodeTimer timer;
+
+		bool operator<(const Entry &other) const {
+			return trigger_time < other.trigger_time ||
+				(trigger_time == other.trigger_time && seq < other.seq);
+		}
+	};
+
+	static constexpr u16 NO_SLOT = 0xFFFF;
+
+	// Returns the heap slot of the timer at p, or NO_SLOT
+	u16 findSlot(v3s16 p) const;
+	// Stores e in slot i and updates the index
+	void place(size_t i, Entry &&e);
+	void siftUp(size_t i);
+	void siftDown(size_t i);
+	// Removes the timer in slot i
+	void eraseSlot(size_t i);
+
+	std::vector<Entry> m_heap;
+	// Heap slot by node index within the block, allocated with the first timer
+	std::vector<u16> m_slots;
+	u64 m_next_seq = 0;
 	double m_time = 0.0;
 };
@@ -25,8 +25,10 @@
 
 #include <cmath>
 #include "noise.h"
+#include "noise_kernels.h"
 #include <iostream>
 #include <cstring> // memset
+#include <utility> // std::swap
 #include "debug.h"
 #include "util/numeric.h"
 #include "util/string.h"
@@ -156,21 +158,15 @@ s32 PcgRandom::randNormalDist(s32 min, s32 max, int num_trials)
 
 float noise2d(int x, int y, s32 seed)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
-	n = (n >> 13) ^ n;
-	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)(int)n / 0x40000000;
+	return noiseLatticeValue(NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
+			+ NOISE_MAGIC_SEED * seed);
 }
 
 
 float noise3d(int x, int y, int z, s32 seed)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
-	n = (n >> 13) ^ n;
-	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)(int)n / 0x40000000;
+	return noiseLatticeValue(NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
+			+ NOISE_MAGIC_Z * z + NOISE_MAGIC_SEED * seed);
 }
 
 
@@ -354,6 +350,7 @@ Noise::Noise(const NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 	this->sx   = sx;
 	this->sy   = sy;
 	this->sz   = sz;
+	this->kernels = NoiseKernels::getBest();
 
 	allocBuffers();
 }
@@ -365,6 +362,9 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] column_index;
+	delete[] column_weight;
+	delete[] lerp_rows;
 }
 
 
@@ -456,8 +456,17 @@ void Noise::resizeNoiseBuf(bool is3d)
 	size_t nlz = is3d ? (size_t)std::ceil(num_noise_points_z) + 3 : 1;
 
 	delete[] noise_buf;
+	delete[] column_index;
+	delete[] column_weight;
+	delete[] lerp_rows;
+	column_index = nullptr;
+	column_weight = nullptr;
+	lerp_rows = nullptr;
 	try {
 		noise_buf = new float[nlx * nly * nlz];
+		column_index = new u32[sx];
+		column_weight = new float[sx];
+		lerp_rows = new float[nly * sx * 2];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -481,8 +490,8 @@ void Noise::gradientMap2D(
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 index, j, noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
@@ -491,41 +500,27 @@ void Noise::gradientMap2D(
 	y0 = std::floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
+	u32 base = NOISE_MAGIC_X * (u32)x0 + NOISE_MAGIC_SEED * (u32)seed;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		kernels->lattice_row(&noise_buf[idx(0, j)], nlx,
+			base + NOISE_MAGIC_Y * (u32)(y0 + j), NOISE_MAGIC_X);
+
+	//calculate interpolations, along x once per lattice row
+	prepareColumns(u, step_x, eased);
+	for (j = 0; j != nly; j++)
+		lerpColumns(&lerp_rows[j * sx], &noise_buf[idx(0, j)]);
 
-	//calculate interpolations
 	index  = 0;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] =
-				biLinearInterpolation(v00, v10, v01, v11, u, v, eased);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+		kernels->lerp_row(&gradient_buf[index], sx,
+			&lerp_rows[noisey * sx], &lerp_rows[(noisey + 1) * sx],
+			eased ? easeCurve(v) : v);
+		index += sx;
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -543,10 +538,8 @@ void Noise::gradientMap3D(
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
+	float u, v, w, orig_v;
+	u32 index, j, k, noisey, noisez;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
@@ -558,59 +551,41 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
 	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
+	u32 base = NOISE_MAGIC_X * (u32)x0 + NOISE_MAGIC_SEED * (u32)seed;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+			kernels->lattice_row(&noise_buf[idx(0, j, k)], nlx,
+				base + NOISE_MAGIC_Y * (u32)(y0 + j) + NOISE_MAGIC_Z * (u32)(z0 + k),
+				NOISE_MAGIC_X);
+
+	//calculate interpolations, along x once per lattice row of the two
+	//z planes around the current position
+	prepareColumns(u, step_x, eased);
+	float *plane0 = lerp_rows;
+	float *plane1 = lerp_rows + nly * sx;
+	for (j = 0; j != nly; j++) {
+		lerpColumns(&plane0[j * sx], &noise_buf[idx(0, j, 0)]);
+		lerpColumns(&plane1[j * sx], &noise_buf[idx(0, j, 1)]);
+	}
 
-	//calculate interpolations
 	index  = 0;
-	noisey = 0;
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		float wz = eased ? easeCurve(w) : w;
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = triLinearInterpolation(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w,
-					eased);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
-			}
+			kernels->bilerp_row(&gradient_buf[index], sx,
+				&plane0[noisey * sx], &plane0[(noisey + 1) * sx],
+				&plane1[noisey * sx], &plane1[(noisey + 1) * sx],
+				eased ? easeCurve(v) : v, wz);
+			index += sx;
 
 			v += step_y;
 			if (v >= 1.0) {
@@ -623,12 +598,42 @@ void Noise::gradientMap3D(
 		if (w >= 1.0) {
 			w -= 1.0;
 			noisez++;
+			if (k + 1 != sz) {
+				std::swap(plane0, plane1);
+				for (j = 0; j != nly; j++)
+					lerpColumns(&plane1[j * sx], &noise_buf[idx(0, j, noisez + 1)]);
+			}
 		}
 	}
 }
 #undef idx
 
 
+void Noise::prepareColumns(float u, float step_x, bool eased)
+{
+	u32 noisex = 0;
+	for (u32 i = 0; i != sx; i++) {
+		column_index[i]  = noisex;
+		column_weight[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+}
+
+
+void Noise::lerpColumns(float *out, const float *lattice_row)
+{
+	for (u32 i = 0; i != sx; i++) {
+		const float *p = &lattice_row[column_index[i]];
+		out[i] = linearInterpolation(p[0], p[1], column_weight[i]);
+	}
+}
+
+
 float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 {
 	float f = 1.0, g = 1.0;
@@ -716,8 +721,7 @@ void Noise::updateResults(float g, float *gmap,
 				gmap[i] *= persistence_map[i];
 			}
 		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * std::fabs(gradient_buf[i]);
+			kernels->accumulate(result, gradient_buf, bufsize, g, true);
 		}
 	} else {
 		if (persistence_map) {
@@ -726,8 +730,7 @@ void Noise::updateResults(float g, float *gmap,
 				gmap[i] *= persistence_map[i];
 			}
 		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * gradient_buf[i];
+			kernels->accumulate(result, gradient_buf, bufsize, g, false);
 		}
 	}
 }
@@ -38,6 +38,8 @@
 
 extern FlagDesc flagdesc_noiseparams[];
 
+struct NoiseKernels;
+
 // Note: this class is not polymorphic so that its high level of
 // optimizability may be preserved in the common use case
 class PseudoRandom {
@@ -145,6 +147,8 @@ class Noise {
 	float *gradient_buf = nullptr;
 	float *persist_buf = nullptr;
 	float *result = nullptr;
+	// Implementation of the inner loops, all of them give the same results
+	const NoiseKernels *kernels;
 
 	Noise(const NoiseParams *np, s32 seed, u32 sx, u32 sy, u32 sz=1);
 	~Noise();
@@ -189,7 +193,15 @@ class Noise {
 	void resizeNoiseBuf(bool is3d);
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
-
+	void prepareColumns(float u, float step_x, bool eased);
+	void lerpColumns(float *out, const float *lattice_row);
+
+	// Lattice cell and interpolation weight of every x, the same in all rows
+	u32 *column_index = nullptr;
+	float *column_weight = nullptr;
+	// Lattice rows interpolated along x, all of them for 2D maps and the
+	// ones of two z planes for 3D maps
+	float *lerp_rows = nullptr;
 };
 
 float NoisePerlin2D(const NoiseParams *np, float x, float y, s32 seed);
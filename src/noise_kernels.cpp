@@ -0,0 +1,338 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noise_kernels.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define NOISE_KERNELS_X86 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		// MSVC allows all intrinsics everywhere
+		#define NOISE_TARGET(t)
+	#else
+		#define NOISE_TARGET(t) __attribute__((target(t)))
+	#endif
+#else
+	#define NOISE_KERNELS_X86 0
+#endif
+
+/*
+	Portable implementation
+
+	Also used for the remainders of the SIMD ones, which is why every value
+	must be computed by the same expressions there. This file and noise.cpp
+	are compiled without floating point contraction (see CMakeLists.txt),
+	so the compiler doesn't turn them into FMA where the SIMD code has
+	separate operations.
+*/
+
+static inline float lerp(float v0, float v1, float t)
+{
+	return v0 + (v1 - v0) * t;
+}
+
+static void lattice_row_portable(float *out, u32 count, u32 base, u32 stride)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = noiseLatticeValue(base + stride * i);
+}
+
+static void lerp_row_portable(float *out, u32 count, const float *a,
+		const float *b, float t)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = lerp(a[i], b[i], t);
+}
+
+static void bilerp_row_portable(float *out, u32 count, const float *a0,
+		const float *b0, const float *a1, const float *b1, float t, float s)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = lerp(lerp(a0[i], b0[i], t), lerp(a1[i], b1[i], t), s);
+}
+
+static void accumulate_portable(float *result, const float *gradient,
+		size_t count, float g, bool absvalue)
+{
+	if (absvalue) {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * std::fabs(gradient[i]);
+	} else {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * gradient[i];
+	}
+}
+
+static const NoiseKernels kernels_portable = {
+	"portable",
+	lattice_row_portable,
+	lerp_row_portable,
+	bilerp_row_portable,
+	accumulate_portable,
+};
+
+#if NOISE_KERNELS_X86
+
+/*
+	SSE2
+*/
+
+// _mm_mullo_epi32 needs SSE4.1
+NOISE_TARGET("sse2")
+static inline __m128i mullo_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+			_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+NOISE_TARGET("sse2")
+static inline __m128 lerp_sse2(__m128 v0, __m128 v1, __m128 t)
+{
+	return _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+}
+
+NOISE_TARGET("sse2")
+static void lattice_row_sse2(float *out, u32 count, u32 base, u32 stride)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	const __m128i c1 = _mm_set1_epi32(60493);
+	const __m128i c2 = _mm_set1_epi32(19990303);
+	const __m128i c3 = _mm_set1_epi32(1376312589);
+	// Dividing by 0x40000000 is exact, so is multiplying by its inverse
+	const __m128 scale = _mm_set1_ps(1.f / 0x40000000);
+	const __m128 one = _mm_set1_ps(1.f);
+
+	__m128i in = _mm_add_epi32(_mm_set1_epi32(base),
+			mullo_sse2(_mm_set1_epi32(stride), _mm_setr_epi32(0, 1, 2, 3)));
+	const __m128i in_step = _mm_set1_epi32(stride * 4);
+
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i n = _mm_and_si128(in, mask);
+		n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+		__m128i m = _mm_add_epi32(mullo_sse2(mullo_sse2(n, n), c1), c2);
+		n = _mm_and_si128(_mm_add_epi32(mullo_sse2(n, m), c3), mask);
+		__m128 v = _mm_sub_ps(one, _mm_mul_ps(_mm_cvtepi32_ps(n), scale));
+		_mm_storeu_ps(out + i, v);
+		in = _mm_add_epi32(in, in_step);
+	}
+	for (; i != count; i++)
+		out[i] = noiseLatticeValue(base + stride * i);
+}
+
+NOISE_TARGET("sse2")
+static void lerp_row_sse2(float *out, u32 count, const float *a,
+		const float *b, float t)
+{
+	const __m128 tv = _mm_set1_ps(t);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = lerp_sse2(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i), tv);
+		_mm_storeu_ps(out + i, v);
+	}
+	for (; i != count; i++)
+		out[i] = lerp(a[i], b[i], t);
+}
+
+NOISE_TARGET("sse2")
+static void bilerp_row_sse2(float *out, u32 count, const float *a0,
+		const float *b0, const float *a1, const float *b1, float t, float s)
+{
+	const __m128 tv = _mm_set1_ps(t);
+	const __m128 sv = _mm_set1_ps(s);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 u = lerp_sse2(_mm_loadu_ps(a0 + i), _mm_loadu_ps(b0 + i), tv);
+		__m128 v = lerp_sse2(_mm_loadu_ps(a1 + i), _mm_loadu_ps(b1 + i), tv);
+		_mm_storeu_ps(out + i, lerp_sse2(u, v, sv));
+	}
+	for (; i != count; i++)
+		out[i] = lerp(lerp(a0[i], b0[i], t), lerp(a1[i], b1[i], t), s);
+}
+
+NOISE_TARGET("sse2")
+static void accumulate_sse2(float *result, const float *gradient,
+		size_t count, float g, bool absvalue)
+{
+	const __m128 gv = _mm_set1_ps(g);
+	// Clearing the sign bit is what std::fabs does
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(absvalue ? 0x7fffffff : -1));
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 grad = _mm_and_ps(_mm_loadu_ps(gradient + i), absmask);
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(gv, grad));
+		_mm_storeu_ps(result + i, r);
+	}
+	accumulate_portable(result + i, gradient + i, count - i, g, absvalue);
+}
+
+static const NoiseKernels kernels_sse2 = {
+	"sse2",
+	lattice_row_sse2,
+	lerp_row_sse2,
+	bilerp_row_sse2,
+	accumulate_sse2,
+};
+
+/*
+	AVX2
+
+	Deliberately not compiled with FMA enabled: a fused multiply-add rounds
+	once instead of twice and would change the results.
+*/
+
+NOISE_TARGET("avx2")
+static inline __m256 lerp_avx2(__m256 v0, __m256 v1, __m256 t)
+{
+	return _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t));
+}
+
+NOISE_TARGET("avx2")
+static void lattice_row_avx2(float *out, u32 count, u32 base, u32 stride)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	const __m256i c1 = _mm256_set1_epi32(60493);
+	const __m256i c2 = _mm256_set1_epi32(19990303);
+	const __m256i c3 = _mm256_set1_epi32(1376312589);
+	const __m256 scale = _mm256_set1_ps(1.f / 0x40000000);
+	const __m256 one = _mm256_set1_ps(1.f);
+
+	__m256i in = _mm256_add_epi32(_mm256_set1_epi32(base),
+			_mm256_mullo_epi32(_mm256_set1_epi32(stride),
+				_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	const __m256i in_step = _mm256_set1_epi32(stride * 8);
+
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i n = _mm256_and_si256(in, mask);
+		n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+		__m256i m = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_mullo_epi32(n, n), c1), c2);
+		n = _mm256_and_si256(_mm256_add_epi32(_mm256_mullo_epi32(n, m), c3), mask);
+		__m256 v = _mm256_sub_ps(one, _mm256_mul_ps(_mm256_cvtepi32_ps(n), scale));
+		_mm256_storeu_ps(out + i, v);
+		in = _mm256_add_epi32(in, in_step);
+	}
+	for (; i != count; i++)
+		out[i] = noiseLatticeValue(base + stride * i);
+}
+
+NOISE_TARGET("avx2")
+static void lerp_row_avx2(float *out, u32 count, const float *a,
+		const float *b, float t)
+{
+	const __m256 tv = _mm256_set1_ps(t);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 v = lerp_avx2(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), tv);
+		_mm256_storeu_ps(out + i, v);
+	}
+	for (; i != count; i++)
+		out[i] = lerp(a[i], b[i], t);
+}
+
+NOISE_TARGET("avx2")
+static void bilerp_row_avx2(float *out, u32 count, const float *a0,
+		const float *b0, const float *a1, const float *b1, float t, float s)
+{
+	const __m256 tv = _mm256_set1_ps(t);
+	const __m256 sv = _mm256_set1_ps(s);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 u = lerp_avx2(_mm256_loadu_ps(a0 + i), _mm256_loadu_ps(b0 + i), tv);
+		__m256 v = lerp_avx2(_mm256_loadu_ps(a1 + i), _mm256_loadu_ps(b1 + i), tv);
+		_mm256_storeu_ps(out + i, lerp_avx2(u, v, sv));
+	}
+	for (; i != count; i++)
+		out[i] = lerp(lerp(a0[i], b0[i], t), lerp(a1[i], b1[i], t), s);
+}
+
+NOISE_TARGET("avx2")
+static void accumulate_avx2(float *result, const float *gradient,
+		size_t count, float g, bool absvalue)
+{
+	const __m256 gv = _mm256_set1_ps(g);
+	const __m256 absmask = _mm256_castsi256_ps(
+			_mm256_set1_epi32(absvalue ? 0x7fffffff : -1));
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 grad = _mm256_and_ps(_mm256_loadu_ps(gradient + i), absmask);
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i), _mm256_mul_ps(gv, grad));
+		_mm256_storeu_ps(result + i, r);
+	}
+	accumulate_portable(result + i, gradient + i, count - i, g, absvalue);
+}
+
+static const NoiseKernels kernels_avx2 = {
+	"avx2",
+	lattice_row_avx2,
+	lerp_row_avx2,
+	bilerp_row_avx2,
+	accumulate_avx2,
+};
+
+static void detect_cpu(bool *sse2, bool *avx2)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+	__cpuid(info, 1);
+	*sse2 = info[3] & (1 << 26);
+	// The OS must also save the AVX registers
+	const bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+			(_xgetbv(0) & 6) == 6;
+	*avx2 = false;
+	if (avx && max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		*avx2 = info[1] & (1 << 5);
+	}
+#else
+	__builtin_cpu_init();
+	*sse2 = __builtin_cpu_supports("sse2");
+	*avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // NOISE_KERNELS_X86
+
+std::vector<const NoiseKernels *> NoiseKernels::getSupported()
+{
+	std::vector<const NoiseKernels *> ret;
+	ret.push_back(&kernels_portable);
+#if NOISE_KERNELS_X86
+	bool sse2, avx2;
+	detect_cpu(&sse2, &avx2);
+	if (sse2)
+		ret.push_back(&kernels_sse2);
+	if (avx2)
+		ret.push_back(&kernels_avx2);
+#endif
+	return ret;
+}
+
+const NoiseKernels *NoiseKernels::getBest()
+{
+	static const NoiseKernels *best = getSupported().back();
+	return best;
+}
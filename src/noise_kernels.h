@@ -0,0 +1,66 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "irrlichttypes.h"
+
+/*
+	Inner loops of Noise::perlinMap2D() and perlinMap3D().
+
+	There is a portable implementation and, on x86, SSE2 and AVX2 ones that
+	are picked at runtime. They all do the same float operations in the same
+	order for every value, so their results are bit-identical: switching
+	between them must not leave seams in the generated map.
+*/
+struct NoiseKernels
+{
+	const char *name;
+
+	// out[i] = noiseLatticeValue(base + stride * i)
+	void (*lattice_row)(float *out, u32 count, u32 base, u32 stride);
+
+	// out[i] = lerp(a[i], b[i], t)
+	void (*lerp_row)(float *out, u32 count, const float *a, const float *b,
+			float t);
+
+	// out[i] = lerp(lerp(a0[i], b0[i], t), lerp(a1[i], b1[i], t), s)
+	void (*bilerp_row)(float *out, u32 count, const float *a0, const float *b0,
+			const float *a1, const float *b1, float t, float s);
+
+	// result[i] += g * gradient[i], or g * |gradient[i]| with absvalue
+	void (*accumulate)(float *result, const float *gradient, size_t count,
+			float g, bool absvalue);
+
+	// Fastest implementation supported by the build and the CPU
+	static const NoiseKernels *getBest();
+	// All implementations supported by the build and the CPU, portable first
+	static std::vector<const NoiseKernels *> getSupported();
+};
+
+// Value of the noise lattice point with the hash input n, -1 ... 1
+inline float noiseLatticeValue(u32 n)
+{
+	n &= 0x7fffffff;
+	n = (n >> 13) ^ n;
+	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
+	return 1.f - (float)(int)n / 0x40000000;
+}
@@ -0,0 +1,185 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "object_position.h"
+#include <cmath>
+#include <sstream>
+#include "activeobject.h"
+#include "constants.h"
+#include "util/serialize.h"
+
+// 1/256 of a node
+#define POSITION_QUANTUM (BS / 256.0f)
+// Number of updates after which a new keyframe is sent
+#define KEYFRAME_INTERVAL 32
+
+enum : u8 {
+	POSDELTA_INTERPOLATE   = 0x01,
+	POSDELTA_MOVEMENT_END  = 0x02,
+	POSDELTA_KEYFRAME      = 0x04,
+	POSDELTA_KEYFRAME_ONLY = 0x08,
+	POSDELTA_VELOCITY      = 0x10,
+	POSDELTA_ACCELERATION  = 0x20,
+	POSDELTA_ROTATION      = 0x40,
+};
+
+// Returns false if a component does not fit into a s16
+static bool quantize(v3f v, v3s16 &result)
+{
+	v3f q = v / POSITION_QUANTUM;
+	for (f32 c : {q.X, q.Y, q.Z}) {
+		if (!std::isfinite(c) || std::fabs(c) > S16_MAX)
+			return false;
+	}
+	result = v3s16(std::lround(q.X), std::lround(q.Y), std::lround(q.Z));
+	return true;
+}
+
+static v3f dequantize(v3s16 v)
+{
+	return v3f(v.X, v.Y, v.Z) * POSITION_QUANTUM;
+}
+
+static u16 quantizeAngle(f32 degrees)
+{
+	f32 wrapped = std::fmod(degrees, 360.0f);
+	if (wrapped < 0.0f)
+		wrapped += 360.0f;
+	return (u16)((u32)std::lround(wrapped * (65536.0f / 360.0f)) & 0xFFFF);
+}
+
+std::string ObjectPositionEncoder::encode(const ObjectPositionUpdate &update,
+		bool *new_keyframe)
+{
+	if (new_keyframe)
+		*new_keyframe = false;
+
+	v3s16 velocity, acceleration;
+	if (!quantize(update.velocity, velocity) ||
+			!quantize(update.acceleration, acceleration))
+		return "";
+	for (f32 c : {update.position.X, update.position.Y, update.position.Z,
+			update.rotation.X, update.rotation.Y, update.rotation.Z}) {
+		if (!std::isfinite(c))
+			return "";
+	}
+	if (update.update_interval < 0.0f || update.update_interval * 1000.0f > U16_MAX)
+		return "";
+
+	v3s16 offset;
+	bool keyframe = !m_has_keyframe || m_since_keyframe >= KEYFRAME_INTERVAL ||
+		!quantize(update.position - m_keyframe, offset);
+	if (keyframe) {
+		m_keyframe = update.position;
+		m_keyframe_id++;
+		m_has_keyframe = true;
+		m_since_keyframe = 0;
+		offset = v3s16();
+		if (new_keyframe)
+			*new_keyframe = true;
+	}
+	m_since_keyframe++;
+
+	u8 flags = 0;
+	if (update.do_interpolate)
+		flags |= POSDELTA_INTERPOLATE;
+	if (update.is_movement_end)
+		flags |= POSDELTA_MOVEMENT_END;
+	if (keyframe)
+		flags |= POSDELTA_KEYFRAME;
+	if (velocity != v3s16())
+		flags |= POSDELTA_VELOCITY;
+	if (acceleration != v3s16())
+		flags |= POSDELTA_ACCELERATION;
+	if (update.rotation != v3f())
+		flags |= POSDELTA_ROTATION;
+
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, AO_CMD_UPDATE_POSITION_DELTA);
+	writeU8(os, flags);
+	writeU8(os, m_keyframe_id);
+	if (keyframe)
+		writeV3F32(os, m_keyframe);
+	writeV3S16(os, offset);
+	if (flags & POSDELTA_VELOCITY)
+		writeV3S16(os, velocity);
+	if (flags & POSDELTA_ACCELERATION)
+		writeV3S16(os, acceleration);
+	if (flags & POSDELTA_ROTATION) {
+		writeU16(os, quantizeAngle(update.rotation.X));
+		writeU16(os, quantizeAngle(update.rotation.Y));
+		writeU16(os, quantizeAngle(update.rotation.Z));
+	}
+	writeU16(os, (u16)std::lround(update.update_interval * 1000.0f));
+	return os.str();
+}
+
+std::string ObjectPositionEncoder::encodeKeyframe() const
+{
+	if (!m_has_keyframe)
+		return "";
+
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, AO_CMD_UPDATE_POSITION_DELTA);
+	writeU8(os, POSDELTA_KEYFRAME | POSDELTA_KEYFRAME_ONLY);
+	writeU8(os, m_keyframe_id);
+	writeV3F32(os, m_keyframe);
+	return os.str();
+}
+
+bool ObjectPositionDecoder::decode(std::istream &is, ObjectPositionUpdate &update)
+{
+	const u8 flags = readU8(is);
+	const u8 keyframe_id = readU8(is);
+	if (flags & POSDELTA_KEYFRAME) {
+		const v3f keyframe = readV3F32(is);
+		// The reliable copy can arrive after a newer unreliable one
+		if (!m_has_keyframe || (s8)(keyframe_id - m_keyframe_id) >= 0) {
+			m_keyframe = keyframe;
+			m_keyframe_id = keyframe_id;
+			m_has_keyframe = true;
+		}
+	}
+	if (flags & POSDELTA_KEYFRAME_ONLY)
+		return false;
+
+	const v3s16 offset = readV3S16(is);
+	const v3s16 velocity = (flags & POSDELTA_VELOCITY) ? readV3S16(is) : v3s16();
+	const v3s16 acceleration = (flags & POSDELTA_ACCELERATION) ? readV3S16(is) : v3s16();
+	v3f rotation;
+	if (flags & POSDELTA_ROTATION) {
+		rotation.X = readU16(is) * (360.0f / 65536.0f);
+		rotation.Y = readU16(is) * (360.0f / 65536.0f);
+		rotation.Z = readU16(is) * (360.0f / 65536.0f);
+	}
+	const u16 interval_ms = readU16(is);
+
+	// Missed the keyframe this is relative to
+	if (!m_has_keyframe || keyframe_id != m_keyframe_id)
+		return false;
+
+	update.position = m_keyframe + dequantize(offset);
+	update.velocity = dequantize(velocity);
+	update.acceleration = dequantize(acceleration);
+	update.rotation = rotation;
+	update.do_interpolate = flags & POSDELTA_INTERPOLATE;
+	update.is_movement_end = flags & POSDELTA_MOVEMENT_END;
+	update.update_interval = interval_ms / 1000.0f;
+	return true;
+}
@@ -0,0 +1,97 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "irrlichttypes_bloated.h"
+
+// Contents of an AO_CMD_UPDATE_POSITION command
+struct ObjectPositionUpdate
+{
+	v3f position;
+	v3f velocity;
+	v3f acceleration;
+	v3f rotation;
+	bool do_interpolate = false;
+	bool is_movement_end = false;
+	f32 update_interval = 0.0f;
+};
+
+/*
+	AO_CMD_UPDATE_POSITION_DELTA
+
+	u8 flags (see below)
+	u8 keyframe id
+	if KEYFRAME: v3f32 keyframe position
+	unless KEYFRAME_ONLY:
+		v3s16 position offset from the keyframe, in POSITION_QUANTUM
+		if VELOCITY: v3s16 velocity, in POSITION_QUANTUM per second
+		if ACCELERATION: v3s16 acceleration, in POSITION_QUANTUM per second²
+		if ROTATION: v3u16 rotation, in 360/65536 degrees
+		u16 update interval in milliseconds
+
+	Unreliable messages are not acknowledged, so instead of the last state
+	each client received, the offsets are relative to a keyframe position.
+	Keyframes are sent in full every now and then and whenever an offset
+	gets too large. Each new keyframe is also sent in a reliable
+	KEYFRAME_ONLY message, clients that lost the unreliable one ignore the
+	updates until that arrives. Clients that start to see the object get
+	the current keyframe with the initialization data.
+*/
+class ObjectPositionEncoder
+{
+public:
+	// Returns the command, or an empty string if the update can't be
+	// encoded (the full AO_CMD_UPDATE_POSITION has to be used then).
+	// new_keyframe is set if the command starts a new keyframe, which
+	// should be sent reliably as well (see encodeKeyframe()).
+	std::string encode(const ObjectPositionUpdate &update,
+			bool *new_keyframe = nullptr);
+
+	// Returns a command that only tells the current keyframe, for clients
+	// that start to see the object or missed it. Empty if there is no
+	// keyframe yet.
+	std::string encodeKeyframe() const;
+
+	// The next update will start a new keyframe
+	void reset() { m_has_keyframe = false; }
+
+private:
+	v3f m_keyframe;
+	u8 m_keyframe_id = 0;
+	bool m_has_keyframe = false;
+	// Number of updates since the last keyframe
+	u16 m_since_keyframe = 0;
+};
+
+class ObjectPositionDecoder
+{
+public:
+	// Reads the command (after the command byte). Returns false if there
+	// is no update to apply, either because the command only contained a
+	// keyframe or because the keyframe it refers to is unknown.
+	bool decode(std::istream &is, ObjectPositionUpdate &update);
+
+private:
+	v3f m_keyframe;
+	u8 m_keyframe_id = 0;
+	bool m_has_keyframe = false;
+};
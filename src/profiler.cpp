@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "profiler.h"
 #include "porting.h"
+#include "log.h"
 
 static Profiler main_profiler;
 Profiler *g_profiler = &main_profiler;
@@ -32,8 +33,21 @@ ScopeProfiler::ScopeProfiler(
 		m_timer = new TimeTaker(m_name, nullptr, PRECISION_MILLI);
 }
 
+ScopeProfiler::ScopeProfiler(Profiler *profiler, ProfilerProbe probe) :
+		m_profiler(profiler), m_type(SPT_ADD), m_probe(probe)
+{
+	if (m_profiler)
+		m_start_us = porting::getTimeUs();
+}
+
 ScopeProfiler::~ScopeProfiler()
 {
+	if (m_profiler && !m_timer) {
+		// Probe
+		m_profiler->probeRecord(m_probe, porting::getTimeUs() - m_start_us);
+		return;
+	}
+
 	if (!m_timer)
 		return;
 
@@ -190,6 +204,7 @@ int Profiler::print(std::ostream &o, u32 page, u32 pagecount)
 void Profiler::getPage(GraphValues &o, u32 page, u32 pagecount)
 {
 	MutexAutoLock lock(m_mutex);
+	mergeProbesNoLock();
 
 	u32 minindex, maxindex;
 	paging(m_data.size(), page, pagecount, minindex, maxindex);
@@ -207,3 +222,187 @@ void Profiler::getPage(GraphValues &o, u32 page, u32 pagecount)
 		o[i.first] = i.second / getAvgCount(i.first);
 	}
 }
+
+/*
+	Probes
+*/
+
+// Buffer of the calling thread, for the profiler it was last used with
+static thread_local struct ThreadProbeBuffer {
+	const Profiler *owner = nullptr;
+	void *buffer = nullptr;
+	// Makes the buffer available to other threads when this one exits
+	std::atomic<bool> *in_use = nullptr;
+
+	~ThreadProbeBuffer() {
+		if (in_use)
+			in_use->store(false);
+	}
+} t_probe_buffer;
+
+ProfilerProbe Profiler::registerProbe(const std::string &name, ScopeProfilerType type)
+{
+	assert(type != SPT_GRAPH_ADD);
+
+	MutexAutoLock lock(m_mutex);
+	const std::string full_name = name + " [ms]";
+	for (size_t i = 0; i < m_probes.size(); i++) {
+		if (m_probes[i].name == full_name)
+			return i;
+	}
+
+	// Values recorded for probes past the limit are dropped
+	if (m_probes.size() == PROFILER_MAX_PROBES - 1) {
+		errorstream << "Profiler: too many probes, can't register \""
+			<< name << "\"" << std::endl;
+		return PROFILER_MAX_PROBES - 1;
+	}
+
+	Probe probe;
+	probe.label = name;
+	probe.name = full_name;
+	probe.type = type;
+	if (m_metrics_backend) {
+		probe.time_counter = m_metrics_backend->addCounter(
+			"minetest_core_profiler_time_us", "Time spent in profiled code (in microseconds)",
+			{{"probe", name}});
+		probe.count_counter = m_metrics_backend->addCounter(
+			"minetest_core_profiler_calls", "Number of times profiled code ran",
+			{{"probe", name}});
+	}
+	m_probes.push_back(std::move(probe));
+	return m_probes.size() - 1;
+}
+
+Profiler::ProbeBuffer *Profiler::getThreadBuffer()
+{
+	if (t_probe_buffer.owner == this)
+		return static_cast<ProbeBuffer *>(t_probe_buffer.buffer);
+
+	MutexAutoLock lock(m_mutex);
+	ProbeBuffer *buffer = nullptr;
+	for (auto &it : m_probe_buffers) {
+		bool expected = false;
+		if (it->in_use.compare_exchange_strong(expected, true)) {
+			buffer = it.get();
+			break;
+		}
+	}
+	if (!buffer) {
+		m_probe_buffers.push_back(std::make_unique<ProbeBuffer>());
+		buffer = m_probe_buffers.back().get();
+	}
+
+	if (t_probe_buffer.in_use)
+		t_probe_buffer.in_use->store(false);
+	t_probe_buffer.owner = this;
+	t_probe_buffer.buffer = buffer;
+	t_probe_buffer.in_use = &buffer->in_use;
+	return buffer;
+}
+
+void Profiler::probeRecord(ProfilerProbe probe, u64 value_us)
+{
+	ProbeSlot &slot = getThreadBuffer()->slots[probe];
+	// Only this thread writes the values, the merging thread only reads
+	// them (except for resetting the maximum)
+	slot.time_us.store(slot.time_us.load(std::memory_order_relaxed) + value_us,
+		std::memory_order_relaxed);
+	slot.count.store(slot.count.load(std::memory_order_relaxed) + 1,
+		std::memory_order_relaxed);
+	if (value_us > slot.max_us.load(std::memory_order_relaxed))
+		slot.max_us.store(value_us, std::memory_order_relaxed);
+}
+
+void Profiler::mergeProbes()
+{
+	MutexAutoLock lock(m_mutex);
+	mergeProbesNoLock();
+}
+
+void Profiler::mergeProbesNoLock()
+{
+	for (size_t i = 0; i < m_probes.size(); i++) {
+		Probe &probe = m_probes[i];
+
+		u64 time_us = 0, count = 0, max_us = 0;
+		for (auto &buffer : m_probe_buffers) {
+			ProbeSlot &slot = buffer->slots[i];
+			time_us += slot.time_us.load(std::memory_order_relaxed);
+			count += slot.count.load(std::memory_order_relaxed);
+			max_us = std::max<u64>(max_us,
+				slot.max_us.exchange(0, std::memory_order_relaxed));
+		}
+
+		const u64 new_count = count - probe.merged_count;
+		if (new_count == 0)
+			continue;
+		const u64 new_time_us = time_us - probe.merged_time_us;
+		probe.merged_time_us = time_us;
+		probe.merged_count = count;
+
+		if (probe.time_counter) {
+			probe.time_counter->increment(new_time_us);
+			probe.count_counter->increment(new_count);
+		}
+
+		// Same as add(), avg() and max() would do for every value
+		const float new_time_ms = new_time_us / 1000.0f;
+		switch (probe.type) {
+		case SPT_AVG: {
+			int &avgcount = m_avgcounts[probe.name];
+			avgcount = MYMAX(avgcount, 0) + new_count;
+			m_data[probe.name] += new_time_ms;
+			break;
+		}
+		case SPT_MAX: {
+			m_avgcounts[probe.name] = -2;
+			float &value = m_data[probe.name];
+			value = MYMAX(value, max_us / 1000.0f);
+			break;
+		}
+		default:
+			m_avgcounts[probe.name] = -2;
+			m_data[probe.name] += new_time_ms;
+			break;
+		}
+	}
+}
+
+void Profiler::getProbeTotals(std::vector<ProbeTotals> &totals)
+{
+	MutexAutoLock lock(m_mutex);
+	mergeProbesNoLock();
+
+	totals.clear();
+	for (const Probe &probe : m_probes)
+		totals.push_back({probe.label, probe.merged_time_us, probe.merged_count});
+}
+
+void Profiler::setMetricsBackend(MetricsBackend *mb)
+{
+	MutexAutoLock lock(m_mutex);
+	m_metrics_backend = mb;
+	for (Probe &probe : m_probes) {
+		if (!mb) {
+			probe.time_counter.reset();
+			probe.count_counter.reset();
+			continue;
+		}
+		probe.time_counter = mb->addCounter(
+			"minetest_core_profiler_time_us", "Time spent in profiled code (in microseconds)",
+			{{"probe", probe.label}});
+		probe.count_counter = mb->addCounter(
+			"minetest_core_profiler_calls", "Number of times profiled code ran",
+			{{"probe", probe.label}});
+	}
+}
+
+Profiler::~Profiler()
+{
+	if (t_probe_buffer.owner == this) {
+		t_probe_buffer.owner = nullptr;
+		t_probe_buffer.buffer = nullptr;
+		t_probe_buffer.in_use = nullptr;
+	}
+}
@@ -20,19 +20,46 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include <atomic>
 #include <cassert>
+#include <memory>
 #include <string>
 #include <map>
 #include <ostream>
+#include <vector>
 
 #include "threading/mutex_auto_lock.h"
 #include "util/timetaker.h"
 #include "util/numeric.h"      // paging()
+#include "util/metricsbackend.h"
 
 // Global profiler
 class Profiler;
 extern Profiler *g_profiler;
 
+enum ScopeProfilerType{
+	SPT_ADD,
+	SPT_AVG,
+	SPT_GRAPH_ADD,
+	SPT_MAX
+};
+
+/*
+	Probes are a cheaper alternative to names for code that runs often or
+	on several threads at once. A probe is registered once:
+
+		static const ProfilerProbe probe =
+			g_profiler->registerProbe("Foo::bar()", SPT_AVG);
+		ScopeProfiler sp(g_profiler, probe);
+
+	Its values are collected in per-thread buffers without any locking and
+	merged into the named values whenever the profiler is read.
+*/
+typedef u16 ProfilerProbe;
+
+// Maximum number of probes per profiler
+#define PROFILER_MAX_PROBES 256
+
 /*
 	Time profiler
 */
@@ -41,6 +68,8 @@ class Profiler
 {
 public:
 	Profiler();
+	// Probes must not be used by other threads anymore at this point
+	~Profiler();
 
 	void add(const std::string &name, float value);
 	void avg(const std::string &name, float value);
@@ -82,30 +111,79 @@ class Profiler
 		m_data.erase(name);
 	}
 
+	// Returns the probe for name, registering it if necessary.
+	// SPT_GRAPH_ADD is not supported by probes.
+	ProfilerProbe registerProbe(const std::string &name, ScopeProfilerType type);
+	// Records a value (in microseconds), lock-free
+	void probeRecord(ProfilerProbe probe, u64 value_us);
+	// Moves the values collected by probes into the named values
+	void mergeProbes();
+
+	struct ProbeTotals {
+		std::string name;
+		u64 time_us;
+		u64 count;
+	};
+	// Values of all probes since they were registered
+	void getProbeTotals(std::vector<ProbeTotals> &totals);
+
+	// Probe values will also be reported as metrics when merging
+	void setMetricsBackend(MetricsBackend *mb);
+
 private:
+	// Written by a single thread, read by the merging one
+	struct ProbeSlot {
+		std::atomic<u64> time_us{0};
+		std::atomic<u64> count{0};
+		std::atomic<u64> max_us{0};
+	};
+
+	struct ProbeBuffer {
+		ProbeSlot slots[PROFILER_MAX_PROBES];
+		// Whether a thread is using the buffer
+		std::atomic<bool> in_use{true};
+	};
+
+	struct Probe {
+		// As passed to registerProbe()
+		std::string label;
+		// Name of the value, with unit
+		std::string name;
+		ScopeProfilerType type;
+		// Totals at the last merge
+		u64 merged_time_us = 0;
+		u64 merged_count = 0;
+		MetricCounterPtr time_counter;
+		MetricCounterPtr count_counter;
+	};
+
+	ProbeBuffer *getThreadBuffer();
+	void mergeProbesNoLock();
+
 	std::mutex m_mutex;
+	// The buffers are never freed, threads reuse them once their owner exits
+	std::vector<std::unique_ptr<ProbeBuffer>> m_probe_buffers;
+	std::vector<Probe> m_probes;
+	MetricsBackend *m_metrics_backend = nullptr;
 	std::map<std::string, float> m_data;
 	std::map<std::string, int> m_avgcounts;
 	std::map<std::string, float> m_graphvalues;
 	u64 m_start_time;
 };
 
-enum ScopeProfilerType{
-	SPT_ADD,
-	SPT_AVG,
-	SPT_GRAPH_ADD,
-	SPT_MAX
-};
-
 class ScopeProfiler
 {
 public:
 	ScopeProfiler(Profiler *profiler, const std::string &name,
 			ScopeProfilerType type = SPT_ADD);
+	ScopeProfiler(Profiler *profiler, ProfilerProbe probe);
 	~ScopeProfiler();
 private:
 	Profiler *m_profiler = nullptr;
 	std::string m_name;
 	TimeTaker *m_timer = nullptr;
 	enum ScopeProfilerType m_type;
+	// Only used with probes
+	ProfilerProbe m_probe = 0;
+	u64 m_start_us = 0;
 };
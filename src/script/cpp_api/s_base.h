@@ -60,6 +60,7 @@ extern "C" {
 enum class ScriptingType: u8 {
 	Async, // either mainmenu (client) or ingame (server)
 	Client,
+	Emerge, // mapgen environment of an emerge thread (server)
 	MainMenu,
 	Server
 };
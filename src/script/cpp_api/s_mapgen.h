@@ -0,0 +1,41 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "cpp_api/s_base.h"
+
+struct BlockMakeData;
+
+/*
+	Callbacks of the mapgen environment, run by an emerge thread for a
+	chunk that was generated but not yet committed to the map.
+*/
+class ScriptApiMapgen : virtual public ScriptApiBase
+{
+public:
+	// Called after Mapgen::makeChunk, without the environment lock
+	void on_generated(BlockMakeData *bmdata, u32 blockseed);
+
+	// Chunk that is being worked on, nullptr outside of callbacks
+	BlockMakeData *getBlockMakeData() { return m_bmdata; }
+
+private:
+	BlockMakeData *m_bmdata = nullptr;
+};
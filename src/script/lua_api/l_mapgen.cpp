@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "lua_api/l_vmanip.h"
 #include "common/c_converter.h"
 #include "common/c_content.h"
+#include "cpp_api/s_mapgen.h"
 #include "cpp_api/s_security.h"
 #include "util/serialize.h"
 #include "server.h"
@@ -1475,7 +1476,14 @@ int ModApiMapgen::l_generate_ores(lua_State *L)
 
 	u32 blockseed = Mapgen::getBlockSeed(pmin, mg.seed);
 
-	emerge->oremgr->placeAllOres(&mg, blockseed, pmin, pmax);
+	// The mapgen environment uses the managers cloned for the thread's
+	// mapgen, the others only run with the env lock held
+	Mapgen *current = getScriptApiBase(L)->getType() == ScriptingType::Emerge ?
+			emerge->getCurrentMapgen() : nullptr;
+	if (current && current->m_emerge)
+		current->m_emerge->oremgr->placeAllOres(&mg, blockseed, pmin, pmax);
+	else
+		emerge->oremgr->placeAllOres(&mg, blockseed, pmin, pmax);
 
 	return 0;
 }
@@ -1504,7 +1512,14 @@ int ModApiMapgen::l_generate_decorations(lua_State *L)
 
 	u32 blockseed = Mapgen::getBlockSeed(pmin, mg.seed);
 
-	emerge->decomgr->placeAllDecos(&mg, blockseed, pmin, pmax);
+	// The mapgen environment uses the managers cloned for the thread's
+	// mapgen, the others only run with the env lock held
+	Mapgen *current = getScriptApiBase(L)->getType() == ScriptingType::Emerge ?
+			emerge->getCurrentMapgen() : nullptr;
+	if (current && current->m_emerge)
+		current->m_emerge->decomgr->placeAllDecos(&mg, blockseed, pmin, pmax);
+	else
+		emerge->decomgr->placeAllDecos(&mg, blockseed, pmin, pmax);
 
 	return 0;
 }
@@ -1806,17 +1821,25 @@ int ModApiMapgen::l_read_schematic(lua_State *L)
 
 int ModApiMapgen::update_liquids(lua_State *L, MMVManip *vm)
 {
-	GET_ENV_PTR;
+	UniqueQueue<v3s16> *trans_liquid;
+	if (getScriptApiBase(L)->getType() == ScriptingType::Emerge) {
+		// Queued with the chunk, the map takes them over once it's committed
+		BlockMakeData *bmdata = getScriptApi<ScriptApiMapgen>(L)->getBlockMakeData();
+		if (!bmdata)
+			return 0;
+		trans_liquid = &bmdata->transforming_liquid;
+	} else {
+		GET_ENV_PTR;
+		trans_liquid = &env->getServerMap().m_transforming_liquid;
+	}
 
-	ServerMap *map = &(env->getServerMap());
 	const NodeDefManager *ndef = getServer(L)->getNodeDefManager();
 
 	Mapgen mg;
 	mg.vm   = vm;
 	mg.ndef = ndef;
 
-	mg.updateLiquid(&map->m_transforming_liquid,
-		vm->m_area.MinEdge, vm->m_area.MaxEdge);
+	mg.updateLiquid(trans_liquid, vm->m_area.MinEdge, vm->m_area.MaxEdge);
 	return 0;
 }
 
@@ -1891,3 +1914,22 @@ void ModApiMapgen::Initialize(lua_State *L, int top)
 	API_FCT(serialize_schematic);
 	API_FCT(read_schematic);
 }
+
+void ModApiMapgen::InitializeEmerge(lua_State *L, int top)
+{
+	API_FCT(get_biome_id);
+	API_FCT(get_biome_name);
+	API_FCT(get_heat);
+	API_FCT(get_humidity);
+	API_FCT(get_biome_data);
+	API_FCT(get_mapgen_object);
+
+	API_FCT(get_mapgen_edges);
+	API_FCT(get_mapgen_setting);
+	API_FCT(get_mapgen_setting_noiseparams);
+	API_FCT(get_noiseparams);
+	API_FCT(get_decoration_id);
+
+	API_FCT(generate_ores);
+	API_FCT(generate_decorations);
+}
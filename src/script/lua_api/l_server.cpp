@@ -29,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "environment.h"
 #include "remoteplayer.h"
 #include "log.h"
+#include "profiler.h"
 #include <algorithm>
 
 // request_shutdown()
@@ -67,6 +68,25 @@ int ModApiServer::l_get_server_max_lag(lua_State *L)
 	return 1;
 }
 
+// get_profiler_probes()
+int ModApiServer::l_get_profiler_probes(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	std::vector<Profiler::ProbeTotals> totals;
+	g_profiler->getProbeTotals(totals);
+
+	lua_createtable(L, 0, totals.size());
+	for (const auto &probe : totals) {
+		lua_createtable(L, 0, 2);
+		lua_pushnumber(L, probe.time_us);
+		lua_setfield(L, -2, "time");
+		lua_pushnumber(L, probe.count);
+		lua_setfield(L, -2, "count");
+		lua_setfield(L, -2, probe.name.c_str());
+	}
+	return 1;
+}
+
 // print(text)
 int ModApiServer::l_print(lua_State *L)
 {
@@ -253,6 +273,10 @@ int ModApiServer::l_get_player_information(lua_State *L)
 	lua_pushstring(L, info.lang_code.c_str());
 	lua_settable(L, table);
 
+	lua_pushstring(L, "position_bytes_saved");
+	lua_pushnumber(L, info.position_bytes_saved);
+	lua_settable(L, table);
+
 #ifndef NDEBUG
 	lua_pushstring(L,"serialization_version");
 	lua_pushnumber(L, info.ser_vers);
@@ -642,6 +666,25 @@ int ModApiServer::l_register_async_dofile(lua_State *L)
 	return 1;
 }
 
+// register_mapgen_script(path)
+int ModApiServer::l_register_mapgen_script(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	std::string path = readParam<std::string>(L, 1);
+	CHECK_SECURE_PATH(L, path.c_str(), false);
+
+	// Find currently running mod name (only at init time)
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_CURRENT_MOD_NAME);
+	if (!lua_isstring(L, -1))
+		return 0;
+	std::string modname = readParam<std::string>(L, -1);
+
+	getServer(L)->m_mapgen_init_files.emplace_back(modname, path);
+	lua_pushboolean(L, true);
+	return 1;
+}
+
 // serialize_roundtrip(value)
 // Meant for unit testing the packer from Lua
 int ModApiServer::l_serialize_roundtrip(lua_State *L)
@@ -672,6 +715,7 @@ void ModApiServer::Initialize(lua_State *L, int top)
 	API_FCT(get_server_status);
 	API_FCT(get_server_uptime);
 	API_FCT(get_server_max_lag);
+	API_FCT(get_profiler_probes);
 	API_FCT(get_worldpath);
 	API_FCT(is_singleplayer);
 
@@ -704,6 +748,7 @@ void ModApiServer::Initialize(lua_State *L, int top)
 
 	API_FCT(do_async_callback);
 	API_FCT(register_async_dofile);
+	API_FCT(register_mapgen_script);
 	API_FCT(serialize_roundtrip);
 }
 
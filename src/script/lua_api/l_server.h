@@ -36,6 +36,9 @@ class ModApiServer : public ModApiBase
 	// get_server_max_lag()
 	static int l_get_server_max_lag(lua_State *L);
 
+	// get_profiler_probes()
+	static int l_get_profiler_probes(lua_State *L);
+
 	// get_worldpath()
 	static int l_get_worldpath(lua_State *L);
 
@@ -118,6 +121,9 @@ class ModApiServer : public ModApiBase
 	// register_async_dofile(path)
 	static int l_register_async_dofile(lua_State *L);
 
+	// register_mapgen_script(path)
+	static int l_register_mapgen_script(lua_State *L);
+
 	// serialize_roundtrip(obj)
 	static int l_serialize_roundtrip(lua_State *L);
 
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/c_content.h"
 #include "common/c_converter.h"
 #include "common/c_packer.h"
+#include "cpp_api/s_base.h"
 #include "environment.h"
 #include "map.h"
 #include "mapblock.h"
@@ -47,6 +48,9 @@ int LuaVoxelManip::l_read_from_map(lua_State *L)
 	MMVManip *vm = o->vm;
 	if (vm->isOrphan())
 		return 0;
+	// The mapgen environment runs without the environment lock
+	if (getScriptApiBase(L)->getType() == ScriptingType::Emerge)
+		throw LuaError("VoxelManip:read_from_map is not available in the mapgen environment");
 
 	v3s16 bp1 = getNodeBlockPos(check_v3s16(L, 2));
 	v3s16 bp2 = getNodeBlockPos(check_v3s16(L, 3));
@@ -0,0 +1,47 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "cpp_api/s_base.h"
+#include "cpp_api/s_mapgen.h"
+#include "cpp_api/s_security.h"
+
+/*****************************************************************************/
+/* Scripting <-> Emerge Thread Interface                                     */
+/*****************************************************************************/
+
+/*
+	Mapgen environment of one emerge thread. It is only created if mods
+	registered scripts for it with core.register_mapgen_script() and, like
+	the async environment, has no access to the map or the server state.
+	Its callbacks only work on the chunk that the thread generated.
+*/
+class EmergeScripting:
+		virtual public ScriptApiBase,
+		public ScriptApiMapgen,
+		public ScriptApiSecurity
+{
+public:
+	// Loads builtin and the registered scripts, throws ModError on failure
+	EmergeScripting(Server *server);
+
+private:
+	void InitializeModApi(lua_State *L, int top);
+};
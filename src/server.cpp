@@ -65,6 +65,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "remoteplayer.h"
 #include "server/player_sao.h"
 #include "server/serverinventorymgr.h"
+#include "server/blockserializer.h"
+#include "server/objectmessagerouter.h"
+#include "server/bandwidthscheduler.h"
+#include "threading/workerpool.h"
 #include "translation.h"
 #include "database/database-sqlite3.h"
 #if USE_POSTGRESQL
@@ -282,6 +286,8 @@ Server::Server(
 #endif
 		m_metrics_backend = std::make_unique<MetricsBackend>();
 
+	g_profiler->setMetricsBackend(m_metrics_backend.get());
+
 	m_uptime_counter = m_metrics_backend->addCounter("minetest_core_server_uptime", "Server uptime (in seconds)");
 	m_player_gauge = m_metrics_backend->addGauge("minetest_core_player_number", "Number of connected players");
 
@@ -303,6 +309,10 @@ Server::Server(
 				{{"type", aom_types[i]}});
 	}
 
+	m_aom_position_saved_counter = m_metrics_backend->addCounter(
+			"minetest_core_aom_position_bytes_saved",
+			"Bytes saved by sending compact object position updates");
+
 	m_packet_recv_counter = m_metrics_backend->addCounter(
 			"minetest_core_server_packet_recv",
 			"Processable packets received");
@@ -315,11 +325,34 @@ Server::Server(
 			"minetest_core_map_edit_events",
 			"Number of map edit events");
 
+	const std::string socket_directions[] = {"recv", "send"};
+	for (u32 i = 0; i < ARRLEN(socket_directions); i++) {
+		m_socket_syscall_counter[i] = m_metrics_backend->addCounter(
+				"minetest_core_network_syscalls",
+				"Number of UDP socket send/receive syscalls",
+				{{"direction", socket_directions[i]}});
+		m_socket_datagram_counter[i] = m_metrics_backend->addCounter(
+				"minetest_core_network_datagrams",
+				"Number of UDP datagrams sent/received",
+				{{"direction", socket_directions[i]}});
+	}
+
 	m_lag_gauge->set(g_settings->getFloat("dedicated_server_step"));
+
+	m_block_serializer = std::make_unique<BlockSerializer>(m_metrics_backend.get());
+	m_clients.initBandwidthScheduler(m_metrics_backend.get());
+
+	// 0 = 50% of the system cores
+	const unsigned int collect_threads = Thread::getPoolSize(
+			rangelim(g_settings->getS32("block_collection_threads"), 0, 16), 2);
+	// The server thread is one of them
+	m_block_collect_pool = std::make_unique<WorkerPool>("BlockCollect",
+			collect_threads - 1);
 }
 
 Server::~Server()
 {
+	g_profiler->setMetricsBackend(nullptr);
 
 	// Send shutdown message
 	SendChatMessage(PEER_ID_INEXISTENT, ChatMessage(CHATMESSAGE_TYPE_ANNOUNCE,
@@ -375,6 +408,8 @@ Server::~Server()
 		stop();
 		delete m_thread;
 	}
+	m_block_serializer.reset();
+	m_block_collect_pool.reset();
 
 	// Write any changes before deletion.
 	if (m_mod_storage_database)
@@ -545,7 +580,8 @@ void Server::start()
 	m_con->SetTimeoutMs(30);
 	m_con->Serve(m_bind_addr);
 
-	// Start thread
+	// Start threads
+	m_block_serializer->start();
 	m_thread->start();
 
 	// ASCII art for the win!
@@ -614,6 +650,31 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 	*/
 	m_uptime_counter->increment(dtime);
 
+	// Collect the values of profiler probes, this also updates their metrics
+	g_profiler->mergeProbes();
+
+	/*
+		Update socket metrics (the ratio of datagrams to syscalls shows
+		how well the connection threads batch them)
+	*/
+	{
+		const UDPSocket::Stats stats = m_con->getSocketStats();
+		const u64 recv_calls = stats.recv_calls - m_last_socket_stats.recv_calls;
+		const u64 recv_packets = stats.recv_packets - m_last_socket_stats.recv_packets;
+		const u64 send_calls = stats.send_calls - m_last_socket_stats.send_calls;
+		const u64 send_packets = stats.send_packets - m_last_socket_stats.send_packets;
+		m_last_socket_stats = stats;
+
+		m_socket_syscall_counter[0]->increment(recv_calls);
+		m_socket_datagram_counter[0]->increment(recv_packets);
+		m_socket_syscall_counter[1]->increment(send_calls);
+		m_socket_datagram_counter[1]->increment(send_packets);
+		if (recv_calls > 0)
+			g_profiler->avg("Server: datagrams per recv syscall", (float)recv_packets / recv_calls);
+		if (send_calls > 0)
+			g_profiler->avg("Server: datagrams per send syscall", (float)send_packets / send_calls);
+	}
+
 	handlePeerChanges();
 
 	/*
@@ -797,9 +858,7 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 		MutexAutoLock envlock(m_env_mutex);
 		ScopeProfiler sp(g_profiler, "Server: send SAO messages");
 
-		// Key = object id
-		// Value = data sent by object
-		std::unordered_map<u16, std::vector<ActiveObjectMessage>*> buffered_messages;
+		ObjectMessageRouter router;
 
 		// Get active object messages from environment
 		ActiveObjectMessage aom(0);
@@ -812,15 +871,7 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 			else
 				count_unreliable++;
 
-			std::vector<ActiveObjectMessage>* message_list = nullptr;
-			auto n = buffered_messages.find(aom.id);
-			if (n == buffered_messages.end()) {
-				message_list = new std::vector<ActiveObjectMessage>;
-				buffered_messages[aom.id] = message_list;
-			} else {
-				message_list = n->second;
-			}
-			message_list->push_back(std::move(aom));
+			router.push(std::move(aom));
 		}
 
 		m_aom_buffer_counter[0]->increment(count_reliable);
@@ -828,66 +879,29 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
-			const RemoteClientMap &clients = m_clients.getClientList();
-			// Route data to every client
-			std::string reliable_data, unreliable_data;
-			for (const auto &client_it : clients) {
-				reliable_data.clear();
-				unreliable_data.clear();
-				RemoteClient *client = client_it.second;
-				PlayerSAO *player = getPlayerSAO(client->peer_id);
-				// Go through all objects in message buffer
-				for (const auto &buffered_message : buffered_messages) {
-					// If object does not exist or is not known by client, skip it
-					u16 id = buffered_message.first;
-					ServerActiveObject *sao = m_env->getActiveObject(id);
-					if (!sao || client->m_known_objects.find(id) == client->m_known_objects.end())
-						continue;
-
-					// Get message list of object
-					std::vector<ActiveObjectMessage>* list = buffered_message.second;
-					// Go through every message
-					for (const ActiveObjectMessage &aom : *list) {
-						// Send position updates to players who do not see the attachment
-						if (aom.datastring[0] == AO_CMD_UPDATE_POSITION) {
-							if (sao->getId() == player->getId())
-								continue;
-
-							// Do not send position updates for attached players
-							// as long the parent is known to the client
-							ServerActiveObject *parent = sao->getParent();
-							if (parent && client->m_known_objects.find(parent->getId()) !=
-									client->m_known_objects.end())
-								continue;
-						}
-
-						// Add full new data to appropriate buffer
-						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
-						char idbuf[2];
-						writeU16((u8*) idbuf, aom.id);
-						// u16 id
-						// std::string data
-						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
-					}
-				}
-				/*
-					reliable_data and unreliable_data are now ready.
-					Send them.
-				*/
-				if (!reliable_data.empty()) {
-					SendActiveObjectMessages(client->peer_id, reliable_data);
+			// Serialize the messages once and hand them to the clients that
+			// know the object
+			router.route([this] (u16 id) {
+				return m_env->getActiveObject(id);
+			}, [this] (u16 peer_id) {
+				RemoteClient *client = m_clients.lockedGetClientNoEx(peer_id, CS_Invalid);
+				return client && client->net_proto_version >= 45;
+			});
+
+			for (const auto &it : router.getClientData()) {
+				if (it.second.compact_bytes_saved > 0) {
+					m_aom_position_saved_counter->increment(it.second.compact_bytes_saved);
+					RemoteClient *client = m_clients.lockedGetClientNoEx(it.first, CS_Invalid);
+					if (client)
+						client->position_bytes_saved += it.second.compact_bytes_saved;
 				}
 
-				if (!unreliable_data.empty()) {
-					SendActiveObjectMessages(client->peer_id, unreliable_data, false);
-				}
-			}
-		}
+				if (!it.second.reliable.empty())
+					SendActiveObjectMessages(it.first, it.second.reliable);
 
-		// Clear buffered_messages
-		for (auto &buffered_message : buffered_messages) {
-			delete buffered_message.second;
+				if (!it.second.unreliable.empty())
+					SendActiveObjectMessages(it.first, it.second.unreliable, false);
+			}
 		}
 	}
 
@@ -959,6 +973,10 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 				break;
 			}
 
+			// Serialized data of these blocks is of no use anymore
+			for (const v3s16 &modified_block : event->modified_blocks)
+				m_block_serializer->invalidate(modified_block);
+
 			/*
 				Set blocks not sent to far players
 			*/
@@ -1052,8 +1070,12 @@ void Server::Receive(float timeout)
 		pkt.clear();
 		peer_id = 0;
 		try {
-			if (!m_con->ReceiveTimeoutMs(&pkt,
-					(u32)remaining_time_us() / 1000)) {
+			// Packets that wait for client bandwidth are sent in between
+			u32 timeout_ms = (u32)remaining_time_us() / 1000;
+			if (m_clients.sendScheduled())
+				timeout_ms = MYMIN(timeout_ms, BandwidthScheduler::STEP_INTERVAL_MS);
+
+			if (!m_con->ReceiveTimeoutMs(&pkt, timeout_ms)) {
 				// No incoming data.
 				// Already break if there's 1ms left, as ReceiveTimeoutMs is too coarse
 				// and a faster server-step is better than busy waiting.
@@ -1294,6 +1316,7 @@ bool Server::getClientInfo(session_t peer_id, ClientInfo &ret)
 	ret.uptime = client->uptime();
 	ret.ser_vers = client->serialization_version;
 	ret.prot_vers = client->net_proto_version;
+	ret.position_bytes_saved = client->position_bytes_saved;
 
 	ret.major = client->getMajor();
 	ret.minor = client->getMinor();
@@ -1367,6 +1390,12 @@ void Server::Send(session_t peer_id, NetworkPacket *pkt)
 		clientCommandFactoryTable[pkt->getCommand()].reliable);
 }
 
+void Server::Send(NetworkPacket &&pkt)
+{
+	const ClientCommandFactory &factory = clientCommandFactoryTable[pkt.getCommand()];
+	m_clients.send(pkt.getPeerId(), factory.channel, std::move(pkt), factory.reliable);
+}
+
 void Server::SendMovement(session_t peer_id)
 {
 	NetworkPacket pkt(TOCLIENT_MOVEMENT, 12 * sizeof(float), peer_id);
@@ -2085,8 +2114,8 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		// Remove from known objects
 		client->m_known_objects.erase(id);
 
-		if (obj && obj->m_known_by_count > 0)
-			obj->m_known_by_count--;
+		if (obj)
+			obj->removeKnownBy(client->peer_id);
 
 		removed_objects.pop();
 	}
@@ -2121,7 +2150,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		// Add to known objects
 		client->m_known_objects.insert(id);
 
-		obj->m_known_by_count++;
+		obj->addKnownBy(client->peer_id);
 	}
 
 	NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_REMOVE_ADD, data.size(), client->peer_id);
@@ -2401,45 +2430,77 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 	}
 }
 
-void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+bool Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
+		u16 net_proto_version, bool defer)
 {
-	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
+	// Reuse an earlier serialization of the block if it's still up to date
+	if (auto data = m_block_serializer->getCached(block, ver)) {
+		SendSerializedBlock(peer_id, block->getPos(), *data);
+		return true;
+	}
 
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
+	// Only copy the block here and leave the compression to the workers.
+	// Pre-29 formats compress in between and can't be split.
+	if (defer && ver >= 29) {
+		m_block_serializer->queueBlock(block, ver, peer_id);
+		return false;
 	}
 
+	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
+
 	// Serialize the block in the right format
-	if (!sptr) {
-		std::ostringstream os(std::ios_base::binary);
-		block->serialize(os, ver, false, net_compression_level);
-		block->serializeNetworkSpecific(os);
-		s = os.str();
-		sptr = &s;
-	}
+	std::ostringstream os(std::ios_base::binary);
+	block->serialize(os, ver, false, net_compression_level);
+	block->serializeNetworkSpecific(os);
+	auto data = std::make_shared<const std::string>(os.str());
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
-	Send(&pkt);
+	SendSerializedBlock(peer_id, block->getPos(), *data);
+	m_block_serializer->putCached(block, ver, std::move(data));
+	return true;
+}
 
-	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+void Server::SendSerializedBlock(session_t peer_id, v3s16 pos, const std::string &data)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data.size(), peer_id);
+	pkt << pos;
+	pkt.putRawString(data);
+	Send(std::move(pkt));
 }
 
 void Server::SendBlocks(float dtime)
 {
+	{
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send serialized");
+
+		// Hand out the blocks the workers have finished in the meantime
+		ClientInterface::AutoLock clientlock(m_clients);
+		SerializedBlock result;
+		while (m_block_serializer->getNextResult(result)) {
+			for (session_t peer_id : result.peers) {
+				// The client might be gone by now, or the block was modified
+				// and it will be selected again
+				RemoteClient *client = m_clients.lockedGetClientNoEx(peer_id, CS_Active);
+				if (!client || !client->isWaitingForBlock(result.pos, result.block_version))
+					continue;
+
+				if (result.outdated) {
+					client->SetBlockNotSent(result.pos);
+					continue;
+				}
+				SendSerializedBlock(peer_id, result.pos, *result.data);
+				client->SentBlock(result.pos);
+			}
+		}
+
+		m_block_serializer->step(dtime);
+	}
+
 	MutexAutoLock envlock(m_env_mutex);
 	//TODO check if one big lock could be faster then multiple small ones
 
 	std::vector<PrioritySortedBlockTransfer> queue;
 
-	u32 total_sending = 0, unique_clients = 0;
+	u32 total_sending = 0;
 
 	{
 		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
@@ -2447,6 +2508,8 @@ void Server::SendBlocks(float dtime)
 		std::vector<session_t> clients = m_clients.getClientIDs();
 
 		ClientInterface::AutoLock clientlock(m_clients);
+		std::vector<RemoteClient *> active_clients;
+		active_clients.reserve(clients.size());
 		for (const session_t client_id : clients) {
 			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
 
@@ -2454,10 +2517,22 @@ void Server::SendBlocks(float dtime)
 				continue;
 
 			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
-			client->GetNextBlocks(m_env,m_emerge, dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
+			active_clients.push_back(client);
 		}
+
+		// Clients only touch their own state and read the map, each one
+		// gets its own list that is merged afterwards
+		std::vector<std::vector<PrioritySortedBlockTransfer>> lists(active_clients.size());
+		m_block_collect_pool->run(active_clients.size(), [&] (size_t i) {
+			active_clients[i]->GetNextBlocks(m_env, m_emerge, dtime, lists[i]);
+		});
+
+		size_t total = 0;
+		for (const auto &list : lists)
+			total += list.size();
+		queue.reserve(total);
+		for (const auto &list : lists)
+			queue.insert(queue.end(), list.begin(), list.end());
 	}
 
 	// Sort.
@@ -2475,12 +2550,6 @@ void Server::SendBlocks(float dtime)
 	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
 	Map &map = m_env->getMap();
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
-	}
-
 	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
 		if (total_sending >= max_blocks_to_send)
 			break;
@@ -2494,10 +2563,11 @@ void Server::SendBlocks(float dtime)
 		if (!client)
 			continue;
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
-
-		client->SentBlock(block_to_send.pos);
+		if (SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
+				client->net_proto_version, true))
+			client->SentBlock(block_to_send.pos);
+		else
+			client->QueuedBlock(block_to_send.pos, block->getNetworkVersion());
 		total_sending++;
 	}
 }
@@ -2598,6 +2668,12 @@ void Server::fillMediaCache()
 	fs::GetRecursiveDirs(paths, m_gamespec.path + DIR_DELIM + "textures");
 	m_modmgr->getModsMediaPaths(paths);
 
+	// Keep the contents in memory up to this size, so that clients joining
+	// don't read every file again
+	const u64 memory_max = (u64)g_settings->getU32("media_memory_cache") * 1024 * 1024;
+	// Files with the same contents share the data
+	std::unordered_map<std::string, std::shared_ptr<const std::string>> by_digest;
+
 	// Collect media file information from paths into cache
 	for (const std::string &mediapath : paths) {
 		std::vector<fs::DirListNode> dirlist = fs::GetDirListing(mediapath);
@@ -2611,11 +2687,21 @@ void Server::fillMediaCache()
 
 			std::string filepath = mediapath;
 			filepath.append(DIR_DELIM).append(filename);
-			addMediaFile(filename, filepath);
+			std::string filedata, digest;
+			if (!addMediaFile(filename, filepath, &filedata, &digest))
+				continue;
+
+			auto &data = by_digest[digest];
+			if (!data && m_media_memory + filedata.size() <= memory_max) {
+				m_media_memory += filedata.size();
+				data = std::make_shared<const std::string>(std::move(filedata));
+			}
+			m_media[filename].data = data;
 		}
 	}
 
-	infostream << "Server: " << m_media.size() << " media files collected" << std::endl;
+	infostream << "Server: " << m_media.size() << " media files collected, "
+			<< (m_media_memory / 1024) << " KiB kept in memory" << std::endl;
 }
 
 void Server::sendMediaAnnouncement(session_t peer_id, const std::string &lang_code)
@@ -2654,12 +2740,11 @@ void Server::sendMediaAnnouncement(session_t peer_id, const std::string &lang_co
 struct SendableMedia
 {
 	std::string name;
-	std::string path;
-	std::string data;
+	std::shared_ptr<const std::string> data;
 
-	SendableMedia(const std::string &name, const std::string &path,
-			std::string &&data):
-		name(name), path(path), data(std::move(data))
+	SendableMedia(const std::string &name,
+			const std::shared_ptr<const std::string> &data):
+		name(name), data(data)
 	{}
 };
 
@@ -2688,17 +2773,21 @@ void Server::sendRequestedMedia(session_t peer_id,
 
 		const auto &m = m_media[name];
 
-		// Read data
-		std::string data;
-		if (!fs::ReadFile(m.path, data)) {
-			errorstream << "Server::sendRequestedMedia(): Failed to read \""
-					<< name << "\"" << std::endl;
-			continue;
+		// Read data unless it is held in memory
+		std::shared_ptr<const std::string> data = m.data;
+		if (!data) {
+			std::string filedata;
+			if (!fs::ReadFile(m.path, filedata)) {
+				errorstream << "Server::sendRequestedMedia(): Failed to read \""
+						<< name << "\"" << std::endl;
+				continue;
+			}
+			data = std::make_shared<const std::string>(std::move(filedata));
 		}
-		file_size_bunch_total += data.size();
+		file_size_bunch_total += data->size();
 
 		// Put in list
-		file_bunches.back().emplace_back(name, m.path, std::move(data));
+		file_bunches.back().emplace_back(name, data);
 
 		// Start next bunch if got enough data
 		if(file_size_bunch_total >= bytes_per_bunch) {
@@ -2725,19 +2814,23 @@ void Server::sendRequestedMedia(session_t peer_id,
 			}
 		*/
 
-		NetworkPacket pkt(TOCLIENT_MEDIA, 4 + 0, peer_id);
+		u32 pkt_size = 8;
+		for (const SendableMedia &j : file_bunches[i])
+			pkt_size += 6 + j.name.size() + j.data->size();
+
+		NetworkPacket pkt(TOCLIENT_MEDIA, pkt_size, peer_id);
 		pkt << num_bunches << i << (u32) file_bunches[i].size();
 
 		for (const SendableMedia &j : file_bunches[i]) {
 			pkt << j.name;
-			pkt.putLongString(j.data);
+			pkt.putLongString(*j.data);
 		}
 
 		verbosestream << "Server::sendRequestedMedia(): bunch "
 				<< i << "/" << num_bunches
 				<< " files=" << file_bunches[i].size()
 				<< " size="  << pkt.getSize() << std::endl;
-		Send(&pkt);
+		Send(std::move(pkt));
 	}
 }
 
@@ -4066,6 +4159,10 @@ Translations *Server::getTranslationLanguage(const std::string &lang_code)
 	std::string suffix = "." + lang_code + ".tr";
 	for (const auto &i : m_media) {
 		if (str_ends_with(i.first, suffix)) {
+			if (i.second.data) {
+				translations->loadTranslation(*i.second.data);
+				continue;
+			}
 			std::string data;
 			if (fs::ReadFile(i.second.path, data)) {
 				translations->loadTranslation(data);
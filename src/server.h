@@ -29,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "content/subgames.h"
 #include "network/peerhandler.h"
 #include "network/address.h"
+#include "network/socket.h"
 #include "util/numeric.h"
 #include "util/thread.h"
 #include "util/basic_macros.h"
@@ -42,6 +43,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <string>
 #include <list>
 #include <map>
+#include <memory>
 #include <vector>
 #include <unordered_set>
 
@@ -73,6 +75,8 @@ struct Lighting;
 class ServerThread;
 class ServerModManager;
 class ServerInventoryManager;
+class BlockSerializer;
+class WorkerPool;
 struct PackedValue;
 struct ParticleParameters;
 struct ParticleSpawnerParameters;
@@ -88,6 +92,9 @@ struct MediaInfo
 	std::string path;
 	std::string sha1_digest; // base64-encoded
 	bool no_announce; // true: not announced in TOCLIENT_ANNOUNCE_MEDIA (at player join)
+	// File contents kept in memory so that joining clients don't cause disk
+	// reads, shared between files with the same hash. null: read from path
+	std::shared_ptr<const std::string> data;
 
 	MediaInfo(const std::string &path_="",
 	          const std::string &sha1_digest_=""):
@@ -132,6 +139,7 @@ struct ClientInfo {
 	u32 uptime;
 	u8 ser_vers;
 	u16 prot_vers;
+	u64 position_bytes_saved;
 	u8 major, minor, patch;
 	std::string vers_string, lang_code;
 };
@@ -203,6 +211,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	void Send(NetworkPacket *pkt);
 	void Send(session_t peer_id, NetworkPacket *pkt);
+	// For large packets that are not needed afterwards, avoids a copy
+	void Send(NetworkPacket &&pkt);
 
 	// Helper for handleCommand_PlayerPos and handleCommand_Interact
 	void process_PlayerPos(RemotePlayer *player, PlayerSAO *playersao,
@@ -397,6 +407,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	// Lua files registered for init of async env, pair of modname + path
 	std::vector<std::pair<std::string, std::string>> m_async_init_files;
+	// Same for the mapgen env of the emerge threads
+	std::vector<std::pair<std::string, std::string>> m_mapgen_init_files;
 
 	// Data transferred into other Lua envs at init time
 	std::unique_ptr<PackedValue> m_lua_globals_data;
@@ -409,6 +421,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 private:
 	friend class EmergeThread;
+	friend class MapPregenerator;
 	friend class RemoteClient;
 	friend class TestServerShutdownState;
 
@@ -434,15 +447,6 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		std::unordered_set<session_t> waiting_players;
 	};
 
-	// The standard library does not implement std::hash for pairs so we have this:
-	struct SBCHash {
-		size_t operator() (const std::pair<v3s16, u16> &p) const {
-			return std::hash<v3s16>()(p.first) ^ p.second;
-		}
-	};
-
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
-
 	void init();
 
 	void SendMovement(session_t peer_id);
@@ -502,9 +506,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			float far_d_nodes = 100);
 
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
-	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+	// If `defer` is set the block may be handed to the block serializer
+	// threads instead, it is sent once finished. Returns false in that case.
+	bool SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
+		u16 net_proto_version, bool defer = false);
+	void SendSerializedBlock(session_t peer_id, v3s16 pos, const std::string &data);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -696,6 +702,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	// media files known to server
 	std::unordered_map<std::string, MediaInfo> m_media;
+	// bytes of media file contents held in memory
+	u64 m_media_memory = 0;
 
 	// pending dynamic media callbacks, clients inform the server when they have a file fetched
 	std::unordered_map<u32, PendingDynamicMediaCallback> m_pending_dyn_media;
@@ -721,6 +729,12 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Inventory manager
 	std::unique_ptr<ServerInventoryManager> m_inventory_mgr;
 
+	// Serializes blocks for sending off the server thread
+	std::unique_ptr<BlockSerializer> m_block_serializer;
+
+	// Runs RemoteClient::GetNextBlocks() for several clients at once
+	std::unique_ptr<WorkerPool> m_block_collect_pool;
+
 	// Global server metrics backend
 	std::unique_ptr<MetricsBackend> m_metrics_backend;
 
@@ -730,9 +744,15 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	MetricGaugePtr m_timeofday_gauge;
 	MetricGaugePtr m_lag_gauge;
 	MetricCounterPtr m_aom_buffer_counter[2]; // [0] = rel, [1] = unrel
+	MetricCounterPtr m_aom_position_saved_counter;
 	MetricCounterPtr m_packet_recv_counter;
 	MetricCounterPtr m_packet_recv_processed_counter;
 	MetricCounterPtr m_map_edit_event_counter;
+	// [0] = recv, [1] = send
+	MetricCounterPtr m_socket_syscall_counter[2];
+	MetricCounterPtr m_socket_datagram_counter[2];
+	// Socket statistics at the last metrics update
+	UDPSocket::Stats m_last_socket_stats;
 };
 
 /*
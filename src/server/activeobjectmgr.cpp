@@ -18,6 +18,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <log.h>
+#include <algorithm>
+#include <cmath>
 #include "mapblock.h"
 #include "profiler.h"
 #include "activeobjectmgr.h"
@@ -101,6 +103,7 @@ bool ActiveObjectMgr::registerObject(std::unique_ptr<ServerActiveObject> obj)
 
 	auto obj_p = obj.get();
 	m_active_objects[obj->getId()] = std::move(obj);
+	addToIndex(obj_p);
 
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
 			<< "Added id=" << obj_p->getId() << "; there are now "
@@ -119,19 +122,126 @@ void ActiveObjectMgr::removeObject(u16 id)
 		return;
 	}
 
+	removeFromIndex(it->second.get());
+
 	// Delete the obj before erasing, as the destructor may indirectly access
 	// m_active_objects.
 	it->second.reset();
 	m_active_objects.erase(id); // `it` can be invalid now
 }
 
+v3s16 ActiveObjectMgr::getIndexPos(const v3f &pos)
+{
+	constexpr f32 bucket_size = MAP_BLOCKSIZE * BS;
+	auto to_index = [] (f32 v) -> s16 {
+		f32 f = std::floor(v / bucket_size);
+		// written this way to also catch NaN
+		if (!(f > S16_MIN))
+			return S16_MIN;
+		if (f > S16_MAX)
+			return S16_MAX;
+		return (s16)f;
+	};
+	return v3s16(to_index(pos.X), to_index(pos.Y), to_index(pos.Z));
+}
+
+void ActiveObjectMgr::addToIndex(ServerActiveObject *obj)
+{
+	v3s16 p = getIndexPos(obj->getBasePosition());
+	m_spatial_index[p].push_back(obj);
+	m_index_pos[obj->getId()] = p;
+
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_objects.push_back(obj);
+}
+
+void ActiveObjectMgr::removeFromIndex(ServerActiveObject *obj)
+{
+	auto it = m_index_pos.find(obj->getId());
+	if (it == m_index_pos.end())
+		return;
+
+	auto bucket = m_spatial_index.find(it->second);
+	if (bucket != m_spatial_index.end()) {
+		auto &objs = bucket->second;
+		auto o = std::find(objs.begin(), objs.end(), obj);
+		if (o != objs.end()) {
+			*o = objs.back();
+			objs.pop_back();
+		}
+		if (objs.empty())
+			m_spatial_index.erase(bucket);
+	}
+	m_index_pos.erase(it);
+
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
+		auto o = std::find(m_player_objects.begin(), m_player_objects.end(), obj);
+		if (o != m_player_objects.end())
+			m_player_objects.erase(o);
+	}
+}
+
+void ActiveObjectMgr::updateObjectPos(ServerActiveObject *obj)
+{
+	// Objects that are not (yet) registered have nothing to update.
+	// Compare pointers since a pending object may carry the id of another.
+	auto it = m_active_objects.find(obj->getId());
+	if (it == m_active_objects.end() || it->second.get() != obj)
+		return;
+
+	auto old_pos = m_index_pos.find(obj->getId());
+	if (old_pos == m_index_pos.end())
+		return; // being removed right now
+	if (old_pos->second == getIndexPos(obj->getBasePosition()))
+		return;
+
+	removeFromIndex(obj);
+	addToIndex(obj);
+}
+
+void ActiveObjectMgr::getIndexedObjectsInArea(const aabb3f &box,
+		std::vector<ServerActiveObject *> &result) const
+{
+	const v3s16 minp = getIndexPos(box.MinEdge);
+	const v3s16 maxp = getIndexPos(box.MaxEdge);
+	const u64 volume = (u64)(maxp.X - minp.X + 1) * (maxp.Y - minp.Y + 1) *
+			(maxp.Z - minp.Z + 1);
+
+	if (volume > m_spatial_index.size()) {
+		// Huge area: cheaper to go through the occupied buckets
+		for (auto &it : m_spatial_index) {
+			const v3s16 &p = it.first;
+			if (p.X < minp.X || p.Y < minp.Y || p.Z < minp.Z ||
+					p.X > maxp.X || p.Y > maxp.Y || p.Z > maxp.Z)
+				continue;
+			result.insert(result.end(), it.second.begin(), it.second.end());
+		}
+		return;
+	}
+
+	// s32 to not overflow at the limits
+	for (s32 x = minp.X; x <= maxp.X; x++)
+	for (s32 y = minp.Y; y <= maxp.Y; y++)
+	for (s32 z = minp.Z; z <= maxp.Z; z++) {
+		auto it = m_spatial_index.find(v3s16(x, y, z));
+		if (it != m_spatial_index.end())
+			result.insert(result.end(), it->second.begin(), it->second.end());
+	}
+}
+
 void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second.get();
+	aabb3f box(pos - radius, pos + radius);
+	box.repair();
+
+	// Collect first, the callback may move objects around
+	std::vector<ServerActiveObject *> candidates;
+	getIndexedObjectsInArea(box, candidates);
+
+	for (ServerActiveObject *obj : candidates) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFromSQ(pos) > r2)
 			continue;
@@ -145,8 +255,10 @@ void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second.get();
+	std::vector<ServerActiveObject *> candidates;
+	getIndexedObjectsInArea(box, candidates);
+
+	for (ServerActiveObject *obj : candidates) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (!box.isPointInside(objectpos))
 			continue;
@@ -161,20 +273,31 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 		std::queue<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects near the player,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects) {
-		u16 id = ao_it.first;
+	const bool unlimited_players = player_radius == 0;
+	f32 search_radius = unlimited_players ? radius : std::max(radius, player_radius);
+	aabb3f box(player_pos - search_radius, player_pos + search_radius);
+	box.repair();
 
-		// Get object
-		ServerActiveObject *object = ao_it.second.get();
-		if (!object)
-			continue;
+	std::vector<ServerActiveObject *> candidates;
+	getIndexedObjectsInArea(box, candidates);
+	if (unlimited_players) {
+		// Players are visible from everywhere, so take all of them instead
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+			[] (ServerActiveObject *obj) {
+				return obj->getType() == ACTIVEOBJECT_TYPE_PLAYER;
+			}), candidates.end());
+		candidates.insert(candidates.end(), m_player_objects.begin(),
+				m_player_objects.end());
+	}
 
+	std::vector<u16> ids;
+	for (ServerActiveObject *object : candidates) {
 		if (object->isGone())
 			continue;
 
@@ -187,12 +310,17 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 			continue;
 
 		// Discard if already on current_objects
+		u16 id = object->getId();
 		auto n = current_objects.find(id);
 		if (n != current_objects.end())
 			continue;
-		// Add to added_objects
-		added_objects.push(id);
+		ids.push_back(id);
 	}
+
+	// Add to added_objects, in the same order as the object list
+	std::sort(ids.begin(), ids.end());
+	for (u16 id : ids)
+		added_objects.push(id);
 }
 
 } // namespace server
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <functional>
+#include <unordered_map>
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
@@ -48,5 +49,28 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 	void getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
 			f32 player_radius, std::set<u16> &current_objects,
 			std::queue<u16> &added_objects);
+
+	// Moves the object to its new place in the spatial index
+	void updateObjectPos(ServerActiveObject *obj);
+
+	// Map block an object at the given position is indexed under
+	static v3s16 getIndexPos(const v3f &pos);
+
+private:
+	void addToIndex(ServerActiveObject *obj);
+	void removeFromIndex(ServerActiveObject *obj);
+
+	// Collects all objects whose index position overlaps with the box.
+	// The caller still has to check the exact object positions.
+	void getIndexedObjectsInArea(const aabb3f &box,
+			std::vector<ServerActiveObject *> &result) const;
+
+	// Spatial index: objects are bucketed by the map block containing their
+	// base position, so area queries only look at nearby objects.
+	std::unordered_map<v3s16, std::vector<ServerActiveObject *>> m_spatial_index;
+	// Bucket every registered object currently resides in
+	std::unordered_map<u16, v3s16> m_index_pos;
+	// Players are also tracked separately for unlimited-range queries
+	std::vector<ServerActiveObject *> m_player_objects;
 };
 } // namespace server
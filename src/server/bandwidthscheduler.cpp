@@ -0,0 +1,285 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "bandwidthscheduler.h"
+#include "porting.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/numeric.h"
+
+// How much a client may send at once after being idle, in seconds of its rate
+#define BANDWIDTH_BURST_TIME 0.1f
+// Unreliable movement packets that waited longer are dropped, in microseconds
+#define BANDWIDTH_MOVEMENT_MAX_AGE 500000
+
+// Share of the rate each class gets when all of them have packets waiting
+static const float send_class_weights[SEND_CLASS_COUNT] = {8.0f, 4.0f, 2.0f, 1.0f};
+
+static const char *send_class_names[SEND_CLASS_COUNT] = {
+	"movement", "interaction", "blocks", "media"
+};
+
+BandwidthScheduler::BandwidthScheduler(u32 rate, const SendFunc &send,
+		MetricsBackend *mb) :
+	m_rate(rate),
+	m_send(send)
+{
+	for (int i = 0; i < SEND_CLASS_COUNT; i++) {
+		const char *name = send_class_names[i];
+		m_queue_gauge[i] = mb->addGauge(
+				"minetest_core_send_queue_packets",
+				"Number of packets waiting for client bandwidth",
+				{{"class", name}});
+		m_queue_bytes_gauge[i] = mb->addGauge(
+				"minetest_core_send_queue_bytes",
+				"Size of the packets waiting for client bandwidth (in bytes)",
+				{{"class", name}});
+		m_sent_counter[i] = mb->addCounter(
+				"minetest_core_send_scheduled_packets",
+				"Number of packets passed through the bandwidth scheduler",
+				{{"class", name}});
+		m_delay_counter[i] = mb->addCounter(
+				"minetest_core_send_queue_delay_seconds",
+				"Total time packets waited for client bandwidth",
+				{{"class", name}});
+	}
+	m_dropped_counter = mb->addCounter(
+			"minetest_core_send_dropped_packets",
+			"Number of stale movement packets dropped by the bandwidth scheduler");
+}
+
+SendClass BandwidthScheduler::classify(u16 command)
+{
+	switch (command) {
+	case TOCLIENT_ACTIVE_OBJECT_MESSAGES:
+	case TOCLIENT_ACTIVE_OBJECT_REMOVE_ADD:
+	case TOCLIENT_MOVE_PLAYER:
+	case TOCLIENT_PLAYER_SPEED:
+		return SEND_CLASS_MOVEMENT;
+	case TOCLIENT_BLOCKDATA:
+		return SEND_CLASS_BLOCKS;
+	case TOCLIENT_MEDIA:
+		return SEND_CLASS_MEDIA;
+	default:
+		return SEND_CLASS_INTERACTION;
+	}
+}
+
+const char *BandwidthScheduler::getClassName(SendClass send_class)
+{
+	return send_class < SEND_CLASS_COUNT ? send_class_names[send_class] : "unknown";
+}
+
+bool BandwidthScheduler::admit(session_t peer_id, u16 command, u32 size)
+{
+	if (!isEnabled())
+		return true;
+	if (command == TOCLIENT_ACCESS_DENIED)
+		return false;
+
+	MutexAutoLock lock(m_mutex);
+	Peer &peer = m_peers[peer_id];
+	refill(peer, porting::getTimeUs());
+	if (peer.queued > 0 || peer.budget < size)
+		return false;
+
+	peer.budget -= size;
+	m_sent_counter[classify(command)]->increment();
+	return true;
+}
+
+void BandwidthScheduler::push(session_t peer_id, u8 channelnum,
+		NetworkPacket &&pkt, bool reliable)
+{
+	if (!isEnabled()) {
+		m_send(peer_id, channelnum, std::move(pkt), reliable);
+		return;
+	}
+
+	const SendClass send_class = classify(pkt.getCommand());
+	const u64 now = porting::getTimeUs();
+
+	MutexAutoLock lock(m_mutex);
+	Peer &peer = m_peers[peer_id];
+	refill(peer, now);
+
+	if (pkt.getCommand() == TOCLIENT_ACCESS_DENIED) {
+		// The peer is disconnected right after this, get everything out
+		sendQueued(peer_id, peer, true);
+		m_sent_counter[send_class]->increment();
+		send(peer_id, peer, channelnum, std::move(pkt), reliable);
+		m_peers.erase(peer_id);
+		return;
+	}
+
+	if (peer.queued == 0 && peer.budget >= pkt.getSize()) {
+		m_sent_counter[send_class]->increment();
+		send(peer_id, peer, channelnum, std::move(pkt), reliable);
+		return;
+	}
+
+	const u32 size = pkt.getSize();
+	const double start = MYMAX(peer.virtual_time, peer.last_finish[send_class]);
+	const double finish = start + size / send_class_weights[send_class];
+	peer.last_finish[send_class] = finish;
+	peer.queues[send_class].push_back({std::move(pkt), channelnum, reliable,
+			now, finish});
+	peer.queued++;
+	m_queue_gauge[send_class]->increment();
+	m_queue_bytes_gauge[send_class]->increment(size);
+
+	sendQueued(peer_id, peer, false);
+}
+
+bool BandwidthScheduler::step()
+{
+	if (!isEnabled())
+		return false;
+
+	const u64 now = porting::getTimeUs();
+	bool waiting = false;
+	MutexAutoLock lock(m_mutex);
+	for (auto &it : m_peers) {
+		if (it.second.queued == 0)
+			continue;
+		refill(it.second, now);
+		dropStale(it.second, now);
+		sendQueued(it.first, it.second, false);
+		waiting |= it.second.queued > 0;
+	}
+	return waiting;
+}
+
+void BandwidthScheduler::flush(session_t peer_id)
+{
+	MutexAutoLock lock(m_mutex);
+	auto it = m_peers.find(peer_id);
+	if (it != m_peers.end())
+		sendQueued(peer_id, it->second, true);
+}
+
+void BandwidthScheduler::removePeer(session_t peer_id)
+{
+	MutexAutoLock lock(m_mutex);
+	auto it = m_peers.find(peer_id);
+	if (it == m_peers.end())
+		return;
+
+	for (int i = 0; i < SEND_CLASS_COUNT; i++) {
+		for (const QueuedPacket &queued : it->second.queues[i]) {
+			m_queue_gauge[i]->decrement();
+			m_queue_bytes_gauge[i]->decrement(queued.pkt.getSize());
+		}
+	}
+	m_peers.erase(it);
+}
+
+size_t BandwidthScheduler::getQueuedCount(session_t peer_id, SendClass send_class)
+{
+	MutexAutoLock lock(m_mutex);
+	auto it = m_peers.find(peer_id);
+	return it != m_peers.end() ? it->second.queues[send_class].size() : 0;
+}
+
+void BandwidthScheduler::refill(Peer &peer, u64 now)
+{
+	const float max_budget = m_rate * BANDWIDTH_BURST_TIME;
+	if (peer.budget_time == 0) {
+		peer.budget = max_budget;
+	} else if (now > peer.budget_time) {
+		peer.budget = MYMIN(peer.budget + (now - peer.budget_time) / 1.0e6f * m_rate,
+				max_budget);
+	}
+	peer.budget_time = now;
+}
+
+void BandwidthScheduler::dropStale(Peer &peer, u64 now)
+{
+	auto &queue = peer.queues[SEND_CLASS_MOVEMENT];
+	auto it = queue.begin();
+	while (it != queue.end()) {
+		if (it->reliable || now - it->queued_time < BANDWIDTH_MOVEMENT_MAX_AGE) {
+			++it;
+			continue;
+		}
+		m_queue_gauge[SEND_CLASS_MOVEMENT]->decrement();
+		m_queue_bytes_gauge[SEND_CLASS_MOVEMENT]->decrement(it->pkt.getSize());
+		m_dropped_counter->increment();
+		// Give back what was already paid, nothing was sent
+		peer.budget += it->paid;
+		peer.queued--;
+		it = queue.erase(it);
+	}
+}
+
+void BandwidthScheduler::sendQueued(session_t peer_id, Peer &peer, bool ignore_budget)
+{
+	const u64 now = porting::getTimeUs();
+	while (peer.queued > 0) {
+		// The head with the earliest finish time goes first
+		int next = -1;
+		for (int i = 0; i < SEND_CLASS_COUNT; i++) {
+			if (peer.queues[i].empty())
+				continue;
+			if (next < 0 || peer.queues[i].front().finish <
+					peer.queues[next].front().finish)
+				next = i;
+		}
+
+		// Large packets are paid for over several refills, while the
+		// budget is short, a packet of another class may overtake
+		QueuedPacket &head = peer.queues[next].front();
+		const u32 due = head.pkt.getSize() - head.paid;
+		if (!ignore_budget && peer.budget < due) {
+			const u32 payment = MYMAX(peer.budget, 0.0f);
+			head.paid += payment;
+			peer.budget -= payment;
+			break;
+		}
+		peer.budget -= due;
+
+		QueuedPacket queued = std::move(head);
+		peer.queues[next].pop_front();
+		peer.queued--;
+		peer.virtual_time = queued.finish;
+
+		m_queue_gauge[next]->decrement();
+		m_queue_bytes_gauge[next]->decrement(queued.pkt.getSize());
+		m_sent_counter[next]->increment();
+		m_delay_counter[next]->increment((now - queued.queued_time) / 1.0e6);
+
+		m_send(peer_id, queued.channelnum, std::move(queued.pkt), queued.reliable);
+	}
+
+	// flush() does not wait for the budget, but doesn't go into debt either
+	peer.budget = MYMAX(peer.budget, 0.0f);
+
+	if (peer.queued == 0) {
+		// Idle, start from scratch so that old finish times don't count
+		peer.virtual_time = 0.0;
+		for (double &last_finish : peer.last_finish)
+			last_finish = 0.0;
+	}
+}
+
+void BandwidthScheduler::send(session_t peer_id, Peer &peer, u8 channelnum,
+		NetworkPacket &&pkt, bool reliable)
+{
+	peer.budget = MYMAX(peer.budget - pkt.getSize(), 0.0f);
+	m_send(peer_id, channelnum, std::move(pkt), reliable);
+}
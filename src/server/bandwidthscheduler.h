@@ -0,0 +1,140 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include "irrlichttypes.h"
+#include "network/networkpacket.h"
+#include "util/basic_macros.h"
+#include "util/metricsbackend.h"
+
+enum SendClass : u8
+{
+	// Object updates and player movement, late data is useless
+	SEND_CLASS_MOVEMENT,
+	// Everything else: node changes, inventory, HUD, chat, ...
+	SEND_CLASS_INTERACTION,
+	SEND_CLASS_BLOCKS,
+	SEND_CLASS_MEDIA,
+	SEND_CLASS_COUNT
+};
+
+/*
+	Limits what is handed to the connection for each client to a byte rate
+	and decides which traffic goes first when the limit is reached.
+
+	Each client has a queue per SendClass. Packets are only queued while a
+	client is over its budget or has packets waiting, and the queues are
+	served by weighted fair queueing (self-clocked), so a flood of blocks or
+	media gets the rate that the other classes leave. The budget never goes
+	into debt: a packet that is larger than what is left is paid for over
+	several refills, and a movement packet that arrives meanwhile goes
+	first. Packets of one class keep their order. Across classes the order
+	is only kept while nothing is queued, which is the case as long as a
+	client stays below the rate.
+
+	Unreliable movement packets that waited for too long are dropped, newer
+	ones will follow.
+
+	A rate of 0 disables the scheduler, everything is sent right away.
+*/
+class BandwidthScheduler
+{
+public:
+	typedef std::function<void(session_t peer_id, u8 channelnum,
+			NetworkPacket &&pkt, bool reliable)> SendFunc;
+
+	// rate in bytes per second
+	BandwidthScheduler(u32 rate, const SendFunc &send, MetricsBackend *mb);
+
+	DISABLE_CLASS_COPY(BandwidthScheduler)
+
+	static SendClass classify(u16 command);
+	static const char *getClassName(SendClass send_class);
+
+	bool isEnabled() const { return m_rate > 0; }
+
+	// How often step() should be called while packets are queued
+	static constexpr u32 STEP_INTERVAL_MS = 10;
+
+	// Returns true if a packet may bypass the queues and be sent right away,
+	// its size is then charged to the client's budget. Otherwise it has to be
+	// passed to push(). Allows sending without moving the packet.
+	bool admit(session_t peer_id, u16 command, u32 size);
+
+	// Sends the packet if the client's budget allows it, queues it otherwise
+	void push(session_t peer_id, u8 channelnum, NetworkPacket &&pkt, bool reliable);
+
+	// Sends what the budgets allow and drops stale packets.
+	// Returns true if packets are still waiting.
+	bool step();
+
+	// Sends everything that is queued for the client, ignoring the budget
+	void flush(session_t peer_id);
+	// Drops everything that is queued for the client
+	void removePeer(session_t peer_id);
+
+	size_t getQueuedCount(session_t peer_id, SendClass send_class);
+
+private:
+	struct QueuedPacket
+	{
+		NetworkPacket pkt;
+		u8 channelnum;
+		bool reliable;
+		u64 queued_time;
+		// Virtual time at which the packet is done in an ideal fair queue
+		double finish;
+		// Part of the size that was already taken from the budget
+		u32 paid = 0;
+	};
+
+	struct Peer
+	{
+		std::deque<QueuedPacket> queues[SEND_CLASS_COUNT];
+		double last_finish[SEND_CLASS_COUNT] = {};
+		double virtual_time = 0.0;
+		// Bytes that may be sent right now
+		float budget = 0.0f;
+		u64 budget_time = 0;
+		size_t queued = 0;
+	};
+
+	void refill(Peer &peer, u64 now);
+	void dropStale(Peer &peer, u64 now);
+	void sendQueued(session_t peer_id, Peer &peer, bool ignore_budget);
+	void send(session_t peer_id, Peer &peer, u8 channelnum, NetworkPacket &&pkt,
+			bool reliable);
+
+	const u32 m_rate;
+	SendFunc m_send;
+
+	std::mutex m_mutex;
+	std::unordered_map<session_t, Peer> m_peers;
+
+	MetricGaugePtr m_queue_gauge[SEND_CLASS_COUNT];
+	MetricGaugePtr m_queue_bytes_gauge[SEND_CLASS_COUNT];
+	MetricCounterPtr m_sent_counter[SEND_CLASS_COUNT];
+	MetricCounterPtr m_delay_counter[SEND_CLASS_COUNT];
+	MetricCounterPtr m_dropped_counter;
+};
@@ -0,0 +1,298 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "blockserializer.h"
+#include <sstream>
+#include "mapblock.h"
+#include "profiler.h"
+#include "serialization.h"
+#include "settings.h"
+#include "util/numeric.h"
+
+/*
+	SerializedBlockCache
+*/
+
+std::shared_ptr<const std::string> SerializedBlockCache::get(v3s16 pos,
+		u8 ser_ver, u64 block_version)
+{
+	auto it = m_entries.find({pos, ser_ver});
+	if (it == m_entries.end())
+		return nullptr;
+
+	if (it->second.block_version != block_version) {
+		// block was modified since
+		erase(it);
+		return nullptr;
+	}
+
+	// move to front
+	m_lru.splice(m_lru.begin(), m_lru, it->second.lru_it);
+	return it->second.data;
+}
+
+void SerializedBlockCache::put(v3s16 pos, u8 ser_ver, u64 block_version,
+		std::shared_ptr<const std::string> data)
+{
+	const Key key(pos, ser_ver);
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		erase(it);
+
+	if (data->size() > m_max_bytes)
+		return;
+
+	m_lru.push_front(key);
+	m_bytes += data->size();
+	m_entries[key] = Entry{block_version, std::move(data), m_lru.begin()};
+
+	while (m_bytes > m_max_bytes) {
+		it = m_entries.find(m_lru.back());
+		assert(it != m_entries.end());
+		erase(it);
+	}
+}
+
+void SerializedBlockCache::invalidate(v3s16 pos)
+{
+	for (u8 ser_ver = SER_FMT_VER_LOWEST_WRITE; ser_ver <= SER_FMT_VER_HIGHEST_WRITE; ser_ver++) {
+		auto it = m_entries.find({pos, ser_ver});
+		if (it != m_entries.end())
+			erase(it);
+	}
+}
+
+void SerializedBlockCache::clear()
+{
+	m_entries.clear();
+	m_lru.clear();
+	m_bytes = 0;
+}
+
+void SerializedBlockCache::erase(std::unordered_map<Key, Entry, KeyHash>::iterator it)
+{
+	m_bytes -= it->second.data->size();
+	m_lru.erase(it->second.lru_it);
+	m_entries.erase(it);
+}
+
+/*
+	BlockSerializerThread
+*/
+
+void BlockSerializerThread::doUpdate()
+{
+	BlockSerializer::Job job;
+	while (m_manager->popJob(job)) {
+		static const ProfilerProbe probe = g_profiler->registerProbe(
+			"BlockSerializer: compress (sum)", SPT_ADD);
+		ScopeProfiler sp(g_profiler, probe);
+
+		std::ostringstream os(std::ios_base::binary);
+		MapBlock::compressNetworkSerialization(job.raw, os, job.ser_ver,
+				m_manager->m_compression_level);
+
+		SerializedBlock result;
+		result.pos = job.pos;
+		result.ser_ver = job.ser_ver;
+		result.block_version = job.block_version;
+		result.data = std::make_shared<const std::string>(os.str());
+		m_manager->putResult(std::move(result));
+	}
+}
+
+/*
+	BlockSerializer
+*/
+
+BlockSerializer::BlockSerializer(MetricsBackend *mb) :
+	m_cache((size_t)g_settings->getU32("serialized_block_cache_size") * 1024 * 1024)
+{
+	m_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
+
+	// 0 = 25% of the system cores
+	const unsigned int number_of_threads = Thread::getPoolSize(
+			rangelim(g_settings->getS32("block_serialization_threads"), 0, 8), 4);
+	infostream << "BlockSerializer: using " << number_of_threads << " threads" << std::endl;
+
+	for (unsigned int i = 0; i < number_of_threads; i++)
+		m_workers.push_back(std::make_unique<BlockSerializerThread>(this));
+
+	m_serialized_counter = mb->addCounter(
+			"minetest_core_block_serialized",
+			"Number of blocks serialized for the network");
+	m_serialized_bytes_counter = mb->addCounter(
+			"minetest_core_block_serialized_bytes",
+			"Size of blocks serialized for the network (in bytes)");
+	m_cache_hit_counter = mb->addCounter(
+			"minetest_core_block_cache_hits",
+			"Block sends served from the serialized block cache");
+	m_cache_miss_counter = mb->addCounter(
+			"minetest_core_block_cache_misses",
+			"Block sends that needed the block to be serialized");
+	m_queue_gauge = mb->addGauge(
+			"minetest_core_block_serialize_queue",
+			"Number of blocks waiting to be serialized");
+	m_cache_bytes_gauge = mb->addGauge(
+			"minetest_core_block_cache_bytes",
+			"Size of the serialized block cache (in bytes)");
+}
+
+BlockSerializer::~BlockSerializer()
+{
+	stop();
+	wait();
+}
+
+std::shared_ptr<const std::string> BlockSerializer::getCached(MapBlock *block, u8 ser_ver)
+{
+	auto data = m_cache.get(block->getPos(), ser_ver, block->getNetworkVersion());
+	if (data)
+		m_cache_hit_counter->increment();
+	else
+		m_cache_miss_counter->increment();
+	return data;
+}
+
+void BlockSerializer::putCached(MapBlock *block, u8 ser_ver,
+		std::shared_ptr<const std::string> data)
+{
+	m_serialized_counter->increment();
+	m_serialized_bytes_counter->increment(data->size());
+
+	m_cache.put(block->getPos(), ser_ver, block->getNetworkVersion(), std::move(data));
+}
+
+void BlockSerializer::queueBlock(MapBlock *block, u8 ser_ver, u16 peer_id)
+{
+	const CacheKey key(block->getPos(), ser_ver);
+	const u64 block_version = block->getNetworkVersion();
+
+	// Is this exact block already on its way?
+	auto it = m_pending.find({key, block_version});
+	if (it != m_pending.end()) {
+		it->second.push_back(peer_id);
+		return;
+	}
+	m_pending[{key, block_version}].push_back(peer_id);
+	m_key_states[key].pending_jobs++;
+
+	Job job;
+	job.pos = key.first;
+	job.ser_ver = ser_ver;
+	job.block_version = block_version;
+	{
+		std::ostringstream os(std::ios_base::binary);
+		block->serializeNetworkUncompressed(os, ser_ver);
+		job.raw = os.str();
+	}
+
+	{
+		MutexAutoLock lock(m_jobs_mutex);
+		m_jobs.push_back(std::move(job));
+		m_queue_gauge->set(m_jobs.size());
+	}
+
+	for (auto &worker : m_workers)
+		worker->deferUpdate();
+}
+
+bool BlockSerializer::getNextResult(SerializedBlock &result)
+{
+	if (m_results.empty())
+		return false;
+	result = m_results.pop_frontNoEx();
+
+	const CacheKey key(result.pos, result.ser_ver);
+	auto it = m_pending.find({key, result.block_version});
+	if (it != m_pending.end()) {
+		result.peers = std::move(it->second);
+		m_pending.erase(it);
+	}
+
+	// Jobs of the same block may finish in any order
+	auto state_it = m_key_states.find(key);
+	if (state_it != m_key_states.end()) {
+		KeyState &state = state_it->second;
+		result.outdated = state.delivered &&
+				result.block_version < state.delivered_version;
+		if (!result.outdated) {
+			state.delivered = true;
+			state.delivered_version = result.block_version;
+		}
+		if (--state.pending_jobs == 0)
+			m_key_states.erase(state_it);
+	}
+
+	if (result.outdated)
+		return true;
+
+	// The block might have been modified in the meantime, in that case
+	// the entry is dropped on the next lookup
+	m_cache.put(result.pos, result.ser_ver, result.block_version, result.data);
+
+	m_serialized_counter->increment();
+	m_serialized_bytes_counter->increment(result.data->size());
+	return true;
+}
+
+void BlockSerializer::step(float dtime)
+{
+	m_stats_timer += dtime;
+	if (m_stats_timer < 2.0f)
+		return;
+	m_stats_timer = 0.0f;
+
+	m_cache_bytes_gauge->set(m_cache.getBytes());
+	g_profiler->avg("BlockSerializer: cached blocks [#]", m_cache.size());
+}
+
+bool BlockSerializer::popJob(Job &job)
+{
+	MutexAutoLock lock(m_jobs_mutex);
+	if (m_jobs.empty())
+		return false;
+	job = std::move(m_jobs.front());
+	m_jobs.pop_front();
+	m_queue_gauge->set(m_jobs.size());
+	return true;
+}
+
+void BlockSerializer::putResult(SerializedBlock &&result)
+{
+	m_results.push_back(std::move(result));
+}
+
+void BlockSerializer::start()
+{
+	for (auto &worker : m_workers)
+		worker->start();
+}
+
+void BlockSerializer::stop()
+{
+	for (auto &worker : m_workers)
+		worker->stop();
+}
+
+void BlockSerializer::wait()
+{
+	for (auto &worker : m_workers)
+		worker->wait();
+}
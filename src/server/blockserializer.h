@@ -0,0 +1,224 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "irr_v3d.h"
+#include "util/container.h"
+#include "util/metricsbackend.h"
+#include "util/thread.h"
+
+class MapBlock;
+
+/*
+	Network serializations of map blocks, kept across send rounds so
+	unchanged blocks are only compressed once no matter how many clients
+	receive them. Bounded in size, the least recently used entries are
+	dropped first.
+	Not thread-safe, only used from the server thread.
+*/
+class SerializedBlockCache
+{
+public:
+	SerializedBlockCache(size_t max_bytes) : m_max_bytes(max_bytes) {}
+
+	// Returns the cached data if it matches the given version of the block.
+	// Outdated entries are dropped.
+	std::shared_ptr<const std::string> get(v3s16 pos, u8 ser_ver, u64 block_version);
+
+	// Caches (or replaces) the data for a block
+	void put(v3s16 pos, u8 ser_ver, u64 block_version,
+			std::shared_ptr<const std::string> data);
+
+	// Drops the data of all serialization versions of a block
+	void invalidate(v3s16 pos);
+
+	void clear();
+
+	size_t size() const { return m_entries.size(); }
+	size_t getBytes() const { return m_bytes; }
+
+private:
+	typedef std::pair<v3s16, u8> Key;
+
+	struct KeyHash {
+		size_t operator() (const Key &k) const {
+			return std::hash<v3s16>()(k.first) ^ k.second;
+		}
+	};
+
+	struct Entry
+	{
+		u64 block_version;
+		std::shared_ptr<const std::string> data;
+		// position in m_lru
+		std::list<Key>::iterator lru_it;
+	};
+
+	void erase(std::unordered_map<Key, Entry, KeyHash>::iterator it);
+
+	size_t m_max_bytes;
+	size_t m_bytes = 0;
+	std::unordered_map<Key, Entry, KeyHash> m_entries;
+	// Most recently used first
+	std::list<Key> m_lru;
+};
+
+struct SerializedBlock
+{
+	v3s16 pos;
+	u8 ser_ver = 0;
+	u64 block_version = 0;
+	std::shared_ptr<const std::string> data;
+	// Peers waiting for this block
+	std::vector<u16> peers;
+	// A newer version of the block was handed out already, this one must
+	// not be sent
+	bool outdated = false;
+};
+
+class BlockSerializer;
+
+class BlockSerializerThread : public UpdateThread
+{
+public:
+	BlockSerializerThread(BlockSerializer *manager) :
+		UpdateThread("BlockSerializer"), m_manager(manager)
+	{}
+
+protected:
+	virtual void doUpdate();
+
+private:
+	BlockSerializer *m_manager;
+};
+
+/*
+	Serializes map blocks for the network on a pool of worker threads.
+
+	The server thread only copies the uncompressed block data while it
+	holds the environment lock, the (expensive) compression is done by
+	the workers. Finished blocks are cached by position and serialization
+	version; an entry is only reused as long as the block has not been
+	modified since (see MapBlock::getNetworkVersion()).
+*/
+class BlockSerializer
+{
+	friend class BlockSerializerThread;
+	friend class TestBlockSerializer;
+
+public:
+	BlockSerializer(MetricsBackend *mb);
+	~BlockSerializer();
+
+	DISABLE_CLASS_COPY(BlockSerializer)
+
+	// Returns the cached network serialization of the block, if there is one
+	// for the current state of it
+	std::shared_ptr<const std::string> getCached(MapBlock *block, u8 ser_ver);
+	// For blocks that were serialized on the server thread
+	void putCached(MapBlock *block, u8 ser_ver, std::shared_ptr<const std::string> data);
+	// Frees cached data of a modified block early
+	void invalidate(v3s16 pos) { m_cache.invalidate(pos); }
+
+	// Takes a copy of the block data and queues it for compression,
+	// the result will be handed out for `peer_id`.
+	// Must be called with the environment lock held.
+	void queueBlock(MapBlock *block, u8 ser_ver, u16 peer_id);
+
+	// Returns a finished block and stores it in the cache (server thread only).
+	// Results come in the order the workers finish them, see
+	// SerializedBlock::outdated.
+	bool getNextResult(SerializedBlock &result);
+
+	// Reports cache statistics
+	void step(float dtime);
+
+	void start();
+	void stop();
+	void wait();
+
+private:
+	struct Job
+	{
+		v3s16 pos;
+		u8 ser_ver;
+		u64 block_version;
+		std::string raw;
+	};
+
+	typedef std::pair<v3s16, u8> CacheKey;
+
+	struct CacheKeyHash {
+		size_t operator() (const CacheKey &k) const {
+			return std::hash<v3s16>()(k.first) ^ k.second;
+		}
+	};
+
+	struct KeyState
+	{
+		// Jobs that were queued and not handed out yet
+		u32 pending_jobs = 0;
+		// Newest version handed out while there were jobs pending
+		u64 delivered_version = 0;
+		bool delivered = false;
+	};
+
+	struct PendingKeyHash {
+		size_t operator() (const std::pair<CacheKey, u64> &k) const {
+			return std::hash<v3s16>()(k.first.first) ^ k.first.second ^
+				std::hash<u64>()(k.second);
+		}
+	};
+
+	// Used by the worker threads
+	bool popJob(Job &job);
+	void putResult(SerializedBlock &&result);
+
+	int m_compression_level;
+
+	std::deque<Job> m_jobs;
+	std::mutex m_jobs_mutex;
+	MutexedQueue<SerializedBlock> m_results;
+
+	// Only accessed from the server thread
+	SerializedBlockCache m_cache;
+	// Peers waiting for a queued block, by key and block version
+	std::unordered_map<std::pair<CacheKey, u64>, std::vector<u16>,
+			PendingKeyHash> m_pending;
+	// Only for keys that have jobs pending
+	std::unordered_map<CacheKey, KeyState, CacheKeyHash> m_key_states;
+	float m_stats_timer = 0.0f;
+
+	std::vector<std::unique_ptr<BlockSerializerThread>> m_workers;
+
+	MetricCounterPtr m_serialized_counter;
+	MetricCounterPtr m_serialized_bytes_counter;
+	MetricCounterPtr m_cache_hit_counter;
+	MetricCounterPtr m_cache_miss_counter;
+	MetricGaugePtr m_queue_gauge;
+	MetricGaugePtr m_cache_bytes_gauge;
+};
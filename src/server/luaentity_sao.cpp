@@ -158,7 +158,7 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
 	if (auto *parent = getParent()) {
-		m_base_position = parent->getBasePosition();
+		setBasePosition(parent->getBasePosition());
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	} else {
@@ -177,11 +177,12 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 			moveresult_p = &moveresult;
 
 			// Apply results
-			m_base_position = p_pos;
+			setBasePosition(p_pos);
 			m_velocity = p_velocity;
 			m_acceleration = p_acceleration;
 		} else {
-			m_base_position += (m_velocity + m_acceleration * 0.5f * dtime) * dtime;
+			setBasePosition(m_base_position +
+					(m_velocity + m_acceleration * 0.5f * dtime) * dtime);
 			m_velocity += dtime * m_acceleration;
 		}
 
@@ -275,6 +276,14 @@ std::string LuaEntitySAO::getClientInitializationData(u16 protocol_version)
 	msg_os << serializeString32(generateSetTextureModCommand());
 	message_count++;
 
+	if (protocol_version >= 45) {
+		std::string keyframe = generatePositionKeyframeCommand();
+		if (!keyframe.empty()) {
+			msg_os << serializeString32(keyframe);
+			message_count++;
+		}
+	}
+
 	writeU8(os, message_count);
 	std::string serialized = msg_os.str();
 	os.write(serialized.c_str(), serialized.size());
@@ -371,7 +380,7 @@ void LuaEntitySAO::setPos(const v3f &pos)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	sendPosition(false, true);
 }
 
@@ -379,7 +388,7 @@ void LuaEntitySAO::moveTo(v3f pos, bool continuous)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	if(!continuous)
 		sendPosition(true, true);
 }
@@ -521,17 +530,15 @@ void LuaEntitySAO::sendPosition(bool do_interpolate, bool is_movement_end)
 
 	float update_interval = m_env->getSendRecommendedInterval();
 
-	std::string str = generateUpdatePositionCommand(
-		m_base_position,
-		m_velocity,
-		m_acceleration,
-		m_rotation,
-		do_interpolate,
-		is_movement_end,
-		update_interval
-	);
-	// create message and add to list
-	m_messages_out.emplace(getId(), false, str);
+	ObjectPositionUpdate update;
+	update.position = m_base_position;
+	update.velocity = m_velocity;
+	update.acceleration = m_acceleration;
+	update.rotation = m_rotation;
+	update.do_interpolate = do_interpolate;
+	update.is_movement_end = is_movement_end;
+	update.update_interval = update_interval;
+	sendPositionUpdate(update);
 }
 
 bool LuaEntitySAO::getCollisionBox(aabb3f *toset) const
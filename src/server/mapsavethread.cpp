@@ -0,0 +1,323 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapsavethread.h"
+#include <sstream>
+#include <vector>
+#include "database/database.h"
+#include "exceptions.h"
+#include "irrlicht_changes/printing.h"
+#include "log.h"
+#include "mapblock.h"
+#include "porting.h"
+#include "profiler.h"
+#include "serialization.h"
+
+// Maximum number of blocks written in one transaction
+#define MAP_SAVE_BATCH_SIZE 256
+// Number of times writing a block is attempted before it is dropped
+#define MAP_SAVE_MAX_ATTEMPTS 5
+
+MapSaveThread::MapSaveThread(MapDatabase *db, std::mutex &db_mutex,
+		int compression_level, size_t max_queued_bytes, MetricsBackend *mb) :
+	Thread("MapSave"),
+	m_db(db),
+	m_db_mutex(db_mutex),
+	m_compression_level(compression_level),
+	m_max_queued_bytes(max_queued_bytes)
+{
+	m_written_counter = mb->addCounter(
+			"minetest_map_written_blocks",
+			"Number of blocks written to the database by the save thread");
+	m_stall_counter = mb->addCounter(
+			"minetest_map_save_stalls",
+			"Number of times the server had to wait for the save thread");
+	m_queue_gauge = mb->addGauge(
+			"minetest_map_save_queue",
+			"Number of blocks waiting to be written to the database");
+}
+
+MapSaveThread::~MapSaveThread()
+{
+	stop();
+	wait();
+}
+
+void MapSaveThread::queueBlock(MapBlock *block)
+{
+	const v3s16 pos = block->getPos();
+	std::shared_ptr<const std::string> raw;
+	{
+		static const ProfilerProbe probe = g_profiler->registerProbe(
+			"MapSaveThread: snapshot (sum)", SPT_ADD);
+		ScopeProfiler sp(g_profiler, probe);
+		std::ostringstream os(std::ios_base::binary);
+		block->serializeDiskUncompressed(os, SER_FMT_VER_HIGHEST_WRITE);
+		raw = std::make_shared<const std::string>(os.str());
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (m_queued_bytes > m_max_queued_bytes && isRunning()) {
+		// Don't let the queue grow without bounds if the database is slow
+		m_stall_counter->increment();
+		ScopeProfiler sp(g_profiler, "MapSaveThread: wait for queue (sum)");
+		m_done_cv.wait(lock, [this] {
+			return m_queued_bytes <= m_max_queued_bytes || m_finished;
+		});
+	}
+
+	auto it = m_queued.find(pos);
+	if (it != m_queued.end()) {
+		// Not written yet, replace the old snapshot
+		m_queued_bytes -= it->second.raw->size();
+		it->second.seq = m_next_seq++;
+		it->second.raw = std::move(raw);
+	} else {
+		it = m_queued.emplace(pos, Snapshot{m_next_seq++, std::move(raw), false}).first;
+	}
+	m_queued_bytes += it->second.raw->size();
+
+	if (!it->second.in_order) {
+		m_order.push_back(pos);
+		it->second.in_order = true;
+	}
+	m_queue_gauge->set(m_queued.size());
+
+	lock.unlock();
+	m_work_cv.notify_one();
+}
+
+bool MapSaveThread::getQueued(v3s16 pos, std::string *data)
+{
+	std::shared_ptr<const std::string> raw;
+	{
+		MutexAutoLock lock(m_mutex);
+		auto it = m_queued.find(pos);
+		if (it == m_queued.end())
+			return false;
+		raw = it->second.raw;
+	}
+
+	*data = compress(*raw);
+	return true;
+}
+
+void MapSaveThread::cancel(v3s16 pos)
+{
+	{
+		MutexAutoLock lock(m_mutex);
+		auto it = m_queued.find(pos);
+		if (it == m_queued.end())
+			return;
+		// The position is skipped once it comes up in m_order
+		m_queued_bytes -= it->second.raw->size();
+		m_queued.erase(it);
+		m_queue_gauge->set(m_queued.size());
+	}
+	m_done_cv.notify_all();
+}
+
+bool MapSaveThread::flush()
+{
+	ScopeProfiler sp(g_profiler, "MapSaveThread: flush", SPT_AVG);
+	if (!isRunning())
+		return true;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	// Don't wait for the retries if the database keeps failing
+	const u64 failed_batches = m_failed_batches;
+	m_done_cv.wait(lock, [&] {
+		return (m_order.empty() && m_in_progress == 0) || m_finished ||
+				m_failed_batches != failed_batches;
+	});
+	return m_failed_batches == failed_batches;
+}
+
+size_t MapSaveThread::getQueuedCount()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_queued.size();
+}
+
+void MapSaveThread::stop()
+{
+	{
+		MutexAutoLock lock(m_mutex);
+		Thread::stop();
+	}
+	m_work_cv.notify_all();
+}
+
+void *MapSaveThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_cv.wait(lock, [this] {
+				return !m_order.empty() || stopRequested();
+			});
+		}
+		saveBatch();
+	}
+
+	// Write out everything that is left
+	for (;;) {
+		{
+			MutexAutoLock lock(m_mutex);
+			if (m_order.empty())
+				break;
+		}
+		saveBatch();
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	{
+		MutexAutoLock lock(m_mutex);
+		m_finished = true;
+	}
+	m_done_cv.notify_all();
+	return nullptr;
+}
+
+void MapSaveThread::saveBatch()
+{
+	struct Item {
+		v3s16 pos;
+		u64 seq;
+		std::shared_ptr<const std::string> raw;
+	};
+
+	std::vector<Item> items;
+	{
+		MutexAutoLock lock(m_mutex);
+		while (!m_order.empty() && items.size() < MAP_SAVE_BATCH_SIZE) {
+			const v3s16 pos = m_order.front();
+			m_order.pop_front();
+
+			auto it = m_queued.find(pos);
+			if (it == m_queued.end())
+				continue; // cancelled
+			it->second.in_order = false;
+			items.push_back({pos, it->second.seq, it->second.raw});
+		}
+		m_in_progress += items.size();
+	}
+
+	std::vector<std::string> compressed;
+	compressed.reserve(items.size());
+	{
+		static const ProfilerProbe probe = g_profiler->registerProbe(
+			"MapSaveThread: compress (sum)", SPT_ADD);
+		ScopeProfiler sp(g_profiler, probe);
+		for (const Item &item : items)
+			compressed.push_back(compress(*item.raw));
+	}
+
+	bool success = true;
+	size_t written = 0;
+	if (!items.empty()) {
+		MutexAutoLock dblock(m_db_mutex);
+
+		// Leave out blocks that were cancelled or queued again meanwhile
+		std::vector<std::pair<v3s16, std::string>> blocks;
+		{
+			MutexAutoLock lock(m_mutex);
+			for (size_t i = 0; i < items.size(); i++) {
+				auto it = m_queued.find(items[i].pos);
+				if (it != m_queued.end() && it->second.seq == items[i].seq)
+					blocks.emplace_back(items[i].pos, std::move(compressed[i]));
+			}
+		}
+
+		static const ProfilerProbe probe = g_profiler->registerProbe(
+			"MapSaveThread: write (sum)", SPT_ADD);
+		ScopeProfiler sp(g_profiler, probe);
+		try {
+			m_db->beginSave();
+			success = m_db->saveBlocks(blocks);
+			m_db->endSave();
+			written = blocks.size();
+		} catch (DatabaseException &e) {
+			errorstream << "MapSaveThread: " << e.what() << std::endl;
+			success = false;
+		}
+
+		if (!success) {
+			// Don't leave the transaction open, or every later one fails too
+			try {
+				m_db->rollback();
+			} catch (DatabaseException &e) {
+				errorstream << "MapSaveThread: " << e.what() << std::endl;
+			}
+		}
+	}
+
+	if (!success)
+		errorstream << "MapSaveThread: Failed to write " << items.size()
+				<< " blocks" << std::endl;
+
+	{
+		MutexAutoLock lock(m_mutex);
+		for (const Item &item : items) {
+			auto it = m_queued.find(item.pos);
+			if (it == m_queued.end() || it->second.seq != item.seq)
+				continue;
+
+			bool done = success || stopRequested();
+			if (!done && ++it->second.failures >= MAP_SAVE_MAX_ATTEMPTS) {
+				errorstream << "MapSaveThread: Giving up on block "
+						<< item.pos << " after " << MAP_SAVE_MAX_ATTEMPTS
+						<< " attempts" << std::endl;
+				done = true;
+			}
+
+			if (done) {
+				m_queued_bytes -= it->second.raw->size();
+				m_queued.erase(it);
+			} else if (!it->second.in_order) {
+				// Try again later
+				m_order.push_back(item.pos);
+				it->second.in_order = true;
+			}
+		}
+		m_in_progress -= items.size();
+		if (!success)
+			m_failed_batches++;
+		m_queue_gauge->set(m_queued.size());
+	}
+	m_done_cv.notify_all();
+
+	if (success)
+		m_written_counter->increment(written);
+	else if (!stopRequested())
+		sleep_ms(500);
+}
+
+std::string MapSaveThread::compress(const std::string &raw) const
+{
+	// Same format as ServerMap::serializeBlock()
+	const u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::ostringstream os(std::ios_base::binary);
+	os.write((const char *)&version, 1);
+	MapBlock::compressDiskSerialization(raw, os, version, m_compression_level);
+	return os.str();
+}
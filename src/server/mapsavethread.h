@@ -0,0 +1,121 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "irr_v3d.h"
+#include "threading/thread.h"
+#include "util/metricsbackend.h"
+
+class MapBlock;
+class MapDatabase;
+
+/*
+	Writes map blocks to the database in the background.
+
+	The server thread only takes a snapshot of the uncompressed block data,
+	compressing and writing it is done here. Blocks are written in batches,
+	each inside a beginSave()/endSave() transaction.
+	All database accesses (including those of other threads) must be done
+	with the database mutex held.
+
+	If a block is queued again before it was written, only the newest
+	snapshot is saved. If more data is waiting than the configured limit,
+	queueBlock() blocks until the thread has caught up.
+	Blocks that fail to be written are retried a few times, then dropped.
+*/
+class MapSaveThread : public Thread
+{
+public:
+	MapSaveThread(MapDatabase *db, std::mutex &db_mutex, int compression_level,
+			size_t max_queued_bytes, MetricsBackend *mb);
+	~MapSaveThread();
+
+	DISABLE_CLASS_COPY(MapSaveThread)
+
+	// Takes a snapshot of the block and queues it for saving
+	void queueBlock(MapBlock *block);
+
+	// Gets the queued data of a block that was not written yet, in the
+	// database format. Returns false if there is none.
+	bool getQueued(v3s16 pos, std::string *data);
+
+	// Drops a queued block, call with the database mutex held
+	void cancel(v3s16 pos);
+
+	// Waits until everything queued so far is written.
+	// Returns false early if writing failed meanwhile.
+	bool flush();
+
+	size_t getQueuedCount();
+
+	void stop();
+
+protected:
+	void *run();
+
+private:
+	struct Snapshot
+	{
+		// Increased for every new snapshot of a block
+		u64 seq;
+		std::shared_ptr<const std::string> raw;
+		// Whether the position is in m_order
+		bool in_order;
+		// Number of failed attempts to write the block
+		u8 failures = 0;
+	};
+
+	// Compresses and writes up to a batch of blocks
+	void saveBatch();
+
+	std::string compress(const std::string &raw) const;
+
+	MapDatabase *m_db;
+	std::mutex &m_db_mutex;
+	const int m_compression_level;
+	const size_t m_max_queued_bytes;
+
+	std::mutex m_mutex;
+	// signalled when there is work
+	std::condition_variable m_work_cv;
+	// signalled when blocks were written
+	std::condition_variable m_done_cv;
+	std::unordered_map<v3s16, Snapshot> m_queued;
+	// Order in which blocks are written
+	std::deque<v3s16> m_order;
+	size_t m_queued_bytes = 0;
+	u64 m_next_seq = 0;
+	// Number of blocks taken from the queue but not written yet
+	size_t m_in_progress = 0;
+	// Set when the thread is about to exit
+	bool m_finished = false;
+	// Increased for every batch that failed to be written
+	u64 m_failed_batches = 0;
+
+	MetricCounterPtr m_written_counter;
+	MetricCounterPtr m_stall_counter;
+	MetricGaugePtr m_queue_gauge;
+};
@@ -0,0 +1,121 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "objectmessagerouter.h"
+#include "server/player_sao.h"
+#include "util/serialize.h"
+
+static void append_message(std::string &buffer, u16 id, const std::string &data)
+{
+	// u16 id
+	// std::string data
+	char idbuf[2];
+	writeU16((u8 *)idbuf, id);
+	buffer.append(idbuf, sizeof(idbuf));
+	buffer.append(serializeString16(data));
+}
+
+void ObjectMessageRouter::push(ActiveObjectMessage &&aom)
+{
+	m_messages[aom.id].push_back(std::move(aom));
+}
+
+void ObjectMessageRouter::route(const ObjectGetter &get_object,
+		const CompactSupport &supports_compact)
+{
+	// Serialized messages of the current object, [0] = reliable,
+	// [1] = unreliable
+	std::string all[2];
+	// Same in the compact encoding
+	std::string compact[2];
+	// Same without position updates
+	std::string without_pos[2];
+
+	for (const auto &it : m_messages) {
+		ServerActiveObject *sao = get_object(it.first);
+		if (!sao || sao->getKnownBy().empty())
+			continue;
+
+		bool has_compact = false;
+		if (supports_compact) {
+			for (const ActiveObjectMessage &aom : it.second)
+				has_compact |= !aom.compact_datastring.empty();
+		}
+
+		bool has_pos = false;
+		for (int i = 0; i < 2; i++) {
+			all[i].clear();
+			compact[i].clear();
+			without_pos[i].clear();
+		}
+		for (const ActiveObjectMessage &aom : it.second) {
+			const int i = aom.reliable ? 0 : 1;
+			if (has_compact) {
+				append_message(compact[i], aom.id, aom.compact_datastring.empty() ?
+						aom.datastring : aom.compact_datastring);
+			}
+			// Only exists in the compact encoding (a position keyframe)
+			if (aom.datastring.empty())
+				continue;
+			append_message(all[i], aom.id, aom.datastring);
+			if (aom.datastring[0] == AO_CMD_UPDATE_POSITION)
+				has_pos = true;
+			else
+				append_message(without_pos[i], aom.id, aom.datastring);
+		}
+		const size_t all_size = all[0].size() + all[1].size();
+		const size_t compact_size = compact[0].size() + compact[1].size();
+		const size_t compact_saved = has_compact && compact_size < all_size ?
+				all_size - compact_size : 0;
+
+		// Position updates are not sent to the player itself, nor for
+		// attached objects as long as the client knows the parent
+		const PlayerSAO *player = nullptr;
+		ServerActiveObject *parent = nullptr;
+		if (has_pos) {
+			if (sao->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+				player = static_cast<PlayerSAO *>(sao);
+			parent = sao->getParent();
+		}
+
+		for (u16 peer_id : sao->getKnownBy()) {
+			const bool skip_pos = has_pos &&
+					((player && player->getPeerID() == peer_id) ||
+					(parent && parent->isKnownBy(peer_id)));
+
+			ClientData &client_data = m_client_data[peer_id];
+			const std::string *data = all;
+			if (skip_pos) {
+				data = without_pos;
+			} else if (has_compact && supports_compact(peer_id)) {
+				data = compact;
+				client_data.compact_bytes_saved += compact_saved;
+			}
+
+			client_data.reliable.append(data[0]);
+			client_data.unreliable.append(data[1]);
+		}
+	}
+}
+
+void ObjectMessageRouter::clear()
+{
+	m_messages.clear();
+	m_client_data.clear();
+}
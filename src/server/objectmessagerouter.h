@@ -0,0 +1,76 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "activeobject.h"
+
+class ServerActiveObject;
+
+/*
+	Routes active object messages to the clients that know the object.
+
+	The messages of an object are serialized once per step and then
+	appended to the data of every client in its known-by list (see
+	ServerActiveObject::getKnownBy()), so the cost depends on the number
+	of (object, observer) pairs and not on clients times objects.
+	Messages that have a compact encoding are also serialized once in that
+	encoding, for the clients that support it.
+*/
+class ObjectMessageRouter
+{
+public:
+	// Serialized TOCLIENT_ACTIVE_OBJECT_MESSAGES payloads for one client
+	struct ClientData
+	{
+		std::string reliable;
+		std::string unreliable;
+		// Bytes saved by sending compact messages
+		size_t compact_bytes_saved = 0;
+	};
+
+	typedef std::function<ServerActiveObject *(u16 id)> ObjectGetter;
+	// Whether a client supports the compact encoding, by peer id
+	typedef std::function<bool(u16 peer_id)> CompactSupport;
+
+	// Buffers a message until the next route()
+	void push(ActiveObjectMessage &&aom);
+
+	// Distributes the buffered messages, objects that do not exist anymore
+	// are skipped. Without supports_compact, the compact encoding is not
+	// used at all.
+	void route(const ObjectGetter &get_object,
+			const CompactSupport &supports_compact = nullptr);
+
+	// Result of the last route() by peer id
+	const std::unordered_map<u16, ClientData> &getClientData() const
+	{ return m_client_data; }
+
+	// Drops all messages and results
+	void clear();
+
+private:
+	// Messages by object id
+	std::unordered_map<u16, std::vector<ActiveObjectMessage>> m_messages;
+	std::unordered_map<u16, ClientData> m_client_data;
+};
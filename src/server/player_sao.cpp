@@ -138,6 +138,14 @@ std::string PlayerSAO::getClientInitializationData(u16 protocol_version)
 		}
 	}
 
+	if (protocol_version >= 45) {
+		std::string keyframe = generatePositionKeyframeCommand();
+		if (!keyframe.empty()) {
+			msg_os << serializeString32(keyframe);
+			message_count++;
+		}
+	}
+
 	writeU8(os, message_count);
 	std::string serialized = msg_os.str();
 	os.write(serialized.c_str(), serialized.size());
@@ -284,17 +292,12 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 		else
 			pos = m_base_position;
 
-		std::string str = generateUpdatePositionCommand(
-			pos,
-			v3f(0.0f, 0.0f, 0.0f),
-			v3f(0.0f, 0.0f, 0.0f),
-			m_rotation,
-			true,
-			false,
-			update_interval
-		);
-		// create message and add to list
-		m_messages_out.emplace(getId(), false, str);
+		ObjectPositionUpdate update;
+		update.position = pos;
+		update.rotation = m_rotation;
+		update.do_interpolate = true;
+		update.update_interval = update_interval;
+		sendPositionUpdate(update);
 	}
 
 	if (!m_physics_override_sent) {
@@ -0,0 +1,376 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "pregenerate.h"
+#include <chrono>
+#include <iomanip>
+#include "filesys.h"
+#include "log.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapgen/mapgen.h"
+#include "porting.h"
+#include "server.h"
+#include "serverenvironment.h"
+#include "settings.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/numeric.h"
+#include "util/string.h"
+#if !defined(_WIN32)
+#include <unistd.h> // isatty
+#endif
+
+// Blocks that were not used for this long are unloaded, in seconds.
+// Generated chunks are rarely looked at again, only their neighbours need
+// them for a short while.
+#define PREGENERATE_UNLOAD_TIMEOUT 10.0f
+// How often progress is shown, in milliseconds
+#define PREGENERATE_PROGRESS_INTERVAL_TTY 1000
+#define PREGENERATE_PROGRESS_INTERVAL_LOG 30000
+
+static std::string pos_to_string(v3s16 p)
+{
+	std::ostringstream os;
+	os << "(" << p.X << "," << p.Y << "," << p.Z << ")";
+	return os.str();
+}
+
+MapPregenerator::MapPregenerator(Server *server, v3s16 minp, v3s16 maxp) :
+	m_server(server),
+	m_minp(minp),
+	m_maxp(maxp),
+	m_checkpoint_path(server->getWorldPath() + DIR_DELIM "pregenerate.txt")
+{
+	sortBoxVerticies(m_minp, m_maxp);
+#if !defined(_WIN32)
+	m_progress_tty = isatty(STDERR_FILENO);
+#endif
+}
+
+bool MapPregenerator::run(bool &kill)
+{
+	m_server->init();
+
+	if (!initArea())
+		return false;
+
+	loadCheckpoint();
+	m_start = m_next;
+
+	EmergeManager *emerge = m_server->getEmergeManager();
+	// One chunk being generated and one waiting for each thread
+	m_max_in_flight = emerge->getThreadCount() * 2;
+
+	actionstream << "Pregenerating " << m_total << " chunks from "
+			<< pos_to_string(m_chunk_origin * MAP_BLOCKSIZE) << " with "
+			<< emerge->getThreadCount() << " emerge threads";
+	if (m_start > 0)
+		actionstream << ", continuing at chunk " << m_start;
+	actionstream << std::endl;
+
+	const u64 save_interval_ms =
+			MYMAX(g_settings->getFloat("server_map_save_interval"), 1.0f) * 1000;
+	m_start_time = porting::getTimeMs();
+	u64 last_save_time = m_start_time;
+	u64 last_print_time = m_start_time;
+	const u64 print_interval_ms = m_progress_tty ?
+			PREGENERATE_PROGRESS_INTERVAL_TTY : PREGENERATE_PROGRESS_INTERVAL_LOG;
+	std::string error;
+	bool interrupted = false;
+
+	emerge->startThreads();
+
+	for (;;) {
+		error = m_server->m_async_fatal_error.get();
+		if (!error.empty())
+			break;
+		if (kill) {
+			interrupted = true;
+			break;
+		}
+
+		fillQueue();
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_in_flight.empty() && m_next == m_total)
+				break;
+			m_done_cv.wait_for(lock, std::chrono::milliseconds(100));
+		}
+
+		const u64 now = porting::getTimeMs();
+		if (now - last_save_time >= save_interval_ms) {
+			saveMap((now - last_save_time) / 1000.0f);
+			last_save_time = now;
+		}
+		if (now - last_print_time >= print_interval_ms) {
+			printProgress(false);
+			last_print_time = now;
+		}
+	}
+	// Ends the progress line
+	if (m_progress_tty)
+		std::cerr << std::endl;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	// Chunks that are still queued are cancelled
+	emerge->stopThreads();
+	saveMap(0.0f);
+	printProgress(true);
+
+	if (!error.empty()) {
+		errorstream << "Pregenerating failed: " << error << std::endl;
+		return false;
+	}
+	if (interrupted) {
+		actionstream << "Pregenerating interrupted, run again to continue"
+				<< std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_failed.empty()) {
+		errorstream << m_failed.size() << " chunks could not be generated, "
+				"run again to retry" << std::endl;
+		return false;
+	}
+
+	fs::DeleteSingleFileOrEmptyDirectory(m_checkpoint_path);
+	return true;
+}
+
+void MapPregenerator::emergeCallback(v3s16 blockpos, EmergeAction action,
+		void *param)
+{
+	MapPregenerator *pregen = (MapPregenerator *)param;
+	const u64 index = pregen->getChunkIndex(blockpos);
+
+	{
+		std::lock_guard<std::mutex> lock(pregen->m_mutex);
+		pregen->m_in_flight.erase(index);
+		switch (action) {
+		case EMERGE_GENERATED:
+			pregen->m_generated++;
+			// fallthrough
+		case EMERGE_FROM_MEMORY:
+		case EMERGE_FROM_DISK:
+			pregen->m_completed++;
+			break;
+		default:
+			// Expected for the queued chunks when stopping
+			if (!pregen->m_stopping) {
+				warningstream << "Pregenerating chunk at "
+						<< pos_to_string(blockpos * MAP_BLOCKSIZE) << " failed: "
+						<< emergeActionStrs[action] << std::endl;
+			}
+			pregen->m_failed.insert(index);
+			break;
+		}
+	}
+	pregen->m_done_cv.notify_one();
+}
+
+bool MapPregenerator::initArea()
+{
+	MapgenParams *params = m_server->getEnv().getServerMap().getMapgenParams();
+	m_chunksize = params->chunksize;
+
+	// Chunks beyond the mapgen limit are never generated
+	const std::pair<s16, s16> edges =
+			get_mapgen_edges(params->mapgen_limit, m_chunksize);
+	v3s16 minp = m_minp, maxp = m_maxp;
+	for (int i = 0; i < 3; i++) {
+		minp[i] = MYMAX(minp[i], edges.first);
+		maxp[i] = MYMIN(maxp[i], edges.second);
+		if (minp[i] > maxp[i]) {
+			errorstream << "Pregenerating: the area " << pos_to_string(m_minp)
+					<< " - " << pos_to_string(m_maxp)
+					<< " is outside of the mapgen limits" << std::endl;
+			return false;
+		}
+	}
+
+	m_chunk_origin = EmergeManager::getContainingChunk(getNodeBlockPos(minp),
+			m_chunksize);
+	const v3s16 last = EmergeManager::getContainingChunk(getNodeBlockPos(maxp),
+			m_chunksize);
+	m_chunk_count = (last - m_chunk_origin) / m_chunksize + v3s16(1, 1, 1);
+	m_total = (u64)m_chunk_count.X * m_chunk_count.Y * m_chunk_count.Z;
+	return true;
+}
+
+void MapPregenerator::loadCheckpoint()
+{
+	if (!fs::PathExists(m_checkpoint_path))
+		return;
+
+	Settings conf;
+	std::string minp, maxp;
+	s16 chunksize;
+	u64 chunks_done;
+	if (!conf.readConfigFile(m_checkpoint_path.c_str()) ||
+			!conf.getNoEx("minp", minp) || !conf.getNoEx("maxp", maxp) ||
+			!conf.getS16NoEx("chunksize", chunksize) ||
+			!conf.getU64NoEx("chunks_done", chunks_done)) {
+		warningstream << "Pregenerating: ignoring invalid checkpoint file "
+				<< m_checkpoint_path << std::endl;
+		return;
+	}
+
+	// The chunks are numbered differently for any other area
+	if (minp != pos_to_string(m_minp) || maxp != pos_to_string(m_maxp) ||
+			chunksize != m_chunksize) {
+		warningstream << "Pregenerating: the checkpoint is for the area "
+				<< minp << " - " << maxp << ", starting from the beginning"
+				<< std::endl;
+		return;
+	}
+
+	m_next = MYMIN(chunks_done, m_total);
+}
+
+void MapPregenerator::writeCheckpoint(u64 chunks_done)
+{
+	Settings conf;
+	conf.set("minp", pos_to_string(m_minp));
+	conf.set("maxp", pos_to_string(m_maxp));
+	conf.setS16("chunksize", m_chunksize);
+	conf.setU64("chunks_done", chunks_done);
+	if (!conf.updateConfigFile(m_checkpoint_path.c_str())) {
+		errorstream << "Pregenerating: could not write " << m_checkpoint_path
+				<< std::endl;
+	}
+}
+
+v3s16 MapPregenerator::getChunkPos(u64 index) const
+{
+	// Y is innermost, so that the chunks of a column are generated together
+	v3s16 chunk;
+	chunk.Y = index % m_chunk_count.Y;
+	index /= m_chunk_count.Y;
+	chunk.X = index % m_chunk_count.X;
+	chunk.Z = index / m_chunk_count.X;
+	return m_chunk_origin + chunk * m_chunksize;
+}
+
+u64 MapPregenerator::getChunkIndex(v3s16 blockpos) const
+{
+	const v3s16 chunk = (blockpos - m_chunk_origin) / m_chunksize;
+	return ((u64)chunk.Z * m_chunk_count.X + chunk.X) * m_chunk_count.Y + chunk.Y;
+}
+
+void MapPregenerator::fillQueue()
+{
+	EmergeManager *emerge = m_server->getEmergeManager();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_next < m_total && m_in_flight.size() < m_max_in_flight) {
+		const u64 index = m_next++;
+		// Before queueing, the callback may run right away
+		m_in_flight.insert(index);
+		lock.unlock();
+
+		// Generating any block of a chunk generates all of them
+		const bool queued = emerge->enqueueBlockEmergeEx(getChunkPos(index),
+				PEER_ID_INEXISTENT,
+				BLOCK_EMERGE_ALLOW_GEN | BLOCK_EMERGE_FORCE_QUEUE,
+				emergeCallback, this);
+
+		lock.lock();
+		if (!queued) {
+			m_in_flight.erase(index);
+			m_failed.insert(index);
+		}
+	}
+}
+
+void MapPregenerator::saveMap(float dtime)
+{
+	// Taken first, everything before it is in the map by now
+	const u64 chunks_done = getChunksDone();
+
+	ServerMap &map = m_server->getEnv().getServerMap();
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+
+		map.save(MOD_STATE_WRITE_NEEDED);
+		if (dtime > 0.0f)
+			map.timerUpdate(dtime, PREGENERATE_UNLOAD_TIMEOUT, -1);
+
+		// Nobody is connected to send them to
+		while (!m_server->m_unsent_map_edit_queue.empty()) {
+			delete m_server->m_unsent_map_edit_queue.front();
+			m_server->m_unsent_map_edit_queue.pop();
+		}
+	}
+
+	// Note: Orphan MapBlock ptrs become dangling after this call.
+	map.step();
+
+	// The checkpoint must not get ahead of the database
+	map.flushSaves();
+	writeCheckpoint(chunks_done);
+}
+
+u64 MapPregenerator::getChunksDone()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	u64 done = m_next;
+	if (!m_in_flight.empty())
+		done = MYMIN(done, *m_in_flight.begin());
+	if (!m_failed.empty())
+		done = MYMIN(done, *m_failed.begin());
+	return done;
+}
+
+void MapPregenerator::printProgress(bool final)
+{
+	u64 completed, generated;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		completed = m_completed;
+		generated = m_generated;
+	}
+
+	const float elapsed = (porting::getTimeMs() - m_start_time) / 1000.0f;
+	const float rate = elapsed > 0.0f ? completed / elapsed : 0.0f;
+	const u64 done = MYMIN(m_start + completed, m_total);
+
+	std::ostringstream os;
+	os << std::fixed << std::setprecision(1)
+			<< "Pregenerated " << done << "/" << m_total << " chunks ("
+			<< (100.0f * done / m_total) << "%), " << rate << " chunks/s";
+	if (final) {
+		os << ", " << generated << " newly generated in "
+				<< duration_to_string((int)elapsed);
+	} else if (rate > 0.0f) {
+		os << ", ETA " << duration_to_string((int)((m_total - done) / rate));
+	}
+
+	if (!final && m_progress_tty) {
+		// Padded to overwrite a longer previous line
+		std::cerr << std::left << std::setw(79) << os.str() << "\r" << std::flush;
+	} else {
+		actionstream << os.str() << std::endl;
+	}
+}
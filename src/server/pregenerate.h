@@ -0,0 +1,108 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include "emerge.h"
+#include "irr_v3d.h"
+#include "util/basic_macros.h"
+
+class Server;
+
+/*
+	Generates all mapchunks of an area without anyone connected, for
+	preparing a world before it goes online.
+
+	The chunks are handed to the emerge threads in a fixed order, a few more
+	than there are threads so that none of them runs out of work. Apart from
+	that the server does nothing but periodically save and unload the map,
+	so the emerge threads only compete with each other for the env lock.
+
+	Progress is written to a checkpoint file in the world directory whenever
+	the map was saved, an interrupted run continues from there.
+*/
+class MapPregenerator
+{
+public:
+	// minp and maxp in nodes, the area is extended to whole chunks
+	MapPregenerator(Server *server, v3s16 minp, v3s16 maxp);
+
+	DISABLE_CLASS_COPY(MapPregenerator)
+
+	// Initializes the server and generates the area. Returns false on
+	// errors or if kill was set before it was done.
+	bool run(bool &kill);
+
+private:
+	static void emergeCallback(v3s16 blockpos, EmergeAction action, void *param);
+
+	// Sets up the chunk range, returns false if nothing can be generated
+	bool initArea();
+	void loadCheckpoint();
+	void writeCheckpoint(u64 chunks_done);
+
+	v3s16 getChunkPos(u64 index) const;
+	u64 getChunkIndex(v3s16 blockpos) const;
+
+	// Queues chunks until enough are in flight
+	void fillQueue();
+	// Saves the map and unloads unused blocks if dtime > 0, then updates
+	// the checkpoint
+	void saveMap(float dtime);
+	// Number of chunks up to which everything is done
+	u64 getChunksDone();
+	void printProgress(bool final);
+
+	Server *m_server;
+	v3s16 m_minp;
+	v3s16 m_maxp;
+	const std::string m_checkpoint_path;
+
+	// Chunk grid, in blocks
+	s16 m_chunksize = 0;
+	v3s16 m_chunk_origin;
+	v3s16 m_chunk_count;
+	u64 m_total = 0;
+
+	// Index of the next chunk to queue
+	u64 m_next = 0;
+	// Where this run started
+	u64 m_start = 0;
+	size_t m_max_in_flight = 0;
+	u64 m_start_time = 0;
+	// Progress is shown on one updating line, otherwise it is logged
+	bool m_progress_tty = false;
+
+	std::mutex m_mutex;
+	std::condition_variable m_done_cv;
+	// Queued chunks that were not completed yet
+	std::set<u64> m_in_flight;
+	// Chunks that were cancelled or failed, they are tried again next run
+	std::set<u64> m_failed;
+	// Completed in this run
+	u64 m_completed = 0;
+	u64 m_generated = 0;
+	// Set once no more chunks are expected to complete
+	bool m_stopping = false;
+};
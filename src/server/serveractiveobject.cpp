@@ -18,11 +18,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "serveractiveobject.h"
+#include <algorithm>
 #include <fstream>
 #include "inventory.h"
 #include "inventorymanager.h"
 #include "constants.h" // BS
 #include "log.h"
+#include "serverenvironment.h"
 
 ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 	ActiveObject(0),
@@ -31,6 +33,15 @@ ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 {
 }
 
+void ServerActiveObject::setBasePosition(v3f pos)
+{
+	if (pos == m_base_position)
+		return;
+	m_base_position = pos;
+	if (m_env)
+		m_env->updateActiveObjectPos(this);
+}
+
 float ServerActiveObject::getMinimumSavedMovement()
 {
 	return 2.0*BS;
@@ -75,6 +86,25 @@ void ServerActiveObject::dumpAOMessagesToQueue(std::queue<ActiveObjectMessage> &
 	}
 }
 
+void ServerActiveObject::addKnownBy(u16 peer_id)
+{
+	auto it = std::lower_bound(m_known_by.begin(), m_known_by.end(), peer_id);
+	if (it == m_known_by.end() || *it != peer_id)
+		m_known_by.insert(it, peer_id);
+}
+
+void ServerActiveObject::removeKnownBy(u16 peer_id)
+{
+	auto it = std::lower_bound(m_known_by.begin(), m_known_by.end(), peer_id);
+	if (it != m_known_by.end() && *it == peer_id)
+		m_known_by.erase(it);
+}
+
+bool ServerActiveObject::isKnownBy(u16 peer_id) const
+{
+	return std::binary_search(m_known_by.begin(), m_known_by.end(), peer_id);
+}
+
 void ServerActiveObject::markForRemoval()
 {
 	if (!m_pending_removal) {
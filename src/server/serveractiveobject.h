@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <cassert>
 #include <unordered_set>
+#include <vector>
 #include "irrlichttypes_bloated.h"
 #include "activeobject.h"
 #include "itemgroup.h"
@@ -82,7 +83,8 @@ class ServerActiveObject : public ActiveObject
 		Some simple getters/setters
 	*/
 	v3f getBasePosition() const { return m_base_position; }
-	void setBasePosition(v3f pos){ m_base_position = pos; }
+	// Also keeps the spatial index of the environment up to date
+	void setBasePosition(v3f pos);
 	ServerEnvironment* getEnv(){ return m_env; }
 
 	/*
@@ -209,11 +211,16 @@ class ServerActiveObject : public ActiveObject
 	void dumpAOMessagesToQueue(std::queue<ActiveObjectMessage> &queue);
 
 	/*
-		Number of players which know about this object. Object won't be
-		deleted until this is 0 to keep the id preserved for the right
-		object.
+		Peer ids of the clients which know about this object. Object won't
+		be deleted until there are none to keep the id preserved for the
+		right object. Object messages are only sent to these clients.
 	*/
-	u16 m_known_by_count = 0;
+	void addKnownBy(u16 peer_id);
+	void removeKnownBy(u16 peer_id);
+	bool isKnownBy(u16 peer_id) const;
+	// Sorted by peer id
+	const std::vector<u16> &getKnownBy() const { return m_known_by; }
+	u16 getKnownByCount() const { return m_known_by.size(); }
 
 	/*
 		A getter that unifies the above to answer the question:
@@ -245,6 +252,7 @@ class ServerActiveObject : public ActiveObject
 	ServerEnvironment *m_env;
 	v3f m_base_position;
 	std::unordered_set<u32> m_attached_particle_spawners;
+	std::vector<u16> m_known_by;
 
 	/*
 		Same purpose as m_pending_removal but for deactivation.
@@ -162,8 +162,12 @@ void UnitSAO::setAttachment(int parent_id, const std::string &bone, v3f position
 	m_force_visible = force_visible;
 	m_attachment_sent = false;
 
-	if (parent_id != old_parent)
+	if (parent_id != old_parent) {
+		// Clients that know the parent got no position updates meanwhile
+		// and might have missed keyframes
+		m_position_encoder.reset();
 		onAttach(parent_id);
+	}
 }
 
 void UnitSAO::getAttachment(int *parent_id, std::string *bone, v3f *position,
@@ -357,6 +361,30 @@ std::string UnitSAO::generateUpdatePositionCommand(const v3f &position,
 	return os.str();
 }
 
+void UnitSAO::sendPositionUpdate(const ObjectPositionUpdate &update)
+{
+	ActiveObjectMessage aom(getId(), false, generateUpdatePositionCommand(
+		update.position,
+		update.velocity,
+		update.acceleration,
+		update.rotation,
+		update.do_interpolate,
+		update.is_movement_end,
+		update.update_interval
+	));
+	bool new_keyframe;
+	aom.compact_datastring = m_position_encoder.encode(update, &new_keyframe);
+	m_messages_out.push(std::move(aom));
+
+	if (new_keyframe) {
+		// Clients that lose the unreliable update would otherwise ignore
+		// all updates until the next keyframe
+		ActiveObjectMessage keyframe(getId(), true, "");
+		keyframe.compact_datastring = m_position_encoder.encodeKeyframe();
+		m_messages_out.push(std::move(keyframe));
+	}
+}
+
 std::string UnitSAO::generateSetPropertiesCommand(const ObjectProperties &prop) const
 {
 	std::ostringstream os(std::ios::binary);
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include "object_position.h"
 #include "object_properties.h"
 #include "serveractiveobject.h"
 #include <quaternion.h>
@@ -101,6 +102,11 @@ class UnitSAO : public ServerActiveObject
 	static std::string generateUpdatePositionCommand(const v3f &position,
 			const v3f &velocity, const v3f &acceleration, const v3f &rotation,
 			bool do_interpolate, bool is_movement_end, f32 update_interval);
+	// Keyframe for AO_CMD_UPDATE_POSITION_DELTA, empty if there is none yet
+	std::string generatePositionKeyframeCommand() const
+	{
+		return m_position_encoder.encodeKeyframe();
+	}
 	std::string generateSetPropertiesCommand(const ObjectProperties &prop) const;
 	static std::string generateUpdateBoneOverrideCommand(
 			const std::string &bone, const BoneOverride &props);
@@ -123,12 +129,18 @@ class UnitSAO : public ServerActiveObject
 
 	int m_attachment_parent_id = 0;
 
+	// Queues an unreliable position update, in both the full and the
+	// compact encoding, plus the keyframe reliably if a new one starts
+	void sendPositionUpdate(const ObjectPositionUpdate &update);
+
 private:
 	void onAttach(int parent_id);
 	void onDetach(int parent_id);
 
 	std::string generatePunchCommand(u16 result_hp) const;
 
+	ObjectPositionEncoder m_position_encoder;
+
 	// Armor groups
 	bool m_armor_groups_sent = false;
 
@@ -18,6 +18,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <stack>
 #include "serverenvironment.h"
 #include "settings.h"
@@ -25,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 #include "nodedef.h"
 #include "nodemetadata.h"
+#include "noise.h"
 #include "gamedef.h"
 #include "map.h"
 #include "porting.h"
@@ -37,6 +40,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
 #include "threading/mutex_auto_lock.h"
+#include "threading/semaphore.h"
+#include "util/thread.h"
 #include "filesys.h"
 #include "gameparams.h"
 #include "database/database-dummy.h"
@@ -298,7 +303,27 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 	ActiveBlockList
 */
 
-void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
+void BlockPosSet::sort()
+{
+	std::sort(m_data.begin(), m_data.end(), less);
+	m_data.erase(std::unique(m_data.begin(), m_data.end()), m_data.end());
+}
+
+void BlockPosSet::erase(v3s16 p)
+{
+	auto it = std::lower_bound(m_data.begin(), m_data.end(), p, less);
+	if (it != m_data.end() && *it == p)
+		m_data.erase(it);
+}
+
+void BlockPosSet::difference(const BlockPosSet &a, const BlockPosSet &b,
+	std::vector<v3s16> &out)
+{
+	std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+		std::back_inserter(out), less);
+}
+
+static void fillRadiusBlock(v3s16 p0, s16 r, BlockPosSet &list)
 {
 	v3s16 p;
 	for(p.X=p0.X-r; p.X<=p0.X+r; p.X++)
@@ -308,17 +333,17 @@ void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
 				// limit to a sphere
 				if (p.getDistanceFrom(p0) <= r) {
 					// Set in list
-					list.insert(p);
+					list.push(p);
 				}
 			}
 }
 
-void fillViewConeBlock(v3s16 p0,
+static void fillViewConeBlock(v3s16 p0,
 	const s16 r,
 	const v3f camera_pos,
 	const v3f camera_dir,
 	const float camera_fov,
-	std::set<v3s16> &list)
+	BlockPosSet &list)
 {
 	v3s16 p;
 	const s16 r_nodes = r * BS * MAP_BLOCKSIZE;
@@ -326,7 +351,7 @@ void fillViewConeBlock(v3s16 p0,
 	for (p.Y = p0.Y - r; p.Y <= p0.Y+r; p.Y++)
 	for (p.Z = p0.Z - r; p.Z <= p0.Z+r; p.Z++) {
 		if (isBlockInSight(p, camera_pos, camera_dir, camera_fov, r_nodes)) {
-			list.insert(p);
+			list.push(p);
 		}
 	}
 }
@@ -334,14 +359,19 @@ void fillViewConeBlock(v3s16 p0,
 void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 	s16 active_block_range,
 	s16 active_object_range,
-	std::set<v3s16> &blocks_removed,
-	std::set<v3s16> &blocks_added)
+	std::vector<v3s16> &blocks_removed,
+	std::vector<v3s16> &blocks_added)
 {
 	/*
 		Create the new list
 	*/
-	std::set<v3s16> newlist = m_forceloaded_list;
-	m_abm_list = m_forceloaded_list;
+	BlockPosSet newlist;
+	newlist.reserve(m_list.size() + m_forceloaded_list.size());
+	m_abm_list.clear();
+	for (v3s16 p : m_forceloaded_list) {
+		newlist.push(p);
+		m_abm_list.push(p);
+	}
 	for (const PlayerSAO *playersao : active_players) {
 		v3s16 pos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
 		fillRadiusBlock(pos, active_block_range, m_abm_list);
@@ -363,26 +393,18 @@ void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 				newlist);
 		}
 	}
+	m_abm_list.sort();
+	newlist.sort();
 
 	/*
 		Find out which blocks on the old list are not on the new list
 	*/
-	// Go through old list
-	for (v3s16 p : m_list) {
-		// If not on new list, it's been removed
-		if (newlist.find(p) == newlist.end())
-			blocks_removed.insert(p);
-	}
+	BlockPosSet::difference(m_list, newlist, blocks_removed);
 
 	/*
 		Find out which blocks on the new list are not on the old list
 	*/
-	// Go through new list
-	for (v3s16 p : newlist) {
-		// If not on old list, it's been added
-		if (m_list.find(p) == m_list.end())
-			blocks_added.insert(p);
-	}
+	BlockPosSet::difference(newlist, m_list, blocks_added);
 
 	/*
 		Update m_list
@@ -402,6 +424,393 @@ void OnMapblocksChangedReceiver::onMapEditEvent(const MapEditEvent &event)
 	}
 }
 
+/*
+	ABMHandler
+*/
+
+// Number of active blocks scanned for ABM triggers at once
+#define ABM_SCAN_BATCH_SIZE 256
+
+struct ActiveABM
+{
+	ActiveBlockModifier *abm;
+	int chance;
+	// log(1 - 1 / chance), used to skip over candidates that fail the roll
+	double log_miss;
+	// Indexed by content ID
+	std::vector<bool> required_neighbors;
+	bool check_required_neighbors; // false if required_neighbors is known to be empty
+	s16 min_y;
+	s16 max_y;
+};
+
+// A node that passed the chance roll of an ABM
+struct ABMCandidate
+{
+	u16 index; // in the node data of the block
+	content_t c;
+	// neighbors outside of the block still need to be checked
+	bool check_neighbors;
+	ActiveABM *aabm;
+};
+
+struct ABMScanResult
+{
+	std::vector<ABMCandidate> candidates;
+	// whether the content index of the block was reused
+	bool cached;
+};
+
+/*
+	Matching of ABMs happens in two phases: scan() picks the candidate
+	nodes of a block and only looks at the data of that block, so it can
+	run for many blocks in parallel. run() then calls the triggers on
+	the server thread.
+*/
+class ABMHandler
+{
+private:
+	ServerEnvironment *m_env;
+	std::vector<ActiveABM> m_aabm_list;
+	// By trigger content ID
+	std::vector<std::vector<ActiveABM *> *> m_aabms;
+public:
+	ABMHandler(std::vector<ABMWithState> &abms,
+		float dtime_s, ServerEnvironment *env,
+		bool use_timers):
+		m_env(env)
+	{
+		if(dtime_s < 0.001)
+			return;
+		const NodeDefManager *ndef = env->getGameDef()->ndef();
+		// m_aabms points into this
+		m_aabm_list.reserve(abms.size());
+		for (ABMWithState &abmws : abms) {
+			ActiveBlockModifier *abm = abmws.abm;
+			float trigger_interval = abm->getTriggerInterval();
+			if(trigger_interval < 0.001)
+				trigger_interval = 0.001;
+			float actual_interval = dtime_s;
+			if(use_timers){
+				abmws.timer += dtime_s;
+				if(abmws.timer < trigger_interval)
+					continue;
+				abmws.timer -= trigger_interval;
+				actual_interval = trigger_interval;
+			}
+			float chance = abm->getTriggerChance();
+			if (chance == 0)
+				chance = 1;
+			ActiveABM aabm;
+			aabm.abm = abm;
+			if (abm->getSimpleCatchUp()) {
+				float intervals = actual_interval / trigger_interval;
+				if (intervals == 0)
+					continue;
+				aabm.chance = chance / intervals;
+				if (aabm.chance == 0)
+					aabm.chance = 1;
+			} else {
+				aabm.chance = chance;
+			}
+			aabm.log_miss = aabm.chance > 1 ?
+				std::log(1.0 - 1.0 / aabm.chance) : 0.0;
+			// y limits
+			aabm.min_y = abm->getMinY();
+			aabm.max_y = abm->getMaxY();
+
+			// Trigger neighbors
+			const std::vector<std::string> &required_neighbors_s =
+				abm->getRequiredNeighbors();
+			std::vector<content_t> ids;
+			for (const std::string &required_neighbor_s : required_neighbors_s) {
+				ndef->getIds(required_neighbor_s, ids);
+			}
+			for (content_t c : ids) {
+				if (c >= aabm.required_neighbors.size())
+					aabm.required_neighbors.resize(c + 1, false);
+				aabm.required_neighbors[c] = true;
+			}
+			aabm.check_required_neighbors = !required_neighbors_s.empty();
+
+			// Trigger contents
+			const std::vector<std::string> &contents_s = abm->getTriggerContents();
+			ids.clear();
+			for (const std::string &content_s : contents_s) {
+				ndef->getIds(content_s, ids);
+			}
+			if (ids.empty())
+				continue;
+			m_aabm_list.push_back(std::move(aabm));
+			for (content_t c : ids) {
+				if (c >= m_aabms.size())
+					m_aabms.resize(c + 256, NULL);
+				if (!m_aabms[c])
+					m_aabms[c] = new std::vector<ActiveABM *>;
+				m_aabms[c]->push_back(&m_aabm_list.back());
+			}
+		}
+	}
+
+	~ABMHandler()
+	{
+		for (auto &aabms : m_aabms)
+			delete aabms;
+	}
+
+	// Find out how many objects the given block and its neighbors contain.
+	// Returns the number of objects in the block, and also in 'wider' the
+	// number of objects in the block and all its neighbors. The latter
+	// may an estimate if any neighbors are unloaded.
+	u32 countObjects(MapBlock *block, ServerMap * map, u32 &wider)
+	{
+		wider = 0;
+		u32 wider_unknown_count = 0;
+		for(s16 x=-1; x<=1; x++)
+			for(s16 y=-1; y<=1; y++)
+				for(s16 z=-1; z<=1; z++)
+				{
+					MapBlock *block2 = map->getBlockNoCreateNoEx(
+						block->getPos() + v3s16(x,y,z));
+					if(block2==NULL){
+						wider_unknown_count++;
+						continue;
+					}
+					wider += block2->m_static_objects.size();
+				}
+		// Extrapolate
+		u32 active_object_count = block->m_static_objects.getActiveSize();
+		u32 wider_known_count = 3 * 3 * 3 - wider_unknown_count;
+		wider += wider_unknown_count * wider / wider_known_count;
+		return active_object_count;
+	}
+
+	static inline v3s16 indexToPos(u16 i)
+	{
+		return v3s16(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+			i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+	}
+
+	// Number of candidates to skip until the next one that passes the
+	// chance roll. Geometrically distributed, so the outcome is the same
+	// as rolling for every single candidate.
+	static inline size_t skipCount(const ActiveABM &aabm, PcgRandom &rand)
+	{
+		// uniform in (0, 1)
+		double u = (rand.next() + 0.5) / 4294967296.0;
+		double skip = std::log(u) / aabm.log_miss;
+		return skip >= MapBlock::nodecount ? MapBlock::nodecount : (size_t)skip;
+	}
+
+	// Picks the nodes of one content type that pass the chance roll
+	static void sampleCandidates(MapBlock *block, ActiveABM *aabm, content_t c,
+		const std::vector<u16> &positions, bool neighbors_in_block,
+		PcgRandom &rand, std::vector<ABMCandidate> &out)
+	{
+		const s16 block_y = block->getPosRelative().Y;
+		const bool check_y = block_y < aabm->min_y ||
+			block_y + MAP_BLOCKSIZE - 1 > aabm->max_y;
+
+		size_t k = aabm->chance > 1 ? skipCount(*aabm, rand) : 0;
+		while (k < positions.size()) {
+			const u16 i = positions[k];
+			k += aabm->chance > 1 ? 1 + skipCount(*aabm, rand) : 1;
+
+			const v3s16 p0 = indexToPos(i);
+			if (check_y && (block_y + p0.Y < aabm->min_y ||
+					block_y + p0.Y > aabm->max_y))
+				continue;
+
+			bool check_neighbors = false;
+			if (aabm->check_required_neighbors) {
+				if (isInner(p0)) {
+					// Everything needed is right here
+					if (!neighbors_in_block || !hasRequiredNeighbor(block,
+							nullptr, *aabm, p0))
+						continue;
+				} else {
+					check_neighbors = true;
+				}
+			}
+			out.push_back({i, c, check_neighbors, aabm});
+		}
+	}
+
+	static inline bool isRequiredNeighbor(const ActiveABM &aabm, content_t c)
+	{
+		return c < aabm.required_neighbors.size() && aabm.required_neighbors[c];
+	}
+
+	// Whether all neighbors of the node are in the same block
+	static inline bool isInner(v3s16 p0)
+	{
+		return p0.X > 0 && p0.X < MAP_BLOCKSIZE - 1 &&
+			p0.Y > 0 && p0.Y < MAP_BLOCKSIZE - 1 &&
+			p0.Z > 0 && p0.Z < MAP_BLOCKSIZE - 1;
+	}
+
+	// `map` may only be null for inner nodes
+	static bool hasRequiredNeighbor(MapBlock *block, ServerMap *map,
+		const ActiveABM &aabm, v3s16 p0)
+	{
+		const bool inner = isInner(p0);
+		v3s16 p1;
+		for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+		for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+		for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+		{
+			if(p1 == p0)
+				continue;
+			content_t c;
+			if (inner || block->isValidPosition(p1)) {
+				// if the neighbor is found on the same map block
+				// get it straight from there
+				const MapNode &n = block->getNodeNoCheck(p1);
+				c = n.getContent();
+			} else {
+				// otherwise consult the map
+				MapNode n = map->getNode(p1 + block->getPosRelative());
+				c = n.getContent();
+			}
+			if (isRequiredNeighbor(aabm, c))
+				return true;
+		}
+		return false;
+	}
+
+	bool empty() const { return m_aabms.empty(); }
+
+	// Collects the nodes of the block that may trigger an ABM.
+	// Only touches the given block, safe to run for several blocks at once.
+	void scan(MapBlock *block, PcgRandom &rand, ABMScanResult &result) const
+	{
+		result.candidates.clear();
+
+		// Nodes of the block by content type, kept across steps
+		BlockContentIndex &index = block->content_index;
+		result.cached = index.isValid();
+		if (!result.cached)
+			index.build(block->getData(), MapBlock::nodecount);
+
+		// Roll the dice for the nodes of all trigger contents
+		const std::vector<content_t> &contents = index.getContents();
+		for (size_t k = 0; k < contents.size(); k++) {
+			const content_t c = contents[k];
+			if (c >= m_aabms.size() || !m_aabms[c])
+				continue;
+			for (ActiveABM *aabm : *m_aabms[c]) {
+				bool neighbors_in_block = false;
+				if (aabm->check_required_neighbors) {
+					for (content_t c2 : contents) {
+						if (isRequiredNeighbor(*aabm, c2)) {
+							neighbors_in_block = true;
+							break;
+						}
+					}
+				}
+				sampleCandidates(block, aabm, c, index.getPositions(k),
+					neighbors_in_block, rand, result.candidates);
+			}
+		}
+
+		// Visit the nodes in block order, the ABMs of each node stay in
+		// (shuffled) registration order
+		std::stable_sort(result.candidates.begin(), result.candidates.end(),
+			[](const ABMCandidate &a, const ABMCandidate &b) {
+				return a.index < b.index;
+			});
+	}
+
+	// Calls the triggers for the candidates found by scan()
+	void run(MapBlock *block, const std::vector<ABMCandidate> &candidates,
+		int &abms_run)
+	{
+		if (candidates.empty())
+			return;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		u32 active_object_count_wider;
+		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
+		m_env->m_added_objects = 0;
+
+		for (const ABMCandidate &candidate : candidates) {
+			const ActiveABM &aabm = *candidate.aabm;
+			const v3s16 p0 = indexToPos(candidate.index);
+
+			// Skip nodes changed by an earlier trigger
+			MapNode n = block->getNodeNoCheck(p0);
+			if (n.getContent() != candidate.c)
+				continue;
+
+			if (candidate.check_neighbors &&
+					!hasRequiredNeighbor(block, map, aabm, p0))
+				continue;
+
+			v3s16 p = p0 + block->getPosRelative();
+
+			abms_run++;
+			// Call all the trigger variations
+			aabm.abm->trigger(m_env, p, n);
+			aabm.abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
+
+			if (block->isOrphan())
+				return;
+
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+			}
+		}
+	}
+};
+
+/*
+	Work shared between the server thread and the ABM scan threads:
+	scanning one batch of active blocks.
+*/
+struct ABMScanJob
+{
+	const ABMHandler *handler = nullptr;
+	std::vector<MapBlock *> blocks;
+	std::vector<ABMScanResult> results;
+	std::atomic<size_t> next{0};
+	Semaphore done;
+
+	void work(PcgRandom &rand)
+	{
+		size_t i;
+		while ((i = next++) < blocks.size())
+			handler->scan(blocks[i], rand, results[i]);
+	}
+};
+
+class ABMScanThread : public UpdateThread
+{
+public:
+	ABMScanThread(u64 seed) : UpdateThread("ABMScan"), m_rand(seed) {}
+
+	// The job must stay alive until job->done was posted
+	void scan(ABMScanJob *job)
+	{
+		m_job = job;
+		deferUpdate();
+	}
+
+protected:
+	virtual void doUpdate()
+	{
+		m_job->work(m_rand);
+		m_job->done.post();
+	}
+
+private:
+	ABMScanJob *m_job = nullptr;
+	PcgRandom m_rand;
+};
+
 /*
 	ServerEnvironment
 */
@@ -427,6 +836,15 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 
 	m_active_object_gauge = mb->addGauge(
 		"minetest_env_active_objects", "Number of active objects");
+
+	// 0 = 25% of the system cores
+	const unsigned int abm_scan_threads = Thread::getPoolSize(
+			rangelim(g_settings->getS32("abm_scan_threads"), 0, 16), 4);
+	// The server thread does its share of the work
+	for (unsigned int i = 1; i < abm_scan_threads; i++) {
+		m_abm_scan_threads.push_back(std::make_unique<ABMScanThread>(myrand()));
+		m_abm_scan_threads.back()->start();
+	}
 }
 
 void ServerEnvironment::init()
@@ -506,6 +924,11 @@ void ServerEnvironment::init()
 
 ServerEnvironment::~ServerEnvironment()
 {
+	for (auto &thread : m_abm_scan_threads)
+		thread->stop();
+	for (auto &thread : m_abm_scan_threads)
+		thread->wait();
+
 	// Clear active block list.
 	// This makes the next one delete all active objects.
 	m_active_blocks.clear();
@@ -772,235 +1195,6 @@ void ServerEnvironment::loadDefaultMeta()
 	m_lbm_mgr.loadIntroductionTimes("", m_server, m_game_time);
 }
 
-struct ActiveABM
-{
-	ActiveBlockModifier *abm;
-	int chance;
-	std::vector<content_t> required_neighbors;
-	bool check_required_neighbors; // false if required_neighbors is known to be empty
-	s16 min_y;
-	s16 max_y;
-};
-
-#define CONTENT_TYPE_CACHE_MAX 64
-
-class ABMHandler
-{
-private:
-	ServerEnvironment *m_env;
-	std::vector<std::vector<ActiveABM> *> m_aabms;
-public:
-	ABMHandler(std::vector<ABMWithState> &abms,
-		float dtime_s, ServerEnvironment *env,
-		bool use_timers):
-		m_env(env)
-	{
-		if(dtime_s < 0.001)
-			return;
-		const NodeDefManager *ndef = env->getGameDef()->ndef();
-		for (ABMWithState &abmws : abms) {
-			ActiveBlockModifier *abm = abmws.abm;
-			float trigger_interval = abm->getTriggerInterval();
-			if(trigger_interval < 0.001)
-				trigger_interval = 0.001;
-			float actual_interval = dtime_s;
-			if(use_timers){
-				abmws.timer += dtime_s;
-				if(abmws.timer < trigger_interval)
-					continue;
-				abmws.timer -= trigger_interval;
-				actual_interval = trigger_interval;
-			}
-			float chance = abm->getTriggerChance();
-			if (chance == 0)
-				chance = 1;
-			ActiveABM aabm;
-			aabm.abm = abm;
-			if (abm->getSimpleCatchUp()) {
-				float intervals = actual_interval / trigger_interval;
-				if (intervals == 0)
-					continue;
-				aabm.chance = chance / intervals;
-				if (aabm.chance == 0)
-					aabm.chance = 1;
-			} else {
-				aabm.chance = chance;
-			}
-			// y limits
-			aabm.min_y = abm->getMinY();
-			aabm.max_y = abm->getMaxY();
-
-			// Trigger neighbors
-			const std::vector<std::string> &required_neighbors_s =
-				abm->getRequiredNeighbors();
-			for (const std::string &required_neighbor_s : required_neighbors_s) {
-				ndef->getIds(required_neighbor_s, aabm.required_neighbors);
-			}
-			aabm.check_required_neighbors = !required_neighbors_s.empty();
-
-			// Trigger contents
-			const std::vector<std::string> &contents_s = abm->getTriggerContents();
-			for (const std::string &content_s : contents_s) {
-				std::vector<content_t> ids;
-				ndef->getIds(content_s, ids);
-				for (content_t c : ids) {
-					if (c >= m_aabms.size())
-						m_aabms.resize(c + 256, NULL);
-					if (!m_aabms[c])
-						m_aabms[c] = new std::vector<ActiveABM>;
-					m_aabms[c]->push_back(aabm);
-				}
-			}
-		}
-	}
-
-	~ABMHandler()
-	{
-		for (auto &aabms : m_aabms)
-			delete aabms;
-	}
-
-	// Find out how many objects the given block and its neighbors contain.
-	// Returns the number of objects in the block, and also in 'wider' the
-	// number of objects in the block and all its neighbors. The latter
-	// may an estimate if any neighbors are unloaded.
-	u32 countObjects(MapBlock *block, ServerMap * map, u32 &wider)
-	{
-		wider = 0;
-		u32 wider_unknown_count = 0;
-		for(s16 x=-1; x<=1; x++)
-			for(s16 y=-1; y<=1; y++)
-				for(s16 z=-1; z<=1; z++)
-				{
-					MapBlock *block2 = map->getBlockNoCreateNoEx(
-						block->getPos() + v3s16(x,y,z));
-					if(block2==NULL){
-						wider_unknown_count++;
-						continue;
-					}
-					wider += block2->m_static_objects.size();
-				}
-		// Extrapolate
-		u32 active_object_count = block->m_static_objects.getActiveSize();
-		u32 wider_known_count = 3 * 3 * 3 - wider_unknown_count;
-		wider += wider_unknown_count * wider / wider_known_count;
-		return active_object_count;
-	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
-	{
-		if (m_aabms.empty())
-			return;
-
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (!block->contents.empty()) {
-			assert(!block->do_not_cache_contents); // invariant
-			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
-			}
-			if (!run_abms)
-				return;
-		}
-		blocks_scanned++;
-
-		ServerMap *map = &m_env->getServerMap();
-
-		u32 active_object_count_wider;
-		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
-		m_env->m_added_objects = 0;
-
-		bool want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
-
-		v3s16 p0;
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		{
-			MapNode n = block->getNodeNoCheck(p0);
-			content_t c = n.getContent();
-
-			// Cache content types as we go
-			if (want_contents_cached && !CONTAINS(block->contents, c)) {
-				if (block->contents.size() >= CONTENT_TYPE_CACHE_MAX) {
-					// Too many different nodes... don't try to cache
-					want_contents_cached = false;
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-					block->contents.shrink_to_fit();
-				} else {
-					block->contents.push_back(c);
-				}
-			}
-
-			if (c >= m_aabms.size() || !m_aabms[c])
-				continue;
-
-			v3s16 p = p0 + block->getPosRelative();
-			for (ActiveABM &aabm : *m_aabms[c]) {
-				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
-					continue;
-
-				if (myrand() % aabm.chance != 0)
-					continue;
-
-				// Check neighbors
-				if (aabm.check_required_neighbors) {
-					v3s16 p1;
-					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-					{
-						if(p1 == p0)
-							continue;
-						content_t c;
-						if (block->isValidPosition(p1)) {
-							// if the neighbor is found on the same map block
-							// get it straight from there
-							const MapNode &n = block->getNodeNoCheck(p1);
-							c = n.getContent();
-						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
-						}
-						if (CONTAINS(aabm.required_neighbors, c))
-							goto neighbor_found;
-					}
-					// No required neighbor found
-					continue;
-				}
-				neighbor_found:
-
-				abms_run++;
-				// Call all the trigger variations
-				aabm.abm->trigger(m_env, p, n);
-				aabm.abm->trigger(m_env, p, n,
-					active_object_count, active_object_count_wider);
-
-				if (block->isOrphan())
-					return;
-
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
-					active_object_count = countObjects(block, map, active_object_count_wider);
-					m_env->m_added_objects = 0;
-				}
-
-				// Update and check node after possible modification
-				n = block->getNodeNoCheck(p0);
-				if (n.getContent() != c)
-					break;
-			}
-		}
-	}
-};
-
 void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 {
 	// Reset usage timer immediately, otherwise a block that becomes active
@@ -1225,7 +1419,7 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 		deleteStaticFromBlock(obj, id, MOD_REASON_CLEAR_ALL_OBJECTS, true);
 
 		// If known by some client, don't delete immediately
-		if (obj->m_known_by_count > 0) {
+		if (obj->getKnownByCount() > 0) {
 			obj->markForRemoval();
 			return false;
 		}
@@ -1401,8 +1595,8 @@ void ServerEnvironment::step(float dtime)
 				g_settings->getS16("active_object_send_range_blocks");
 		static thread_local const s16 active_block_range =
 				g_settings->getS16("active_block_range");
-		std::set<v3s16> blocks_removed;
-		std::set<v3s16> blocks_added;
+		std::vector<v3s16> blocks_removed;
+		std::vector<v3s16> blocks_added;
 		m_active_blocks.update(players, active_block_range, active_object_range,
 			blocks_removed, blocks_added);
 
@@ -1420,6 +1614,9 @@ void ServerEnvironment::step(float dtime)
 
 			// Set current time as timestamp (and let it set ChangedFlag)
 			block->setTimestamp(m_game_time);
+
+			// The ABM scan doesn't need this anymore
+			block->content_index.clear();
 		}
 
 		/*
@@ -1502,26 +1699,71 @@ void ServerEnvironment::step(float dtime)
 		int i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
-				continue;
+		bool over_budget = false;
+
+		// The blocks are scanned in batches by the server thread together
+		// with the scan threads, then the triggers of the batch are run
+		ABMScanJob job;
+		job.handler = &abmhandler;
+		PcgRandom rand(myrand());
+		for (size_t batch_start = 0; batch_start < output.size() && !over_budget;
+				batch_start += ABM_SCAN_BATCH_SIZE) {
+			const size_t batch_end = MYMIN(output.size(),
+					batch_start + ABM_SCAN_BATCH_SIZE);
+
+			job.blocks.clear();
+			for (size_t k = batch_start; k < batch_end; k++) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(output[k]);
+				if (block)
+					job.blocks.push_back(block);
+			}
+			if (job.results.size() < job.blocks.size())
+				job.results.resize(job.blocks.size());
+
+			if (!abmhandler.empty()) {
+				ScopeProfiler sp2(g_profiler, "SEnv: ABM scan (sum)");
+				job.next = 0;
+				// Not worth waking up threads for a few blocks
+				size_t helpers = job.blocks.size() >= 16 ?
+					m_abm_scan_threads.size() : 0;
+				for (size_t t = 0; t < helpers; t++)
+					m_abm_scan_threads[t]->scan(&job);
+				job.work(rand);
+				for (size_t t = 0; t < helpers; t++)
+					job.done.wait();
+			}
 
-			i++;
+			for (size_t k = 0; k < job.blocks.size(); k++) {
+				MapBlock *block = job.blocks[k];
+				// An earlier trigger might have deleted the block
+				if (block->isOrphan() ||
+						m_map->getBlockNoCreateNoEx(block->getPos()) != block)
+					continue;
 
-			// Set current time as timestamp
-			block->setTimestampNoChangedFlag(m_game_time);
+				i++;
+
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+				/* Handle ActiveBlockModifiers */
+				if (!abmhandler.empty()) {
+					const ABMScanResult &result = job.results[k];
+					if (result.cached)
+						blocks_cached++;
+					if (!result.candidates.empty())
+						blocks_scanned++;
+					abmhandler.run(block, result.candidates, abms_run);
+				}
 
-			u32 time_ms = timer.getTimerTime();
+				u32 time_ms = timer.getTimerTime();
 
-			if (time_ms > max_time_ms) {
-				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
-				break;
+				if (time_ms > max_time_ms) {
+					warningstream << "active block modifiers took "
+						  << time_ms << "ms (processed " << i << " of "
+						  << output.size() << " active blocks)" << std::endl;
+					over_budget = true;
+					break;
+				}
 			}
 		}
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
@@ -1875,7 +2117,7 @@ u16 ServerEnvironment::addActiveObjectRaw(std::unique_ptr<ServerActiveObject> ob
 }
 
 /*
-	Remove objects that satisfy (isGone() && m_known_by_count==0)
+	Remove objects that satisfy (isGone() && getKnownByCount() == 0)
 */
 void ServerEnvironment::removeRemovedObjects()
 {
@@ -1903,7 +2145,7 @@ void ServerEnvironment::removeRemovedObjects()
 
 		// If still known by clients, don't actually remove. On some future
 		// invocation this will be 0, which is when removal will continue.
-		if (obj->m_known_by_count > 0)
+		if (obj->getKnownByCount() > 0)
 			return false;
 
 		/*
@@ -2038,7 +2280,7 @@ void ServerEnvironment::activateObjects(MapBlock *block, u32 dtime_s)
 /*
 	Convert objects that are not standing inside active blocks to static.
 
-	If m_known_by_count != 0, active object is not deleted, but static
+	If getKnownByCount() != 0, active object is not deleted, but static
 	data is still updated.
 
 	If force_delete is set, active object is deleted nevertheless. It
@@ -2094,7 +2336,7 @@ void ServerEnvironment::deactivateFarObjects(bool _force_delete)
 					  << blockpos_o << std::endl;
 
 		// If known by some client, don't immediately delete.
-		bool pending_delete = (obj->m_known_by_count > 0 && !force_delete);
+		bool pending_delete = (obj->getKnownByCount() > 0 && !force_delete);
 
 		/*
 			Update the static data
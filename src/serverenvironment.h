@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
 #include "util/metricsbackend.h"
+#include <algorithm>
 #include <set>
 #include <random>
 
@@ -37,6 +38,7 @@ class AuthDatabase;
 class PlayerSAO;
 class ServerEnvironment;
 class ActiveBlockModifier;
+class ABMScanThread;
 struct StaticObject;
 class ServerActiveObject;
 class Server;
@@ -157,6 +159,54 @@ class LBMManager
 	{ return m_lbm_lookup.lower_bound(time); }
 };
 
+/*
+	Set of block positions kept in a sorted vector.
+	Cheap to build in bulk (push() everything, then sort()) and to diff
+	against another set, unlike std::set.
+	Ordered by a packed 48-bit key of the position.
+*/
+
+class BlockPosSet
+{
+public:
+	static inline u64 getKey(v3s16 p)
+	{
+		return ((u64)(u16)p.Z << 32) | ((u64)(u16)p.Y << 16) | (u16)p.X;
+	}
+
+	static inline bool less(v3s16 a, v3s16 b)
+	{
+		return getKey(a) < getKey(b);
+	}
+
+	// Adds a position, the set is invalid until sort() is called
+	void push(v3s16 p) { m_data.push_back(p); }
+	// Sorts the pushed positions and removes duplicates
+	void sort();
+
+	bool contains(v3s16 p) const
+	{
+		return std::binary_search(m_data.begin(), m_data.end(), p, less);
+	}
+
+	void erase(v3s16 p);
+
+	// Writes the positions of `a` that are not in `b` to `out`
+	static void difference(const BlockPosSet &a, const BlockPosSet &b,
+		std::vector<v3s16> &out);
+
+	size_t size() const { return m_data.size(); }
+	bool empty() const { return m_data.empty(); }
+	void clear() { m_data.clear(); }
+	void reserve(size_t n) { m_data.reserve(n); }
+
+	std::vector<v3s16>::const_iterator begin() const { return m_data.begin(); }
+	std::vector<v3s16>::const_iterator end() const { return m_data.end(); }
+
+private:
+	std::vector<v3s16> m_data;
+};
+
 /*
 	List of active blocks, used by ServerEnvironment
 */
@@ -167,11 +217,11 @@ class ActiveBlockList
 	void update(std::vector<PlayerSAO*> &active_players,
 		s16 active_block_range,
 		s16 active_object_range,
-		std::set<v3s16> &blocks_removed,
-		std::set<v3s16> &blocks_added);
+		std::vector<v3s16> &blocks_removed,
+		std::vector<v3s16> &blocks_added);
 
 	bool contains(v3s16 p) const {
-		return (m_list.find(p) != m_list.end());
+		return m_list.contains(p);
 	}
 
 	auto size() const {
@@ -187,8 +237,8 @@ class ActiveBlockList
 		m_abm_list.erase(p);
 	}
 
-	std::set<v3s16> m_list;
-	std::set<v3s16> m_abm_list;
+	BlockPosSet m_list;
+	BlockPosSet m_abm_list;
 	// list of blocks that are always active, not modified by this class
 	std::set<v3s16> m_forceloaded_list;
 };
@@ -358,6 +408,12 @@ class ServerEnvironment final : public Environment
 		return m_ao_manager.getObjectsInArea(box, objects, include_obj_cb);
 	}
 
+	// Called by objects whenever their base position changes
+	void updateActiveObjectPos(ServerActiveObject *obj)
+	{
+		m_ao_manager.updateObjectPos(obj);
+	}
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -426,7 +482,7 @@ class ServerEnvironment final : public Environment
 			bool set_changed, u32 dtime_s);
 
 	/*
-		Remove all objects that satisfy (isGone() && m_known_by_count==0)
+		Remove all objects that satisfy (isGone() && getKnownByCount() == 0)
 	*/
 	void removeRemovedObjects();
 
@@ -438,7 +494,7 @@ class ServerEnvironment final : public Environment
 	/*
 		Convert objects that are not in active blocks to static.
 
-		If m_known_by_count != 0, active object is not deleted, but static
+		If getKnownByCount() != 0, active object is not deleted, but static
 		data is still updated.
 
 		If force_delete is set, active object is deleted nevertheless. It
@@ -493,6 +549,8 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Help the server thread to find the nodes to run ABMs on
+	std::vector<std::unique_ptr<ABMScanThread>> m_abm_scan_threads;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
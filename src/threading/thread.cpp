@@ -28,6 +28,8 @@ DEALINGS IN THE SOFTWARE.
 #include "log.h"
 #include "porting.h"
 
+#include <algorithm>
+
 // for setName
 #if defined(__linux__)
 	#include <sys/prctl.h>
@@ -255,6 +257,17 @@ unsigned int Thread::getNumberOfProcessors()
 }
 
 
+unsigned int Thread::getPoolSize(int configured, unsigned int cores_per_thread)
+{
+	if (configured > 0)
+		return configured;
+
+	// Leave most of the cores to the other threads of the process
+	unsigned int count = getNumberOfProcessors() / cores_per_thread;
+	return std::min(std::max(count, 1U), 4U);
+}
+
+
 bool Thread::bindToProcessor(unsigned int proc_number)
 {
 #if defined(__ANDROID__)
@@ -130,6 +130,13 @@ class Thread {
 	 */
 	static unsigned int getNumberOfProcessors();
 
+	/*
+	 * Returns the number of threads to use for a pool of helper threads:
+	 * `configured` if it is positive, otherwise one per `cores_per_thread`
+	 * processors, between 1 and 4.
+	 */
+	static unsigned int getPoolSize(int configured, unsigned int cores_per_thread);
+
 protected:
 	std::string m_name;
 
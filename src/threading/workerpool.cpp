@@ -0,0 +1,133 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "workerpool.h"
+#include "threading/thread.h"
+#include "debug.h"
+#include "log.h"
+
+class WorkerPool::WorkerThread : public Thread
+{
+public:
+	WorkerThread(const std::string &name, WorkerPool *pool) :
+		Thread(name),
+		m_pool(pool)
+	{
+	}
+
+	void *run()
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		m_pool->workerLoop();
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return nullptr;
+	}
+
+private:
+	WorkerPool *m_pool;
+};
+
+WorkerPool::WorkerPool(const std::string &name, unsigned int thread_count)
+{
+	for (unsigned int i = 0; i < thread_count; i++) {
+		m_threads.push_back(std::make_unique<WorkerThread>(name, this));
+		m_threads.back()->start();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_start_cv.notify_all();
+	for (auto &thread : m_threads)
+		thread->wait();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &func)
+{
+	// Not worth waking anyone up
+	if (m_threads.empty() || count <= 1) {
+		for (size_t i = 0; i < count; i++)
+			func(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_func = &func;
+		m_count = count;
+		m_next = 0;
+		m_done = 0;
+		m_generation++;
+	}
+	m_start_cv.notify_all();
+
+	const size_t done = work(func, count);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done += done;
+	// Threads that picked up the job must be out of it before func and
+	// m_next may be reused
+	m_done_cv.wait(lock, [this] {
+		return m_done == m_count && m_active == 0;
+	});
+	m_func = nullptr;
+}
+
+void WorkerPool::workerLoop()
+{
+	u32 generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_start_cv.wait(lock, [&] {
+			return m_stopping || (m_func && m_generation != generation);
+		});
+		if (m_stopping)
+			break;
+
+		generation = m_generation;
+		const std::function<void(size_t)> &func = *m_func;
+		const size_t count = m_count;
+		m_active++;
+		lock.unlock();
+
+		const size_t done = work(func, count);
+
+		lock.lock();
+		m_done += done;
+		m_active--;
+		m_done_cv.notify_one();
+	}
+}
+
+size_t WorkerPool::work(const std::function<void(size_t)> &func, size_t count)
+{
+	size_t done = 0;
+	for (size_t i = m_next++; i < count; i = m_next++) {
+		func(i);
+		done++;
+	}
+	return done;
+}
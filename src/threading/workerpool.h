@@ -0,0 +1,74 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "irrlichttypes.h"
+#include "util/basic_macros.h"
+
+/*
+	A fixed set of threads that call a function for every index of a range
+	and return once all calls are done. The calling thread works along, so
+	a pool without threads simply runs everything on the caller.
+*/
+class WorkerPool
+{
+public:
+	// thread_count is the number of threads in addition to the caller
+	WorkerPool(const std::string &name, unsigned int thread_count);
+	~WorkerPool();
+
+	DISABLE_CLASS_COPY(WorkerPool);
+
+	// Calls func(i) for every 0 <= i < count, in no particular order and
+	// possibly at the same time. Must not be called from several threads.
+	void run(size_t count, const std::function<void(size_t)> &func);
+
+	unsigned int getThreadCount() const { return m_threads.size(); }
+
+private:
+	class WorkerThread;
+
+	void workerLoop();
+	// Calls func for indices until there are none left, returns how many
+	size_t work(const std::function<void(size_t)> &func, size_t count);
+
+	std::vector<std::unique_ptr<WorkerThread>> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_start_cv;
+	std::condition_variable m_done_cv;
+
+	// Current job, m_func is null while there is none
+	const std::function<void(size_t)> *m_func = nullptr;
+	size_t m_count = 0;
+	std::atomic<size_t> m_next{0};
+	size_t m_done = 0;
+	// Threads that are working on the current job
+	unsigned int m_active = 0;
+	u32 m_generation = 0;
+	bool m_stopping = false;
+};
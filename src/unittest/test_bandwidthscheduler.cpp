@@ -0,0 +1,253 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/bandwidthscheduler.h"
+
+class TestBandwidthScheduler : public TestBase
+{
+public:
+	TestBandwidthScheduler() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestBandwidthScheduler"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testClassify();
+	void testDisabled();
+	void testPriority();
+	void testLargePackets();
+	void testStaleMovement();
+	void testAdmit();
+	void testFlush();
+};
+
+static TestBandwidthScheduler g_test_instance;
+
+void TestBandwidthScheduler::runTests(IGameDef *gamedef)
+{
+	TEST(testClassify);
+	TEST(testDisabled);
+	TEST(testPriority);
+	TEST(testLargePackets);
+	TEST(testStaleMovement);
+	TEST(testAdmit);
+	TEST(testFlush);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Sent
+{
+	session_t peer_id;
+	u16 command;
+	u32 size;
+};
+
+struct Recorder
+{
+	BandwidthScheduler::SendFunc func()
+	{
+		return [this] (session_t peer_id, u8 channelnum, NetworkPacket &&pkt,
+				bool reliable) {
+			sent.push_back({peer_id, pkt.getCommand(), pkt.getSize()});
+		};
+	}
+
+	std::vector<Sent> sent;
+};
+
+NetworkPacket makePacket(u16 command, u32 size)
+{
+	NetworkPacket pkt(command, size);
+	pkt.putRawString(std::string(size, 'x'));
+	return pkt;
+}
+
+}
+
+void TestBandwidthScheduler::testClassify()
+{
+	UASSERTEQ(int, BandwidthScheduler::classify(TOCLIENT_ACTIVE_OBJECT_MESSAGES),
+			SEND_CLASS_MOVEMENT);
+	UASSERTEQ(int, BandwidthScheduler::classify(TOCLIENT_BLOCKDATA),
+			SEND_CLASS_BLOCKS);
+	UASSERTEQ(int, BandwidthScheduler::classify(TOCLIENT_MEDIA),
+			SEND_CLASS_MEDIA);
+	UASSERTEQ(int, BandwidthScheduler::classify(TOCLIENT_CHAT_MESSAGE),
+			SEND_CLASS_INTERACTION);
+}
+
+void TestBandwidthScheduler::testDisabled()
+{
+	MetricsBackend mb;
+	Recorder rec;
+	BandwidthScheduler scheduler(0, rec.func(), &mb);
+	UASSERT(!scheduler.isEnabled());
+
+	for (int i = 0; i < 100; i++)
+		scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 10000), true);
+	UASSERTEQ(size_t, rec.sent.size(), 100);
+	UASSERTEQ(size_t, scheduler.getQueuedCount(1, SEND_CLASS_MEDIA), 0);
+}
+
+void TestBandwidthScheduler::testPriority()
+{
+	MetricsBackend mb;
+	Recorder rec;
+	// 1000 bytes of burst, enough for one packet of 600 bytes
+	BandwidthScheduler scheduler(10000, rec.func(), &mb);
+
+	// The burst lets one through, the rest has to wait
+	for (int i = 0; i < 10; i++)
+		scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 600), true);
+	UASSERTEQ(size_t, rec.sent.size(), 1);
+	UASSERTEQ(size_t, scheduler.getQueuedCount(1, SEND_CLASS_MEDIA), 9);
+
+	// Other clients have their own budget
+	scheduler.push(2, 2, makePacket(TOCLIENT_MEDIA, 600), true);
+	UASSERTEQ(size_t, rec.sent.size(), 2);
+
+	scheduler.push(1, 2, makePacket(TOCLIENT_BLOCKDATA, 500), true);
+	scheduler.push(1, 0, makePacket(TOCLIENT_ACTIVE_OBJECT_MESSAGES, 100), true);
+	UASSERTEQ(size_t, scheduler.getQueuedCount(1, SEND_CLASS_MOVEMENT), 1);
+
+	// Once there is budget again, the later packets overtake the media
+	sleep_ms(30);
+	scheduler.step();
+	UASSERT(rec.sent.size() > 2);
+	UASSERTEQ(u16, rec.sent[2].command, TOCLIENT_ACTIVE_OBJECT_MESSAGES);
+
+	// Everything goes out eventually, in order within a class
+	for (int i = 0; i < 200 && rec.sent.size() < 12; i++) {
+		sleep_ms(10);
+		scheduler.step();
+	}
+	UASSERTEQ(size_t, rec.sent.size(), 12);
+	size_t blockdata_index = 0, last_media_index = 0;
+	for (size_t i = 0; i < rec.sent.size(); i++) {
+		if (rec.sent[i].command == TOCLIENT_BLOCKDATA)
+			blockdata_index = i;
+		else if (rec.sent[i].command == TOCLIENT_MEDIA)
+			last_media_index = i;
+	}
+	// Blocks have twice the weight of media
+	UASSERT(blockdata_index < last_media_index);
+}
+
+void TestBandwidthScheduler::testLargePackets()
+{
+	MetricsBackend mb;
+	Recorder rec;
+	BandwidthScheduler scheduler(10000, rec.func(), &mb);
+
+	// 5000 bytes is half a second worth of rate
+	scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 5000), true);
+	scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 5000), true);
+	UASSERTEQ(size_t, rec.sent.size(), 0);
+
+	// Paying for the media doesn't hold back movement packets
+	sleep_ms(30);
+	scheduler.step();
+	scheduler.push(1, 0, makePacket(TOCLIENT_ACTIVE_OBJECT_MESSAGES, 100), false);
+	for (int i = 0; i < 10 && rec.sent.empty(); i++) {
+		sleep_ms(10);
+		scheduler.step();
+	}
+	UASSERTEQ(size_t, rec.sent.size(), 1);
+	UASSERTEQ(u16, rec.sent[0].command, TOCLIENT_ACTIVE_OBJECT_MESSAGES);
+
+	// The media is sent once it is paid for
+	bool waiting = true;
+	for (int i = 0; i < 200 && waiting; i++) {
+		sleep_ms(10);
+		waiting = scheduler.step();
+	}
+	UASSERT(!waiting);
+	UASSERTEQ(size_t, rec.sent.size(), 3);
+}
+
+void TestBandwidthScheduler::testStaleMovement()
+{
+	MetricsBackend mb;
+	Recorder rec;
+	BandwidthScheduler scheduler(10000, rec.func(), &mb);
+
+	// Use up the budget, then queue movement behind a big packet
+	scheduler.push(1, 0, makePacket(TOCLIENT_CHAT_MESSAGE, 1000), true);
+	scheduler.push(1, 0, makePacket(TOCLIENT_CHAT_MESSAGE, 10000), true);
+	scheduler.push(1, 0, makePacket(TOCLIENT_ACTIVE_OBJECT_MESSAGES, 100), false);
+	scheduler.push(1, 0, makePacket(TOCLIENT_ACTIVE_OBJECT_MESSAGES, 100), true);
+	UASSERTEQ(size_t, rec.sent.size(), 1);
+	UASSERTEQ(size_t, scheduler.getQueuedCount(1, SEND_CLASS_MOVEMENT), 2);
+
+	// Only the reliable one is kept
+	sleep_ms(600);
+	scheduler.step();
+	UASSERTEQ(size_t, scheduler.getQueuedCount(1, SEND_CLASS_MOVEMENT), 0);
+	UASSERTEQ(size_t, rec.sent.size(), 2);
+	UASSERTEQ(u16, rec.sent[1].command, TOCLIENT_ACTIVE_OBJECT_MESSAGES);
+}
+
+void TestBandwidthScheduler::testAdmit()
+{
+	MetricsBackend mb;
+	Recorder rec;
+	BandwidthScheduler scheduler(10000, rec.func(), &mb);
+
+	UASSERT(scheduler.admit(1, TOCLIENT_MEDIA, 600));
+	UASSERT(!scheduler.admit(1, TOCLIENT_MEDIA, 600));
+	UASSERT(!scheduler.admit(1, TOCLIENT_ACCESS_DENIED, 10));
+
+	// Nothing may overtake queued packets
+	scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 600), true);
+	UASSERTEQ(size_t, scheduler.getQueuedCount(1, SEND_CLASS_MEDIA), 1);
+	UASSERT(!scheduler.admit(1, TOCLIENT_CHAT_MESSAGE, 1));
+
+	BandwidthScheduler disabled(0, rec.func(), &mb);
+	UASSERT(disabled.admit(1, TOCLIENT_MEDIA, 100000));
+}
+
+void TestBandwidthScheduler::testFlush()
+{
+	MetricsBackend mb;
+	Recorder rec;
+	BandwidthScheduler scheduler(10000, rec.func(), &mb);
+
+	for (int i = 0; i < 10; i++)
+		scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 600), true);
+	UASSERTEQ(size_t, rec.sent.size(), 1);
+
+	scheduler.flush(1);
+	UASSERTEQ(size_t, rec.sent.size(), 10);
+
+	// Access denied messages get everything out first
+	for (int i = 0; i < 10; i++)
+		scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 600), true);
+	scheduler.push(1, 0, makePacket(TOCLIENT_ACCESS_DENIED, 10), true);
+	UASSERTEQ(size_t, rec.sent.size(), 21);
+	UASSERTEQ(u16, rec.sent.back().command, TOCLIENT_ACCESS_DENIED);
+
+	for (int i = 0; i < 10; i++)
+		scheduler.push(1, 2, makePacket(TOCLIENT_MEDIA, 600), true);
+	scheduler.removePeer(1);
+	UASSERTEQ(size_t, scheduler.getQueuedCount(1, SEND_CLASS_MEDIA), 0);
+}
@@ -0,0 +1,171 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/blockserializer.h"
+#include "mapblock.h"
+
+class TestBlockSerializer : public TestBase
+{
+public:
+	TestBlockSerializer() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestBlockSerializer"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testCacheVersion();
+	void testCacheEviction();
+	void testCacheInvalidate();
+	void testResultOrder(IGameDef *gamedef);
+};
+
+static TestBlockSerializer g_test_instance;
+
+void TestBlockSerializer::runTests(IGameDef *gamedef)
+{
+	TEST(testCacheVersion);
+	TEST(testCacheEviction);
+	TEST(testCacheInvalidate);
+	TEST(testResultOrder, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::shared_ptr<const std::string> makeData(size_t size, char c = 'x')
+{
+	return std::make_shared<const std::string>(size, c);
+}
+
+void TestBlockSerializer::testCacheVersion()
+{
+	SerializedBlockCache cache(1000);
+	const v3s16 pos(1, 2, 3);
+
+	cache.put(pos, 29, 5, makeData(100, 'a'));
+	UASSERTEQ(size_t, cache.getBytes(), 100);
+
+	auto data = cache.get(pos, 29, 5);
+	UASSERT(data && *data == std::string(100, 'a'));
+
+	// other serialization version
+	UASSERT(!cache.get(pos, 28, 5));
+
+	// the block was modified, the entry is gone for good
+	UASSERT(!cache.get(pos, 29, 6));
+	UASSERT(!cache.get(pos, 29, 5));
+	UASSERTEQ(size_t, cache.size(), 0);
+	UASSERTEQ(size_t, cache.getBytes(), 0);
+
+	// replacing an entry
+	cache.put(pos, 29, 6, makeData(100));
+	cache.put(pos, 29, 7, makeData(50));
+	UASSERTEQ(size_t, cache.size(), 1);
+	UASSERTEQ(size_t, cache.getBytes(), 50);
+	UASSERT(cache.get(pos, 29, 7));
+}
+
+void TestBlockSerializer::testCacheEviction()
+{
+	SerializedBlockCache cache(300);
+
+	cache.put(v3s16(0, 0, 0), 29, 1, makeData(100));
+	cache.put(v3s16(1, 0, 0), 29, 1, makeData(100));
+	cache.put(v3s16(2, 0, 0), 29, 1, makeData(100));
+	UASSERTEQ(size_t, cache.getBytes(), 300);
+
+	// makes (1,0,0) the least recently used one
+	UASSERT(cache.get(v3s16(0, 0, 0), 29, 1));
+
+	cache.put(v3s16(3, 0, 0), 29, 1, makeData(100));
+	UASSERTEQ(size_t, cache.size(), 3);
+	UASSERTEQ(size_t, cache.getBytes(), 300);
+	UASSERT(!cache.get(v3s16(1, 0, 0), 29, 1));
+	UASSERT(cache.get(v3s16(0, 0, 0), 29, 1));
+	UASSERT(cache.get(v3s16(2, 0, 0), 29, 1));
+	UASSERT(cache.get(v3s16(3, 0, 0), 29, 1));
+
+	// too large to be cached at all
+	cache.put(v3s16(4, 0, 0), 29, 1, makeData(301));
+	UASSERT(!cache.get(v3s16(4, 0, 0), 29, 1));
+	UASSERTEQ(size_t, cache.size(), 3);
+
+	cache.clear();
+	UASSERTEQ(size_t, cache.size(), 0);
+	UASSERTEQ(size_t, cache.getBytes(), 0);
+}
+
+void TestBlockSerializer::testCacheInvalidate()
+{
+	SerializedBlockCache cache(1000);
+	const v3s16 pos(-5, 0, 7);
+
+	cache.put(pos, 28, 1, makeData(10));
+	cache.put(pos, 29, 1, makeData(20));
+	cache.put(v3s16(0, 0, 0), 29, 1, makeData(30));
+
+	cache.invalidate(pos);
+	UASSERT(!cache.get(pos, 28, 1));
+	UASSERT(!cache.get(pos, 29, 1));
+	UASSERT(cache.get(v3s16(0, 0, 0), 29, 1));
+	UASSERTEQ(size_t, cache.getBytes(), 30);
+}
+
+void TestBlockSerializer::testResultOrder(IGameDef *gamedef)
+{
+	MetricsBackend mb;
+	BlockSerializer serializer(&mb);
+	MapBlock block(v3s16(0, 0, 0), gamedef);
+
+	serializer.queueBlock(&block, 29, 1);
+	const u64 old_version = block.getNetworkVersion();
+	block.raiseModified(MOD_STATE_WRITE_NEEDED);
+	serializer.queueBlock(&block, 29, 2);
+	const u64 new_version = block.getNetworkVersion();
+	UASSERT(new_version > old_version);
+
+	// The workers are not started, finish the jobs in reverse order
+	BlockSerializer::Job jobs[2];
+	UASSERT(serializer.popJob(jobs[0]));
+	UASSERT(serializer.popJob(jobs[1]));
+	UASSERT(!serializer.popJob(jobs[0]));
+	for (int i = 1; i >= 0; i--) {
+		SerializedBlock result;
+		result.pos = jobs[i].pos;
+		result.ser_ver = jobs[i].ser_ver;
+		result.block_version = jobs[i].block_version;
+		result.data = makeData(10);
+		serializer.putResult(std::move(result));
+	}
+
+	SerializedBlock result;
+	UASSERT(serializer.getNextResult(result));
+	UASSERT(result.block_version == new_version);
+	UASSERT(!result.outdated);
+	UASSERT(result.peers == std::vector<u16>{2});
+
+	// The older one must not overwrite what the client got already
+	UASSERT(serializer.getNextResult(result));
+	UASSERT(result.block_version == old_version);
+	UASSERT(result.outdated);
+	UASSERT(result.peers == std::vector<u16>{1});
+
+	UASSERT(!serializer.getNextResult(result));
+	UASSERT(serializer.getCached(&block, 29));
+}
@@ -19,11 +19,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <atomic>
+#include <deque>
 #include "log.h"
+#include "noise.h"
 #include "porting.h"
 #include "settings.h"
+#include "threading/thread.h"
 #include "util/serialize.h"
+#include "network/congestioncontrol.h"
 #include "network/connection.h"
+#include "network/networkexceptions.h"
 #include "network/networkpacket.h"
 #include "network/socket.h"
 
@@ -41,7 +47,14 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testForgedPacket();
+	void testSplitReliablePackets();
+	void testReliablePacketBuffer();
+	void testReliablePacketBufferWrap();
+	void testCubic();
+	void testBbr();
 	void testConnectSendReceive();
+	void testLossyLink();
 };
 
 static TestConnection g_test_instance;
@@ -50,7 +63,14 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testForgedPacket);
+	TEST(testSplitReliablePackets);
+	TEST(testReliablePacketBuffer);
+	TEST(testReliablePacketBufferWrap);
+	TEST(testCubic);
+	TEST(testBbr);
 	TEST(testConnectSendReceive);
+	TEST(testLossyLink);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -156,6 +176,358 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p2[3]) == data1[0]);
 }
 
+void TestConnection::testForgedPacket()
+{
+	NetworkPacket pkt(0x1234, 0, 5);
+	for (u32 i = 0; i < 1000; i++)
+		pkt << i;
+
+	Buffer<u8> expected = pkt.oldForgePacket();
+	std::vector<u8> copied = pkt.getForgedPacket();
+	UASSERTEQ(size_t, copied.size(), expected.getSize());
+	UASSERT(!memcmp(copied.data(), *expected, copied.size()));
+	// Copying leaves the packet alone
+	UASSERTEQ(u32, pkt.getSize(), 4000);
+
+	std::vector<u8> taken = pkt.takeForgedPacket();
+	UASSERT(taken == copied);
+	UASSERTEQ(u32, pkt.getSize(), 0);
+
+	// The packet is usable again after that
+	pkt.putRawPacket(taken.data(), taken.size(), 7);
+	UASSERTEQ(u16, pkt.getCommand(), 0x1234);
+	UASSERTEQ(u32, pkt.getSize(), 4000);
+	u32 value;
+	pkt >> value >> value;
+	UASSERTEQ(u32, value, 1);
+}
+
+void TestConnection::testSplitReliablePackets()
+{
+	Address a(127, 0, 0, 1, 10);
+	const u32 chunksize_max = 500;
+
+	// Must give exactly the same packets as the separate steps
+	for (u32 size : {1U, 100U, chunksize_max - 1, chunksize_max, 2000U, 4986U}) {
+		SharedBuffer<u8> data(size);
+		for (u32 i = 0; i < size; i++)
+			data[i] = i * 7;
+
+		u16 split_seqnum = 42;
+		std::list<SharedBuffer<u8>> expected;
+		con::makeAutoSplitPacket(data, chunksize_max, split_seqnum, &expected);
+
+		u16 split_seqnum2 = 42;
+		std::vector<con::BufferedPacketPtr> packets;
+		con::makeAutoSplitReliablePackets(a, *data, size, chunksize_max,
+				split_seqnum2, 0x12345678, 123, 2, &packets);
+		UASSERTEQ(u16, split_seqnum2, split_seqnum);
+		UASSERTEQ(size_t, packets.size(), expected.size());
+
+		u16 seqnum = 65530;
+		auto p = packets.begin();
+		for (const SharedBuffer<u8> &chunk : expected) {
+			con::setReliableSeqnum(**p, seqnum);
+			con::BufferedPacketPtr old = con::makePacket(a,
+					con::makeReliablePacket(chunk, seqnum), 0x12345678, 123, 2);
+			UASSERTEQ(size_t, (*p)->size(), old->size());
+			UASSERT(!memcmp(&(*p)->data[0], &old->data[0], old->size()));
+			UASSERTEQ(u16, (*p)->getSeqnum(), seqnum);
+			++p;
+			seqnum++;
+		}
+	}
+}
+
+static con::BufferedPacketPtr make_reliable(u16 seqnum, u8 data = 0)
+{
+	Address a(127, 0, 0, 1, 10);
+	SharedBuffer<u8> payload(1);
+	payload[0] = data;
+	return con::makePacket(a, con::makeReliablePacket(payload, seqnum),
+			0x12345678, 123, 0);
+}
+
+void TestConnection::testReliablePacketBuffer()
+{
+	con::ReliablePacketBuffer buf;
+	u16 first;
+	UASSERT(buf.empty());
+	UASSERT(!buf.getFirstSeqnum(first));
+	EXCEPTION_CHECK(con::NotFoundException, buf.popFirst());
+
+	// Out of order
+	const u16 next_expected = 100;
+	for (u16 seqnum : {105, 101, 103, 102, 110}) {
+		auto p = make_reliable(seqnum);
+		buf.insert(p, next_expected);
+	}
+	UASSERTEQ(u32, buf.size(), 5);
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, 101);
+
+	// A resent packet is ignored, a different one with the same seqnum is not
+	auto p = make_reliable(103);
+	buf.insert(p, next_expected);
+	UASSERTEQ(u32, buf.size(), 5);
+	p = con::makePacket(p->address, SharedBuffer<u8>(10), 0, 0, 0);
+	writeU8(&p->data[BASE_HEADER_SIZE], con::PACKET_TYPE_RELIABLE);
+	writeU16(&p->data[BASE_HEADER_SIZE + 1], 103);
+	EXCEPTION_CHECK(con::IncomingDataCorruption, buf.insert(p, next_expected));
+
+	// Outside of the window or the next expected one
+	p = make_reliable(next_expected);
+	buf.insert(p, next_expected);
+	p = make_reliable(next_expected - 1);
+	buf.insert(p, next_expected);
+	UASSERTEQ(u32, buf.size(), 5);
+
+	// Acks in any order
+	UASSERTEQ(u16, buf.popSeqnum(103)->getSeqnum(), 103);
+	EXCEPTION_CHECK(con::NotFoundException, buf.popSeqnum(103));
+	EXCEPTION_CHECK(con::NotFoundException, buf.popSeqnum(104));
+	EXCEPTION_CHECK(con::NotFoundException, buf.popSeqnum(200));
+	UASSERTEQ(u16, buf.popSeqnum(110)->getSeqnum(), 110);
+	UASSERTEQ(u16, buf.popFirst()->getSeqnum(), 101);
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, 102);
+
+	// Timeouts
+	buf.incrementTimeouts(1.0f);
+	p = make_reliable(106);
+	buf.insert(p, next_expected);
+	auto timed_outs = buf.getTimedOuts(0.5f, 100);
+	UASSERTEQ(size_t, timed_outs.size(), 2);
+	UASSERTEQ(u16, timed_outs.front()->getSeqnum(), 102);
+	UASSERTEQ(u16, timed_outs.back()->getSeqnum(), 105);
+	UASSERTEQ(u32, timed_outs.front()->resend_count, 1);
+	UASSERT(buf.getTimedOuts(0.5f, 100).empty());
+
+	UASSERTEQ(u16, buf.popFirst()->getSeqnum(), 102);
+	UASSERTEQ(u16, buf.popFirst()->getSeqnum(), 105);
+	UASSERTEQ(u16, buf.popFirst()->getSeqnum(), 106);
+	UASSERT(buf.empty());
+}
+
+void TestConnection::testReliablePacketBufferWrap()
+{
+	con::ReliablePacketBuffer buf;
+
+	// Fill a large window across the seqnum wraparound, in reverse order
+	// so that the first packet changes on every insert
+	const u16 next_expected = SEQNUM_MAX - 1000;
+	const u16 count = 3000;
+	for (u16 i = count; i > 0; i--) {
+		auto p = make_reliable(next_expected + i, i & 0xff);
+		buf.insert(p, next_expected);
+	}
+	UASSERTEQ(u32, buf.size(), count);
+
+	u16 first;
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, (u16)(next_expected + 1));
+
+	// Ack everything before the wraparound out of order
+	for (u16 i = 1; i <= 1000; i += 2)
+		buf.popSeqnum(next_expected + i);
+	for (u16 i = 2; i <= 1000; i += 2)
+		buf.popSeqnum(next_expected + i);
+	UASSERTEQ(u32, buf.size(), count - 1000);
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, 0);
+
+	// The rest comes out in order, with the right data
+	for (u16 i = 1001; i <= count; i++) {
+		auto p = buf.popFirst();
+		UASSERTEQ(u16, p->getSeqnum(), (u16)(next_expected + i));
+		UASSERTEQ(u8, p->data[BASE_HEADER_SIZE + 3], i & 0xff);
+	}
+	UASSERT(buf.empty());
+
+	// Sliding window, like acks coming in for sent packets
+	u16 seqnum = SEQNUM_INITIAL;
+	u16 oldest = seqnum;
+	for (int i = 0; i < 100000; i++) {
+		auto p = make_reliable(seqnum);
+		buf.insert(p, seqnum - 1);
+		seqnum++;
+		if (buf.size() > 64) {
+			UASSERTEQ(u16, buf.popSeqnum(oldest)->getSeqnum(), oldest);
+			oldest++;
+		}
+	}
+	UASSERTEQ(u32, buf.size(), 64);
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, oldest);
+}
+
+
+void TestConnection::testCubic()
+{
+	con::CubicCongestionController cc;
+	u64 time_ms = 1000;
+
+	// Slow start: one more packet per ack
+	const u32 initial = cc.getWindowSize();
+	UASSERTEQ(float, cc.getPacingRate(), 0.0f);
+	for (u32 i = 0; i < initial; i++)
+		cc.onPacketAcked(500, 0.1f, time_ms);
+	UASSERTEQ(u32, cc.getWindowSize(), 2 * initial);
+	// Twice the window per round trip
+	UASSERT(cc.getPacingRate() > 2 * initial * 500 / 0.1f);
+
+	// Multiplicative decrease, but only once per window
+	const u32 before_loss = cc.getWindowSize();
+	cc.onPacketsLost(3, time_ms);
+	const u32 after_loss = cc.getWindowSize();
+	UASSERTEQ(u32, after_loss, (u32)(before_loss * 0.7f));
+	cc.onPacketsLost(1, time_ms + 100);
+	UASSERTEQ(u32, cc.getWindowSize(), after_loss);
+
+	// Returns to the old window quickly, and only slowly beyond it
+	u32 window = after_loss;
+	for (int round = 0; round < 100 && window < before_loss; round++) {
+		time_ms += 100;
+		for (u32 i = 0; i < window; i++)
+			cc.onPacketAcked(500, 0.1f, time_ms);
+		window = cc.getWindowSize();
+	}
+	UASSERT(window >= before_loss);
+	UASSERT(window < before_loss * 1.1f);
+
+	// Never below the minimum
+	for (int i = 0; i < 20; i++) {
+		time_ms += 10000;
+		cc.onPacketsLost(1, time_ms);
+	}
+	UASSERTEQ(u32, cc.getWindowSize(), MIN_RELIABLE_WINDOW_SIZE);
+}
+
+void TestConnection::testBbr()
+{
+	con::BbrCongestionController cc;
+	UASSERTEQ(u32, cc.getWindowSize(), MIN_RELIABLE_WINDOW_SIZE);
+	UASSERTEQ(float, cc.getPacingRate(), 0.0f);
+
+	// A link of 1 MB/s with 200 ms round trip time
+	const float bandwidth = 1000000.0f;
+	const float rtt = 0.2f;
+	const u32 packet_size = 500;
+
+	// Every millisecond, acks come in for what the link could deliver or
+	// for what was sent one round trip ago, whichever is less
+	std::deque<u32> sent; // bytes per millisecond
+	float backlog = 0.0f;
+	for (u64 time_ms = 1; time_ms <= 10000; time_ms++) {
+		float rate = cc.getPacingRate();
+		if (rate == 0.0f)
+			rate = cc.getWindowSize() * packet_size / rtt;
+		sent.push_back(rate / 1000.0f);
+		if (sent.size() < rtt * 1000.0f)
+			continue;
+		backlog += sent.front();
+		sent.pop_front();
+
+		float deliverable = MYMIN(backlog, bandwidth / 1000.0f);
+		for (; deliverable >= packet_size; deliverable -= packet_size) {
+			cc.onPacketAcked(packet_size, rtt, time_ms);
+			backlog -= packet_size;
+		}
+	}
+
+	// Found the bandwidth and is pacing around it
+	UASSERT(!cc.isInStartup());
+	UASSERT(std::fabs(cc.getBandwidth() - bandwidth) < bandwidth * 0.1f);
+	UASSERTEQ(float, cc.getMinRtt(), rtt);
+	UASSERT(cc.getPacingRate() >= bandwidth * 0.7f);
+	UASSERT(cc.getPacingRate() <= bandwidth * 1.4f);
+
+	// Twice the bandwidth-delay product
+	const float bdp = bandwidth * rtt / packet_size;
+	UASSERT(cc.getWindowSize() > 1.8f * bdp);
+	UASSERT(cc.getWindowSize() < 2.4f * bdp);
+}
+
+/*
+	Forwards datagrams between one client and a server like a slow link
+	that loses packets. The client connects to the port of the link.
+*/
+class LossyLink : public Thread
+{
+public:
+	// Listens on an ephemeral port, see getPort()
+	LossyLink(const Address &server, u32 delay_ms, u32 loss_percent) :
+		Thread("LossyLink"),
+		m_server(server),
+		m_delay_ms(delay_ms),
+		m_loss_percent(loss_percent)
+	{
+		m_socket.init(false);
+		m_socket.Bind(Address(0, 0, 0, 0, 0));
+		m_socket.setTimeoutMs(1);
+	}
+
+	~LossyLink()
+	{
+		stop();
+		wait();
+	}
+
+	u16 getPort() { return m_socket.getLocalAddress().getPort(); }
+	u32 getDropped() const { return m_dropped; }
+
+protected:
+	void *run()
+	{
+		struct Datagram
+		{
+			u64 due;
+			Address destination;
+			std::string data;
+		};
+		std::deque<Datagram> in_flight;
+		Address client;
+		std::string buffer(0x10000, '\0');
+		PcgRandom random(m_loss_percent);
+
+		while (!stopRequested()) {
+			Address sender;
+			int size = m_socket.Receive(sender, &buffer[0], buffer.size());
+			const u64 now = porting::getTimeMs();
+			if (size >= 0) {
+				const bool from_server = sender == m_server;
+				if (!from_server)
+					client = sender;
+
+				if (random.range(0, 99) < (s32)m_loss_percent) {
+					m_dropped++;
+				} else {
+					in_flight.push_back({now + m_delay_ms,
+							from_server ? client : m_server,
+							buffer.substr(0, size)});
+				}
+			}
+
+			while (!in_flight.empty() && in_flight.front().due <= now) {
+				const Datagram &d = in_flight.front();
+				try {
+					m_socket.Send(d.destination, d.data.data(), d.data.size());
+				} catch (SendFailedException &e) {
+				}
+				in_flight.pop_front();
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	UDPSocket m_socket;
+	Address m_server;
+	const u32 m_delay_ms;
+	const u32 m_loss_percent;
+	std::atomic<u32> m_dropped{0};
+};
+
 
 void TestConnection::testConnectSendReceive()
 {
@@ -376,3 +748,72 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id == 2);
 }
+
+void TestConnection::testLossyLink()
+{
+	const u32 proto_id = 0xad26846a;
+	const u32 count = 20;
+	const u32 datasize = 2000;
+
+	for (const char *congestion_control : {"legacy", "cubic", "bbr"}) {
+		Handler hand_server("server");
+		Handler hand_client("client");
+
+		// Let the system pick a free port. The connection binds
+		// asynchronously, so look one up with a temporary socket first.
+		u16 server_port;
+		{
+			UDPSocket socket(false);
+			socket.Bind(Address(0, 0, 0, 0, 0));
+			server_port = socket.getLocalAddress().getPort();
+		}
+
+		con::Connection server(proto_id, 512, 10.0, false, &hand_server);
+		server.SetCongestionControl(congestion_control);
+		server.Serve(Address(0, 0, 0, 0, server_port));
+
+		// 100 ms round trip time, 10% of the packets are lost
+		LossyLink link(Address(127, 0, 0, 1, server_port), 50, 10);
+		link.start();
+
+		con::Connection client(proto_id, 512, 10.0, false, &hand_client);
+		client.SetCongestionControl(congestion_control);
+		client.Connect(Address(127, 0, 0, 1, link.getPort()));
+
+		u64 start = porting::getTimeMs();
+		while (!client.Connected() || hand_server.count == 0) {
+			NetworkPacket pkt;
+			client.ReceiveTimeoutMs(&pkt, 10);
+			server.ReceiveTimeoutMs(&pkt, 10);
+			UASSERT(porting::getTimeMs() - start < 10000);
+		}
+
+		start = porting::getTimeMs();
+		for (u32 i = 0; i < count; i++) {
+			NetworkPacket pkt(i, datasize);
+			for (u32 j = 0; j < datasize; j++)
+				pkt << (u8)(i + j);
+			server.Send(hand_server.last_id, 0, std::move(pkt), true);
+		}
+
+		// Everything arrives in order and intact
+		u32 received = 0;
+		while (received < count) {
+			UASSERT(porting::getTimeMs() - start < 20000);
+			NetworkPacket pkt;
+			if (!client.ReceiveTimeoutMs(&pkt, 100))
+				continue;
+			UASSERTEQ(u16, pkt.getCommand(), received);
+			UASSERTEQ(u32, pkt.getSize(), datasize);
+			for (u32 j = 0; j < datasize; j++)
+				UASSERTEQ(u8, *pkt.getU8Ptr(j), (u8)(received + j));
+			received++;
+		}
+
+		infostream << "TestConnection: " << congestion_control << ": "
+			<< count * datasize << " bytes in "
+			<< porting::getTimeMs() - start << " ms, "
+			<< link.getDropped() << " datagrams dropped" << std::endl;
+		UASSERT(link.getDropped() > 0);
+	}
+}
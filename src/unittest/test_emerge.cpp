@@ -0,0 +1,85 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include "emerge.h"
+
+class TestEmerge : public TestBase
+{
+public:
+	TestEmerge() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestEmerge"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testPrefetchPositions();
+	void testPrefetchDuplicates();
+};
+
+static TestEmerge g_test_instance;
+
+void TestEmerge::runTests(IGameDef *gamedef)
+{
+	TEST(testPrefetchPositions);
+	TEST(testPrefetchDuplicates);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestEmerge::testPrefetchPositions()
+{
+	std::deque<v3s16> queues[EMERGE_PRIORITY_COUNT];
+	queues[EMERGE_PRIORITY_PLAYER] = {v3s16(1, 0, 0), v3s16(2, 0, 0)};
+	queues[EMERGE_PRIORITY_BULK] = {v3s16(3, 0, 0), v3s16(4, 0, 0),
+		v3s16(MAX_MAP_GENERATION_LIMIT, 0, 0)};
+
+	// The requested block comes first, then the queues in order
+	std::vector<v3s16> positions = get_prefetch_positions(v3s16(0, 0, 0),
+		queues, {}, 16);
+	UASSERTEQ(size_t, positions.size(), 5);
+	for (s16 i = 0; i < 5; i++)
+		UASSERT(positions[i] == v3s16(i, 0, 0));
+
+	// Already looked up
+	positions = get_prefetch_positions(v3s16(0, 0, 0), queues,
+		{v3s16(2, 0, 0), v3s16(3, 0, 0)}, 16);
+	UASSERTEQ(size_t, positions.size(), 3);
+	UASSERT(positions[1] == v3s16(1, 0, 0));
+	UASSERT(positions[2] == v3s16(4, 0, 0));
+
+	positions = get_prefetch_positions(v3s16(0, 0, 0), queues, {}, 2);
+	UASSERTEQ(size_t, positions.size(), 2);
+}
+
+void TestEmerge::testPrefetchDuplicates()
+{
+	// Queued by a player and in bulk, and the requested block is still
+	// queued as well
+	const v3s16 pos(0, 0, 0), other(5, 6, 7);
+	std::deque<v3s16> queues[EMERGE_PRIORITY_COUNT];
+	queues[EMERGE_PRIORITY_PLAYER] = {other, pos};
+	queues[EMERGE_PRIORITY_BULK] = {pos, other, other};
+
+	std::vector<v3s16> positions = get_prefetch_positions(pos, queues, {}, 16);
+	UASSERTEQ(size_t, positions.size(), 2);
+	UASSERT(positions[0] == pos);
+	UASSERT(positions[1] == other);
+}
@@ -19,10 +19,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cstdio>
+#include <sstream>
 #include <unordered_set>
 #include <unordered_map>
 #include "mapblock.h"
 #include "dummymap.h"
+#include "serialization.h"
 
 class TestMap : public TestBase
 {
@@ -36,6 +38,8 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testNetworkSerializationSplit(IGameDef *gamedef);
+	void testContentIndex(IGameDef *gamedef);
 };
 
 static TestMap g_test_instance;
@@ -46,6 +50,8 @@ void TestMap::runTests(IGameDef *gamedef)
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testNetworkSerializationSplit, gamedef);
+	TEST(testContentIndex, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +175,97 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+void TestMap::testNetworkSerializationSplit(IGameDef *gamedef)
+{
+	MapBlock block(v3s16(1, 2, 3), gamedef);
+	block.setNodeNoCheck(1, 2, 3, MapNode(t_CONTENT_STONE));
+	block.setNodeNoCheck(4, 5, 6, MapNode(t_CONTENT_TORCH));
+
+	const u8 ver = SER_FMT_VER_HIGHEST_WRITE;
+
+	std::ostringstream os_oneshot(std::ios_base::binary);
+	block.serialize(os_oneshot, ver, false, -1);
+	block.serializeNetworkSpecific(os_oneshot);
+
+	// Copying the data and compressing it later must produce the same thing
+	std::ostringstream os_raw(std::ios_base::binary);
+	block.serializeNetworkUncompressed(os_raw, ver);
+	std::ostringstream os_split(std::ios_base::binary);
+	MapBlock::compressNetworkSerialization(os_raw.str(), os_split, ver, -1);
+
+	UASSERT(os_oneshot.str() == os_split.str());
+
+	// Modifications must be noticed by caches
+	u64 version = block.getNetworkVersion();
+	block.setNodeNoCheck(1, 2, 3, MapNode(CONTENT_AIR));
+	UASSERT(block.getNetworkVersion() != version);
+
+	// ...but nothing else
+	version = block.getNetworkVersion();
+	block.setTimestamp(1234);
+	UASSERT(block.getNetworkVersion() == version);
+
+	// Other blocks never have the same version
+	MapBlock block2(v3s16(1, 2, 3), gamedef);
+	UASSERT(block2.getNetworkVersion() != block.getNetworkVersion());
+}
+
+void TestMap::testContentIndex(IGameDef *gamedef)
+{
+	MapBlock block(v3s16(0, 0, 0), gamedef);
+	block.setNodeNoCheck(1, 2, 3, MapNode(t_CONTENT_STONE));
+
+	BlockContentIndex &index = block.content_index;
+	UASSERT(!index.isValid());
+	index.build(block.getData(), MapBlock::nodecount);
+	UASSERT(index.isValid());
+	UASSERTEQ(size_t, index.getContents().size(), 2);
+
+	const auto count = [&] (content_t c) -> size_t {
+		const auto &contents = index.getContents();
+		for (size_t k = 0; k < contents.size(); k++) {
+			if (contents[k] == c)
+				return index.getPositions(k).size();
+		}
+		return 0;
+	};
+	UASSERTEQ(size_t, count(t_CONTENT_STONE), 1);
+	UASSERTEQ(size_t, count(CONTENT_IGNORE), MapBlock::nodecount - 1);
+
+	// single node changes keep the index up to date
+	block.setNode(v3s16(4, 5, 6), MapNode(t_CONTENT_TORCH));
+	block.setNodeNoCheck(1, 2, 3, MapNode(t_CONTENT_WATER));
+	UASSERT(index.isValid());
+	UASSERT(!index.contains(t_CONTENT_STONE));
+	UASSERTEQ(size_t, count(t_CONTENT_TORCH), 1);
+	UASSERTEQ(size_t, count(t_CONTENT_WATER), 1);
+	UASSERTEQ(size_t, count(CONTENT_IGNORE), MapBlock::nodecount - 2);
+
+	// many changes back and forth, removals reorder the positions
+	const content_t cycle[] = {t_CONTENT_STONE, t_CONTENT_WATER, CONTENT_IGNORE};
+	for (u32 n = 0; n < 3 * MapBlock::nodecount; n += 7) {
+		const u32 i = n % MapBlock::nodecount;
+		v3s16 p(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+		block.setNode(p, MapNode(cycle[n % 3]));
+	}
+
+	size_t total = 0;
+	const auto &contents = index.getContents();
+	for (size_t k = 0; k < contents.size(); k++) {
+		for (u16 i : index.getPositions(k))
+			UASSERT(block.getData()[i].getContent() == contents[k]);
+		total += index.getPositions(k).size();
+	}
+	UASSERTEQ(size_t, total, MapBlock::nodecount);
+
+	// changes that don't touch nodes keep it too
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_STATIC_DATA_ADDED);
+	UASSERT(index.isValid());
+
+	// bulk changes invalidate it
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_VMANIP);
+	UASSERT(!index.isValid());
+	UASSERT(index.getContents().empty());
+}
@@ -0,0 +1,283 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "cmake_config.h"
+
+#include "test.h"
+
+#include <atomic>
+#include <cstdlib>
+#include "database/database-dummy.h"
+#include "database/database-sqlite3.h"
+#if USE_POSTGRESQL
+#include "database/database-postgresql.h"
+#endif
+#include "filesys.h"
+#include "mapblock.h"
+#include "server/mapsavethread.h"
+#include "util/metricsbackend.h"
+
+class TestMapDatabase : public TestBase
+{
+public:
+	TestMapDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+	void runTestsForDB(MapDatabase *db);
+
+	void testSingle(MapDatabase *db);
+	void testSaveBlocks(MapDatabase *db);
+	void testLoadBlocks(MapDatabase *db);
+	void testRollback(MapDatabase *db);
+	void testSaveThread(IGameDef *gamedef);
+	void testSaveThreadFailure(IGameDef *gamedef);
+};
+
+static TestMapDatabase g_test_instance;
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	const std::string test_dir = getTestTempDirectory();
+
+	rawstream << "-------- Dummy database" << std::endl;
+	{
+		Database_Dummy db;
+		runTestsForDB(&db);
+	}
+
+	rawstream << "-------- SQLite3 database" << std::endl;
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+	{
+		MapDatabaseSQLite3 db(test_dir);
+		runTestsForDB(&db);
+		TEST(testRollback, &db);
+	}
+
+#if USE_POSTGRESQL
+	const char *env_postgresql_connect_string = getenv("MINETEST_POSTGRESQL_CONNECT_STRING");
+	if (env_postgresql_connect_string) {
+		rawstream << "-------- PostgreSQL database" << std::endl;
+		MapDatabasePostgreSQL db(env_postgresql_connect_string);
+		runTestsForDB(&db);
+		TEST(testRollback, &db);
+	}
+#endif
+
+	TEST(testSaveThread, gamedef);
+	TEST(testSaveThreadFailure, gamedef);
+}
+
+void TestMapDatabase::runTestsForDB(MapDatabase *db)
+{
+	db->beginSave();
+	TEST(testSingle, db);
+	TEST(testSaveBlocks, db);
+	TEST(testLoadBlocks, db);
+	db->endSave();
+}
+
+static std::string block_data(v3s16 pos)
+{
+	// Contains a NUL byte on purpose
+	return std::string("block\0", 6) + std::to_string(pos.X) + "," +
+		std::to_string(pos.Y) + "," + std::to_string(pos.Z);
+}
+
+void TestMapDatabase::testSingle(MapDatabase *db)
+{
+	const v3s16 pos(1, -2, 3);
+	UASSERT(db->saveBlock(pos, block_data(pos)));
+
+	std::string data;
+	db->loadBlock(pos, &data);
+	UASSERT(data == block_data(pos));
+
+	UASSERT(db->deleteBlock(pos));
+	data.clear();
+	db->loadBlock(pos, &data);
+	UASSERT(data.empty());
+}
+
+void TestMapDatabase::testSaveBlocks(MapDatabase *db)
+{
+	std::vector<std::pair<v3s16, std::string>> blocks;
+	for (s16 i = -300; i < 300; i++) {
+		v3s16 pos(i, i % 7, -i);
+		blocks.emplace_back(pos, block_data(pos));
+	}
+	UASSERT(db->saveBlocks(blocks));
+
+	for (const auto &it : blocks) {
+		std::string data;
+		db->loadBlock(it.first, &data);
+		UASSERT(data == it.second);
+	}
+
+	// Overwriting works just like saveBlock()
+	blocks.resize(10);
+	for (auto &it : blocks)
+		it.second = "new";
+	UASSERT(db->saveBlocks(blocks));
+
+	std::string data;
+	db->loadBlock(blocks[0].first, &data);
+	UASSERTEQ(std::string, data, "new");
+
+	// Empty batch
+	UASSERT(db->saveBlocks({}));
+}
+
+void TestMapDatabase::testLoadBlocks(MapDatabase *db)
+{
+	std::vector<v3s16> positions;
+	for (s16 i = 0; i < 50; i++) {
+		v3s16 pos(1000 + i, -1000, i * 3);
+		// Only every third block exists
+		if (i % 3 == 0) {
+			UASSERT(db->saveBlock(pos, block_data(pos)));
+		}
+		positions.push_back(pos);
+	}
+
+	std::vector<std::string> blocks;
+	db->loadBlocks(positions, &blocks);
+	UASSERTEQ(size_t, blocks.size(), positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (i % 3 == 0) {
+			UASSERT(blocks[i] == block_data(positions[i]));
+		} else {
+			UASSERT(blocks[i].empty());
+		}
+	}
+
+	db->loadBlocks({}, &blocks);
+	UASSERT(blocks.empty());
+}
+
+void TestMapDatabase::testRollback(MapDatabase *db)
+{
+	const v3s16 pos(-2000, 2000, 0);
+	db->beginSave();
+	UASSERT(db->saveBlock(pos, block_data(pos)));
+	db->rollback();
+
+	std::string data;
+	db->loadBlock(pos, &data);
+	UASSERT(data.empty());
+
+	// Harmless outside of a transaction
+	db->rollback();
+
+	// The next transaction works as usual
+	db->beginSave();
+	UASSERT(db->saveBlock(pos, block_data(pos)));
+	db->endSave();
+	db->loadBlock(pos, &data);
+	UASSERT(data == block_data(pos));
+	UASSERT(db->deleteBlock(pos));
+}
+
+void TestMapDatabase::testSaveThread(IGameDef *gamedef)
+{
+	Database_Dummy db;
+	std::mutex db_mutex;
+	MetricsBackend mb;
+	MapSaveThread thread(&db, db_mutex, -1, 1024 * 1024, &mb);
+
+	MapBlock block(v3s16(1, 2, 3), gamedef);
+	block.setNodeNoCheck(v3s16(4, 5, 6), MapNode(CONTENT_AIR));
+
+	// Nothing is written before the thread runs
+	thread.queueBlock(&block);
+	UASSERTEQ(size_t, thread.getQueuedCount(), 1);
+	std::string queued;
+	UASSERT(thread.getQueued(block.getPos(), &queued));
+	std::string data;
+	db.loadBlock(block.getPos(), &data);
+	UASSERT(data.empty());
+
+	// Queuing again replaces the snapshot
+	thread.queueBlock(&block);
+	UASSERTEQ(size_t, thread.getQueuedCount(), 1);
+
+	// Cancelled blocks are not written
+	MapBlock block2(v3s16(7, 8, 9), gamedef);
+	thread.queueBlock(&block2);
+	thread.cancel(block2.getPos());
+	UASSERT(!thread.getQueued(block2.getPos(), &data));
+
+	thread.start();
+	thread.flush();
+	UASSERTEQ(size_t, thread.getQueuedCount(), 0);
+	db.loadBlock(block.getPos(), &data);
+	UASSERT(data == queued);
+	db.loadBlock(block2.getPos(), &data);
+	UASSERT(data.empty());
+
+	// Stopping writes out the rest
+	thread.queueBlock(&block2);
+	thread.stop();
+	thread.wait();
+	db.loadBlock(block2.getPos(), &data);
+	UASSERT(!data.empty());
+}
+
+namespace {
+	// Fails every write
+	class FailingDatabase : public Database_Dummy
+	{
+	public:
+		bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &) override
+		{
+			return false;
+		}
+		void rollback() override { rollbacks++; }
+
+		std::atomic<u32> rollbacks{0};
+	};
+}
+
+void TestMapDatabase::testSaveThreadFailure(IGameDef *gamedef)
+{
+	FailingDatabase db;
+	std::mutex db_mutex;
+	MetricsBackend mb;
+	MapSaveThread thread(&db, db_mutex, -1, 1024 * 1024, &mb);
+
+	MapBlock block(v3s16(1, 2, 3), gamedef);
+	thread.queueBlock(&block);
+	thread.start();
+
+	// Returns instead of waiting for the write forever
+	UASSERT(!thread.flush());
+	UASSERT(db.rollbacks > 0);
+
+	// The block is dropped after a few attempts
+	for (int i = 0; i < 20 && thread.getQueuedCount() > 0; i++)
+		thread.flush();
+	UASSERTEQ(size_t, thread.getQueuedCount(), 0);
+	UASSERT(thread.flush());
+
+	// Stopping does not wait for failing blocks either
+	thread.queueBlock(&block);
+	thread.stop();
+	thread.wait();
+	UASSERTEQ(size_t, thread.getQueuedCount(), 0);
+}
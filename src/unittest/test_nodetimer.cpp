@@ -0,0 +1,129 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <sstream>
+#include "nodetimer.h"
+
+class TestNodeTimer : public TestBase
+{
+public:
+	TestNodeTimer() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestNodeTimer"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testElapseOrder();
+	void testSetRemove();
+	void testSerialize();
+};
+
+static TestNodeTimer g_test_instance;
+
+void TestNodeTimer::runTests(IGameDef *gamedef)
+{
+	TEST(testElapseOrder);
+	TEST(testSetRemove);
+	TEST(testSerialize);
+}
+
+void TestNodeTimer::testElapseOrder()
+{
+	NodeTimerList list;
+	list.insert(NodeTimer(3.0f, 0.0f, v3s16(1, 0, 0)));
+	list.insert(NodeTimer(1.0f, 0.0f, v3s16(2, 0, 0)));
+	list.insert(NodeTimer(2.0f, 0.0f, v3s16(3, 0, 0)));
+	// Same trigger time as the previous one, set later
+	list.insert(NodeTimer(2.5f, 0.5f, v3s16(4, 0, 0)));
+	UASSERTEQ(size_t, list.size(), 4);
+
+	UASSERT(list.step(0.5f).empty());
+
+	std::vector<NodeTimer> elapsed = list.step(2.0f);
+	UASSERTEQ(size_t, elapsed.size(), 3);
+	UASSERT(elapsed[0].position == v3s16(2, 0, 0));
+	UASSERT(elapsed[1].position == v3s16(3, 0, 0));
+	UASSERT(elapsed[2].position == v3s16(4, 0, 0));
+	// Overshoot is reported as elapsed time
+	UASSERT(elapsed[0].elapsed == 2.5f);
+	UASSERT(elapsed[1].elapsed == 2.5f);
+
+	elapsed = list.step(1.0f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(1, 0, 0));
+	UASSERTEQ(size_t, list.size(), 0);
+}
+
+void TestNodeTimer::testSetRemove()
+{
+	NodeTimerList list;
+	for (s16 i = 0; i < 100; i++)
+		list.insert(NodeTimer(1.0f + i, 0.0f, v3s16(i % 16, i / 16, 0)));
+
+	list.step(0.5f);
+	NodeTimer t = list.get(v3s16(3, 0, 0));
+	UASSERT(t.timeout == 4.0f);
+	UASSERT(t.elapsed == 0.5f);
+	// No timer
+	UASSERT(list.get(v3s16(15, 15, 15)).timeout == 0.0f);
+
+	// Replacing and removing timers keeps the rest in order
+	list.set(NodeTimer(0.25f, 0.0f, v3s16(5, 5, 0)));
+	for (s16 i = 0; i < 100; i += 2)
+		list.remove(v3s16(i % 16, i / 16, 0));
+	list.remove(v3s16(15, 15, 15));
+	UASSERTEQ(size_t, list.size(), 50);
+
+	std::vector<NodeTimer> elapsed = list.step(0.25f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(5, 5, 0));
+
+	elapsed = list.step(100.0f);
+	UASSERTEQ(size_t, elapsed.size(), 49);
+	for (size_t i = 1; i < elapsed.size(); i++)
+		UASSERT(elapsed[i - 1].timeout < elapsed[i].timeout);
+}
+
+void TestNodeTimer::testSerialize()
+{
+	NodeTimerList list;
+	list.insert(NodeTimer(5.0f, 1.0f, v3s16(15, 14, 13)));
+	list.insert(NodeTimer(2.0f, 0.0f, v3s16(0, 0, 0)));
+	list.insert(NodeTimer(3.0f, 0.5f, v3s16(1, 2, 3)));
+	list.step(1.0f);
+
+	std::ostringstream os(std::ios_base::binary);
+	list.serialize(os, 29);
+	// Timers are written in trigger order
+	const std::string expected(
+		"\x0a\x00\x03"
+		"\x00\x00" "\x00\x00\x07\xd0" "\x00\x00\x03\xe8"
+		"\x03\x21" "\x00\x00\x0b\xb8" "\x00\x00\x05\xdc"
+		"\x0d\xef" "\x00\x00\x13\x88" "\x00\x00\x07\xd0", 33);
+	UASSERT(os.str() == expected);
+
+	NodeTimerList list2;
+	std::istringstream is(os.str(), std::ios_base::binary);
+	list2.deSerialize(is, 29);
+	UASSERTEQ(size_t, list2.size(), 3);
+	NodeTimer t = list2.get(v3s16(1, 2, 3));
+	UASSERT(t.timeout == 3.0f);
+	UASSERT(t.elapsed == 1.5f);
+}
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <cmath>
 #include "exceptions.h"
 #include "noise.h"
+#include "noise_kernels.h"
 
 class TestNoise : public TestBase {
 public:
@@ -41,6 +42,7 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseKernels();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -61,6 +63,7 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseKernels);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,6 +178,44 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseKernels()
+{
+	// All implementations must give exactly the same values, or chunks
+	// generated on different CPUs would not fit together.
+	// The sizes are odd so that the remainders of the SIMD loops are used.
+	const NoiseParams params[] = {
+		NoiseParams(0, 1, v3f(250, 250, 250), 5934, 5, 0.63, 2.0),
+		NoiseParams(0, 12, v3f(96, 48, 96), 42, 3, 0.5, 2.0, NOISE_FLAG_EASED),
+		NoiseParams(-3, 40, v3f(4, 4, 4), 99, 2, 0.7, 2.0,
+			NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE),
+	};
+	const u32 sx = 37, sy = 21, sz = 19;
+	const std::vector<const NoiseKernels *> supported = NoiseKernels::getSupported();
+
+	for (const NoiseParams &np : params) {
+		Noise reference_2d(&np, 1337, sx, sz);
+		Noise reference_3d(&np, 1337, sx, sy, sz);
+		reference_2d.kernels = supported[0];
+		reference_3d.kernels = supported[0];
+		const float *expected_2d = reference_2d.perlinMap2D(-1234.5, 99.25);
+		const float *expected_3d = reference_3d.perlinMap3D(-1234.5, -17, 99.25);
+
+		for (const NoiseKernels *kernels : supported) {
+			Noise noise_2d(&np, 1337, sx, sz);
+			Noise noise_3d(&np, 1337, sx, sy, sz);
+			noise_2d.kernels = kernels;
+			noise_3d.kernels = kernels;
+			const float *actual_2d = noise_2d.perlinMap2D(-1234.5, 99.25);
+			const float *actual_3d = noise_3d.perlinMap3D(-1234.5, -17, 99.25);
+
+			for (u32 i = 0; i != sx * sz; i++)
+				UASSERT(actual_2d[i] == expected_2d[i]);
+			for (u32 i = 0; i != sx * sy * sz; i++)
+				UASSERT(actual_3d[i] == expected_3d[i]);
+		}
+	}
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
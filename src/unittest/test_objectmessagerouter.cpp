@@ -0,0 +1,364 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+#include "mock_serveractiveobject.h"
+
+#include <map>
+#include <sstream>
+#include "constants.h"
+#include "object_position.h"
+#include "server/objectmessagerouter.h"
+#include "util/serialize.h"
+
+class TestObjectMessageRouter : public TestBase
+{
+public:
+	TestObjectMessageRouter() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestObjectMessageRouter"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testRouting();
+	void testAttachedPosition();
+	void testCompact();
+	void testPositionEncoding();
+	void testPositionKeyframes();
+	void testReliableKeyframes();
+};
+
+static TestObjectMessageRouter g_test_instance;
+
+void TestObjectMessageRouter::runTests(IGameDef *gamedef)
+{
+	TEST(testRouting);
+	TEST(testAttachedPosition);
+	TEST(testCompact);
+	TEST(testPositionEncoding);
+	TEST(testPositionKeyframes);
+	TEST(testReliableKeyframes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+class AttachedObject : public MockServerActiveObject
+{
+public:
+	ServerActiveObject *getParent() const override { return parent; }
+
+	ServerActiveObject *parent = nullptr;
+};
+
+std::string serialized(u16 id, const std::string &data)
+{
+	char idbuf[2];
+	writeU16((u8 *)idbuf, id);
+	return std::string(idbuf, 2) + serializeString16(data);
+}
+
+const std::string props_cmd = std::string(1, AO_CMD_SET_PROPERTIES) + "props";
+const std::string pos_cmd = std::string(1, AO_CMD_UPDATE_POSITION) + "pos";
+
+}
+
+void TestObjectMessageRouter::testRouting()
+{
+	std::map<u16, ServerActiveObject *> objects;
+	MockServerActiveObject obj1, obj2, obj3;
+	obj1.setId(1);
+	obj2.setId(2);
+	obj3.setId(3);
+	objects[1] = &obj1;
+	objects[2] = &obj2;
+	objects[3] = &obj3;
+
+	obj1.addKnownBy(10);
+	obj1.addKnownBy(11);
+	obj1.addKnownBy(10);
+	UASSERTEQ(u16, obj1.getKnownByCount(), 2);
+	obj2.addKnownBy(11);
+	// obj3 is not known by anyone
+
+	ObjectMessageRouter router;
+	router.push(ActiveObjectMessage(1, true, props_cmd));
+	router.push(ActiveObjectMessage(1, false, pos_cmd));
+	router.push(ActiveObjectMessage(2, true, props_cmd));
+	router.push(ActiveObjectMessage(3, true, props_cmd));
+	// Object does not exist (anymore)
+	router.push(ActiveObjectMessage(4, true, props_cmd));
+
+	router.route([&] (u16 id) -> ServerActiveObject * {
+		auto it = objects.find(id);
+		return it == objects.end() ? nullptr : it->second;
+	});
+
+	const auto &data = router.getClientData();
+	UASSERTEQ(size_t, data.size(), 2);
+
+	const auto &client10 = data.at(10);
+	UASSERT(client10.reliable == serialized(1, props_cmd));
+	UASSERT(client10.unreliable == serialized(1, pos_cmd));
+
+	// The order of objects is not defined
+	const auto &client11 = data.at(11);
+	const std::string a = serialized(1, props_cmd), b = serialized(2, props_cmd);
+	UASSERT(client11.reliable == a + b || client11.reliable == b + a);
+	UASSERT(client11.unreliable == serialized(1, pos_cmd));
+
+	router.clear();
+	UASSERT(router.getClientData().empty());
+
+	obj1.removeKnownBy(10);
+	UASSERT(!obj1.isKnownBy(10));
+	UASSERT(obj1.isKnownBy(11));
+}
+
+void TestObjectMessageRouter::testAttachedPosition()
+{
+	MockServerActiveObject parent;
+	AttachedObject child;
+	parent.setId(1);
+	child.setId(2);
+	child.parent = &parent;
+
+	parent.addKnownBy(10);
+	child.addKnownBy(10);
+	child.addKnownBy(11);
+
+	ObjectMessageRouter router;
+	router.push(ActiveObjectMessage(2, true, props_cmd));
+	router.push(ActiveObjectMessage(2, false, pos_cmd));
+	router.push(ActiveObjectMessage(2, true, props_cmd + "2"));
+	router.route([&] (u16 id) -> ServerActiveObject * {
+		return id == 1 ? &parent : (id == 2 ? &child : nullptr);
+	});
+
+	const auto &data = router.getClientData();
+
+	// Client 10 knows the parent, so it moves the child by itself
+	UASSERT(data.at(10).reliable ==
+			serialized(2, props_cmd) + serialized(2, props_cmd + "2"));
+	UASSERT(data.at(10).unreliable.empty());
+
+	UASSERT(data.at(11).reliable == data.at(10).reliable);
+	UASSERT(data.at(11).unreliable == serialized(2, pos_cmd));
+}
+
+void TestObjectMessageRouter::testCompact()
+{
+	MockServerActiveObject obj;
+	obj.setId(1);
+	obj.addKnownBy(10);
+	obj.addKnownBy(11);
+
+	const std::string compact_cmd = std::string(1, AO_CMD_UPDATE_POSITION_DELTA) + "p";
+	ActiveObjectMessage aom(1, false, pos_cmd);
+	aom.compact_datastring = compact_cmd;
+
+	ObjectMessageRouter router;
+	router.push(ActiveObjectMessage(1, true, props_cmd));
+	router.push(std::move(aom));
+	router.route([&] (u16 id) -> ServerActiveObject * {
+		return id == 1 ? &obj : nullptr;
+	}, [] (u16 peer_id) {
+		return peer_id == 11;
+	});
+
+	const auto &data = router.getClientData();
+	UASSERT(data.at(10).reliable == serialized(1, props_cmd));
+	UASSERT(data.at(10).unreliable == serialized(1, pos_cmd));
+	UASSERTEQ(size_t, data.at(10).compact_bytes_saved, 0);
+
+	UASSERT(data.at(11).reliable == serialized(1, props_cmd));
+	UASSERT(data.at(11).unreliable == serialized(1, compact_cmd));
+	UASSERTEQ(size_t, data.at(11).compact_bytes_saved,
+			pos_cmd.size() - compact_cmd.size());
+
+	// Messages without a full encoding only go to clients that support
+	// the compact one
+	ActiveObjectMessage keyframe(1, true, "");
+	keyframe.compact_datastring = compact_cmd;
+	router.clear();
+	router.push(std::move(keyframe));
+	router.route([&] (u16 id) -> ServerActiveObject * {
+		return id == 1 ? &obj : nullptr;
+	}, [] (u16 peer_id) {
+		return peer_id == 11;
+	});
+
+	UASSERT(data.at(10).reliable.empty());
+	UASSERT(data.at(11).reliable == serialized(1, compact_cmd));
+	UASSERTEQ(size_t, data.at(11).compact_bytes_saved, 0);
+}
+
+static std::string decode_command(ObjectPositionDecoder &decoder,
+		const std::string &cmd, ObjectPositionUpdate &update, bool &applied)
+{
+	std::istringstream is(cmd, std::ios::binary);
+	UASSERTEQ(int, readU8(is), AO_CMD_UPDATE_POSITION_DELTA);
+	applied = decoder.decode(is, update);
+	// Everything was read
+	UASSERT(is.peek() == EOF);
+	return cmd;
+}
+
+static void assert_near(v3f a, v3f b, f32 tolerance)
+{
+	UASSERT(a.getDistanceFrom(b) <= tolerance);
+}
+
+void TestObjectMessageRouter::testPositionEncoding()
+{
+	ObjectPositionEncoder encoder;
+	ObjectPositionDecoder decoder;
+
+	ObjectPositionUpdate in, out;
+	in.position = v3f(1234.5f, -20.25f, 3e4f);
+	in.velocity = v3f(0, -9.81f * BS, 4.0f);
+	in.rotation = v3f(0, 370.0f, -45.0f);
+	in.do_interpolate = true;
+	in.update_interval = 0.2f;
+
+	bool applied;
+	const std::string first = decode_command(decoder, encoder.encode(in), out, applied);
+	UASSERT(applied);
+	// The keyframe itself is exact
+	UASSERT(out.position == in.position);
+	assert_near(out.velocity, in.velocity, BS / 256.0f);
+	UASSERT(out.acceleration == v3f());
+	assert_near(out.rotation, v3f(0, 10.0f, 315.0f), 0.01f);
+	UASSERT(out.do_interpolate);
+	UASSERT(!out.is_movement_end);
+	UASSERT(std::fabs(out.update_interval - 0.2f) < 0.001f);
+
+	in.position += v3f(0.3f, 0, -5.0f);
+	in.velocity = v3f();
+	in.rotation = v3f();
+	in.is_movement_end = true;
+	const std::string second = decode_command(decoder, encoder.encode(in), out, applied);
+	UASSERT(applied);
+	assert_near(out.position, in.position, BS / 256.0f);
+	UASSERT(out.velocity == v3f());
+	UASSERT(out.rotation == v3f());
+	UASSERT(out.is_movement_end);
+	// The full command is 55 bytes
+	UASSERT(second.size() < first.size());
+	UASSERT(second.size() <= 11);
+
+	// Values that do not fit are not encoded
+	in.velocity = v3f(1e6f, 0, 0);
+	UASSERT(encoder.encode(in).empty());
+	in.velocity = v3f();
+	in.update_interval = 100.0f;
+	UASSERT(encoder.encode(in).empty());
+}
+
+void TestObjectMessageRouter::testPositionKeyframes()
+{
+	ObjectPositionEncoder encoder;
+	UASSERT(encoder.encodeKeyframe().empty());
+
+	ObjectPositionUpdate in, out;
+	in.position = v3f(10, 20, 30);
+	encoder.encode(in);
+
+	// A client that missed the keyframe ignores updates
+	ObjectPositionDecoder late;
+	bool applied;
+	in.position.X += 1.0f;
+	const std::string delta = encoder.encode(in);
+	decode_command(late, delta, out, applied);
+	UASSERT(!applied);
+
+	// until it gets one, e.g. with the initialization data
+	decode_command(late, encoder.encodeKeyframe(), out, applied);
+	UASSERT(!applied);
+	decode_command(late, delta, out, applied);
+	UASSERT(applied);
+	assert_near(out.position, in.position, BS / 256.0f);
+
+	// Large jumps start a new keyframe
+	in.position.X += 1000.0f * BS;
+	decode_command(late, encoder.encode(in), out, applied);
+	UASSERT(applied);
+	UASSERT(out.position == in.position);
+
+	// Keyframes are refreshed regularly, so lost ones are not fatal
+	ObjectPositionDecoder lossy;
+	bool got_keyframe = false;
+	for (int i = 0; i < 100; i++) {
+		in.position.Z += 0.1f;
+		decode_command(lossy, encoder.encode(in), out, applied);
+		if (applied) {
+			got_keyframe = true;
+			assert_near(out.position, in.position, BS / 256.0f);
+		}
+	}
+	UASSERT(got_keyframe);
+
+	// After reset() the next update contains a keyframe
+	encoder.reset();
+	ObjectPositionDecoder fresh;
+	decode_command(fresh, encoder.encode(in), out, applied);
+	UASSERT(applied);
+	UASSERT(out.position == in.position);
+}
+
+void TestObjectMessageRouter::testReliableKeyframes()
+{
+	ObjectPositionEncoder encoder;
+	ObjectPositionDecoder decoder;
+	ObjectPositionUpdate in, out;
+	bool applied, new_keyframe;
+
+	in.position = v3f(10, 20, 30);
+	encoder.encode(in, &new_keyframe);
+	UASSERT(new_keyframe);
+	const std::string old_keyframe = encoder.encodeKeyframe();
+	decode_command(decoder, old_keyframe, out, applied);
+
+	in.position.X += 1.0f;
+	encoder.encode(in, &new_keyframe);
+	UASSERT(!new_keyframe);
+
+	// The unreliable update with the next keyframe gets lost
+	in.position.X += 1000.0f * BS;
+	encoder.encode(in, &new_keyframe);
+	UASSERT(new_keyframe);
+	in.position.X += 1.0f;
+	const std::string delta = encoder.encode(in);
+	decode_command(decoder, delta, out, applied);
+	UASSERT(!applied);
+
+	// The reliable copy makes the following updates work again
+	const std::string keyframe = encoder.encodeKeyframe();
+	decode_command(decoder, keyframe, out, applied);
+	UASSERT(!applied);
+	decode_command(decoder, delta, out, applied);
+	UASSERT(applied);
+	assert_near(out.position, in.position, BS / 256.0f);
+
+	// An older keyframe arriving late is ignored
+	decode_command(decoder, old_keyframe, out, applied);
+	decode_command(decoder, delta, out, applied);
+	UASSERT(applied);
+	assert_near(out.position, in.position, BS / 256.0f);
+}
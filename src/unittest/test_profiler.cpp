@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "profiler.h"
+#include <thread>
 
 class TestProfiler : public TestBase
 {
@@ -30,6 +31,7 @@ class TestProfiler : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testProfilerAverage();
+	void testProfilerProbes();
 };
 
 static TestProfiler g_test_instance;
@@ -37,6 +39,7 @@ static TestProfiler g_test_instance;
 void TestProfiler::runTests(IGameDef *gamedef)
 {
 	TEST(testProfilerAverage);
+	TEST(testProfilerProbes);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,3 +74,51 @@ void TestProfiler::testProfilerAverage()
 
 	UASSERT(p.getValue("Test2") == 123.57f);
 }
+
+void TestProfiler::testProfilerProbes()
+{
+	Profiler p;
+
+	ProfilerProbe avg_probe = p.registerProbe("Avg", SPT_AVG);
+	ProfilerProbe add_probe = p.registerProbe("Add", SPT_ADD);
+	ProfilerProbe max_probe = p.registerProbe("Max", SPT_MAX);
+	// Registering again returns the same probe
+	UASSERTEQ(ProfilerProbe, p.registerProbe("Avg", SPT_AVG), avg_probe);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&, t] {
+			for (int i = 0; i < 100; i++) {
+				p.probeRecord(avg_probe, 1000 * (t + 1));
+				p.probeRecord(add_probe, 500);
+			}
+			p.probeRecord(max_probe, 2000 * (t + 1));
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	p.mergeProbes();
+	UASSERT(p.getValue("Avg [ms]") == 2.5f);
+	UASSERTEQ(int, p.getAvgCount("Avg [ms]"), 400);
+	UASSERT(p.getValue("Add [ms]") == 200.f);
+	UASSERT(p.getValue("Max [ms]") == 8.f);
+
+	// Buffers of finished threads are reused, their values are kept
+	std::thread([&] { p.probeRecord(add_probe, 1000); }).join();
+	p.probeRecord(add_probe, 1000);
+
+	std::vector<Profiler::ProbeTotals> totals;
+	p.getProbeTotals(totals);
+	UASSERTEQ(size_t, totals.size(), 3);
+	UASSERT(totals[add_probe].name == "Add");
+	UASSERTEQ(u64, totals[add_probe].time_us, 202000);
+	UASSERTEQ(u64, totals[add_probe].count, 402);
+	UASSERT(p.getValue("Add [ms]") == 202.f);
+
+	// Merged values start over when cleared
+	p.clear();
+	p.probeRecord(avg_probe, 3000);
+	p.mergeProbes();
+	UASSERT(p.getValue("Avg [ms]") == 3.f);
+}
@@ -40,6 +40,7 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
 	void testGetAddedActiveObjectsAroundPos();
+	void testSpatialIndexUpdate();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -51,6 +52,7 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testSpatialIndexUpdate);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -185,3 +187,45 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	saomgr.clear();
 }
+
+void TestServerActiveObjectMgr::testSpatialIndexUpdate()
+{
+	server::ActiveObjectMgr saomgr;
+	auto sao_u = std::make_unique<MockServerActiveObject>(nullptr, v3f(10, 40, 10));
+	auto sao = sao_u.get();
+	UASSERT(saomgr.registerObject(std::move(sao_u)));
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInArea(aabb3f(v3f(-50), v3f(50)), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Move it a few map blocks away (no environment, so notify by hand)
+	sao->setBasePosition(v3f(-2000, 40, 1300));
+	saomgr.updateObjectPos(sao);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-50), v3f(50)), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(-2000, 0, 1300), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+	UASSERT(result[0] == sao);
+
+	std::queue<u16> added;
+	std::set<u16> cur_objects;
+	saomgr.getAddedActiveObjectsAroundPos(v3f(-1990, 40, 1300), 20, 0,
+			cur_objects, added);
+	UASSERTCMP(int, ==, added.size(), 1);
+
+	// Negative coordinates must round down, not towards zero
+	UASSERT(server::ActiveObjectMgr::getIndexPos(v3f(-1, 0, 1)) ==
+			v3s16(-1, 0, 0));
+
+	saomgr.removeObject(sao->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 750000, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	saomgr.clear();
+}
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <atomic>
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "threading/workerpool.h"
 
 
 class TestThreading : public TestBase {
@@ -32,6 +33,7 @@ class TestThreading : public TestBase {
 
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -40,6 +42,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 {
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -156,3 +159,31 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+void TestThreading::testWorkerPool()
+{
+	for (unsigned int thread_count : {0, 3}) {
+		WorkerPool pool("WorkerPoolTest", thread_count);
+		UASSERTEQ(unsigned int, pool.getThreadCount(), thread_count);
+
+		// Every index exactly once, also when run again right away
+		for (size_t count : {0, 1, 2, 100, 1000}) {
+			std::vector<std::atomic<u32>> calls(count);
+			for (auto &c : calls)
+				c = 0;
+			pool.run(count, [&] (size_t i) {
+				calls.at(i)++;
+			});
+			for (auto &c : calls)
+				UASSERTEQ(u32, c, 1);
+		}
+
+		// All calls are done before run() returns
+		std::atomic<u32> finished(0);
+		pool.run(8, [&] (size_t i) {
+			sleep_ms(5);
+			finished++;
+		});
+		UASSERTEQ(u32, finished, 8);
+	}
+}